@@ -0,0 +1,171 @@
+#ifndef __EVENT_LOOP_H
+#define __EVENT_LOOP_H
+
+#include "TimerWheel.h"
+#include "Uring.h"
+
+#include <sys/epoll.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Socket;
+
+const int EVENT_LOOP_BATCH_SIZE = 256;
+
+/**
+ * Edge-triggered epoll reactor. A single EventLoop may own many Sockets, and
+ * is meant to be driven by exactly one thread (see EventLoopGroup for running
+ * one loop per core).
+ *
+ * Every registered Socket is watched for all readiness edges; the loop keeps
+ * the Socket's ready flags up to date so that the blocking Socket calls only
+ * ever wait when the kernel has told us there is nothing to do. The callback
+ * is only invoked for the events the caller expressed interest in.
+ *
+ * Because notifications are edge-triggered, callbacks _must_ drain the socket
+ * (read/ write until EAGAIN) or they will not be told again.
+ *
+ * With enableUring(), connected sockets instead receive through multishot
+ * io_uring receives into a shared ring of provided buffers, and their sends
+ * are staged and handed to the kernel together at the end of each tick; the
+ * Socket interface and callbacks are unchanged.
+ */
+class EventLoop
+{
+public:
+	typedef std::function<void(Socket& socket, uint32_t events)> ReadyCallback;
+	typedef std::function<void(void)> Task;
+
+	EventLoop(void);
+	EventLoop(const EventLoop& source) = delete;
+	~EventLoop(void);
+
+	/**
+	 * Register a socket with the loop. If owned is true the loop deletes the
+	 * socket when it is removed, or when the loop itself is destroyed.
+	 */
+	int add(Socket* socket, uint32_t events, const ReadyCallback& callback, bool owned = false);
+	int modify(Socket* socket, uint32_t events);
+
+	/**
+	 * Unregister a socket. Anything it had staged for io_uring still goes out
+	 * afterwards, over a descriptor the loop keeps open until then (or for a
+	 * second at most), so nothing more should be sent on the socket.
+	 */
+	int remove(Socket* socket);
+
+	/**
+	 * Wait up to timeout milliseconds (-1 for forever) for readiness and
+	 * dispatch callbacks. Returns the number of callbacks invoked, or -1 on
+	 * error.
+	 */
+	int runOnce(int timeout);
+	void run(void);
+	void stop(void);
+
+	/**
+	 * Queue a task to be run on the loop's thread. Safe to call from any
+	 * thread. Tasks still queued when the loop is destroyed are run then.
+	 */
+	void post(const Task& task);
+
+	/**
+	 * Run task on the loop's thread once the current tick's callbacks have all
+	 * been dispatched, or at the end of the first tick at least delay
+	 * milliseconds from now. Only call from the loop's own thread.
+	 */
+	void defer(const Task& task, int delay = 0);
+
+	/**
+	 * As defer() with a delay, but cancellable, and allowing the task to run
+	 * up to slack milliseconds late so that it can share a wakeup with
+	 * others (see TimerWheel). Only call from the loop's own thread.
+	 */
+	TimerHandle schedule(int delay, const Task& task, int slack = 0);
+	bool cancel(TimerHandle timer);
+
+	/**
+	 * Move sockets added from now on over to io_uring. Returns -1, and the
+	 * loop stays on epoll alone, if the kernel lacks the features we need or
+	 * sockets have already been added.
+	 */
+	int enableUring(unsigned entries = URING_ENTRIES, bool registerFiles = false);
+	bool uring(void) const;
+
+	bool running(void) const;
+	std::size_t size(void) const;
+
+	/**
+	 * The calling thread's private loop, used by blocking Socket calls for
+	 * sockets which have not been added to any other loop.
+	 */
+	static EventLoop& local(void);
+private:
+	friend class Socket;
+
+	struct Registration
+	{
+		Socket* socket;
+		uint32_t events;
+		uint32_t pendingEvents;
+		ReadyCallback callback;
+		bool owned;
+		bool removed;
+	};
+
+	/**
+	 * Unregister socket, as remove() does, but leave deleting it to the
+	 * caller; owned says whether it should. Used by sockets removing
+	 * themselves, which still have work to do once they are out of the loop.
+	 */
+	int detach(Socket* socket, bool& owned);
+	int wait(Socket& socket, short events, int timeout);
+
+	/**
+	 * Whether the calling thread is the one driving the loop: the last to
+	 * call runOnce(), or the one that created it if none has yet.
+	 */
+	bool onLoopThread(void) const;
+	void update(Registration* registration, uint32_t events);
+	void queue(Registration* registration, uint32_t events);
+	int dispatch(Registration* registration, uint32_t events);
+	int dispatchPending(void);
+	void runTasks(void);
+	void runDeferred(void);
+	int nextTimeout(int timeout) const;
+	void reclaim(void);
+
+	void attachUring(Socket* socket);
+	void detachUring(Socket* socket);
+	void armReceive(UringSocket* state);
+	void queueSend(UringSocket* state);
+	std::size_t stage(UringSocket* state, iovec*& segments, int& count);
+	int drain(UringSocket* state, RingBuffer& ring);
+	void submitUring(void);
+	void reapUring(Socket* waiting, uint32_t waited);
+	void release(UringSocket* state);
+
+	int mEpoll;
+	int mWakeup;
+	int mDepth;
+	std::size_t mCount;
+	std::atomic<bool> mStopped;
+	std::atomic<std::thread::id> mThread;
+	std::vector<Registration*> mRegistrations; // Indexed by file descriptor.
+	std::vector<Registration*> mPending;
+	std::vector<Registration*> mRemoved;
+	std::mutex mTaskLock;
+	std::vector<Task> mTasks;
+	std::vector<Task> mDeferred;
+	TimerWheel mTimers;
+	Uring* mUring;
+	std::vector<UringSocket*> mSends; // Staged data to submit this tick.
+	std::vector<UringSocket*> mStarved; // Receives stopped for want of buffers.
+	std::vector<UringSocket*> mDetached; // Removed, with operations in flight.
+};
+
+#endif
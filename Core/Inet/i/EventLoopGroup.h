@@ -0,0 +1,48 @@
+#ifndef __EVENT_LOOP_GROUP_H
+#define __EVENT_LOOP_GROUP_H
+
+#include "EventLoop.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of EventLoops, each driven by its own thread. By default one
+ * loop is created per available core.
+ */
+class EventLoopGroup
+{
+public:
+	EventLoopGroup(std::size_t loops = 0);
+	EventLoopGroup(const EventLoopGroup& source) = delete;
+	~EventLoopGroup(void);
+
+	/**
+	 * Start one thread per loop. If pinThreads is true, thread i is bound to
+	 * core i (modulo the number of cores).
+	 */
+	void start(bool pinThreads = false);
+	void stop(void);
+
+	/**
+	 * Move every loop over to io_uring (see EventLoop::enableUring). Must be
+	 * called before start(). Returns -1 if the kernel does not support it,
+	 * or any loop could not be moved; those loops stay on epoll.
+	 */
+	int enableUring(unsigned entries = URING_ENTRIES, bool registerFiles = false);
+
+	std::size_t size(void) const;
+	EventLoop& at(std::size_t index);
+
+	/**
+	 * Round-robin over the loops, for spreading new connections.
+	 */
+	EventLoop& next(void);
+private:
+	std::vector<EventLoop*> mLoops;
+	std::vector<std::thread> mThreads;
+	std::atomic<std::size_t> mNext;
+};
+
+#endif
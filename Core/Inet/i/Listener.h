@@ -0,0 +1,58 @@
+#ifndef __LISTENER_H
+#define __LISTENER_H
+
+#include "EventLoopGroup.h"
+#include "Socket.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+const int LISTENER_BACKLOG = SOMAXCONN;
+
+// How long a shard waits to accept again after running out of descriptors.
+const int LISTENER_RETRY_DELAY = 50;
+
+/**
+ * Sharded acceptor. One SO_REUSEPORT listening socket is opened per loop in
+ * the group, so the kernel spreads incoming connections across the loops and
+ * no single thread has to accept for everyone.
+ *
+ * Each shard drains its accept queue with accept4() whenever it becomes
+ * readable, and hands the new (non-blocking) connections to the callback on
+ * the thread of the loop which accepted them. The callback takes ownership of
+ * the Socket; usually it just adds it to the loop it was given.
+ *
+ * If accept4() runs out of descriptors the connections left queued would get
+ * no further edge, so the shard retries on a timer until the queue drains.
+ */
+class Listener
+{
+public:
+	typedef std::function<void(EventLoop& loop, Socket* connection)> AcceptCallback;
+
+	Listener(EventLoopGroup& loops, const AcceptCallback& callback);
+	Listener(const Listener& source) = delete;
+	~Listener(void);
+
+	int listen(const char* port, const char* ip = NULL, int backlog = LISTENER_BACKLOG);
+	void close(void);
+
+	uint64_t accepted(void) const;
+private:
+	struct Shared
+	{
+		AcceptCallback callback;
+		std::atomic<uint64_t> accepted;
+		std::vector<TimerHandle> retries; // Per shard, only touched by its loop.
+	};
+
+	static void drain(const std::shared_ptr<Shared>& shared, EventLoop& loop, Socket& listening, std::size_t shard);
+
+	EventLoopGroup& mLoops;
+	std::shared_ptr<Shared> mShared;
+	std::vector<Socket*> mSockets;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __RING_BUFFER_H
+#define __RING_BUFFER_H
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Fixed capacity byte ring. Capacity is rounded up to a power of two. The
+ * free and used space are each exposed as (at most) two iovecs so that a
+ * single readv/ writev can fill or drain the whole ring.
+ */
+class RingBuffer
+{
+public:
+	RingBuffer(std::size_t capacity);
+	RingBuffer(const RingBuffer& source) = delete;
+	~RingBuffer(void);
+
+	std::size_t capacity(void) const;
+	std::size_t size(void) const;
+	std::size_t space(void) const;
+	bool empty(void) const;
+
+	/**
+	 * Fill segments (which must hold 2 entries) with the readable/ writable
+	 * regions of the ring, returning how many were used.
+	 */
+	int readable(iovec* segments) const;
+	int writable(iovec* segments);
+
+	/**
+	 * Mark count bytes as written (after filling the writable segments) or
+	 * as read.
+	 */
+	void produce(std::size_t count);
+	void consume(std::size_t count);
+
+	std::size_t read(void* buffer, std::size_t length);
+	std::size_t write(const void* buffer, std::size_t length);
+	void clear(void);
+private:
+	uint8_t* mBuffer;
+	std::size_t mCapacity;
+	uint64_t mHead; // Total bytes consumed.
+	uint64_t mTail; // Total bytes produced.
+};
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <climits>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -12,6 +14,8 @@
 #include <cstdlib>
 
 #include "Endian.h"
+#include "EventLoop.h"
+#include "RingBuffer.h"
 
 #include <iostream>
 using namespace std;
@@ -20,7 +24,16 @@ using namespace std;
 const int MAX_HOSTNAME_LENGTH = 200;
 const int MAX_RECV_LENGTH = 1024;
 const int SOCKET_CONNECTION_LIMIT = 10;
+const int READ_AHEAD_LENGTH = 64 * MAX_RECV_LENGTH;
 
+/**
+ * A TCP socket. Blocking calls wait on the EventLoop the socket belongs to,
+ * or on the calling thread's private loop (see EventLoop::local()) if it
+ * belongs to none yet, but only ever from the thread driving that loop;
+ * called from any other thread they wait with a private poll() instead.
+ * Sockets on an io_uring loop receive through that loop, so must only be
+ * read from its thread.
+ */
 class Socket
 {
 public:
@@ -29,20 +42,71 @@ public:
 
 	~Socket(void);
 
-	int bind(const char* port, const char* ip = NULL);
+	int bind(const char* port, const char* ip = NULL, int backlog = SOCKET_CONNECTION_LIMIT, bool reusePort = false);
 	Socket* accept(bool block = true);
 
 	bool connected(void) const;
 	int recvLength(void) const;
+	int descriptor(void) const;
 
+	/**
+	 * The kernel's send buffer size for the socket (SO_SNDBUF, which the
+	 * kernel may be tuning as it goes), or -1.
+	 */
+	int sendBufferSize(void) const;
+
+	/**
+	 * Close the connection, removing it from its loop first. A socket which
+	 * its loop owns is deleted on the way out, so must not be touched again.
+	 */
 	int close(void);
 	int connect(const char* ip, const char* port);
 	int receive(char* buffer, int bufferLength, int timeout = 30);
 	int send(const char* buffer, int bufferLength, bool critical = false);
+
+	/**
+	 * Gather-send every segment with as few syscalls as the kernel allows,
+	 * waiting for the socket to drain when needed unless block is false. The
+	 * segments are advanced in place as data is sent. Returns the number of
+	 * bytes sent, which is short only on error or if the socket stays (or, when
+	 * not blocking, is) full, or -42 if the socket is not connected. Errors
+	 * other than running short of memory leave the socket disconnected.
+	 */
+	ssize_t send(iovec* segments, int count, bool block = true);
+
+	/**
+	 * Send length bytes of fd, starting at offset, straight from the page
+	 * cache with sendfile(). offset is advanced past whatever is sent, and
+	 * waiting works as for the gather send. Returns the number of bytes sent,
+	 * or -1 (with errno set) if sendfile() fails before sending anything; most
+	 * likely because fd cannot be used with it, so the caller should copy.
+	 */
+	ssize_t sendFile(int fd, off_t& offset, std::size_t length, bool block = true);
+
+	/**
+	 * The per-socket read-ahead buffer. Reads shorter than its capacity are
+	 * served from it, so a single syscall can pull in many pipelined frames.
+	 * The capacity may only be changed while the buffer is empty.
+	 */
+	RingBuffer& readAhead(void);
+	int readAhead(std::size_t capacity);
+
+	/**
+	 * Pull as much as is available into the read-ahead buffer with a single
+	 * scatter read, waiting up to timeout milliseconds if nothing is. Returns
+	 * the number of bytes added; 0 on timeout, a full buffer or a peer
+	 * hang-up (see connected()), and -1 on error.
+	 */
+	int fill(int timeout = 30);
 private:
+	friend class EventLoop;
+	friend class Listener;
+
 	Socket(int sock);
 
 	void checkForReady(short events, int timeout);
+	int pollForReady(short events, int timeout);
+	int fillReadAhead(void);
 
 	bool mConnected;
 	bool mInvalid;
@@ -52,7 +116,11 @@ private:
 	bool mTimedout;
 	int mSocket;
 	int mReceivedBytes;
-
+	EventLoop* mLoop;
+	UringSocket* mUring; // Set while on an io_uring EventLoop.
+	bool mLingering; // A loop still holds the connection to finish sending.
+	RingBuffer* mReadAhead;
+	std::size_t mReadAheadCapacity;
 };
 
 #endif
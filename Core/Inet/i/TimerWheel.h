@@ -0,0 +1,101 @@
+#ifndef __TIMER_WHEEL_H
+#define __TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Each level has 64 slots, each slot covering 64 of the level below's, from
+// single milliseconds at level 0 to roughly two years over the whole wheel.
+const unsigned TIMER_WHEEL_LEVELS = 6;
+const unsigned TIMER_WHEEL_SLOT_BITS = 6;
+const unsigned TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_SLOT_BITS;
+
+/**
+ * Identifies a scheduled timer; never reused, so a handle to a timer which
+ * has already fired or been cancelled is simply ignored. 0 is never a valid
+ * handle.
+ */
+typedef uint64_t TimerHandle;
+const TimerHandle TIMER_NONE = 0;
+
+/**
+ * Hierarchical timing wheel with millisecond resolution.
+ *
+ * Scheduling and cancelling are O(1): a timer is linked into the slot of the
+ * coarsest level that still tells it apart from now, and only moves down a
+ * level when the wheel reaches that slot. Timers far in the future are
+ * therefore touched once per level (at most) before they fire, and a wheel
+ * full of long, idle timers costs nothing between those cascades.
+ *
+ * Every level keeps a bitmap of its occupied slots, so advance() skips over
+ * empty stretches and timeout() finds the next time the wheel needs to be
+ * advanced without walking any lists.
+ */
+class TimerWheel
+{
+public:
+	typedef std::function<void(void)> Callback;
+
+	/**
+	 * now is the time, in milliseconds on any monotonic clock, the wheel
+	 * starts at; every later call must use the same clock.
+	 */
+	TimerWheel(int64_t now);
+	TimerWheel(const TimerWheel& source) = delete;
+
+	/**
+	 * Call callback once at least delay milliseconds have passed, on the
+	 * first advance() after that. A timer which may fire up to slack
+	 * milliseconds late is rounded up onto a coarser grid, so that timers
+	 * from many connections come due together rather than each waking the
+	 * loop on its own.
+	 */
+	TimerHandle schedule(int64_t delay, const Callback& callback, int64_t slack = 0);
+
+	/**
+	 * Returns false if the timer has already fired or been cancelled.
+	 */
+	bool cancel(TimerHandle timer);
+
+	/**
+	 * Fire every timer due by now, in order of expiry. Callbacks may schedule
+	 * and cancel timers; anything they schedule to fire by now waits for the
+	 * next advance(). Returns the number of timers fired.
+	 */
+	std::size_t advance(int64_t now);
+
+	/**
+	 * Milliseconds from now until advance() next has something to do (fire a
+	 * timer, or move some down a level), 0 if that is overdue, or -1 if no
+	 * timers are scheduled.
+	 */
+	int64_t timeout(int64_t now) const;
+
+	std::size_t size(void) const;
+private:
+	struct Node
+	{
+		int64_t expiry;
+		Callback callback;
+		uint32_t generation;
+		int32_t next;
+		int32_t previous;
+		uint16_t slot; // Level * TIMER_WHEEL_SLOTS + slot, while linked.
+	};
+
+	void link(int32_t index);
+	void unlink(int32_t index);
+	void cascade(unsigned level, int64_t tick);
+	std::size_t expire(int64_t tick);
+
+	int64_t mNow; // Every timer due at or before this has fired.
+	std::vector<Node> mNodes;
+	std::vector<int32_t> mFree;
+	int32_t mSlots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+	uint64_t mOccupied[TIMER_WHEEL_LEVELS];
+	std::size_t mCount;
+};
+
+#endif
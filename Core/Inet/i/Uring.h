@@ -0,0 +1,152 @@
+#ifndef __URING_H
+#define __URING_H
+
+#include "RingBuffer.h"
+#include "TimerWheel.h"
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class Socket;
+
+const unsigned URING_ENTRIES = 256;
+
+// Provided receive buffers, shared by every socket on a ring.
+const unsigned URING_BUFFER_COUNT = 512;
+const std::size_t URING_BUFFER_SIZE = 16 * 1024;
+const uint16_t URING_BUFFER_GROUP = 0;
+
+// Descriptors below this can be registered with the ring.
+const unsigned URING_FIXED_FILES = 4096;
+
+// Bytes of outgoing data staged per socket while sends are in flight.
+const std::size_t URING_SEND_BUFFER = 256 * 1024;
+
+/**
+ * A thin io_uring wrapper over the raw syscalls: one submission/ completion
+ * queue pair, a ring of provided buffers for multishot receives, and
+ * (optionally) a sparse table of registered descriptors.
+ *
+ * Entries are only handed to the kernel by submit(), so everything queued
+ * between two submits goes in with a single io_uring_enter.
+ */
+class Uring
+{
+public:
+	Uring(unsigned entries = URING_ENTRIES, bool registerFiles = false);
+	Uring(const Uring& source) = delete;
+	~Uring(void);
+
+	/**
+	 * Whether the running kernel has everything we need: the RECV, SENDMSG
+	 * and ASYNC_CANCEL operations, provided buffer rings and multishot
+	 * receive. Probed once.
+	 */
+	static bool supported(void);
+
+	int descriptor(void) const;
+
+	/**
+	 * The next free submission entry, zeroed. Submits whatever is already
+	 * queued if the queue is full; NULL only if the kernel will not take it.
+	 */
+	io_uring_sqe* next(void);
+
+	/**
+	 * Point an entry at fd, through the registered file table if fd is in it.
+	 */
+	void target(io_uring_sqe* sqe, int fd) const;
+
+	/**
+	 * Hand every queued entry to the kernel, optionally waiting for at least
+	 * one completion. Returns the number submitted, or -1 on error.
+	 */
+	int submit(bool wait = false);
+	std::size_t queued(void) const;
+
+	/**
+	 * The oldest unseen completion, or NULL; call seen() once done with it.
+	 */
+	io_uring_cqe* peek(void);
+	void seen(void);
+
+	uint8_t* buffer(uint16_t id);
+	void recycle(uint16_t id);
+
+	int registerFile(int fd);
+	void unregisterFile(int fd);
+private:
+	static bool probe(void);
+	void release(void);
+	int enter(unsigned submit, unsigned complete, unsigned flags);
+	int update(int fd, int value);
+
+	int mRing;
+	unsigned mEntries;
+
+	void* mSqMapping;
+	std::size_t mSqMappingLength;
+	void* mCqMapping;
+	std::size_t mCqMappingLength;
+	io_uring_sqe* mSqes;
+	std::size_t mSqesLength;
+
+	unsigned* mSqHead;
+	unsigned* mSqTail;
+	unsigned mSqMask;
+	unsigned mSqLocalTail; // Entries handed out, submitted or not.
+	unsigned mSqSubmitted;
+
+	unsigned* mCqHead;
+	unsigned* mCqTail;
+	unsigned mCqMask;
+	io_uring_cqe* mCqes;
+
+	io_uring_buf_ring* mBufferRing;
+	std::size_t mBufferRingLength;
+	uint8_t* mBuffers;
+	uint16_t mBufferTail;
+
+	bool mFixedFiles;
+	std::vector<bool> mRegistered;
+};
+
+struct UringReceived
+{
+	uint16_t id;
+	uint32_t offset;
+	uint32_t length;
+};
+
+/**
+ * Per-socket io_uring state, owned by the EventLoop. It outlives the Socket
+ * if operations are still in flight when the socket is removed, or data is
+ * still staged, in which case it holds a duplicate descriptor of its own.
+ */
+struct UringSocket
+{
+	UringSocket(Socket* owner, int descriptor);
+	UringSocket(const UringSocket& source) = delete;
+	~UringSocket(void);
+
+	Socket* socket; // NULL once removed from the loop.
+	int fd;
+	std::deque<UringReceived> received; // Completed, not yet read.
+	RingBuffer outbound;
+	msghdr message; // In flight with the kernel while sending != 0.
+	iovec segments[2];
+	std::size_t sending;
+	bool receiving; // A multishot receive is armed.
+	bool queued; // Waiting for the end of the tick to send.
+	int error;
+	bool closed; // The peer has shut down its end.
+	bool owned; // fd is our own, and closed with us.
+	TimerHandle linger; // Gives up sending once removed, if the peer stalls.
+};
+
+#endif
@@ -0,0 +1,1019 @@
+#include "EventLoop.h"
+#include "Socket.h"
+
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+namespace
+{
+	const uint32_t WATCHED_EVENTS = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+	// Sockets on io_uring receive through it; epoll only covers the rest.
+	const uint32_t URING_WATCHED_EVENTS = EPOLLPRI | EPOLLOUT | EPOLLET;
+
+	// How long a removed socket's staged sends have to go out.
+	const int URING_DRAIN_TIMEOUT = 1000;
+
+	// Completions carry their UringSocket, with the operation in the low bits.
+	const uint64_t URING_RECEIVE = 1;
+	const uint64_t URING_SEND = 2;
+	const uint64_t URING_OPERATION_MASK = 7;
+
+	uint64_t tag(UringSocket* state, uint64_t operation)
+	{
+		return reinterpret_cast<uint64_t>(state) | operation;
+	}
+
+	bool connectedStream(int fd)
+	{
+		int type = 0;
+		int listening = 0;
+		socklen_t length = sizeof(type);
+		if (::getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length) == -1 || type != SOCK_STREAM)
+		{
+			return false;
+		}
+		length = sizeof(listening);
+		return ::getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &length) == 0 && !listening;
+	}
+
+	int64_t monotonicMilliseconds(void)
+	{
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return int64_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+	}
+}
+
+EventLoop::EventLoop(void):
+	mEpoll(::epoll_create1(EPOLL_CLOEXEC)),
+	mWakeup(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+	mDepth(0),
+	mCount(0),
+	mStopped(false),
+	mThread(std::this_thread::get_id()),
+	mRegistrations(),
+	mPending(),
+	mRemoved(),
+	mTaskLock(),
+	mTasks(),
+	mDeferred(),
+	mTimers(monotonicMilliseconds()),
+	mUring(NULL),
+	mSends(),
+	mStarved(),
+	mDetached()
+{
+	if (mEpoll == -1 || mWakeup == -1)
+	{
+		cerr << "Unable to create event loop " << errno << " " << strerror(errno) << endl;
+		throw "EventLoop::EventLoop failed";
+	}
+
+	epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL; // The wakeup descriptor is the only one without a registration.
+	if (::epoll_ctl(mEpoll, EPOLL_CTL_ADD, mWakeup, &event) == -1)
+	{
+		cerr << "Unable to watch event loop wakeup " << errno << " " << strerror(errno) << endl;
+		throw "EventLoop::EventLoop failed";
+	}
+}
+
+EventLoop::~EventLoop(void)
+{
+	// Tasks posted once the loop stopped running may be releasing resources
+	// of their own, such as a Listener's sockets, so still run them.
+	bool more = true;
+	while (more)
+	{
+		runTasks();
+		std::lock_guard<std::mutex> lock(mTaskLock);
+		more = !mTasks.empty();
+	}
+
+	for (std::size_t i = 0; i < mRegistrations.size(); i++)
+	{
+		Registration* registration = mRegistrations[i];
+		if (registration)
+		{
+			delete registration->socket->mUring;
+			registration->socket->mUring = NULL;
+			registration->socket->mLoop = NULL;
+			if (registration->owned)
+			{
+				delete registration->socket;
+			}
+			delete registration;
+		}
+	}
+	for (std::size_t i = 0; i < mRemoved.size(); i++)
+	{
+		delete mRemoved[i];
+	}
+	for (std::size_t i = 0; i < mDetached.size(); i++)
+	{
+		delete mDetached[i];
+	}
+	// Closing the ring cancels anything still in flight.
+	delete mUring;
+
+	::close(mWakeup);
+	::close(mEpoll);
+}
+
+int EventLoop::add(Socket* socket, uint32_t events, const ReadyCallback& callback, bool owned)
+{
+	int fd = socket->mSocket;
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	if (socket->mLoop == this)
+	{
+		Registration* registration = mRegistrations[fd];
+		registration->events = events;
+		registration->callback = callback;
+		registration->owned = owned;
+		return 0;
+	}
+	else if (socket->mLoop)
+	{
+		socket->mLoop->remove(socket);
+	}
+
+	Registration* registration = new Registration();
+	registration->socket = socket;
+	registration->events = events;
+	registration->pendingEvents = 0;
+	registration->callback = callback;
+	registration->owned = owned;
+	registration->removed = false;
+
+	bool uring = mUring && connectedStream(fd);
+	epoll_event event;
+	event.events = uring ? URING_WATCHED_EVENTS : WATCHED_EVENTS;
+	event.data.ptr = registration;
+	if (::epoll_ctl(mEpoll, EPOLL_CTL_ADD, fd, &event) == -1)
+	{
+		cerr << "Unable to add fd=" << fd << " to event loop " << errno << " " << strerror(errno) << endl;
+		delete registration;
+		return -1;
+	}
+
+	if (mRegistrations.size() <= std::size_t(fd))
+	{
+		mRegistrations.resize(fd + 1, NULL);
+	}
+	mRegistrations[fd] = registration;
+	mCount++;
+
+	// The kernel reports the current state of the descriptor as the first edge.
+	socket->mLoop = this;
+	socket->mReadReady = false;
+	socket->mReadyReadyOOB = false;
+	socket->mWriteReady = false;
+	if (uring)
+	{
+		attachUring(socket);
+	}
+	return 0;
+}
+
+int EventLoop::modify(Socket* socket, uint32_t events)
+{
+	if (socket->mLoop != this)
+	{
+		return -1;
+	}
+	mRegistrations[socket->mSocket]->events = events;
+	return 0;
+}
+
+int EventLoop::remove(Socket* socket)
+{
+	bool owned = false;
+	if (detach(socket, owned) != 0)
+	{
+		return -1;
+	}
+
+	if (owned)
+	{
+		delete socket;
+	}
+	return 0;
+}
+
+int EventLoop::detach(Socket* socket, bool& owned)
+{
+	if (socket->mLoop != this)
+	{
+		return -1;
+	}
+
+	if (socket->mUring)
+	{
+		detachUring(socket);
+	}
+
+	int fd = socket->mSocket;
+	Registration* registration = mRegistrations[fd];
+	owned = registration->owned;
+	mRegistrations[fd] = NULL;
+	mCount--;
+
+	// Closing the descriptor would remove it from the epoll set too, but the
+	// socket may outlive its registration here.
+	::epoll_ctl(mEpoll, EPOLL_CTL_DEL, fd, NULL);
+
+	socket->mLoop = NULL;
+	registration->removed = true;
+	if (mDepth == 0)
+	{
+		for (std::size_t i = 0; i < mPending.size(); i++)
+		{
+			if (mPending[i] == registration)
+			{
+				mPending.erase(mPending.begin() + i);
+				break;
+			}
+		}
+		delete registration;
+	}
+	else
+	{
+		// Events gathered this tick may still point at the registration.
+		mRemoved.push_back(registration);
+	}
+	return 0;
+}
+
+int EventLoop::runOnce(int timeout)
+{
+	epoll_event events[EVENT_LOOP_BATCH_SIZE];
+	int dispatched = 0;
+
+	mThread = std::this_thread::get_id();
+	mDepth++;
+	runTasks();
+	dispatched += dispatchPending();
+	if (dispatched > 0 || !mPending.empty())
+	{
+		timeout = 0;
+	}
+	timeout = nextTimeout(timeout);
+	submitUring();
+
+	int count = ::epoll_wait(mEpoll, events, EVENT_LOOP_BATCH_SIZE, timeout);
+	if (count == -1 && errno != EINTR)
+	{
+		cerr << "Error encountered in ::epoll_wait " << errno << ", " << strerror(errno) << endl;
+		mDepth--;
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		Registration* registration = static_cast<Registration*>(events[i].data.ptr);
+		if (registration == NULL)
+		{
+			uint64_t value;
+			while (::read(mWakeup, &value, sizeof(value)) > 0);
+			continue;
+		}
+		if (events[i].data.ptr == mUring || registration->removed)
+		{
+			// Completions are reaped below, in one go.
+			continue;
+		}
+
+		update(registration, events[i].events);
+		dispatched += dispatch(registration, events[i].events);
+	}
+
+	if (mUring)
+	{
+		reapUring(NULL, 0);
+		dispatched += dispatchPending();
+	}
+
+	runTasks();
+	mTimers.advance(monotonicMilliseconds());
+	runDeferred();
+
+	// Everything sent this tick goes to the kernel in one submission.
+	submitUring();
+	mDepth--;
+	reclaim();
+	return dispatched;
+}
+
+void EventLoop::run(void)
+{
+	while (!mStopped.load(std::memory_order_acquire))
+	{
+		if (runOnce(-1) == -1)
+		{
+			break;
+		}
+	}
+	mStopped.store(false, std::memory_order_release);
+}
+
+void EventLoop::stop(void)
+{
+	mStopped.store(true, std::memory_order_release);
+	uint64_t value = 1;
+	if (::write(mWakeup, &value, sizeof(value)) == -1 && errno != EAGAIN)
+	{
+		cerr << "Unable to wake event loop " << errno << " " << strerror(errno) << endl;
+	}
+}
+
+void EventLoop::post(const Task& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mTaskLock);
+		mTasks.push_back(task);
+	}
+	uint64_t value = 1;
+	if (::write(mWakeup, &value, sizeof(value)) == -1 && errno != EAGAIN)
+	{
+		cerr << "Unable to wake event loop " << errno << " " << strerror(errno) << endl;
+	}
+}
+
+void EventLoop::defer(const Task& task, int delay)
+{
+	if (delay > 0)
+	{
+		mTimers.schedule(delay, task);
+	}
+	else
+	{
+		mDeferred.push_back(task);
+	}
+}
+
+TimerHandle EventLoop::schedule(int delay, const Task& task, int slack)
+{
+	return mTimers.schedule(delay, task, slack);
+}
+
+bool EventLoop::cancel(TimerHandle timer)
+{
+	return mTimers.cancel(timer);
+}
+
+int EventLoop::enableUring(unsigned entries, bool registerFiles)
+{
+	if (mUring)
+	{
+		return 0;
+	}
+	if (mCount > 0 || !Uring::supported())
+	{
+		return -1;
+	}
+
+	try
+	{
+		mUring = new Uring(entries, registerFiles);
+	}
+	catch (const char* error)
+	{
+		return -1;
+	}
+
+	// Completions make the ring readable, so one epoll_wait covers both.
+	epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = mUring;
+	if (::epoll_ctl(mEpoll, EPOLL_CTL_ADD, mUring->descriptor(), &event) == -1)
+	{
+		cerr << "Unable to watch io_uring " << errno << " " << strerror(errno) << endl;
+		delete mUring;
+		mUring = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+bool EventLoop::uring(void) const
+{
+	return mUring != NULL;
+}
+
+bool EventLoop::running(void) const
+{
+	return mDepth > 0;
+}
+
+std::size_t EventLoop::size(void) const
+{
+	return mCount;
+}
+
+EventLoop& EventLoop::local(void)
+{
+	static thread_local EventLoop oLocalLoop;
+	return oLocalLoop;
+}
+
+bool EventLoop::onLoopThread(void) const
+{
+	return mThread == std::this_thread::get_id();
+}
+
+int EventLoop::wait(Socket& socket, short events, int timeout)
+{
+	epoll_event ready[EVENT_LOOP_BATCH_SIZE];
+	int64_t deadline = monotonicMilliseconds() + timeout;
+
+	// The waiter deals with what it is waiting for itself; anything else on
+	// its socket still goes to the callback (see queue()).
+	uint32_t waited = 0;
+	if (events & (POLLIN | POLLPRI))
+	{
+		waited |= EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+	}
+	if (events & POLLOUT)
+	{
+		waited |= EPOLLOUT | EPOLLHUP | EPOLLERR;
+	}
+
+	mDepth++;
+	while (true)
+	{
+		if (((events & (POLLIN | POLLPRI)) && (socket.mReadReady || socket.mReadyReadyOOB)) ||
+			((events & POLLOUT) && socket.mWriteReady) ||
+			socket.mLoop != this)
+		{
+			mDepth--;
+			return 1;
+		}
+
+		int remaining = -1;
+		if (timeout >= 0)
+		{
+			remaining = int(deadline - monotonicMilliseconds());
+			if (remaining < 0)
+			{
+				remaining = 0;
+			}
+		}
+
+		submitUring();
+		int count = ::epoll_wait(mEpoll, ready, EVENT_LOOP_BATCH_SIZE, remaining);
+		if (count == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			cerr << "Error encountered in ::epoll_wait " << errno << ", " << strerror(errno) << endl;
+			mDepth--;
+			return -1;
+		}
+		else if (count == 0 && remaining == 0)
+		{
+			mDepth--;
+			return 0;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			Registration* registration = static_cast<Registration*>(ready[i].data.ptr);
+			if (registration == NULL)
+			{
+				// Posted tasks and stop requests are picked up by the outer
+				// runOnce once the blocking call returns.
+				uint64_t value;
+				while (::read(mWakeup, &value, sizeof(value)) > 0);
+				continue;
+			}
+			if (ready[i].data.ptr == mUring || registration->removed)
+			{
+				continue;
+			}
+
+			update(registration, ready[i].events);
+			queue(registration, registration->socket == &socket ? ready[i].events & ~waited : ready[i].events);
+		}
+
+		reapUring(&socket, waited);
+	}
+}
+
+void EventLoop::queue(Registration* registration, uint32_t events)
+{
+	// Callbacks are deferred until we are back in the loop proper; running
+	// them from inside a blocking call would be re-entrant.
+	if (registration->callback && (registration->events & events))
+	{
+		if (registration->pendingEvents == 0)
+		{
+			mPending.push_back(registration);
+		}
+		registration->pendingEvents |= events;
+	}
+}
+
+void EventLoop::update(Registration* registration, uint32_t events)
+{
+	Socket* socket = registration->socket;
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+	{
+		// Hang-ups and errors surface through recv, so make sure it gets called.
+		socket->mReadReady = true;
+	}
+	if (events & EPOLLPRI)
+	{
+		socket->mReadyReadyOOB = true;
+	}
+	if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+	{
+		socket->mWriteReady = true;
+	}
+}
+
+int EventLoop::dispatch(Registration* registration, uint32_t events)
+{
+	if (!registration->callback || !(registration->events & events))
+	{
+		return 0;
+	}
+	registration->callback(*registration->socket, events);
+	return 1;
+}
+
+int EventLoop::dispatchPending(void)
+{
+	int dispatched = 0;
+	std::vector<Registration*> pending;
+	pending.swap(mPending);
+	for (std::size_t i = 0; i < pending.size(); i++)
+	{
+		Registration* registration = pending[i];
+		uint32_t events = registration->pendingEvents;
+		registration->pendingEvents = 0;
+		if (!registration->removed)
+		{
+			dispatched += dispatch(registration, events);
+		}
+	}
+	return dispatched;
+}
+
+void EventLoop::runTasks(void)
+{
+	std::vector<Task> tasks;
+	{
+		std::lock_guard<std::mutex> lock(mTaskLock);
+		if (mTasks.empty())
+		{
+			return;
+		}
+		tasks.swap(mTasks);
+	}
+	for (std::size_t i = 0; i < tasks.size(); i++)
+	{
+		tasks[i]();
+	}
+}
+
+void EventLoop::runDeferred(void)
+{
+	if (mDeferred.empty())
+	{
+		return;
+	}
+
+	// Tasks deferred while running these wait for the next tick.
+	std::vector<Task> deferred;
+	deferred.swap(mDeferred);
+	for (std::size_t i = 0; i < deferred.size(); i++)
+	{
+		deferred[i]();
+	}
+}
+
+int EventLoop::nextTimeout(int timeout) const
+{
+	if (!mDeferred.empty())
+	{
+		return 0;
+	}
+
+	int64_t remaining = mTimers.timeout(monotonicMilliseconds());
+	if (remaining >= 0 && (timeout < 0 || remaining < timeout))
+	{
+		timeout = int(remaining);
+	}
+	return timeout;
+}
+
+void EventLoop::reclaim(void)
+{
+	if (mDepth != 0)
+	{
+		return;
+	}
+	if (mRemoved.empty())
+	{
+		return;
+	}
+
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < mPending.size(); i++)
+	{
+		if (!mPending[i]->removed)
+		{
+			mPending[kept++] = mPending[i];
+		}
+	}
+	mPending.resize(kept);
+
+	for (std::size_t i = 0; i < mRemoved.size(); i++)
+	{
+		delete mRemoved[i];
+	}
+	mRemoved.clear();
+}
+
+void EventLoop::attachUring(Socket* socket)
+{
+	UringSocket* state = new UringSocket(socket, socket->mSocket);
+	socket->mUring = state;
+	mUring->registerFile(state->fd);
+	armReceive(state);
+}
+
+void EventLoop::detachUring(Socket* socket)
+{
+	UringSocket* state = socket->mUring;
+	state->socket = NULL;
+	socket->mUring = NULL;
+	mUring->unregisterFile(state->fd);
+
+	// Staged data would be lost once the descriptor is closed. Rather than
+	// hold up every other socket waiting for it to go, keep the connection
+	// open with a descriptor of our own and let it finish as it completes.
+	bool flushing = !state->outbound.empty() && state->error == 0;
+	if (flushing)
+	{
+		int fd = ::fcntl(state->fd, F_DUPFD_CLOEXEC, 0);
+		if (fd == -1)
+		{
+			cerr << "Unable to keep fd=" << state->fd << " open to finish sending " << errno << " " << strerror(errno) << endl;
+			flushing = false;
+		}
+		else
+		{
+			state->fd = fd;
+			state->owned = true;
+			socket->mLingering = true;
+			state->linger = mTimers.schedule(URING_DRAIN_TIMEOUT, [this, state](void)
+			{
+				// The peer is not taking the rest; give up on it.
+				state->linger = TIMER_NONE;
+				state->error = ETIMEDOUT;
+				if (state->sending != 0)
+				{
+					io_uring_sqe* sqe = mUring->next();
+					if (sqe)
+					{
+						sqe->opcode = IORING_OP_ASYNC_CANCEL;
+						sqe->addr = tag(state, URING_SEND);
+						sqe->user_data = 0;
+					}
+				}
+				release(state);
+			});
+		}
+	}
+
+	if (!flushing)
+	{
+		for (std::size_t i = 0; i < mSends.size(); i++)
+		{
+			if (mSends[i] == state)
+			{
+				mSends.erase(mSends.begin() + i);
+				break;
+			}
+		}
+	}
+	for (std::size_t i = 0; i < mStarved.size(); i++)
+	{
+		if (mStarved[i] == state)
+		{
+			mStarved.erase(mStarved.begin() + i);
+			break;
+		}
+	}
+	while (!state->received.empty())
+	{
+		mUring->recycle(state->received.front().id);
+		state->received.pop_front();
+	}
+
+	if (state->receiving)
+	{
+		// The receive holds its own reference to the socket; cancel it now so
+		// that closing the descriptor really does close the connection.
+		io_uring_sqe* sqe = mUring->next();
+		if (sqe)
+		{
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = tag(state, URING_RECEIVE);
+			sqe->user_data = 0;
+		}
+	}
+	submitUring();
+
+	if (state->receiving || state->sending != 0 || flushing)
+	{
+		mDetached.push_back(state);
+	}
+	else
+	{
+		delete state;
+	}
+}
+
+void EventLoop::armReceive(UringSocket* state)
+{
+	io_uring_sqe* sqe = mUring->next();
+	if (sqe == NULL)
+	{
+		state->error = EBUSY;
+		return;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	mUring->target(sqe, state->fd);
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = tag(state, URING_RECEIVE);
+	state->receiving = true;
+}
+
+void EventLoop::queueSend(UringSocket* state)
+{
+	if (!state->queued)
+	{
+		state->queued = true;
+		mSends.push_back(state);
+	}
+}
+
+std::size_t EventLoop::stage(UringSocket* state, iovec*& segments, int& count)
+{
+	std::size_t staged = 0;
+	while (count > 0)
+	{
+		std::size_t written = state->outbound.write(segments->iov_base, segments->iov_len);
+		staged += written;
+		if (written < segments->iov_len)
+		{
+			segments->iov_base = static_cast<uint8_t*>(segments->iov_base) + written;
+			segments->iov_len -= written;
+			break;
+		}
+		segments++;
+		count--;
+	}
+
+	if (staged > 0)
+	{
+		queueSend(state);
+	}
+	return staged;
+}
+
+int EventLoop::drain(UringSocket* state, RingBuffer& ring)
+{
+	std::size_t total = 0;
+	bool recycled = false;
+	while (!state->received.empty() && ring.space() > 0)
+	{
+		UringReceived& piece = state->received.front();
+		std::size_t count = ring.write(mUring->buffer(piece.id) + piece.offset, piece.length);
+		piece.offset += count;
+		piece.length -= count;
+		total += count;
+		if (piece.length == 0)
+		{
+			mUring->recycle(piece.id);
+			state->received.pop_front();
+			recycled = true;
+		}
+	}
+
+	if (recycled && !mStarved.empty())
+	{
+		for (std::size_t i = 0; i < mStarved.size(); i++)
+		{
+			UringSocket* starved = mStarved[i];
+			if (!starved->receiving && !starved->closed && starved->error == 0)
+			{
+				armReceive(starved);
+			}
+		}
+		mStarved.clear();
+	}
+
+	if (total > 0)
+	{
+		return int(total);
+	}
+	else if (!state->received.empty() || state->closed)
+	{
+		// Either the ring is full or the peer has hung up; both read as 0.
+		return 0;
+	}
+
+	errno = state->error ? state->error : EAGAIN;
+	return -1;
+}
+
+void EventLoop::submitUring(void)
+{
+	if (!mUring)
+	{
+		return;
+	}
+
+	std::vector<UringSocket*> sends;
+	sends.swap(mSends);
+	for (std::size_t i = 0; i < sends.size(); i++)
+	{
+		UringSocket* state = sends[i];
+		state->queued = false;
+		if (state->sending != 0 || state->outbound.empty() || state->error != 0)
+		{
+			// Whatever is left goes once the send in flight completes.
+			continue;
+		}
+
+		io_uring_sqe* sqe = mUring->next();
+		if (sqe == NULL)
+		{
+			queueSend(state);
+			continue;
+		}
+
+		memset(&state->message, 0, sizeof(state->message));
+		state->message.msg_iov = state->segments;
+		state->message.msg_iovlen = state->outbound.readable(state->segments);
+		for (std::size_t j = 0; j < state->message.msg_iovlen; j++)
+		{
+			state->sending += state->segments[j].iov_len;
+		}
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		mUring->target(sqe, state->fd);
+		sqe->addr = reinterpret_cast<uint64_t>(&state->message);
+		sqe->len = 1;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = tag(state, URING_SEND);
+	}
+
+	if (mUring->queued() > 0)
+	{
+		mUring->submit();
+	}
+}
+
+void EventLoop::reapUring(Socket* waiting, uint32_t waited)
+{
+	if (!mUring)
+	{
+		return;
+	}
+
+	io_uring_cqe* cqe;
+	while ((cqe = mUring->peek()) != NULL)
+	{
+		uint64_t data = cqe->user_data;
+		int result = cqe->res;
+		uint32_t flags = cqe->flags;
+		mUring->seen();
+
+		UringSocket* state = reinterpret_cast<UringSocket*>(data & ~URING_OPERATION_MASK);
+		if (state == NULL)
+		{
+			// Cancellations.
+			continue;
+		}
+
+		uint32_t events = 0;
+		if ((data & URING_OPERATION_MASK) == URING_RECEIVE)
+		{
+			if (flags & IORING_CQE_F_BUFFER)
+			{
+				uint16_t id = uint16_t(flags >> IORING_CQE_BUFFER_SHIFT);
+				if (result > 0 && state->socket)
+				{
+					UringReceived piece = {id, 0, uint32_t(result)};
+					state->received.push_back(piece);
+				}
+				else
+				{
+					mUring->recycle(id);
+				}
+			}
+
+			bool more = flags & IORING_CQE_F_MORE;
+			if (!more)
+			{
+				state->receiving = false;
+			}
+
+			if (result > 0)
+			{
+				events |= EPOLLIN;
+				if (!more && state->socket)
+				{
+					// Stopped for some other reason, such as a full completion queue.
+					armReceive(state);
+				}
+			}
+			else if (result == 0)
+			{
+				state->closed = true;
+				events |= EPOLLIN | EPOLLRDHUP;
+			}
+			else if (result == -ENOBUFS)
+			{
+				// Every buffer is waiting to be read; resume once one is.
+				if (state->socket)
+				{
+					mStarved.push_back(state);
+				}
+			}
+			else if (result != -ECANCELED)
+			{
+				state->error = -result;
+				events |= EPOLLIN | EPOLLERR;
+			}
+		}
+		else
+		{
+			state->sending = 0;
+			if (result > 0)
+			{
+				state->outbound.consume(result);
+			}
+			else if (result < 0 && result != -EAGAIN && result != -EINTR)
+			{
+				state->error = -result;
+				events |= EPOLLERR;
+			}
+
+			if (!state->outbound.empty() && state->error == 0)
+			{
+				queueSend(state);
+			}
+			events |= EPOLLOUT;
+		}
+
+		if (state->socket == NULL)
+		{
+			release(state);
+			continue;
+		}
+
+		// Completions only fire once, so whatever the waiter is not going to
+		// deal with itself (a send completing while it waits to read, say)
+		// must reach the callback.
+		Registration* registration = mRegistrations[state->fd];
+		update(registration, events);
+		queue(registration, registration->socket == waiting ? events & ~waited : events);
+	}
+}
+
+void EventLoop::release(UringSocket* state)
+{
+	if (state->receiving || state->sending != 0 || (!state->outbound.empty() && state->error == 0))
+	{
+		return;
+	}
+	mTimers.cancel(state->linger);
+
+	for (std::size_t i = 0; i < mDetached.size(); i++)
+	{
+		if (mDetached[i] == state)
+		{
+			mDetached.erase(mDetached.begin() + i);
+			break;
+		}
+	}
+	delete state;
+}
@@ -0,0 +1,101 @@
+#include "EventLoopGroup.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+EventLoopGroup::EventLoopGroup(std::size_t loops):
+	mLoops(),
+	mThreads(),
+	mNext(0)
+{
+	if (loops == 0)
+	{
+		loops = std::thread::hardware_concurrency();
+	}
+	if (loops == 0)
+	{
+		loops = 1;
+	}
+
+	for (std::size_t i = 0; i < loops; i++)
+	{
+		mLoops.push_back(new EventLoop());
+	}
+}
+
+EventLoopGroup::~EventLoopGroup(void)
+{
+	stop();
+	for (std::size_t i = 0; i < mLoops.size(); i++)
+	{
+		delete mLoops[i];
+	}
+}
+
+void EventLoopGroup::start(bool pinThreads)
+{
+	if (!mThreads.empty())
+	{
+		return;
+	}
+
+	std::size_t cores = std::thread::hardware_concurrency();
+	for (std::size_t i = 0; i < mLoops.size(); i++)
+	{
+		EventLoop* loop = mLoops[i];
+		mThreads.push_back(std::thread([loop](void) { loop->run(); }));
+
+		if (pinThreads && cores > 0)
+		{
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(i % cores, &cpus);
+			pthread_setaffinity_np(mThreads.back().native_handle(), sizeof(cpus), &cpus);
+		}
+	}
+}
+
+int EventLoopGroup::enableUring(unsigned entries, bool registerFiles)
+{
+	if (!mThreads.empty() || !Uring::supported())
+	{
+		return -1;
+	}
+
+	for (std::size_t i = 0; i < mLoops.size(); i++)
+	{
+		if (mLoops[i]->enableUring(entries, registerFiles) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void EventLoopGroup::stop(void)
+{
+	for (std::size_t i = 0; i < mThreads.size(); i++)
+	{
+		mLoops[i]->stop();
+	}
+	for (std::size_t i = 0; i < mThreads.size(); i++)
+	{
+		mThreads[i].join();
+	}
+	mThreads.clear();
+}
+
+std::size_t EventLoopGroup::size(void) const
+{
+	return mLoops.size();
+}
+
+EventLoop& EventLoopGroup::at(std::size_t index)
+{
+	return *mLoops[index % mLoops.size()];
+}
+
+EventLoop& EventLoopGroup::next(void)
+{
+	return at(mNext.fetch_add(1, std::memory_order_relaxed));
+}
@@ -0,0 +1,115 @@
+#include "Listener.h"
+
+#include <fcntl.h>
+
+Listener::Listener(EventLoopGroup& loops, const AcceptCallback& callback):
+	mLoops(loops),
+	mShared(new Shared()),
+	mSockets()
+{
+	mShared->callback = callback;
+	mShared->accepted = 0;
+}
+
+Listener::~Listener(void)
+{
+	close();
+}
+
+int Listener::listen(const char* port, const char* ip, int backlog)
+{
+	mShared->retries.assign(mLoops.size(), TIMER_NONE);
+	for (std::size_t i = 0; i < mLoops.size(); i++)
+	{
+		Socket* listening = new Socket();
+		int ret = listening->bind(port, ip, backlog, true);
+		if (ret != 0)
+		{
+			delete listening;
+			close();
+			return ret;
+		}
+
+		int flags = ::fcntl(listening->mSocket, F_GETFL, 0);
+		if (flags == -1 || ::fcntl(listening->mSocket, F_SETFL, flags | O_NONBLOCK) == -1)
+		{
+			cerr << "Unable to make listener non-blocking " << errno << " " << strerror(errno) << endl;
+			delete listening;
+			close();
+			return -1;
+		}
+		mSockets.push_back(listening);
+
+		// Registration has to happen on the loop's own thread.
+		EventLoop* loop = &mLoops.at(i);
+		std::shared_ptr<Shared> shared = mShared;
+		loop->post([loop, listening, shared, i](void) {
+			loop->add(listening, EPOLLIN, [loop, shared, i](Socket& sock, uint32_t) {
+				drain(shared, *loop, sock, i);
+			}, true);
+		});
+	}
+	return 0;
+}
+
+void Listener::close(void)
+{
+	for (std::size_t i = 0; i < mSockets.size(); i++)
+	{
+		EventLoop* loop = &mLoops.at(i);
+		Socket* listening = mSockets[i];
+		std::shared_ptr<Shared> shared = mShared;
+		loop->post([loop, listening, shared, i](void) {
+			// Should the loop not be running any more, this happens when it is
+			// destroyed instead.
+			loop->cancel(shared->retries[i]);
+			shared->retries[i] = TIMER_NONE;
+			if (loop->remove(listening) != 0)
+			{
+				delete listening;
+			}
+		});
+	}
+	mSockets.clear();
+}
+
+uint64_t Listener::accepted(void) const
+{
+	return mShared->accepted.load(std::memory_order_relaxed);
+}
+
+void Listener::drain(const std::shared_ptr<Shared>& shared, EventLoop& loop, Socket& listening, std::size_t shard)
+{
+	// Edge-triggered; keep going until the kernel's queue is empty.
+	while (true)
+	{
+		int nsock = ::accept4(listening.mSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (nsock == -1)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				// Most likely EMFILE/ENFILE. The pending connections stay
+				// queued, but being edge-triggered we will not be told about
+				// them again, so try again once some descriptors may be free.
+				cerr << "Error encountered in ::accept4 " << errno << ", " << strerror(errno) << endl;
+				if (shared->retries[shard] == TIMER_NONE)
+				{
+					Socket* retrying = &listening;
+					EventLoop* owner = &loop;
+					shared->retries[shard] = loop.schedule(LISTENER_RETRY_DELAY, [shared, owner, retrying, shard](void) {
+						shared->retries[shard] = TIMER_NONE;
+						drain(shared, *owner, *retrying, shard);
+					});
+				}
+			}
+			break;
+		}
+
+		shared->accepted.fetch_add(1, std::memory_order_relaxed);
+		shared->callback(loop, new Socket(nsock));
+	}
+}
@@ -0,0 +1,144 @@
+#include "RingBuffer.h"
+
+#include <cstring>
+
+RingBuffer::RingBuffer(std::size_t capacity):
+	mBuffer(NULL),
+	mCapacity(1),
+	mHead(0),
+	mTail(0)
+{
+	while (mCapacity < capacity)
+	{
+		mCapacity <<= 1;
+	}
+	mBuffer = new uint8_t[mCapacity];
+}
+
+RingBuffer::~RingBuffer(void)
+{
+	delete [] mBuffer;
+	mBuffer = NULL;
+}
+
+std::size_t RingBuffer::capacity(void) const
+{
+	return mCapacity;
+}
+
+std::size_t RingBuffer::size(void) const
+{
+	return std::size_t(mTail - mHead);
+}
+
+std::size_t RingBuffer::space(void) const
+{
+	return mCapacity - size();
+}
+
+bool RingBuffer::empty(void) const
+{
+	return mTail == mHead;
+}
+
+int RingBuffer::readable(iovec* segments) const
+{
+	std::size_t used = size();
+	if (used == 0)
+	{
+		return 0;
+	}
+
+	std::size_t start = std::size_t(mHead & (mCapacity - 1));
+	std::size_t first = mCapacity - start;
+	segments[0].iov_base = mBuffer + start;
+	if (used <= first)
+	{
+		segments[0].iov_len = used;
+		return 1;
+	}
+
+	segments[0].iov_len = first;
+	segments[1].iov_base = mBuffer;
+	segments[1].iov_len = used - first;
+	return 2;
+}
+
+int RingBuffer::writable(iovec* segments)
+{
+	std::size_t free = space();
+	if (free == 0)
+	{
+		return 0;
+	}
+
+	std::size_t start = std::size_t(mTail & (mCapacity - 1));
+	std::size_t first = mCapacity - start;
+	segments[0].iov_base = mBuffer + start;
+	if (free <= first)
+	{
+		segments[0].iov_len = free;
+		return 1;
+	}
+
+	segments[0].iov_len = first;
+	segments[1].iov_base = mBuffer;
+	segments[1].iov_len = free - first;
+	return 2;
+}
+
+void RingBuffer::produce(std::size_t count)
+{
+	mTail += count;
+}
+
+void RingBuffer::consume(std::size_t count)
+{
+	mHead += count;
+	if (mHead == mTail)
+	{
+		// Rewind so the next fill starts at the front and stays contiguous.
+		mHead = 0;
+		mTail = 0;
+	}
+}
+
+std::size_t RingBuffer::read(void* buffer, std::size_t length)
+{
+	iovec segments[2];
+	int count = readable(segments);
+	uint8_t* cursor = static_cast<uint8_t*>(buffer);
+	std::size_t copied = 0;
+
+	for (int i = 0; i < count && copied < length; i++)
+	{
+		std::size_t chunk = length - copied < segments[i].iov_len ? length - copied : segments[i].iov_len;
+		memcpy(cursor + copied, segments[i].iov_base, chunk);
+		copied += chunk;
+	}
+	consume(copied);
+	return copied;
+}
+
+std::size_t RingBuffer::write(const void* buffer, std::size_t length)
+{
+	iovec segments[2];
+	int count = writable(segments);
+	const uint8_t* cursor = static_cast<const uint8_t*>(buffer);
+	std::size_t copied = 0;
+
+	for (int i = 0; i < count && copied < length; i++)
+	{
+		std::size_t chunk = length - copied < segments[i].iov_len ? length - copied : segments[i].iov_len;
+		memcpy(segments[i].iov_base, cursor + copied, chunk);
+		copied += chunk;
+	}
+	produce(copied);
+	return copied;
+}
+
+void RingBuffer::clear(void)
+{
+	mHead = 0;
+	mTail = 0;
+}
@@ -1,5 +1,58 @@
 #include "Socket.h"
 
+#include <sys/sendfile.h>
+#include <csignal>
+#include <ctime>
+
+namespace
+{
+	/**
+	 * sendfile() has no MSG_NOSIGNAL, so block SIGPIPE on the calling thread
+	 * for the duration and swallow any raised before unblocking it again.
+	 */
+	class SigPipeGuard
+	{
+	public:
+		SigPipeGuard(void):
+			mBlocked(false)
+		{
+			sigset_t pipe;
+			sigemptyset(&pipe);
+			sigaddset(&pipe, SIGPIPE);
+
+			sigset_t pending;
+			sigpending(&pending);
+			if (!sigismember(&pending, SIGPIPE))
+			{
+				sigset_t previous;
+				pthread_sigmask(SIG_BLOCK, &pipe, &previous);
+				mBlocked = !sigismember(&previous, SIGPIPE);
+			}
+		}
+
+		~SigPipeGuard(void)
+		{
+			if (!mBlocked)
+			{
+				return;
+			}
+
+			sigset_t pipe;
+			sigemptyset(&pipe);
+			sigaddset(&pipe, SIGPIPE);
+
+			// Leave errno as the send left it for the caller.
+			int error = errno;
+			timespec immediately = {0, 0};
+			while (sigtimedwait(&pipe, NULL, &immediately) == -1 && errno == EINTR);
+			pthread_sigmask(SIG_UNBLOCK, &pipe, NULL);
+			errno = error;
+		}
+	private:
+		bool mBlocked;
+	};
+}
+
 Socket::Socket(void):
 	mConnected(false),
 	mInvalid(true),
@@ -8,7 +61,12 @@ Socket::Socket(void):
 	mWriteReady(false),
 	mTimedout(false),
 	mSocket(-1),
-	mReceivedBytes(0)
+	mReceivedBytes(0),
+	mLoop(NULL),
+	mUring(NULL),
+	mLingering(false),
+	mReadAhead(NULL),
+	mReadAheadCapacity(READ_AHEAD_LENGTH)
 {
 	// empty
 }
@@ -21,20 +79,33 @@ Socket::Socket(int sock):
 	mWriteReady(false),
 	mTimedout(false),
 	mSocket(sock),
-	mReceivedBytes(0)
+	mReceivedBytes(0),
+	mLoop(NULL),
+	mUring(NULL),
+	mLingering(false),
+	mReadAhead(NULL),
+	mReadAheadCapacity(READ_AHEAD_LENGTH)
 {
 	// empty
 }
 
 Socket::~Socket(void)
 {
-	if (mConnected)
+	if (mLoop)
+	{
+		// Already being destroyed, whoever owns us.
+		bool owned = false;
+		mLoop->detach(this, owned);
+	}
+	if (mSocket != -1)
 	{
 		close();
 	}
+	delete mReadAhead;
+	mReadAhead = NULL;
 }
 
-int Socket::bind(const char* port, const char* ip)
+int Socket::bind(const char* port, const char* ip, int backlog, bool reusePort)
 {
 	addrinfo hints;
 	addrinfo* res;
@@ -55,7 +126,7 @@ int Socket::bind(const char* port, const char* ip)
 	int socketReuseValue = 1;
 	for (addrinfo* p = res; p != NULL; p = p->ai_next)
 	{
-		mSocket = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		mSocket = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
 		if (mSocket == -1)
 		{
 			continue;
@@ -68,7 +139,14 @@ int Socket::bind(const char* port, const char* ip)
 			mSocket = -1;
 			continue;
 		}
-		if (::bind(mSocket, res->ai_addr, res->ai_addrlen) == -1)
+		if (reusePort && ::setsockopt(mSocket, SOL_SOCKET, SO_REUSEPORT, &socketReuseValue, sizeof(socketReuseValue)) == -1)
+		{
+			cerr << "Unable to reuse port " << errno << " " << strerror(errno) << endl;
+			::close(mSocket);
+			mSocket = -1;
+			continue;
+		}
+		if (::bind(mSocket, p->ai_addr, p->ai_addrlen) == -1)
 		{
 			cerr << "Unable to bind " << errno << " " << strerror(errno) << endl;
 			::close(mSocket);
@@ -84,7 +162,7 @@ int Socket::bind(const char* port, const char* ip)
 		return EAGAIN;
 	}
 
-	ret = ::listen(mSocket, SOCKET_CONNECTION_LIMIT);
+	ret = ::listen(mSocket, backlog);
 	mConnected = (ret == 0);
 	return ret;
 }
@@ -130,20 +208,58 @@ int Socket::recvLength(void) const
 	return mReceivedBytes;
 }
 
+int Socket::descriptor(void) const
+{
+	return mSocket;
+}
+
+int Socket::sendBufferSize(void) const
+{
+	int size = 0;
+	socklen_t length = sizeof(size);
+	if (::getsockopt(mSocket, SOL_SOCKET, SO_SNDBUF, &size, &length) == -1)
+	{
+		return -1;
+	}
+	return size;
+}
+
 int Socket::close(void)
 {
 	int ret = -1;
-	if (mConnected)
+	bool failed = false;
+	bool owned = false;
+	if (mLoop)
+	{
+		// A loop which owns us would delete us on removal; that has to wait
+		// until we are done with the descriptor.
+		mLoop->detach(this, owned);
+	}
+	// A peer hang-up clears mConnected, but the descriptor still needs closing.
+	if (mSocket != -1)
 	{
-		::shutdown(mSocket, SHUT_RDWR);
+		// Shutting down would cut off whatever a loop is still sending for us.
+		if (!mLingering)
+		{
+			::shutdown(mSocket, SHUT_RDWR);
+		}
 		ret = ::close(mSocket);
 		mConnected = false;
 
-		if (ret != 0)
+		failed = ret != 0;
+		if (!failed || owned)
 		{
-			throw "Socket::close failed";
+			mSocket = -1;
 		}
-		mSocket = -1;
+	}
+
+	if (owned)
+	{
+		delete this;
+	}
+	if (failed)
+	{
+		throw "Socket::close failed";
 	}
 	return ret;
 }
@@ -198,56 +314,185 @@ int Socket::connect(const char* ip, const char* port)
 int Socket::receive(char* buffer, int bufferLength, int timeout)
 {
 	int received = 0; // Other end hung up.
-	int flags = 0;
 
-	do
+	mReceivedBytes = 0;
+	if (mReadAhead && !mReadAhead->empty())
+	{
+		received = mReadAhead->read(buffer, bufferLength);
+	}
+
+	while (received < bufferLength)
 	{
-		checkForReady(POLLIN | POLLPRI, timeout);
 		if (!mConnected)
 		{
 			cerr << "Socket not connected." << endl;
 			received = 0;
 			break;
 		}
-		if (mTimedout)
+
+		// Try the read first; we only need to wait on the reactor once the
+		// kernel tells us there is nothing left.
+		int ret;
+		int remaining = bufferLength - received;
+		bool urgent = mReadyReadyOOB;
+		if (urgent)
 		{
-			break;
+			ret = ::recv(mSocket, buffer + received, remaining, MSG_DONTWAIT | MSG_OOB);
 		}
-		
-		if (mReadReady || mReadyReadyOOB)
+		else if (mUring || std::size_t(remaining) < mReadAheadCapacity)
 		{
-			if (mReadyReadyOOB)
+			// Small reads go through the read-ahead buffer, picking up
+			// whatever else the peer has already sent along the way. With
+			// io_uring every read does, as that is where receives land.
+			ret = fillReadAhead();
+			if (ret > 0)
 			{
-				flags = MSG_OOB;
+				ret = mReadAhead->read(buffer + received, remaining);
 			}
+		}
+		else
+		{
+			ret = ::recv(mSocket, buffer + received, remaining, MSG_DONTWAIT);
+		}
 
-			int ret = ::recv(mSocket, buffer + received, bufferLength - received, flags);
-
-			if (ret == 0 /* Other side shut down */)
+		if (ret == 0 /* Other side shut down */)
+		{
+			cerr << "Socket shut down by other side." << endl;
+			received = 0;
+			mConnected = false;
+			break;
+		}
+		else if (ret < 0)
+		{
+			if (errno == EINTR)
 			{
-				cerr << "Socket shut down by other side." << endl;
-				received = 0;
-				mConnected = false;
-				break;
+				continue;
 			}
-			else if (ret < 0)
+			else if (urgent)
 			{
-				cerr << "Fewer than 0 bytes received." << endl;
-				received = 0;
-				return -1;
+				// Urgent data has already been consumed, or was delivered inline.
+				mReadyReadyOOB = false;
+				continue;
 			}
-			else
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
 			{
-				received += ret;
+				mReadReady = false;
+				checkForReady(POLLIN | POLLPRI, timeout);
+				if (mTimedout)
+				{
+					break;
+				}
+				continue;
 			}
+			cerr << "Fewer than 0 bytes received." << endl;
+			received = 0;
+			return -1;
+		}
+		else
+		{
+			if (urgent)
+			{
+				mReadyReadyOOB = false;
+			}
+			received += ret;
 		}
-	} while (received < bufferLength);
+	}
 
 	mReceivedBytes = received;
 
 	return received;
 }
 
+RingBuffer& Socket::readAhead(void)
+{
+	if (mReadAhead == NULL)
+	{
+		mReadAhead = new RingBuffer(mReadAheadCapacity);
+	}
+	return *mReadAhead;
+}
+
+int Socket::readAhead(std::size_t capacity)
+{
+	if (mReadAhead && !mReadAhead->empty())
+	{
+		return -1;
+	}
+
+	delete mReadAhead;
+	mReadAhead = NULL;
+	mReadAheadCapacity = capacity;
+	return 0;
+}
+
+int Socket::fill(int timeout)
+{
+	while (mConnected)
+	{
+		int ret = fillReadAhead();
+		if (ret > 0)
+		{
+			return ret;
+		}
+		else if (ret == 0)
+		{
+			if (readAhead().space() == 0)
+			{
+				return 0;
+			}
+			cerr << "Socket shut down by other side." << endl;
+			mConnected = false;
+			return 0;
+		}
+		else if (errno == EINTR)
+		{
+			continue;
+		}
+		else if (errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			return -1;
+		}
+
+		mReadReady = false;
+		checkForReady(POLLIN, timeout);
+		if (mTimedout)
+		{
+			return 0;
+		}
+	}
+	return 0;
+}
+
+int Socket::fillReadAhead(void)
+{
+	RingBuffer& ring = readAhead();
+	if (mUring)
+	{
+		// Completed io_uring receives stand in for the recvmsg.
+		return mLoop->drain(mUring, ring);
+	}
+
+	iovec segments[2];
+	msghdr message;
+
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = segments;
+	message.msg_iovlen = ring.writable(segments);
+	if (message.msg_iovlen == 0)
+	{
+		return 0;
+	}
+
+	// recvmsg rather than readv, so that the read never blocks even if the
+	// descriptor itself is in blocking mode.
+	int ret = ::recvmsg(mSocket, &message, MSG_DONTWAIT);
+	if (ret > 0)
+	{
+		ring.produce(ret);
+	}
+	return ret;
+}
+
 int Socket::send(const char* buffer, int bufferLength, bool critical)
 {
 	int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
@@ -257,37 +502,270 @@ int Socket::send(const char* buffer, int bufferLength, bool critical)
 	{
 		flags |= MSG_OOB;
 	}
+	else if (mUring)
+	{
+		// Keep ordering with sends already staged for io_uring.
+		iovec segment;
+		segment.iov_base = const_cast<char*>(buffer);
+		segment.iov_len = bufferLength;
+		ssize_t ret = send(&segment, 1);
+		return ret == bufferLength || ret == -42 ? int(ret) : -1;
+	}
 
 	do
 	{
+		if (!mConnected)
+		{
+			return -42;
+		}
+
+		int ret = ::send(mSocket, buffer + sent, bufferLength - sent, flags);
+
+		if (ret == -1 && errno == EPIPE)
+		{
+			cout << "EPIPE encountered!" << endl;
+			mConnected = false;
+			mInvalid = true;
+			break;
+		}
+		else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			mWriteReady = false;
+			checkForReady(POLLOUT, 30);
+			if (!mConnected)
+			{
+				return -42;
+			}
+			if (!mWriteReady)
+			{
+				sent = -1;
+				break;
+			}
+			continue;
+		}
+		else if (ret == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+
+		sent += ret;
+	} while (sent < bufferLength);
+
+	return sent;
+}
+
+ssize_t Socket::send(iovec* segments, int count, bool block)
+{
+	ssize_t sent = 0;
+
+	// Skip anything empty up front so a fully sent batch is easy to spot.
+	while (count > 0 && segments->iov_len == 0)
+	{
+		segments++;
+		count--;
+	}
+
+	while (mUring && count > 0)
+	{
+		if (!mConnected)
+		{
+			return -42;
+		}
+		if (mUring->error != 0)
+		{
+			cout << "Send failed " << mUring->error << " " << strerror(mUring->error) << endl;
+			mConnected = false;
+			mInvalid = true;
+			break;
+		}
+
+		// Staged here, and handed to the kernel with everything else sent
+		// this tick.
+		sent += mLoop->stage(mUring, segments, count);
+		if (count == 0)
+		{
+			break;
+		}
+
+		mWriteReady = false;
+		if (!block)
+		{
+			break;
+		}
 		checkForReady(POLLOUT, 30);
 		if (!mConnected)
 		{
 			return -42;
 		}
+		if (!mWriteReady)
+		{
+			break;
+		}
+	}
+	if (mUring)
+	{
+		return sent;
+	}
 
-		if (!mConnected || !mWriteReady)
+	while (count > 0)
+	{
+		if (!mConnected)
 		{
-			sent = -1;
+			return -42;
+		}
+
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = segments;
+		message.msg_iovlen = count < IOV_MAX ? count : IOV_MAX;
+
+		ssize_t ret = ::sendmsg(mSocket, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (ret == -1 && errno == EPIPE)
+		{
+			cout << "EPIPE encountered!" << endl;
+			mConnected = false;
+			mInvalid = true;
+			break;
+		}
+		else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			mWriteReady = false;
+			if (!block)
+			{
+				break;
+			}
+			checkForReady(POLLOUT, 30);
+			if (!mConnected)
+			{
+				return -42;
+			}
+			if (!mWriteReady)
+			{
+				break;
+			}
+			continue;
+		}
+		else if (ret == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno != ENOBUFS && errno != ENOMEM)
+			{
+				// Anything else leaves the connection unusable.
+				cout << "Send failed " << errno << " " << strerror(errno) << endl;
+				mConnected = false;
+				mInvalid = true;
+			}
 			break;
 		}
 
-		int ret = ::send(mSocket, buffer + sent, bufferLength - sent, flags);
+		sent += ret;
+
+		// Partial write; step over whatever made it out.
+		std::size_t written = ret;
+		while (count > 0 && written >= segments->iov_len)
+		{
+			written -= segments->iov_len;
+			segments++;
+			count--;
+		}
+		if (count > 0)
+		{
+			segments->iov_base = static_cast<char*>(segments->iov_base) + written;
+			segments->iov_len -= written;
+		}
+	}
+
+	return sent;
+}
+
+ssize_t Socket::sendFile(int fd, off_t& offset, std::size_t length, bool block)
+{
+	// Anything staged for io_uring has to reach the kernel first.
+	while (mUring && !mUring->outbound.empty())
+	{
+		if (!mConnected)
+		{
+			return -42;
+		}
+		mWriteReady = false;
+		if (!block)
+		{
+			return 0;
+		}
+		checkForReady(POLLOUT, 30);
+		if (!mWriteReady)
+		{
+			return 0;
+		}
+	}
+
+	SigPipeGuard guard;
+	ssize_t sent = 0;
+
+	while (std::size_t(sent) < length)
+	{
+		if (!mConnected)
+		{
+			return -42;
+		}
 
-		if (ret == EPIPE)
+		ssize_t ret = ::sendfile(mSocket, fd, &offset, length - sent);
+
+		if (ret == -1 && errno == EPIPE)
 		{
 			cout << "EPIPE encountered!" << endl;
 			mConnected = false;
 			mInvalid = true;
 			break;
 		}
+		else if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			mWriteReady = false;
+			if (!block)
+			{
+				break;
+			}
+			checkForReady(POLLOUT, 30);
+			if (!mConnected)
+			{
+				return -42;
+			}
+			if (!mWriteReady)
+			{
+				break;
+			}
+			continue;
+		}
+		else if (ret == -1 && errno != EINTR && sent == 0)
+		{
+			// Most likely not something sendfile can read from; the caller
+			// has to copy.
+			return -1;
+		}
 		else if (ret == -1)
 		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		else if (ret == 0)
+		{
+			// The file is shorter than promised.
 			break;
 		}
 
 		sent += ret;
-	} while (sent < bufferLength); 
+	}
 
 	return sent;
 }
@@ -296,36 +774,70 @@ void Socket::checkForReady(short events, int timeout)
 {
 	if (!mConnected)
 	{
-		cout << "HERER" << endl;
 		return;
 	}
 
-	int ret = -1;
-	pollfd pollInfo;
-	pollInfo.fd = mSocket;
-	pollInfo.events = events;
-	pollInfo.revents = 0;
+	// Sockets not owned by a reactor wait on this thread's private one.
+	if (mLoop == NULL && EventLoop::local().add(this, 0, EventLoop::ReadyCallback()) != 0)
+	{
+		mConnected = false;
+		return;
+	}
 
-	ret = poll(&pollInfo, 1, timeout);
-	mReceivedBytes = 0;
+	// Only the loop's own thread may epoll_wait on it; anyone else would race
+	// it for the loop's state.
+	int ret = mLoop->onLoopThread() ? mLoop->wait(*this, events, timeout) : pollForReady(events, timeout);
 
 	if (ret == -1)
 	{
-		cerr << "Error encountered: " << ret << ", errno: " << errno << strerror(errno) << endl;
 		mConnected = false;
 	}
 	else if (ret == 0 /* Socket timed out */)
 	{
 		mTimedout = true;
 	}
-	else if (mConnected)
+	else
 	{
 		mTimedout = false;
-		mInvalid = pollInfo.revents & POLLNVAL;
-		mReadReady = pollInfo.revents & POLLIN;
-		mReadyReadyOOB = pollInfo.revents & POLLPRI;
-		mWriteReady = pollInfo.revents & POLLOUT;
-		mConnected = !(pollInfo.revents & POLLHUP);
 	}
+}
 
+int Socket::pollForReady(short events, int timeout)
+{
+	pollfd descriptor;
+	descriptor.fd = mSocket;
+	descriptor.events = events;
+	descriptor.revents = 0;
+
+	int ret = ::poll(&descriptor, 1, timeout);
+	if (ret == -1)
+	{
+		if (errno == EINTR)
+		{
+			// Let the caller retry, as for a spurious wakeup.
+			return 1;
+		}
+		cerr << "Error encountered in ::poll " << errno << ", " << strerror(errno) << endl;
+		return -1;
+	}
+	else if (ret == 0)
+	{
+		return 0;
+	}
+
+	// Errors and hang-ups are reported by the call that follows, so they
+	// wake readers and writers alike.
+	if (descriptor.revents & (POLLIN | POLLHUP | POLLERR))
+	{
+		mReadReady = true;
+	}
+	if (descriptor.revents & POLLPRI)
+	{
+		mReadyReadyOOB = true;
+	}
+	if (descriptor.revents & (POLLOUT | POLLHUP | POLLERR))
+	{
+		mWriteReady = true;
+	}
+	return 1;
 }
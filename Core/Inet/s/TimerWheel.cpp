@@ -0,0 +1,254 @@
+#include "TimerWheel.h"
+
+#include <climits>
+#include <utility>
+
+namespace
+{
+	const uint16_t TIMER_UNLINKED = 0xFFFF;
+	const uint64_t TIMER_SLOT_MASK = TIMER_WHEEL_SLOTS - 1;
+
+	// Beyond this a timer simply sits in the last slot until it comes round.
+	const int64_t TIMER_WHEEL_SPAN = (int64_t(1) << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1;
+
+	uint64_t rotateRight(uint64_t value, unsigned count)
+	{
+		return count == 0 ? value : (value >> count) | (value << (64 - count));
+	}
+}
+
+TimerWheel::TimerWheel(int64_t now):
+	mNow(now),
+	mNodes(),
+	mFree(),
+	mCount(0)
+{
+	for (std::size_t i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++)
+	{
+		mSlots[i] = -1;
+	}
+	for (std::size_t i = 0; i < TIMER_WHEEL_LEVELS; i++)
+	{
+		mOccupied[i] = 0;
+	}
+}
+
+TimerHandle TimerWheel::schedule(int64_t delay, const Callback& callback, int64_t slack)
+{
+	int32_t index;
+	if (mFree.empty())
+	{
+		index = int32_t(mNodes.size());
+		mNodes.push_back(Node());
+		mNodes.back().generation = 0;
+	}
+	else
+	{
+		index = mFree.back();
+		mFree.pop_back();
+	}
+
+	// Nothing can be scheduled into the tick currently being fired.
+	delay = delay < 1 ? 1 : (delay > TIMER_WHEEL_SPAN ? TIMER_WHEEL_SPAN : delay);
+
+	Node& node = mNodes[index];
+	node.expiry = mNow + delay;
+	if (slack > 1)
+	{
+		// Round up to the largest power of two within the slack.
+		int64_t grain = int64_t(1) << (63 - __builtin_clzll(uint64_t(slack)));
+		node.expiry = (node.expiry + grain - 1) & ~(grain - 1);
+	}
+	node.callback = callback;
+	link(index);
+	mCount++;
+
+	return (TimerHandle(node.generation) << 32) | TimerHandle(uint32_t(index) + 1);
+}
+
+bool TimerWheel::cancel(TimerHandle timer)
+{
+	uint64_t position = timer & 0xFFFFFFFF;
+	if (position == 0 || position > mNodes.size())
+	{
+		return false;
+	}
+
+	int32_t index = int32_t(position - 1);
+	Node& node = mNodes[index];
+	if (node.generation != uint32_t(timer >> 32) || node.slot == TIMER_UNLINKED)
+	{
+		return false;
+	}
+
+	unlink(index);
+	node.callback = Callback();
+	node.generation++;
+	mFree.push_back(index);
+	mCount--;
+	return true;
+}
+
+std::size_t TimerWheel::advance(int64_t now)
+{
+	std::size_t fired = 0;
+	while (mNow < now)
+	{
+		// With the lowest levels empty nothing can happen before the next
+		// time one of the occupied levels has to cascade, so jump there.
+		unsigned empty = 0;
+		while (empty < TIMER_WHEEL_LEVELS && mOccupied[empty] == 0)
+		{
+			empty++;
+		}
+		if (empty == TIMER_WHEEL_LEVELS)
+		{
+			mNow = now;
+			break;
+		}
+		if (empty > 0)
+		{
+			int64_t span = int64_t(1) << (empty * TIMER_WHEEL_SLOT_BITS);
+			int64_t boundary = (mNow | (span - 1)) + 1;
+			if (boundary > now)
+			{
+				mNow = now;
+				break;
+			}
+			mNow = boundary - 1;
+		}
+
+		int64_t tick = ++mNow;
+		if ((tick & TIMER_SLOT_MASK) == 0)
+		{
+			cascade(1, tick);
+		}
+		fired += expire(tick);
+	}
+	return fired;
+}
+
+int64_t TimerWheel::timeout(int64_t now) const
+{
+	if (mCount == 0)
+	{
+		return -1;
+	}
+
+	int64_t next = LLONG_MAX;
+	for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++)
+	{
+		if (mOccupied[level] == 0)
+		{
+			continue;
+		}
+
+		// The first occupied slot after the current one is where the wheel
+		// next has work at this level: firing at level 0, cascading above.
+		unsigned shift = level * TIMER_WHEEL_SLOT_BITS;
+		int64_t position = (mNow >> shift) + 1;
+		uint64_t bits = rotateRight(mOccupied[level], unsigned(position & TIMER_SLOT_MASK));
+		int64_t tick = (position + __builtin_ctzll(bits)) << shift;
+		next = tick < next ? tick : next;
+	}
+
+	return next > now ? next - now : 0;
+}
+
+std::size_t TimerWheel::size(void) const
+{
+	return mCount;
+}
+
+void TimerWheel::link(int32_t index)
+{
+	Node& node = mNodes[index];
+	int64_t delta = node.expiry - mNow;
+
+	unsigned level = 0;
+	while (level + 1 < TIMER_WHEEL_LEVELS && delta >= (int64_t(1) << ((level + 1) * TIMER_WHEEL_SLOT_BITS)))
+	{
+		level++;
+	}
+
+	unsigned slot = unsigned((node.expiry >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_SLOT_MASK);
+	node.slot = uint16_t(level * TIMER_WHEEL_SLOTS + slot);
+	node.previous = -1;
+	node.next = mSlots[node.slot];
+	if (node.next != -1)
+	{
+		mNodes[node.next].previous = index;
+	}
+	mSlots[node.slot] = index;
+	mOccupied[level] |= uint64_t(1) << slot;
+}
+
+void TimerWheel::unlink(int32_t index)
+{
+	Node& node = mNodes[index];
+	if (node.previous != -1)
+	{
+		mNodes[node.previous].next = node.next;
+	}
+	else
+	{
+		mSlots[node.slot] = node.next;
+		if (node.next == -1)
+		{
+			mOccupied[node.slot / TIMER_WHEEL_SLOTS] &= ~(uint64_t(1) << (node.slot % TIMER_WHEEL_SLOTS));
+		}
+	}
+	if (node.next != -1)
+	{
+		mNodes[node.next].previous = node.previous;
+	}
+	node.slot = TIMER_UNLINKED;
+}
+
+void TimerWheel::cascade(unsigned level, int64_t tick)
+{
+	if (level >= TIMER_WHEEL_LEVELS)
+	{
+		return;
+	}
+
+	unsigned slot = unsigned((tick >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_SLOT_MASK);
+	if (slot == 0)
+	{
+		// The level above moves down first, possibly into this very slot.
+		cascade(level + 1, tick);
+	}
+
+	// Everything here expires within this slot's span, so it now belongs on
+	// a lower level.
+	unsigned head = level * TIMER_WHEEL_SLOTS + slot;
+	while (mSlots[head] != -1)
+	{
+		int32_t index = mSlots[head];
+		unlink(index);
+		link(index);
+	}
+}
+
+std::size_t TimerWheel::expire(int64_t tick)
+{
+	std::size_t fired = 0;
+	unsigned head = unsigned(tick & TIMER_SLOT_MASK);
+	while (mSlots[head] != -1)
+	{
+		int32_t index = mSlots[head];
+		unlink(index);
+
+		// The callback may schedule timers, and so move mNodes; it must not
+		// hold a reference into it.
+		Callback callback = std::move(mNodes[index].callback);
+		mNodes[index].callback = Callback();
+		mNodes[index].generation++;
+		mFree.push_back(index);
+		mCount--;
+
+		callback();
+		fired++;
+	}
+	return fired;
+}
@@ -0,0 +1,429 @@
+#include "Uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+namespace
+{
+	template<typename T>
+	T loadAcquire(const T* value)
+	{
+		return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+	}
+
+	template<typename T>
+	void storeRelease(T* destination, T value)
+	{
+		__atomic_store_n(destination, value, __ATOMIC_RELEASE);
+	}
+
+	void* mapRing(int ring, std::size_t length, off_t offset)
+	{
+		void* mapping = ::mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, offset);
+		if (mapping == MAP_FAILED)
+		{
+			cerr << "Unable to map io_uring " << errno << " " << strerror(errno) << endl;
+			throw "Uring::Uring failed";
+		}
+		return mapping;
+	}
+}
+
+Uring::Uring(unsigned entries, bool registerFiles):
+	mRing(-1),
+	mEntries(0),
+	mSqMapping(MAP_FAILED),
+	mSqMappingLength(0),
+	mCqMapping(MAP_FAILED),
+	mCqMappingLength(0),
+	mSqes(NULL),
+	mSqesLength(0),
+	mSqHead(NULL),
+	mSqTail(NULL),
+	mSqMask(0),
+	mSqLocalTail(0),
+	mSqSubmitted(0),
+	mCqHead(NULL),
+	mCqTail(NULL),
+	mCqMask(0),
+	mCqes(NULL),
+	mBufferRing(NULL),
+	mBufferRingLength(0),
+	mBuffers(NULL),
+	mBufferTail(0),
+	mFixedFiles(false),
+	mRegistered()
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	mRing = int(::syscall(__NR_io_uring_setup, entries, &params));
+	if (mRing == -1)
+	{
+		cerr << "Unable to set up io_uring " << errno << " " << strerror(errno) << endl;
+		throw "Uring::Uring failed";
+	}
+
+	try
+	{
+		mEntries = params.sq_entries;
+		mSqMappingLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		mCqMappingLength = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			mSqMappingLength = mSqMappingLength > mCqMappingLength ? mSqMappingLength : mCqMappingLength;
+			mSqMapping = mapRing(mRing, mSqMappingLength, IORING_OFF_SQ_RING);
+			mCqMapping = mSqMapping;
+			mCqMappingLength = 0;
+		}
+		else
+		{
+			mSqMapping = mapRing(mRing, mSqMappingLength, IORING_OFF_SQ_RING);
+			mCqMapping = mapRing(mRing, mCqMappingLength, IORING_OFF_CQ_RING);
+		}
+		mSqesLength = params.sq_entries * sizeof(io_uring_sqe);
+		mSqes = static_cast<io_uring_sqe*>(mapRing(mRing, mSqesLength, IORING_OFF_SQES));
+
+		uint8_t* sq = static_cast<uint8_t*>(mSqMapping);
+		mSqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		mSqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		mSqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		mSqLocalTail = *mSqTail;
+		mSqSubmitted = mSqLocalTail;
+
+		// Submission slots map one to one onto the entries array.
+		unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		for (unsigned i = 0; i < params.sq_entries; i++)
+		{
+			array[i] = i;
+		}
+
+		uint8_t* cq = static_cast<uint8_t*>(mCqMapping);
+		mCqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		mCqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		mCqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		mCqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		// The buffer ring is shared with the kernel and must be page aligned.
+		mBufferRingLength = URING_BUFFER_COUNT * sizeof(io_uring_buf);
+		void* ring = ::mmap(NULL, mBufferRingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		void* buffers = ::mmap(NULL, URING_BUFFER_COUNT * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		mBufferRing = ring == MAP_FAILED ? NULL : static_cast<io_uring_buf_ring*>(ring);
+		mBuffers = buffers == MAP_FAILED ? NULL : static_cast<uint8_t*>(buffers);
+		if (mBufferRing == NULL || mBuffers == NULL)
+		{
+			cerr << "Unable to allocate io_uring buffers " << errno << " " << strerror(errno) << endl;
+			throw "Uring::Uring failed";
+		}
+
+		io_uring_buf_reg registration;
+		memset(&registration, 0, sizeof(registration));
+		registration.ring_addr = reinterpret_cast<uint64_t>(mBufferRing);
+		registration.ring_entries = URING_BUFFER_COUNT;
+		registration.bgid = URING_BUFFER_GROUP;
+		if (::syscall(__NR_io_uring_register, mRing, IORING_REGISTER_PBUF_RING, &registration, 1) == -1)
+		{
+			cerr << "Unable to register io_uring buffer ring " << errno << " " << strerror(errno) << endl;
+			throw "Uring::Uring failed";
+		}
+		for (unsigned i = 0; i < URING_BUFFER_COUNT; i++)
+		{
+			recycle(uint16_t(i));
+		}
+
+		if (registerFiles)
+		{
+			std::vector<int> files(URING_FIXED_FILES, -1);
+			if (::syscall(__NR_io_uring_register, mRing, IORING_REGISTER_FILES, files.data(), unsigned(files.size())) == -1)
+			{
+				// Registered files are an optimisation; carry on without them.
+				cerr << "Unable to register io_uring file table " << errno << " " << strerror(errno) << endl;
+			}
+			else
+			{
+				mFixedFiles = true;
+				mRegistered.resize(URING_FIXED_FILES, false);
+			}
+		}
+	}
+	catch (...)
+	{
+		release();
+		throw;
+	}
+}
+
+Uring::~Uring(void)
+{
+	release();
+}
+
+void Uring::release(void)
+{
+	if (mRing != -1)
+	{
+		::close(mRing);
+		mRing = -1;
+	}
+	if (mBuffers)
+	{
+		::munmap(mBuffers, URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+		mBuffers = NULL;
+	}
+	if (mBufferRing)
+	{
+		::munmap(mBufferRing, mBufferRingLength);
+		mBufferRing = NULL;
+	}
+	if (mSqes)
+	{
+		::munmap(mSqes, mSqesLength);
+		mSqes = NULL;
+	}
+	if (mCqMapping != MAP_FAILED && mCqMapping != mSqMapping)
+	{
+		::munmap(mCqMapping, mCqMappingLength);
+	}
+	mCqMapping = MAP_FAILED;
+	if (mSqMapping != MAP_FAILED)
+	{
+		::munmap(mSqMapping, mSqMappingLength);
+		mSqMapping = MAP_FAILED;
+	}
+}
+
+bool Uring::supported(void)
+{
+	static const bool oSupported = probe();
+	return oSupported;
+}
+
+int Uring::descriptor(void) const
+{
+	return mRing;
+}
+
+io_uring_sqe* Uring::next(void)
+{
+	if (mSqLocalTail - loadAcquire(mSqHead) >= mEntries)
+	{
+		if (submit() <= 0)
+		{
+			return NULL;
+		}
+	}
+
+	io_uring_sqe* sqe = &mSqes[mSqLocalTail & mSqMask];
+	mSqLocalTail++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+void Uring::target(io_uring_sqe* sqe, int fd) const
+{
+	sqe->fd = fd;
+	if (mFixedFiles && fd >= 0 && unsigned(fd) < URING_FIXED_FILES && mRegistered[fd])
+	{
+		// The table is indexed by descriptor.
+		sqe->flags |= IOSQE_FIXED_FILE;
+	}
+}
+
+int Uring::submit(bool wait)
+{
+	unsigned count = mSqLocalTail - mSqSubmitted;
+	if (count == 0 && !wait)
+	{
+		return 0;
+	}
+
+	storeRelease(mSqTail, mSqLocalTail);
+	int ret = enter(count, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+	if (ret < 0)
+	{
+		return -1;
+	}
+	mSqSubmitted += unsigned(ret);
+	return ret;
+}
+
+std::size_t Uring::queued(void) const
+{
+	return mSqLocalTail - mSqSubmitted;
+}
+
+io_uring_cqe* Uring::peek(void)
+{
+	unsigned head = *mCqHead;
+	if (head == loadAcquire(mCqTail))
+	{
+		return NULL;
+	}
+	return &mCqes[head & mCqMask];
+}
+
+void Uring::seen(void)
+{
+	storeRelease(mCqHead, *mCqHead + 1);
+}
+
+uint8_t* Uring::buffer(uint16_t id)
+{
+	return mBuffers + std::size_t(id) * URING_BUFFER_SIZE;
+}
+
+void Uring::recycle(uint16_t id)
+{
+	// Index the ring directly; in C++ the header's flexible bufs member does
+	// not start at offset 0 as it does for the kernel.
+	io_uring_buf* entry = reinterpret_cast<io_uring_buf*>(mBufferRing) + (mBufferTail & (URING_BUFFER_COUNT - 1));
+	entry->addr = reinterpret_cast<uint64_t>(buffer(id));
+	entry->len = URING_BUFFER_SIZE;
+	entry->bid = id;
+	mBufferTail++;
+	storeRelease(&mBufferRing->tail, mBufferTail);
+}
+
+int Uring::registerFile(int fd)
+{
+	if (!mFixedFiles || fd < 0 || unsigned(fd) >= URING_FIXED_FILES)
+	{
+		return -1;
+	}
+	if (update(fd, fd) != 0)
+	{
+		return -1;
+	}
+	mRegistered[fd] = true;
+	return 0;
+}
+
+void Uring::unregisterFile(int fd)
+{
+	if (!mFixedFiles || fd < 0 || unsigned(fd) >= URING_FIXED_FILES || !mRegistered[fd])
+	{
+		return;
+	}
+	update(fd, -1);
+	mRegistered[fd] = false;
+}
+
+bool Uring::probe(void)
+{
+	Uring* ring = NULL;
+	int pair[2] = {-1, -1};
+	bool supported = false;
+
+	try
+	{
+		ring = new Uring(8);
+
+		std::vector<uint8_t> probe(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+		io_uring_probe* ops = reinterpret_cast<io_uring_probe*>(probe.data());
+		if (::syscall(__NR_io_uring_register, ring->mRing, IORING_REGISTER_PROBE, ops, 256) == -1)
+		{
+			throw "Uring::probe failed";
+		}
+		const uint8_t required[] = {IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_ASYNC_CANCEL};
+		for (std::size_t i = 0; i < sizeof(required); i++)
+		{
+			if (required[i] > ops->last_op || !(ops->ops[required[i]].flags & IO_URING_OP_SUPPORTED))
+			{
+				throw "Uring::probe failed";
+			}
+		}
+
+		// Multishot receive cannot be probed for; try it.
+		if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1 || ::write(pair[0], "x", 1) != 1)
+		{
+			throw "Uring::probe failed";
+		}
+		io_uring_sqe* sqe = ring->next();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = pair[1];
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BUFFER_GROUP;
+		if (ring->submit(true) != 1)
+		{
+			throw "Uring::probe failed";
+		}
+		io_uring_cqe* cqe = ring->peek();
+		supported = cqe && cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE) && (cqe->flags & IORING_CQE_F_BUFFER);
+	}
+	catch (...)
+	{
+		supported = false;
+	}
+
+	if (pair[0] != -1)
+	{
+		::close(pair[0]);
+		::close(pair[1]);
+	}
+	delete ring;
+	return supported;
+}
+
+int Uring::enter(unsigned submit, unsigned complete, unsigned flags)
+{
+	while (true)
+	{
+		int ret = int(::syscall(__NR_io_uring_enter, mRing, submit, complete, flags, NULL, 0));
+		if (ret == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (ret == -1)
+		{
+			cerr << "Error encountered in io_uring_enter " << errno << ", " << strerror(errno) << endl;
+		}
+		return ret;
+	}
+}
+
+int Uring::update(int fd, int value)
+{
+	io_uring_files_update files;
+	memset(&files, 0, sizeof(files));
+	files.offset = unsigned(fd);
+	files.fds = reinterpret_cast<uint64_t>(&value);
+	if (::syscall(__NR_io_uring_register, mRing, IORING_REGISTER_FILES_UPDATE, &files, 1) != 1)
+	{
+		cerr << "Unable to update io_uring file table " << errno << " " << strerror(errno) << endl;
+		return -1;
+	}
+	return 0;
+}
+
+UringSocket::UringSocket(Socket* owner, int descriptor):
+	socket(owner),
+	fd(descriptor),
+	received(),
+	outbound(URING_SEND_BUFFER),
+	message(),
+	segments(),
+	sending(0),
+	receiving(false),
+	queued(false),
+	error(0),
+	closed(false),
+	owned(false),
+	linger(TIMER_NONE)
+{
+	// empty
+}
+
+UringSocket::~UringSocket(void)
+{
+	if (owned)
+	{
+		::close(fd);
+	}
+}
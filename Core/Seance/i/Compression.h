@@ -0,0 +1,151 @@
+#ifndef __SEANCE_COMPRESSION_H
+#define __SEANCE_COMPRESSION_H
+
+#include "ExtensionTable.h"
+#include "Frame.h"
+#include "FrameView.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// "SEANCEZ1"
+const uint64_t COMPRESSION_EXTENSION_ID = 0x5345414e43455a31ULL;
+
+// Payloads shorter than this are not worth compressing.
+const std::size_t COMPRESSION_THRESHOLD = 256;
+
+// Longest payload a frame may be compressed from, or decompress to; a peer
+// claiming more is refused rather than buffered.
+const uint32_t COMPRESSION_LENGTH_MAX = 1024 * 1024;
+
+// Decompression space kept between frames; more is released after use.
+const std::size_t COMPRESSION_RETAINED_LENGTH = 64 * 1024;
+
+// Codec, original opcode, dictionary ID and original length, after the
+// extension ID.
+const std::size_t COMPRESSION_HEADER_LENGTH = 1 + 1 + 4 + 4;
+
+enum CompressionCodec
+{
+	COMPRESSION_LZ = 0,     // Built in; see LZ.
+	COMPRESSION_DEFLATE = 1 // Raw deflate, if built with zlib.
+};
+
+struct CompressionStats
+{
+	uint64_t compressed;        // Frames sent compressed.
+	uint64_t skipped;           // Frames sent as they were: short, or incompressible.
+	uint64_t bytesIn;           // Payload bytes before compression.
+	uint64_t bytesOut;          // Payload bytes after compression.
+	uint64_t decompressed;      // Frames received compressed.
+	uint64_t failures;          // Received frames which would not decompress.
+	uint64_t compressNanos;     // Thread CPU time spent compressing.
+	uint64_t decompressNanos;   // Thread CPU time spent decompressing.
+};
+
+/**
+ * The compression extension's state for one connection (see
+ * Seance::compression): the codec's contexts and scratch buffers, kept and
+ * reused from frame to frame so that nothing is allocated per frame beyond
+ * the compressed frame itself.
+ *
+ * A compressed frame is an extension frame (0x3) for COMPRESSION_EXTENSION_ID
+ * with the original's Message ID, response ID and mask; after the extension
+ * ID its Payload is the codec (1 byte), the original opcode (1 byte), the
+ * dictionary ID (4 bytes; the CRC32 of the dictionary, or 0 for none), the
+ * original Payload Length (4 bytes) and then the compressed Payload. Every
+ * frame is compressed on its own, against the connection's dictionary if it
+ * has one, so frames can be replayed or reordered freely.
+ *
+ * The extension is enabled by negotiating COMPRESSION_EXTENSION_ID (0xB) on
+ * a connection whose table offers it. Both ends should set the same
+ * dictionary.
+ */
+class Compression
+{
+public:
+	Compression(CompressionCodec codec = COMPRESSION_LZ, std::size_t threshold = COMPRESSION_THRESHOLD);
+	Compression(const Compression& source) = delete;
+	~Compression(void);
+
+	/**
+	 * Whether codec was built in.
+	 */
+	static bool available(CompressionCodec codec);
+
+	/**
+	 * Offer the extension in table. Connections which receive compressed
+	 * frames without a Compression of their own are given a default one.
+	 */
+	static void offer(ExtensionTable& table);
+
+	/**
+	 * Compress every frame against the (at most LZ_WINDOW) last bytes of
+	 * data, which both ends must agree on; typically text common to many
+	 * messages. Pass no data to stop using one.
+	 */
+	void dictionary(const uint8_t* data = NULL, std::size_t length = 0);
+	uint32_t dictionaryID(void) const;
+
+	/**
+	 * The compressed version of frame, or frame itself if it is too short,
+	 * too long (see maxLength), not in memory, or would not get any shorter.
+	 */
+	std::shared_ptr<Frame> compress(const std::shared_ptr<Frame>& frame);
+
+	/**
+	 * Decompress the length bytes of data carried by frame (after the
+	 * extension ID) into a view of the original frame. The view's payload is
+	 * only valid until the next call. Returns false if it would not
+	 * decompress, or claims to be longer than maxLength.
+	 */
+	bool decompress(const FrameView& frame, const uint8_t* data, uint64_t length, FrameView& original);
+
+	CompressionCodec codec(void) const;
+	std::size_t threshold(void) const;
+	void threshold(std::size_t threshold);
+
+	/**
+	 * The longest payload compressed or decompressed; both ends should agree.
+	 */
+	uint32_t maxLength(void) const;
+	void maxLength(uint32_t maxLength);
+
+	/**
+	 * Compressed bytes over uncompressed bytes, for the frames compressed so
+	 * far; 1 before any.
+	 */
+	double ratio(void) const;
+	const CompressionStats& stats(void) const;
+private:
+	std::size_t deflate(const uint8_t* data, std::size_t length, uint8_t* out, std::size_t capacity);
+	bool inflate(const uint8_t* data, std::size_t length, uint8_t* out, std::size_t capacity);
+
+	CompressionCodec mCodec;
+	std::size_t mThreshold;
+	uint32_t mMaxLength;
+	std::vector<uint8_t> mDictionary;
+	uint32_t mDictionaryID;
+
+	// The LZ tables: primed for the dictionary, and a working copy.
+	std::vector<uint32_t> mPrimed;
+	std::vector<uint32_t> mTable;
+
+	// The dictionary followed by the data being compressed, for LZ.
+	std::vector<uint8_t> mInput;
+	std::vector<uint8_t> mCompressed;
+
+	// The dictionary followed by the data decompressed; shrunk back to
+	// COMPRESSION_RETAINED_LENGTH after a longer frame.
+	std::vector<uint8_t> mOutput;
+
+	// zlib streams, if built with zlib.
+	void* mDeflate;
+	void* mInflate;
+
+	CompressionStats mStats;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef __SEANCE_EXTENSION_TABLE_H
+#define __SEANCE_EXTENSION_TABLE_H
+
+#include "FrameView.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+class Seance;
+
+// Extension IDs, and whether each is (to be) enabled; as a 0xB frame carries.
+typedef std::vector<std::pair<uint64_t, bool> > ExtensionChanges;
+
+// The extensions enabled on one connection, by extension ID.
+typedef std::set<uint64_t> ExtensionSet;
+
+// Each 0xB record is an extension ID and a flag.
+const std::size_t EXTENSION_RECORD_LENGTH = 8 + 1;
+
+/**
+ * The extensions on offer to one or more connections, by extension ID, for
+ * dispatching extension frames (0x3) to their handlers.
+ *
+ * Which of them are enabled is up to each connection, normally by
+ * negotiation (0xB), and kept in its own ExtensionSet; the table only says
+ * what may be enabled and how each is handled. Each offer or withdrawal
+ * publishes a new version of the table by read-copy-update (see Rcu), so
+ * dispatch() takes no locks and is never held up by a change: a table can be
+ * shared by connections on every loop of an EventLoopGroup without them
+ * noticing more than the new version. Old versions are reclaimed once no
+ * dispatch can still be using them.
+ */
+class ExtensionTable
+{
+public:
+	/**
+	 * Called with the Payload following the extension ID.
+	 */
+	typedef std::function<void(Seance& seance, FrameView& frame, const uint8_t* data, uint64_t length)> Handler;
+
+	ExtensionTable(void);
+	ExtensionTable(const ExtensionTable& source) = delete;
+
+	/**
+	 * No dispatch() may still be running.
+	 */
+	~ExtensionTable(void);
+
+	/**
+	 * Make an extension available to enable. Offering one again replaces its
+	 * handler. Withdrawing one disables it everywhere it is enabled.
+	 */
+	void offer(uint64_t id, const Handler& handler);
+	void withdraw(uint64_t id);
+	bool offered(uint64_t id) const;
+
+	/**
+	 * Enable or disable extensions in one connection's set. Extensions which
+	 * are not on offer stay disabled. result, if given, receives each ID with
+	 * whether it is enabled afterwards.
+	 */
+	void apply(const ExtensionChanges& changes, ExtensionSet& enabled, ExtensionChanges* result = NULL) const;
+
+	/**
+	 * Hand frame, whose Payload starts with the extension ID, to that
+	 * extension's handler. Returns false if it is not in enabled, or no
+	 * longer on offer. Lock free; safe from any thread.
+	 */
+	bool dispatch(Seance& seance, FrameView& frame, const ExtensionSet& enabled);
+	bool enabled(const ExtensionSet& enabled, uint64_t id) const;
+
+	/**
+	 * Extensions on offer.
+	 */
+	std::size_t size(void) const;
+
+	/**
+	 * Versions published so far.
+	 */
+	uint64_t version(void) const;
+private:
+	struct Extension
+	{
+		uint64_t id;
+		Handler handler;
+	};
+
+	// Sorted by ID. Never changed once published.
+	struct Version
+	{
+		uint64_t number;
+		std::vector<Extension> extensions;
+	};
+
+	static const Extension* find(const Version& version, uint64_t id);
+	void publish(Version* next);
+
+	std::atomic<const Version*> mCurrent;
+	std::mutex mWriteLock;
+};
+
+#endif
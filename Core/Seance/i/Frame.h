@@ -1,7 +1,15 @@
 #ifndef __SEANCE_FRAME_H
 #define __SEANCE_FRAME_H
 
+#include <sys/types.h>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
+
+class ParallelCRC;
+class Socket;
+class WorkerPool;
 
 /**
  * NOTE - All values are in network-byte-order and MUST be properly converted to
@@ -52,6 +60,8 @@
  *     length as an unsigned 64-bit value.
  *
  * Extended Length: Unsigned 64-bit value, only present if Length == 65535.
+ *     Must be at least 65535; a shorter payload must use Length instead, and
+ *     frames that do not are rejected as malformed.
  *
  * Message ID: Unsigned 32-bit value specifying a unique identifier for the
  *     message that has been sent. Message IDs _must_ be monotonically
@@ -72,7 +82,8 @@
  * CRC32: The 32-bit CRC of the payload and header combined (with the CRC32
  *     section being all zeroes during the CRC generation). _Must_ always be
  *     present. See [ISO 3309] for the CRC specification, or [RFC 1952] for a
- *     reference implementation.
+ *     reference implementation. The header is covered exactly as it appears
+ *     on the wire, and the payload is covered _before_ masking is applied.
  *
  * Payload Data: Length, or Extended Length bytes long. The Payload Data's
  *     purpose is determined by the opcode provided, and may be outside this
@@ -147,7 +158,15 @@
  * Continuation frames are used to continue a previously started frame if, for
  * instance, not all data was ready to send when the original frame was sent.
  * This may frequently be the case in streaming applications where only a small
- * buffer of data is sent at a time.
+ * buffer of data is sent at a time, or when a long message is split up so that
+ * other messages need not wait behind it.
+ *
+ * A message is its first frame, which carries the opcode (and the Response to
+ * Message ID, if any) and has FIN clear, followed by continuation frames up to
+ * and including one with FIN set; the message goes by its first frame's
+ * Message ID. Only one message may be part way through at a time, but control
+ * frames and whole messages (a single frame with FIN set) may be sent between
+ * its frames.
  *
  * ----------------------------------------------------------------------------
  * Text Frames
@@ -170,6 +189,32 @@
  * forwarded Payload (in bytes - Payload Length minus 8 bytes).
  *
  * ----------------------------------------------------------------------------
+ * Negotiating Extensions
+ *
+ * Either side may enable or disable extensions at any time, by sending a 0xB
+ * frame whose Payload is a list of 9 byte records: an 8 byte extension ID
+ * followed by 1 byte, 1 to enable that extension or 0 to disable it. The
+ * other side applies what it can (it cannot enable extensions it does not
+ * support) and answers with a 0xB response listing the same extension IDs,
+ * each now followed by 1 if the extension is enabled or 0 if it is not.
+ * Extension frames for an extension which is not enabled are not dispatched
+ * to it.
+ *
+ * ----------------------------------------------------------------------------
+ * Semi-persistent Sessions
+ *
+ * A session outlives its connection. To establish or rejoin one, either side
+ * sends a 0xA frame whose Payload is the 8 byte session ID followed by the 4
+ * byte Message ID of the last message it received from the other side in
+ * that session (the other side's first Message ID minus one, wrapping within
+ * its half, if none). The other side resends every message it sent after that
+ * one, with their original Message IDs, and then answers with a 0xA response
+ * whose Payload is a 1 byte status (0 if the session was resumed, 1 if it
+ * must be resynchronised from scratch) followed by the 4 byte Message ID of
+ * the last message _it_ received, so that the initiator can do the same.
+ * Message IDs carry on from where the session left off.
+ *
+ * ----------------------------------------------------------------------------
  * Version Strings:
  *
  * The Seance protocol stores version strings as an eight byte value consisting
@@ -188,16 +233,54 @@
 
 const uint16_t FRAME_LENGTH_MAX = 65535;
 
+// Flags, opcode, length, extended length, message ID, response ID, mask, CRC.
+const std::size_t FRAME_HEADER_LENGTH_MAX = 4 + 8 + 4 + 4 + 4 + 4;
+
+// Payloads at least this long are CRCed on a WorkerPool, if one is given; a
+// piece (see ParallelCRC) at a time as the payload arrives. Kept below
+// FRAME_BUFFERED_LENGTH_MAX so that it applies with the default limits.
+const uint64_t FRAME_PARALLEL_CRC_THRESHOLD = 4 * 1024 * 1024;
+
+// Payloads at least this long are streamed to a sink, if one is given.
+const uint64_t FRAME_STREAM_THRESHOLD = 1024 * 1024;
+
+// Masked payloads are streamed through a scratch buffer this size.
+const std::size_t FRAME_STREAM_CHUNK = 64 * 1024;
+
+// Masked payloads are masked into a scratch buffer this size at a time when
+// sent, as the frame keeps its own copy unmasked.
+const std::size_t FRAME_MASK_CHUNK = 16 * 1024;
+
+// Milliseconds a frame being sent with operator<< may go without any of it
+// being taken by the peer before the send gives up.
+const int FRAME_SEND_TIMEOUT = 5000;
+
+// Longest payload which will be buffered whole by default; anything longer
+// must stream, or the limit be raised, so one header cannot make a connection
+// allocate more than this. Comfortably above the largest fragment Seance
+// sends (see FrameScheduler).
+const uint64_t FRAME_BUFFERED_LENGTH_MAX = 8 * 1024 * 1024;
+
 union FrameHeader
 {
 public:
 	uint8_t fullHeader[4];
 	struct
 	{
+		// Bit-fields are allocated from the least significant bit on
+		// little-endian targets, so list them backwards to keep FIN as the
+		// most significant bit on the wire.
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		uint8_t  RSV:5, // Reserved
+			     MASK:1, // If a mask exists on the payload.
+			     RSP:1, // Response to previous message.
+			     FIN:1; // Final frame in message.
+#else
 		uint8_t  FIN:1, // Final frame in message.
 			     RSP:1, // Response to previous message.
 			     MASK:1, // If a mask exists on the payload.
 			     RSV:5; // Reserved
+#endif
 		uint8_t  Opcode; // Operation.
 		uint16_t Length; // Length, if < 65535
 	} headerParts __attribute__((packed));
@@ -206,22 +289,137 @@ public:
 class Frame
 {
 public:
+	/**
+	 * Receives a streamed payload a piece at a time, already unmasked. The
+	 * data is only valid for the duration of the call. On the final piece
+	 * verified says whether the CRC over the whole frame matched.
+	 */
+	typedef std::function<void(const Frame& frame, const uint8_t* data, std::size_t length, bool final, bool verified)> PayloadSink;
+
 	/**
 	 * Frame constructor. It is expected that the FrameHeader is being passed in
 	 * RAW (in network byte order, and untouched) as the Frame will take care of
 	 * byte-order swapping where necessary.
 	 */
 	Frame(const FrameHeader& header);
+	Frame(const Frame& source) = delete;
 	~Frame(void);
 
-	void write(const uint8_t* buffer, std::size_t length);
+	/**
+	 * Feed raw frame bytes (everything after the FrameHeader) into the frame.
+	 * Returns the number of bytes consumed, which will be less than length if
+	 * the buffer holds the start of the next frame as well. Once the payload
+	 * is complete it is unmasked and the CRC verified.
+	 */
+	std::size_t write(const uint8_t* buffer, std::size_t length);
+	bool complete(void) const;
+
+	/**
+	 * CRC the payload in chunks on pool, as it arrives, if it turns out to be
+	 * at least threshold bytes long. Must be called before the header is
+	 * complete.
+	 */
+	void parallelVerification(WorkerPool* pool, uint64_t threshold = FRAME_PARALLEL_CRC_THRESHOLD);
+
+	/**
+	 * Hand payloads of at least threshold bytes to sink as they arrive rather
+	 * than buffering them, so memory use does not depend on the frame's
+	 * declared length. A streamed frame has no payload() and is never
+	 * verified in parallel. If the CRC does not match, the final piece is
+	 * delivered unverified and write() then throws as usual. Must be called
+	 * before the header is complete.
+	 */
+	void stream(const PayloadSink& sink, uint64_t threshold = FRAME_STREAM_THRESHOLD);
+	bool streaming(void) const;
+
+	/**
+	 * Refuse (throw from write()) payloads longer than maxLength which would
+	 * have to be buffered whole.
+	 */
+	void maxLength(uint64_t maxLength);
+
+	/**
+	 * A PayloadSink which writes every piece to fd, throwing if it cannot, or
+	 * if the payload (all written by then) turns out to fail its CRC.
+	 */
+	static PayloadSink descriptorSink(int fd);
+
+	const FrameHeader& header(void) const;
+	uint8_t opcode(void) const;
 
 	uint64_t size(void) const;
 	void size(uint64_t newSize);
 
+	uint32_t messageID(void) const;
+	void messageID(uint32_t id);
+
+	uint32_t respondingTo(void) const;
+	void respondingTo(uint32_t id);
+
+	uint32_t mask(void) const;
+	void mask(uint32_t key);
+
+	uint32_t crc(void) const;
+
+	const uint8_t* payload(void) const;
+	uint8_t* payload(void);
+
+	/**
+	 * Back the payload with length bytes of fd, starting at offset, instead
+	 * of memory. The CRC is taken over a read-only mapping of the file and an
+	 * unmasked payload is sent with sendfile(), so it never passes through
+	 * user space. fd must stay open, and the range unchanged, until the frame
+	 * has been sent; payload() is NULL for such frames.
+	 */
+	void file(int fd, off_t offset, uint64_t length);
+	int file(void) const;
+	off_t fileOffset(void) const;
+
+	/**
+	 * Use length bytes of source's payload, starting offset bytes in, as
+	 * this frame's payload, without copying it (file-backed sources are
+	 * sliced as files). source is kept alive, and must not change, for as
+	 * long as this frame is.
+	 */
+	void slice(const std::shared_ptr<const Frame>& source, uint64_t offset, uint64_t length);
+
+	/**
+	 * Copy length unmasked payload bytes, starting offset bytes in, into
+	 * buffer; from memory or from the backing file.
+	 */
+	void copyPayload(uint8_t* buffer, uint64_t offset, std::size_t length) const;
+
+	/**
+	 * Write the wire header for this frame, with the CRC field zeroed, into
+	 * buffer (which must hold FRAME_HEADER_LENGTH_MAX bytes). Returns the
+	 * header length.
+	 */
+	std::size_t encodeHeader(uint8_t* buffer) const;
+	uint32_t calculateCRC(void) const;
+
+	/**
+	 * As encodeHeader, but with the CRC (over the header and the unmasked
+	 * payload) filled in; ready to go on the wire ahead of the payload.
+	 */
+	std::size_t encode(uint8_t* buffer) const;
+
+	/**
+	 * Send the frame. The header is built on the stack and goes out together
+	 * with the payload in a single gather write; unmasked payloads are never
+	 * copied. File-backed payloads follow the header with sendfile(), falling
+	 * back to reading the file only if it cannot be used with sendfile().
+	 * Short writes are carried on from, waiting for the socket to drain, until
+	 * the frame has gone in full. This blocks for as long as the peer keeps
+	 * taking data, and throws if the connection fails first or nothing is
+	 * taken for FRAME_SEND_TIMEOUT; the socket is of no further use after
+	 * either, as the frame is left cut short.
+	 */
 	// FIXME - Can we get this to not depend on the socket code?
 	friend Socket& operator<<(Socket& sock, const Frame& frame);
 private:
+	uint32_t payloadCRC(uint32_t crc) const;
+	void releasePayload(void);
+
 	FrameHeader mHeader;
 	uint64_t mLength;
 	uint32_t mMessageID;
@@ -229,7 +427,19 @@ private:
 	uint32_t mMask;
 	uint32_t mCRC;
 	uint8_t* mPayload;
+	int mFile;
+	off_t mFileOffset;
+	std::shared_ptr<const Frame> mSource; // Owns the payload, if sliced.
 
+	uint32_t mRunningCRC;
+	WorkerPool* mVerificationPool;
+	uint64_t mParallelThreshold;
+	ParallelCRC* mParallelCRC;
+	PayloadSink mSink;
+	uint64_t mStreamThreshold;
+	uint64_t mMaxLength;
+	uint8_t* mScratch;
+	bool mStreaming;
 	bool mLengthSet;
 	uint8_t mLengthBytesWritten;
 	uint8_t mMessageIDBytesWritten;
@@ -0,0 +1,69 @@
+#ifndef __SEANCE_FRAME_READER_H
+#define __SEANCE_FRAME_READER_H
+
+#include "Frame.h"
+#include "FrameView.h"
+#include "Socket.h"
+
+#include <functional>
+
+/**
+ * Splits a stream of received bytes into frames. Frames which are entirely
+ * inside the buffer handed to read() are decoded in place as FrameViews; only
+ * a frame which straddles the end of the buffer is copied, through the
+ * incremental Frame::write path, and delivered once the rest of it arrives.
+ *
+ * Every delivered frame has been unmasked and had its CRC verified. Frames
+ * long enough to be streamed (see stream()) go to the sink instead of the
+ * callback, and never through the in-place path.
+ */
+class FrameReader
+{
+public:
+	typedef std::function<void(FrameView& frame)> FrameCallback;
+
+	FrameReader(const FrameCallback& callback);
+	FrameReader(const FrameReader& source) = delete;
+	~FrameReader(void);
+
+	/**
+	 * Consume all of buffer, returning the number of frames delivered. Throws
+	 * on malformed frames and CRC mismatches.
+	 */
+	std::size_t read(uint8_t* buffer, std::size_t length);
+
+	/**
+	 * Read and parse everything the socket has, waiting up to timeout
+	 * milliseconds for the first of it if there is none. Returns the number
+	 * of frames delivered, or -1 on error.
+	 */
+	int receive(Socket& socket, int timeout = 30);
+
+	bool partial(void) const;
+
+	/**
+	 * Verify frames of at least threshold bytes on pool (see
+	 * Frame::parallelVerification). Pass NULL to verify everything inline.
+	 */
+	void parallelVerification(WorkerPool* pool, uint64_t threshold = FRAME_PARALLEL_CRC_THRESHOLD);
+
+	/**
+	 * Stream payloads of at least threshold bytes to sink (see Frame::stream),
+	 * and refuse to buffer any longer than maxLength. Pass an empty sink to
+	 * buffer everything.
+	 */
+	void stream(const Frame::PayloadSink& sink, uint64_t threshold = FRAME_STREAM_THRESHOLD);
+	void maxLength(uint64_t maxLength);
+private:
+	FrameCallback mCallback;
+	WorkerPool* mVerificationPool;
+	uint64_t mParallelThreshold;
+	Frame::PayloadSink mSink;
+	uint64_t mStreamThreshold;
+	uint64_t mMaxLength;
+	FrameHeader mPartialHeader;
+	std::size_t mPartialHeaderBytes;
+	Frame* mPartial;
+};
+
+#endif
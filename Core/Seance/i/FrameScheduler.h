@@ -0,0 +1,136 @@
+#ifndef __SEANCE_FRAME_SCHEDULER_H
+#define __SEANCE_FRAME_SCHEDULER_H
+
+#include "Frame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+
+class OutboundQueue;
+class Socket;
+
+enum FramePriority
+{
+	FRAME_PRIORITY_HIGH,
+	FRAME_PRIORITY_NORMAL,
+	FRAME_PRIORITY_LOW
+};
+
+const std::size_t FRAME_PRIORITIES = 3;
+
+// Fragments are sized to the socket's send buffer, within these bounds.
+const std::size_t FRAME_FRAGMENT_MIN = 16 * 1024;
+const std::size_t FRAME_FRAGMENT_MAX = 4 * 1024 * 1024;
+
+struct FrameSchedulerStats
+{
+	uint64_t messages;   // Data frames pushed.
+	uint64_t control;    // Control frames, which skip the queues.
+	uint64_t fragmented; // Messages split into continuation frames.
+	uint64_t fragments;  // Frames sent for those.
+	uint64_t bytes[FRAME_PRIORITIES]; // Payload bytes sent per class.
+};
+
+/**
+ * Decides what a connection sends next, so that one huge message cannot hold
+ * up everything queued behind it.
+ *
+ * Control frames (0x8 to 0xF) skip the queue and go straight to the
+ * OutboundQueue. Data frames wait in one of three priority classes, FIFO
+ * within a class, and are fed to the OutboundQueue only while it holds less
+ * than a fragment, so whatever is pushed later never sits behind more than
+ * about a socket buffer's worth of data. Classes take turns by deficit round
+ * robin, each allowed its weight in fragments per round.
+ *
+ * Messages longer than a fragment (the socket's send buffer, by default) are
+ * sent as a train of continuation frames sliced from the original payload
+ * without copying, with messages from other classes interleaved between
+ * them. Only one message is ever part way through (see FIN in Frame.h), so a
+ * long message waits for the one in progress to finish before it starts.
+ *
+ * Message IDs are assigned by the emitter as each frame leaves, since they
+ * must increase along the wire.
+ */
+class FrameScheduler
+{
+public:
+	/**
+	 * Turns a frame about to go out into what is pushed to the queue; it
+	 * must at least number it.
+	 */
+	typedef std::function<std::shared_ptr<Frame>(const std::shared_ptr<Frame>& frame)> Emitter;
+
+	/**
+	 * Told the message's frame once its first fragment has gone out, when
+	 * its messageID() is that fragment's; or NULL if it was dropped before
+	 * any of it was sent.
+	 */
+	typedef std::function<void(const Frame* first)> SentCallback;
+
+	FrameScheduler(OutboundQueue& outbound, Socket& socket, const Emitter& emitter);
+	FrameScheduler(const FrameScheduler& source) = delete;
+
+	void push(const std::shared_ptr<Frame>& frame, FramePriority priority = FRAME_PRIORITY_NORMAL, const SentCallback& sent = SentCallback());
+
+	/**
+	 * Feed the OutboundQueue while it has room. The owner must call this
+	 * whenever the queue drains (see OutboundQueue::drained).
+	 */
+	void pump(void);
+
+	/**
+	 * Drop everything queued.
+	 */
+	void clear(void);
+
+	/**
+	 * Fragment size in bytes. Setting 0 (the default) follows the socket's
+	 * send buffer, checked as each long message starts.
+	 */
+	std::size_t fragmentSize(void) const;
+	void fragmentSize(std::size_t size);
+
+	/**
+	 * Fragments per round for a class; 4, 2 and 1 by default.
+	 */
+	void weight(FramePriority priority, unsigned weight);
+
+	std::size_t queued(void) const;
+	uint64_t bytes(void) const;
+	const FrameSchedulerStats& stats(void) const;
+private:
+	struct Pending
+	{
+		std::shared_ptr<Frame> frame;
+		uint64_t offset;
+		bool started;
+		SentCallback sent;
+	};
+
+	bool room(void) const;
+	bool blocked(std::size_t priority) const;
+	uint64_t cost(const Pending& pending) const;
+	void emit(std::size_t priority);
+	void measure(void);
+
+	OutboundQueue& mOutbound;
+	Socket& mSocket;
+	Emitter mEmitter;
+	std::deque<Pending> mQueues[FRAME_PRIORITIES];
+	uint64_t mDeficit[FRAME_PRIORITIES];
+	unsigned mWeights[FRAME_PRIORITIES];
+	std::size_t mTurn;
+	bool mCredited; // mTurn has had its quantum this round.
+	int mTrain;     // The class whose head is part way through, or -1.
+	std::size_t mFixedFragment;
+	std::size_t mFragment;
+	uint64_t mBytes;
+	std::size_t mQueued;
+	bool mPumping;
+	FrameSchedulerStats mStats;
+};
+
+#endif
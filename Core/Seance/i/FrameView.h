@@ -0,0 +1,82 @@
+#ifndef __SEANCE_FRAME_VIEW_H
+#define __SEANCE_FRAME_VIEW_H
+
+#include "Frame.h"
+
+#include <memory>
+
+enum FrameParseResult
+{
+	FRAME_PARSE_COMPLETE,
+	FRAME_PARSE_INCOMPLETE,
+	FRAME_PARSE_INVALID
+};
+
+/**
+ * A decoded frame which does not own its payload. The header is decoded in a
+ * single pass straight out of a contiguous receive buffer and the payload is
+ * left where it landed, so nothing is allocated or copied per frame.
+ *
+ * The view is only valid for as long as the buffer it was parsed from.
+ */
+class FrameView
+{
+public:
+	FrameView(void);
+	FrameView(const Frame& frame);
+
+	/**
+	 * Decode the frame at the front of buffer. If the buffer ends before the
+	 * frame does, FRAME_PARSE_INCOMPLETE is returned and needed() says how
+	 * many bytes (from the start of the frame) are required to go further.
+	 */
+	FrameParseResult parse(uint8_t* buffer, std::size_t length);
+
+	/**
+	 * Unmask the payload in place (if masked) and check the CRC. Safe to call
+	 * more than once.
+	 */
+	bool verify(void);
+
+	const FrameHeader& header(void) const;
+	uint8_t opcode(void) const;
+	uint64_t size(void) const;
+	uint32_t messageID(void) const;
+	uint32_t respondingTo(void) const;
+	uint32_t mask(void) const;
+	uint32_t crc(void) const;
+	const uint8_t* payload(void) const;
+
+	/**
+	 * An owned copy of the frame, which outlives the buffer it was parsed
+	 * from. Call verify() first, or the payload is copied still masked.
+	 */
+	std::shared_ptr<Frame> copy(void) const;
+
+	/**
+	 * The frame carried inside this one's Payload, for extensions which wrap
+	 * one frame in another: length bytes at payload, with opcode, and the
+	 * rest of the header as this frame's. It counts as verified, as this
+	 * frame must have been, and is valid for as long as payload is.
+	 */
+	FrameView inner(uint8_t opcode, uint8_t* payload, uint64_t length) const;
+
+	std::size_t headerLength(void) const;
+	uint64_t frameLength(void) const;
+	uint64_t needed(void) const;
+private:
+	FrameHeader mHeader;
+	uint64_t mLength;
+	uint32_t mMessageID;
+	uint32_t mRespondingToID;
+	uint32_t mMask;
+	uint32_t mCRC;
+	uint8_t* mBuffer;
+	uint8_t* mPayload;
+	std::size_t mHeaderLength;
+	uint64_t mNeeded;
+	bool mUnmasked;
+	bool mVerified;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef __SEANCE_MESSAGE_ASSEMBLER_H
+#define __SEANCE_MESSAGE_ASSEMBLER_H
+
+#include "Frame.h"
+#include "FrameView.h"
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Longest message reassembled from continuation frames by default.
+const uint64_t MESSAGE_ASSEMBLY_MAX = 64 * 1024 * 1024;
+
+// Fragments shorter than this are copied into shared chunks this size.
+const std::size_t MESSAGE_CHUNK_SIZE = 64 * 1024;
+
+enum AssemblyResult
+{
+	ASSEMBLY_INCOMPLETE, // More fragments to come.
+	ASSEMBLY_COMPLETE,   // message() holds the whole message.
+	ASSEMBLY_TOO_LONG,   // The message went over the limit, and is being discarded.
+	ASSEMBLY_DISCARDED,  // A fragment of a message being discarded.
+	ASSEMBLY_INVALID     // A continuation frame with no message to continue.
+};
+
+struct AssemblyStats
+{
+	uint64_t messages;     // Messages completed.
+	uint64_t fragments;    // Frames added.
+	uint64_t copiedBytes;  // Payload bytes copied out of receive buffers.
+	uint64_t chainedBytes; // Payload bytes chained by reference.
+	uint64_t flattened;    // Messages flattened (copied) into one buffer.
+	uint64_t discarded;    // Messages dropped: over the limit, or cut short.
+};
+
+/**
+ * A message as a list of pieces of payload, in order, rather than one
+ * buffer. The opcode and header are those of its first frame.
+ */
+class Message
+{
+public:
+	Message(void);
+	Message(const Message& source) = delete;
+	~Message(void);
+
+	uint8_t opcode(void) const;
+	const FrameHeader& header(void) const;
+	uint32_t messageID(void) const;
+	uint32_t respondingTo(void) const;
+	uint64_t size(void) const;
+
+	/**
+	 * The payload as a scatter list, ready for writev() and friends.
+	 */
+	const std::vector<struct iovec>& pieces(void) const;
+
+	/**
+	 * The payload in one contiguous buffer. A message of one piece is
+	 * returned as it is; otherwise the pieces are copied together, once, and
+	 * released.
+	 */
+	const uint8_t* flatten(void);
+private:
+	friend class MessageAssembler;
+
+	void start(const FrameView& frame);
+	void append(const uint8_t* data, std::size_t length);
+	void reference(const uint8_t* data, std::size_t length);
+	void release(void);
+
+	FrameHeader mHeader;
+	uint32_t mMessageID;
+	uint32_t mRespondingTo;
+	uint64_t mSize;
+	std::vector<struct iovec> mPieces;
+
+	// BufferPool buffers and frames the pieces point into.
+	std::vector<std::pair<uint8_t*, std::size_t> > mBuffers;
+	std::vector<std::shared_ptr<const Frame> > mFrames;
+
+	// The chunk being filled, and the space left at its end.
+	uint8_t* mChunk;
+	std::size_t mChunkFree;
+
+	AssemblyStats* mStats;
+};
+
+/**
+ * Rebuilds messages split over continuation frames (0x0), for one
+ * connection.
+ *
+ * Fragments are chained, never regrown: a fragment in a receive buffer is
+ * copied exactly once, into pooled chunks (small fragments share them), and a
+ * fragment already in a Frame of its own is referenced without copying. A
+ * frame which is a whole message by itself is referenced where it lies. So
+ * the cost of a message is linear in its length and peak memory is the
+ * message itself, until and unless it is flattened.
+ *
+ * A whole message (a single frame with FIN set) may arrive between the
+ * fragments of another, as FrameScheduler sends them; it is completed by
+ * itself without disturbing the one being assembled.
+ *
+ * At most maxLength bytes are held for a message; anything longer is
+ * discarded, up to its final fragment.
+ */
+class MessageAssembler
+{
+public:
+	MessageAssembler(uint64_t maxLength = MESSAGE_ASSEMBLY_MAX);
+	MessageAssembler(const MessageAssembler& source) = delete;
+
+	/**
+	 * Add a data frame (0x0 to 0x2). Once ASSEMBLY_COMPLETE is returned the
+	 * message is in message() until the next add().
+	 */
+	AssemblyResult add(const FrameView& frame);
+	AssemblyResult add(const std::shared_ptr<const Frame>& frame);
+
+	Message& message(void);
+
+	/**
+	 * Whether a message is part way through, and the bytes held for it.
+	 */
+	bool assembling(void) const;
+	uint64_t buffered(void) const;
+
+	uint64_t maxLength(void) const;
+	void maxLength(uint64_t maxLength);
+
+	const AssemblyStats& stats(void) const;
+private:
+	AssemblyResult begin(const FrameView& frame);
+	AssemblyResult finish(const FrameView& frame);
+
+	Message mMessage;
+	Message mInterleaved; // A whole message between fragments of mMessage.
+	Message* mTarget;     // The message the frame being added belongs to.
+	Message* mComplete;   // The message last completed, until the next add().
+	uint64_t mMaxLength;
+	bool mAssembling;
+	bool mDiscarding;
+	AssemblyStats mStats;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __SEANCE_OUTBOUND_QUEUE_H
+#define __SEANCE_OUTBOUND_QUEUE_H
+
+#include "Frame.h"
+
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class EventLoop;
+class Socket;
+
+// Queued bytes beyond which the queue flushes without waiting for the tick.
+const std::size_t OUTBOUND_FLUSH_BYTES = 64 * 1024;
+
+// Extra milliseconds a batch may wait past the end of the tick it was queued in.
+const int OUTBOUND_FLUSH_DELAY = 0;
+
+/**
+ * Per-connection queue of encoded frames, corked so that everything queued
+ * within one EventLoop tick goes out in a single gather write rather than a
+ * syscall (and TCP segment) per frame.
+ *
+ * A batch is flushed at the end of the tick it was started in (plus
+ * flushDelay milliseconds), as soon as flushBytes are queued, or immediately
+ * when a Close (0x8) or Ping (0x9) frame is pushed. Without a loop frames are
+ * only held until flushBytes are queued, a control frame is pushed or flush()
+ * is called.
+ *
+ * File-backed frames (see Frame::file) are sent with sendfile() where
+ * possible. Masked payloads, in memory or in a file, are masked as they are
+ * written, FRAME_MASK_CHUNK bytes at a time into pooled scratch buffers (see
+ * BufferPool), so queueing one never copies it whole.
+ *
+ * Flushing never blocks; whatever the socket will not take stays queued, so
+ * the owner should call flush() again when the socket reports EPOLLOUT.
+ */
+class OutboundQueue
+{
+public:
+	OutboundQueue(Socket& socket, EventLoop* loop = NULL, std::size_t flushBytes = OUTBOUND_FLUSH_BYTES, int flushDelay = OUTBOUND_FLUSH_DELAY);
+	OutboundQueue(const OutboundQueue& source) = delete;
+	~OutboundQueue(void);
+
+	/**
+	 * Encode and queue a frame. The frame's payload is referenced, not copied,
+	 * so it must not change while queued.
+	 */
+	void push(const std::shared_ptr<const Frame>& frame);
+
+	/**
+	 * Write as much of the queue as the socket will take right now. Returns
+	 * the number of bytes written, or -1 if the socket has failed or a
+	 * file-backed frame's file has become shorter than the frame.
+	 */
+	ssize_t flush(void);
+
+	/**
+	 * Call callback whenever a flush leaves lowWater bytes or fewer queued,
+	 * so that whoever feeds the queue can top it up.
+	 */
+	void drained(const std::function<void(void)>& callback, std::size_t lowWater);
+
+	std::size_t size(void) const;
+	std::size_t frames(void) const;
+private:
+	struct Entry
+	{
+		uint8_t header[FRAME_HEADER_LENGTH_MAX];
+		std::size_t headerLength;
+		std::shared_ptr<const Frame> frame;
+		const uint8_t* payload;
+		uint64_t length;
+		bool file; // The payload is sent from the frame's file.
+		bool masked; // The payload is masked a piece at a time as it is sent.
+	};
+
+	ssize_t sendFile(Entry& entry, std::size_t& batch);
+	void advance(std::size_t sent);
+	void schedule(void);
+
+	Socket& mSocket;
+	EventLoop* mLoop;
+	std::size_t mFlushBytes;
+	int mFlushDelay;
+	std::deque<Entry> mQueue;
+	uint64_t mBytes;
+	uint64_t mSent; // Bytes of the front entry already written.
+	bool mScheduled;
+	std::function<void(void)> mDrained;
+	std::size_t mLowWater;
+	std::shared_ptr<OutboundQueue*> mSelf; // Lets a deferred flush outlive us.
+};
+
+#endif
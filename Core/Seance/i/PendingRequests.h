@@ -0,0 +1,85 @@
+#ifndef __SEANCE_PENDING_REQUESTS_H
+#define __SEANCE_PENDING_REQUESTS_H
+
+#include "TimerWheel.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class FrameView;
+
+// Initial number of slots; always a power of two.
+const std::size_t PENDING_REQUESTS_CAPACITY = 64;
+
+/**
+ * Outstanding requests on a connection, keyed by the Message ID they were
+ * sent with, so that a response can be matched by its Response to Message ID
+ * in O(1).
+ *
+ * The table is open addressing with linear probing. Message IDs are handed
+ * out sequentially, so the ID itself (masked to the table size) is used as
+ * the slot; any window of up to capacity outstanding IDs lands in distinct
+ * slots. Removal shifts the following run back rather than leaving
+ * tombstones, so a long-lived connection never degrades. The table doubles
+ * when it becomes half full.
+ */
+class PendingRequests
+{
+public:
+	/**
+	 * Called with the response, or with NULL if the request timed out or the
+	 * connection closed first. The response is only valid for the call.
+	 */
+	typedef std::function<void(const FrameView* response)> Callback;
+
+	PendingRequests(std::size_t capacity = PENDING_REQUESTS_CAPACITY);
+	PendingRequests(const PendingRequests& source) = delete;
+
+	/**
+	 * Returns false, leaving the table untouched, if id is already pending.
+	 * timer is the request's timeout, handed back when it is removed.
+	 */
+	bool insert(uint32_t id, const Callback& callback, TimerHandle timer = TIMER_NONE);
+	bool contains(uint32_t id) const;
+
+	/**
+	 * Remove id, moving its callback into callback and its timer into timer.
+	 * Returns false if id is not pending.
+	 */
+	bool take(uint32_t id, Callback& callback, TimerHandle& timer);
+
+	/**
+	 * Remove every request, appending their callbacks and timers.
+	 */
+	void clear(std::vector<Callback>& callbacks, std::vector<TimerHandle>& timers);
+
+	/**
+	 * Hand out next as a Message ID and advance it, skipping any IDs still
+	 * pending from the previous lap. IDs wrap within their half of the space:
+	 * the bits set in half never change.
+	 */
+	uint32_t nextID(uint32_t& next, uint32_t half) const;
+
+	std::size_t size(void) const;
+	std::size_t capacity(void) const;
+private:
+	struct Slot
+	{
+		uint32_t id;
+		bool used;
+		TimerHandle timer;
+		Callback callback;
+	};
+
+	std::size_t find(uint32_t id) const;
+	void erase(std::size_t index);
+	void grow(void);
+
+	std::vector<Slot> mSlots;
+	std::size_t mMask;
+	std::size_t mSize;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef __SEANCE_REPLAY_BUFFER_H
+#define __SEANCE_REPLAY_BUFFER_H
+
+#include "Frame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Bytes of unacknowledged frames kept per session by default.
+const std::size_t REPLAY_BUFFER_BUDGET = 4 * 1024 * 1024;
+
+// Budget, newest ID, newest evicted ID and flags, ahead of the saved frames.
+const std::size_t REPLAY_SAVED_HEADER = 8 + 4 + 4 + 1;
+
+struct ReplayStats
+{
+	uint64_t recorded;     // Frames recorded.
+	uint64_t acknowledged; // Frames dropped because the peer has them.
+	uint64_t evicted;      // Frames dropped to stay within the budget.
+	uint64_t evictedBytes;
+	uint64_t replayed;     // Frames handed back by replay().
+	uint64_t resyncs;      // Resumes refused because of evictions.
+};
+
+/**
+ * The frames one end of a session has sent and the peer has not yet
+ * acknowledged, oldest first, so that a session can pick up after a
+ * reconnect (see opcode 0xA) by resending only what the peer missed.
+ *
+ * Frames are held by reference, never copied, and are expected to have
+ * Message IDs increasing (and wrapping) within one half of the ID space, as
+ * Seance assigns them; so finding where a replay starts is a subtraction.
+ * Once more than budget bytes are held the oldest frames are evicted, and a
+ * peer which then asks to resume from before them must resynchronise from
+ * scratch.
+ */
+class ReplayBuffer
+{
+public:
+	ReplayBuffer(std::size_t budget = REPLAY_BUFFER_BUDGET);
+	ReplayBuffer(const ReplayBuffer& source) = delete;
+
+	/**
+	 * Hold on to frame, which must have its Message ID set and must not
+	 * change from now on.
+	 */
+	void record(const std::shared_ptr<const Frame>& frame);
+
+	/**
+	 * The peer has everything up to and including id.
+	 */
+	void acknowledge(uint32_t id);
+
+	/**
+	 * Append every frame sent after lastSeen to frames. Returns false, and
+	 * appends nothing, if some of them have been evicted.
+	 */
+	bool replay(uint32_t lastSeen, std::vector<std::shared_ptr<const Frame> >& frames);
+
+	/**
+	 * Whether anything has been recorded, and if so the newest Message ID.
+	 */
+	bool empty(void) const;
+	uint32_t newest(void) const;
+
+	std::size_t size(void) const;
+	std::size_t frames(void) const;
+	std::size_t budget(void) const;
+	void budget(std::size_t budget);
+
+	const ReplayStats& stats(void) const;
+
+	/**
+	 * Write the buffer's state and frames, in their wire encoding, to buffer,
+	 * which must hold savedSize() bytes. Payloads are saved unmasked, with
+	 * the CRC left zeroed; this is scratch space, not something to send.
+	 */
+	std::size_t savedSize(void) const;
+	void save(uint8_t* buffer) const;
+
+	/**
+	 * Rebuild a buffer from what save() wrote. Throws if it is malformed.
+	 */
+	static std::shared_ptr<ReplayBuffer> load(uint8_t* buffer, std::size_t length);
+private:
+	struct Entry
+	{
+		uint32_t id;
+		uint64_t bytes;
+		std::shared_ptr<const Frame> frame;
+	};
+
+	void evict(void);
+
+	std::deque<Entry> mEntries;
+	std::size_t mBudget;
+	uint64_t mBytes;
+	bool mRecorded;
+	uint32_t mNewest;
+	bool mEvicted;
+	uint32_t mEvictedThrough; // Newest Message ID evicted.
+	ReplayStats mStats;
+};
+
+#endif
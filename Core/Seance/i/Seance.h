@@ -1,10 +1,322 @@
 #ifndef __SEANCE_H
 #define __SEANCE_H
 
+#include "Compression.h"
+#include "ExtensionTable.h"
+#include "Frame.h"
+#include "FrameReader.h"
+#include "FrameScheduler.h"
+#include "MessageAssembler.h"
+#include "OutboundQueue.h"
+#include "PendingRequests.h"
+#include "ReplayBuffer.h"
+#include "SendBudget.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+
+class EventLoop;
+class Socket;
+
+enum SeanceRole
+{
+	SEANCE_CLIENT,
+	SEANCE_SERVER
+};
+
+// Server Message IDs have the most significant bit set; client ones do not.
+const uint32_t SEANCE_SERVER_ID_BIT = 0x80000000;
+
+// Milliseconds a request waits for its response by default.
+const int SEANCE_REQUEST_TIMEOUT = 30000;
+
+// Milliseconds the peer has to answer a keepalive Ping by default.
+const int SEANCE_KEEPALIVE_TIMEOUT = 10000;
+
+// A 0xA frame carries a session ID and the last Message ID received; its
+// answer a status and the answerer's last Message ID received.
+const std::size_t SEANCE_RESUME_LENGTH = 8 + 4;
+const std::size_t SEANCE_RESUMED_LENGTH = 1 + 4;
+const uint8_t SEANCE_RESUMED = 0;
+const uint8_t SEANCE_RESYNC = 1;
+
+// Queued outbound bytes at which a connection stops being writable by
+// default, and at which it becomes writable again.
+const std::size_t SEANCE_HIGH_WATER = 16 * 1024 * 1024;
+const std::size_t SEANCE_LOW_WATER = 4 * 1024 * 1024;
+
+/**
+ * One end of a Seance connection, driven by an EventLoop.
+ *
+ * Outgoing frames are numbered from this end's half of the Message ID space
+ * (see SEANCE_SERVER_ID_BIT), increasing and wrapping within it, as they go
+ * out. A FrameScheduler decides the order: control frames ahead of
+ * everything, and long messages split into continuation frames interleaved
+ * with the others by priority; and a corking OutboundQueue writes them out.
+ * Any number of requests may be in flight at
+ * once: each is remembered by its Message ID, and a response is matched to
+ * its request by the Response to Message ID in O(1). A response split into
+ * continuation frames is reassembled, and only finishes its request once its
+ * final fragment arrives. Requests which are not answered within their
+ * timeout complete with no response; the timeouts live on the loop's
+ * TimerWheel.
+ *
+ * Pings (0x9) from the peer are answered automatically. Incoming frames which
+ * are neither those nor responses to an outstanding request are handed to
+ * the FrameCallback. Frames whose Message ID is from the wrong half for the
+ * peer are dropped.
+ *
+ * With a ReplayBuffer attached the connection carries a semi-persistent
+ * session (see Frame.h): data frames are kept until the peer acknowledges
+ * them, which any response does for everything up to the request it answers,
+ * and a 0xA frame from the peer replays whatever it missed. The 0xA frame
+ * goes to the FrameCallback first, so that it can find the session's buffer
+ * and attach it.
+ *
+ * With an ExtensionTable attached, extension frames (0x3) go to the enabled
+ * extension's handler rather than the FrameCallback, and 0xB frames from the
+ * peer change which of the table's extensions are enabled on this
+ * connection, at any point in it.
+ * Once compression (COMPRESSION_EXTENSION_ID) is enabled, data frames are
+ * sent compressed through the connection's Compression.
+ *
+ * With a MessageCallback set, data frames are handed over as whole messages
+ * instead, reassembled from their continuation frames (see MessageAssembler).
+ *
+ * Bytes queued for sending are bounded by watermarks: once highWater bytes
+ * are queued the connection is no longer writable, until it drains back to
+ * lowWater, and it is not writable either while the SendBudget it charges is
+ * exhausted. Nothing is refused while it is unwritable; producers are
+ * expected to wait for it (whenWritable) rather than keep queueing.
+ *
+ * Apart from the future overload of request(), everything must be called
+ * from the loop's thread.
+ */
 class Seance
 {
 public:
+	typedef PendingRequests::Callback ResponseCallback;
+	typedef std::function<void(Seance& seance, FrameView& frame)> FrameCallback;
+	typedef std::function<void(Seance& seance, Message& message)> MessageCallback;
+	typedef std::function<void(Seance& seance, bool writable)> BackpressureCallback;
+	typedef std::function<void(bool open)> WritableCallback;
+
+	/**
+	 * Register socket with loop. The socket must outlive the Seance.
+	 */
+	Seance(Socket& socket, EventLoop& loop, SeanceRole role, const FrameCallback& callback);
+	Seance(const Seance& source) = delete;
+	~Seance(void);
+
+	/**
+	 * Queue a frame which expects no response. It is numbered as it goes out
+	 * (straight away, if nothing is ahead of it), after which messageID()
+	 * holds its Message ID. Once the connection is closed frames are dropped.
+	 */
+	void send(const std::shared_ptr<Frame>& frame, FramePriority priority = FRAME_PRIORITY_NORMAL);
+
+	/**
+	 * Queue a frame, calling callback with its response (or NULL if none
+	 * arrives within timeout milliseconds of it going out, or the connection
+	 * closes first).
+	 */
+	void request(const std::shared_ptr<Frame>& frame, const ResponseCallback& callback, int timeout = SEANCE_REQUEST_TIMEOUT, FramePriority priority = FRAME_PRIORITY_NORMAL);
+
+	/**
+	 * As above, but safe to call from any thread: the request is handed to
+	 * the loop, and the future receives a copy of the response. It throws if
+	 * there was no response.
+	 */
+	std::future<std::shared_ptr<Frame> > request(const std::shared_ptr<Frame>& frame, int timeout = SEANCE_REQUEST_TIMEOUT, FramePriority priority = FRAME_PRIORITY_NORMAL);
+
+	/**
+	 * Queue response as the answer to request, unless the connection is
+	 * closed.
+	 */
+	void respond(const FrameView& request, const std::shared_ptr<Frame>& response, FramePriority priority = FRAME_PRIORITY_NORMAL);
+
+	/**
+	 * Keep the data frames sent from now on in buffer until the peer has them,
+	 * and number frames on from the newest one already in it. Pass NULL to
+	 * stop.
+	 */
+	void replay(const std::shared_ptr<ReplayBuffer>& buffer);
+	const std::shared_ptr<ReplayBuffer>& replayBuffer(void) const;
+
+	/**
+	 * Establish or rejoin session over this connection. lastReceived is the
+	 * last Message ID received from the peer in the session (lastReceived() of
+	 * the old connection's Seance, or of this one for a new session). Once the
+	 * peer has replayed what we missed, ours is replayed in turn and callback
+	 * is told whether the session carried on (false if either side needs a
+	 * resync, or the peer did not answer). Send nothing else until then.
+	 */
+	void resume(uint64_t session, uint32_t lastReceived, const std::function<void(bool resumed)>& callback);
+	uint32_t lastReceived(void) const;
+
+	/**
+	 * Dispatch extension frames through table, which may be shared with
+	 * other connections. Which of its extensions are enabled is kept per
+	 * connection, so the peer's 0xB frames only change them for this one.
+	 * Pass NULL to stop.
+	 */
+	void extensions(const std::shared_ptr<ExtensionTable>& table);
+	const std::shared_ptr<ExtensionTable>& extensions(void) const;
+
+	/**
+	 * Whether extension id is enabled on this connection.
+	 */
+	bool enabled(uint64_t id) const;
+
+	/**
+	 * Ask the peer to make changes, and make whatever it agrees to on this
+	 * end too. callback receives what the peer answered (each extension ID
+	 * with whether it is now enabled), or is told it did not answer.
+	 */
+	void negotiate(const ExtensionChanges& changes, const std::function<void(bool answered, const ExtensionChanges& agreed)>& callback);
+
+	/**
+	 * Hand data frames (0x0 to 0x2) to callback as whole messages, holding
+	 * at most maxLength bytes for one; longer messages are discarded. The
+	 * message is only valid for the duration of the call. Pass NULL to go
+	 * back to handing every frame to the FrameCallback.
+	 */
+	void messages(const MessageCallback& callback, uint64_t maxLength = MESSAGE_ASSEMBLY_MAX);
+
+	/**
+	 * This connection's compression context, used for frames sent while the
+	 * compression extension is enabled, and for those received.
+	 */
+	void compression(const std::shared_ptr<Compression>& context);
+	const std::shared_ptr<Compression>& compression(void) const;
+
+	/**
+	 * Deliver a frame which an extension has unwrapped from an extension
+	 * frame, as though it had arrived by itself.
+	 */
+	void inject(FrameView& frame);
+
+	/**
+	 * Ping the peer whenever nothing has been received from it for interval
+	 * milliseconds, and close the connection if a Ping goes unanswered for
+	 * timeout milliseconds. An interval of 0 turns keepalives off. The check
+	 * is allowed to run an eighth of the interval late, so that idle
+	 * connections share wakeups.
+	 */
+	void keepalive(int interval, int timeout = SEANCE_KEEPALIVE_TIMEOUT);
+
+	/**
+	 * Send a Ping now, taking an RTT sample from the answer.
+	 */
+	void ping(void);
+
+	/**
+	 * Round-trip time in microseconds, from the last answered Ping and
+	 * smoothed over all of them (each new sample weighted 1/8, as TCP's
+	 * SRTT); -1 before the first sample.
+	 */
+	int64_t lastRTT(void) const;
+	int64_t rtt(void) const;
+
+	/**
+	 * Bytes queued for sending, in the FrameScheduler and the OutboundQueue,
+	 * and the watermarks they are held to.
+	 */
+	std::size_t queued(void) const;
+	void watermarks(std::size_t highWater, std::size_t lowWater);
+
+	/**
+	 * Charge queued bytes to budget (SendBudget::global() by default), which
+	 * must outlive the Seance.
+	 */
+	void budget(SendBudget& budget);
+
+	/**
+	 * Whether the connection is writable, and a callback told every time
+	 * that changes. It may be called from within send().
+	 */
+	bool writable(void) const;
+	void backpressure(const BackpressureCallback& callback);
+
+	/**
+	 * Call callback once the connection is writable (straight away if it is
+	 * now), with false if it closes first. Callbacks run in the order they
+	 * were given, for as long as the connection stays writable.
+	 */
+	void whenWritable(const WritableCallback& callback);
+
+	/**
+	 * As above, but safe to call from any thread.
+	 */
+	std::future<bool> whenWritable(void);
+
+	/**
+	 * Stop reading and fail every outstanding request. Frames already handed
+	 * to the OutboundQueue are flushed as far as the socket will take them;
+	 * the rest are dropped.
+	 */
+	void close(void);
+	bool open(void) const;
+
+	std::size_t pending(void) const;
+	SeanceRole role(void) const;
+	OutboundQueue& outbound(void);
+	FrameScheduler& scheduler(void);
+	FrameReader& reader(void);
+	MessageAssembler& assembler(void);
 private:
+	uint32_t nextID(void);
+	std::shared_ptr<Frame> emit(const std::shared_ptr<Frame>& frame);
+	void ready(uint32_t events);
+	void deliver(FrameView& frame);
+	void responded(FrameView& fragment);
+	void expire(uint32_t id);
+	void idle(void);
+	void resumed(const FrameView& frame);
+	void negotiated(const FrameView& frame);
+	bool replayAfter(uint32_t lastSeen);
+	void pressure(void);
+
+	Socket& mSocket;
+	EventLoop& mLoop;
+	SeanceRole mRole;
+	FrameCallback mCallback;
+	OutboundQueue mOutbound;
+	FrameScheduler mScheduler;
+	FrameReader mReader;
+	PendingRequests mPending;
+	MessageCallback mMessageCallback;
+	MessageAssembler mAssembler;
+	MessageAssembler mResponses; // Fragmented responses.
+	FrameView mResponseHead;     // The first fragment of the one arriving.
+	bool mResponseTrain;
+	std::shared_ptr<ReplayBuffer> mReplay;
+	std::shared_ptr<ExtensionTable> mExtensions;
+	ExtensionSet mEnabled; // Extensions enabled on this connection.
+	std::shared_ptr<Compression> mCompression;
+	uint32_t mNextID;
+	uint32_t mLastReceived;
+	int mKeepaliveInterval;
+	int mKeepaliveTimeout;
+	TimerHandle mKeepalive;
+	bool mPinging;
+	int64_t mLastHeard; // Microseconds, for keepalives.
+	int64_t mLastRTT;
+	int64_t mRTT;
+	SendBudget* mBudget;
+	uint64_t mBudgetWait; // Handle while waiting for the budget, or 0.
+	std::size_t mCharged; // Bytes charged to mBudget.
+	std::size_t mHighWater;
+	std::size_t mLowWater;
+	bool mWritable;
+	BackpressureCallback mBackpressure;
+	std::deque<WritableCallback> mWriters;
+	bool mOpen;
+	std::shared_ptr<Seance*> mSelf; // Lets posted and deferred tasks outlive us.
 };
 
 #endif
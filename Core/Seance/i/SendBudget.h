@@ -0,0 +1,65 @@
+#ifndef __SEANCE_SEND_BUDGET_H
+#define __SEANCE_SEND_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Bytes which may be queued for sending across the whole process by default.
+const std::size_t SEND_BUDGET_LIMIT = 256 * 1024 * 1024;
+
+/**
+ * A limit on the bytes queued for sending across every connection charging
+ * it (by default every Seance in the process, through global()), so that
+ * many slow peers together cannot run the process out of memory when none of
+ * them is over its own watermark.
+ *
+ * Connections charge what they queue and credit it back as it is written,
+ * from whichever threads they run on. Once more than the limit is charged the
+ * budget is exhausted; those waiting on it are called, once each, when it
+ * falls back to three quarters of the limit. Waiters are called with the
+ * budget's lock held, on the crediting thread, so they should do no more
+ * than hand the news to their own thread (EventLoop::post).
+ */
+class SendBudget
+{
+public:
+	typedef std::function<void(void)> Waiter;
+
+	SendBudget(std::size_t limit = SEND_BUDGET_LIMIT);
+	SendBudget(const SendBudget& source) = delete;
+
+	static SendBudget& global(void);
+
+	void charge(std::size_t bytes);
+	void credit(std::size_t bytes);
+	bool exhausted(void) const;
+
+	/**
+	 * Call waiter once the budget has room again (straight away if it has
+	 * now). Returns a handle for cancel(), which once it returns guarantees
+	 * the waiter is not being, and will not be, called.
+	 */
+	uint64_t wait(const Waiter& waiter);
+	void cancel(uint64_t handle);
+
+	std::size_t used(void) const;
+	std::size_t limit(void) const;
+	void limit(std::size_t limit);
+private:
+	bool recovered(void) const;
+	void wake(void);
+
+	std::atomic<std::size_t> mUsed;
+	std::atomic<std::size_t> mLimit;
+	std::atomic<bool> mWaiting; // Lets credit() skip the lock.
+	std::mutex mLock;
+	std::vector<std::pair<uint64_t, Waiter> > mWaiters;
+	uint64_t mNextHandle;
+};
+
+#endif
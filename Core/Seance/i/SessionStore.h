@@ -0,0 +1,149 @@
+#ifndef __SEANCE_SESSION_STORE_H
+#define __SEANCE_SESSION_STORE_H
+
+#include "ReplayBuffer.h"
+
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Seconds a session stays parked in memory before spill() moves it to disk.
+const uint32_t SESSION_SPILL_AGE = 30;
+
+// Initial slots per shard; always a power of two.
+const std::size_t SESSION_SHARD_CAPACITY = 1024;
+
+struct SessionStoreStats
+{
+	uint64_t parked;
+	uint64_t claimed;
+	uint64_t expired;
+	uint64_t spilled;      // Sessions written out to the spill file.
+	uint64_t faulted;      // Spilled sessions read back in by claim().
+	uint64_t resident;     // Sessions parked in memory right now.
+	uint64_t onDisk;       // Sessions in the spill file right now.
+	uint64_t spilledBytes; // Bytes of the spill file in use right now.
+};
+
+/**
+ * Sessions whose connection has gone, waiting for their client to come back
+ * and resume them (see Seance::resume), keyed by session token.
+ *
+ * The store is split into shards (one per core by default), each with its own
+ * lock, table and spill file, so connections on different loops rarely touch
+ * the same lock. Each shard's table is open addressing over small fixed-size
+ * entries; a session's ReplayBuffer is kept alongside while it is resident.
+ *
+ * Sessions parked for longer than spillAge seconds are written out by
+ * spill() to the shard's spill file, through a shared mapping, and their
+ * memory is released; those pages are then dropped from the process too, so
+ * resident memory stays bounded by what was parked recently. claim() reads a
+ * spilled session back from the mapping, which recently spilled sessions will
+ * usually find still in the page cache.
+ */
+class SessionStore
+{
+public:
+	/**
+	 * Spill files are created (and immediately unlinked) in spillDirectory;
+	 * with NULL nothing is ever spilled. shards of 0 means one per core.
+	 */
+	SessionStore(const char* spillDirectory = NULL, std::size_t shards = 0, uint32_t spillAge = SESSION_SPILL_AGE);
+	SessionStore(const SessionStore& source) = delete;
+	~SessionStore(void);
+
+	/**
+	 * Park a session, replacing any already parked under token. lastReceived
+	 * is the last Message ID received from the peer (Seance::lastReceived).
+	 */
+	void park(uint64_t token, const std::shared_ptr<ReplayBuffer>& replay, uint32_t lastReceived);
+
+	/**
+	 * Take a parked session back out of the store, reading it back from disk
+	 * if it was spilled. Returns false if no session is parked under token.
+	 */
+	bool claim(uint64_t token, std::shared_ptr<ReplayBuffer>& replay, uint32_t& lastReceived);
+	bool contains(uint64_t token);
+
+	/**
+	 * Spill every session parked for longer than the spill age. Meant to be
+	 * called periodically, e.g. from a loop timer. Returns the number spilled.
+	 */
+	std::size_t spill(void);
+
+	/**
+	 * Forget every session parked for longer than maxAge seconds. Returns the
+	 * number dropped.
+	 */
+	std::size_t expire(uint32_t maxAge);
+
+	std::size_t size(void);
+	std::size_t shards(void) const;
+	SessionStoreStats stats(void);
+private:
+	// 32 bytes; the ReplayBuffer of a resident session lives in a parallel
+	// array, so spilled sessions cost only this.
+	struct Entry
+	{
+		uint64_t token;
+		uint64_t offset; // Into the spill file, once spilled.
+		uint32_t length; // Bytes in the spill file; 0 while resident.
+		uint32_t parked; // Seconds, on the monotonic clock.
+		uint32_t lastReceived;
+		uint32_t used;
+	};
+
+	struct Extent
+	{
+		uint64_t offset;
+		uint64_t length;
+	};
+
+	struct Shard
+	{
+		std::mutex lock;
+		std::vector<Entry> entries;
+		std::vector<std::shared_ptr<ReplayBuffer> > buffers;
+		std::size_t mask;
+		std::size_t count;
+
+		// Tokens in the order they were parked, for spilling and expiry;
+		// spill() has already been through everything before spilled. Claims
+		// and re-parks leave stale entries behind, which compact() clears out
+		// once they outnumber the sessions.
+		std::deque<std::pair<uint32_t, uint64_t> > order;
+		std::size_t spilled;
+
+		int file;
+		uint8_t* mapping;
+		uint64_t capacity;
+		uint64_t end; // Bytes of the file handed out so far.
+		uint64_t used; // Of those, bytes holding sessions.
+		std::vector<Extent> holes; // Sorted by offset, never adjacent.
+
+		SessionStoreStats stats;
+	};
+
+	Shard& shard(uint64_t token);
+	static std::size_t find(const Shard& shard, uint64_t token);
+	static void insert(Shard& shard, const Entry& entry, const std::shared_ptr<ReplayBuffer>& buffer);
+	static void erase(Shard& shard, std::size_t index);
+	static void grow(Shard& shard);
+	static void compact(Shard& shard);
+
+	bool spillEntry(Shard& shard, std::size_t index);
+	std::shared_ptr<ReplayBuffer> fault(Shard& shard, const Entry& entry);
+	uint64_t allocate(Shard& shard, uint64_t length);
+	void release(Shard& shard, uint64_t offset, uint64_t length);
+
+	std::vector<Shard*> mShards;
+	std::string mSpillDirectory;
+	uint32_t mSpillAge;
+};
+
+#endif
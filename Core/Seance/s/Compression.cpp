@@ -0,0 +1,373 @@
+#include "Compression.h"
+#include "CRC.h"
+#include "Endian.h"
+#include "LZ.h"
+#include "Seance.h"
+
+#include <cstring>
+#include <iostream>
+#include <time.h>
+#ifdef SEANCE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+using namespace std;
+
+namespace
+{
+	const uint8_t OPCODE_EXTENSION = 0x3;
+
+	// Continuation, text and binary frames are compressed; nothing else.
+	const uint8_t COMPRESSION_OPCODE_MAX = 0x2;
+
+	const std::size_t EXTENSION_ID_LENGTH = 8;
+	const std::size_t COMPRESSION_OVERHEAD = EXTENSION_ID_LENGTH + COMPRESSION_HEADER_LENGTH;
+
+	uint64_t threadNanos(void)
+	{
+		timespec now;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		return uint64_t(now.tv_sec) * 1000000000 + uint64_t(now.tv_nsec);
+	}
+}
+
+Compression::Compression(CompressionCodec codec, std::size_t threshold):
+	mCodec(codec),
+	mThreshold(threshold),
+	mMaxLength(COMPRESSION_LENGTH_MAX),
+	mDictionary(),
+	mDictionaryID(0),
+	mPrimed(LZ_TABLE_SIZE, 0),
+	mTable(LZ_TABLE_SIZE, 0),
+	mInput(),
+	mCompressed(),
+	mOutput(),
+	mDeflate(NULL),
+	mInflate(NULL),
+	mStats()
+{
+	if (!available(codec))
+	{
+		throw "Compression codec not built in";
+	}
+	memset(&mStats, 0, sizeof(mStats));
+}
+
+Compression::~Compression(void)
+{
+#ifdef SEANCE_HAVE_ZLIB
+	if (mDeflate)
+	{
+		deflateEnd(static_cast<z_stream*>(mDeflate));
+		delete static_cast<z_stream*>(mDeflate);
+	}
+	if (mInflate)
+	{
+		inflateEnd(static_cast<z_stream*>(mInflate));
+		delete static_cast<z_stream*>(mInflate);
+	}
+#endif
+}
+
+bool Compression::available(CompressionCodec codec)
+{
+#ifdef SEANCE_HAVE_ZLIB
+	return codec == COMPRESSION_LZ || codec == COMPRESSION_DEFLATE;
+#else
+	return codec == COMPRESSION_LZ;
+#endif
+}
+
+void Compression::offer(ExtensionTable& table)
+{
+	table.offer(COMPRESSION_EXTENSION_ID, [](Seance& seance, FrameView& frame, const uint8_t* data, uint64_t length)
+	{
+		if (!seance.compression())
+		{
+			seance.compression(std::shared_ptr<Compression>(new Compression()));
+		}
+
+		FrameView original;
+		if (!seance.compression()->decompress(frame, data, length, original))
+		{
+			cerr << "Dropping compressed frame " << frame.messageID() << " which would not decompress" << endl;
+			return;
+		}
+		seance.inject(original);
+	});
+}
+
+void Compression::dictionary(const uint8_t* data, std::size_t length)
+{
+	if (length > LZ_WINDOW)
+	{
+		data += length - LZ_WINDOW;
+		length = LZ_WINDOW;
+	}
+
+	mDictionary.assign(data, data + length);
+	mDictionaryID = length > 0 ? CRC32::calculate(0, data, length) : 0;
+	LZ::prime(mPrimed.data(), mDictionary.data(), mDictionary.size());
+
+	// Kept in front of where data is compressed from and decompressed to.
+	mInput = mDictionary;
+	mOutput = mDictionary;
+}
+
+uint32_t Compression::dictionaryID(void) const
+{
+	return mDictionaryID;
+}
+
+std::shared_ptr<Frame> Compression::compress(const std::shared_ptr<Frame>& frame)
+{
+	std::size_t length = std::size_t(frame->size());
+	if (frame->opcode() > COMPRESSION_OPCODE_MAX || length < mThreshold || length <= COMPRESSION_OVERHEAD ||
+		frame->size() > mMaxLength || frame->payload() == NULL)
+	{
+		mStats.skipped++;
+		return frame;
+	}
+
+	uint64_t started = threadNanos();
+
+	// Only worth sending if it comes out shorter, overhead included.
+	std::size_t capacity = length - COMPRESSION_OVERHEAD - 1;
+	if (mCompressed.size() < LZ::bound(length))
+	{
+		mCompressed.resize(LZ::bound(length));
+	}
+
+	std::size_t compressed = 0;
+	if (mCodec == COMPRESSION_LZ)
+	{
+		const uint8_t* buffer = frame->payload();
+		std::size_t start = 0;
+		if (!mDictionary.empty())
+		{
+			mInput.resize(mDictionary.size() + length);
+			memcpy(mInput.data() + mDictionary.size(), frame->payload(), length);
+			buffer = mInput.data();
+			start = mDictionary.size();
+		}
+		memcpy(mTable.data(), mPrimed.data(), LZ_TABLE_SIZE * sizeof(uint32_t));
+		compressed = LZ::compress(mTable.data(), buffer, start, length, mCompressed.data(), capacity);
+	}
+	else
+	{
+		compressed = deflate(frame->payload(), length, mCompressed.data(), capacity);
+	}
+	mStats.compressNanos += threadNanos() - started;
+
+	if (compressed == 0)
+	{
+		mStats.skipped++;
+		return frame;
+	}
+
+	std::size_t total = COMPRESSION_OVERHEAD + compressed;
+	FrameHeader header;
+	memset(&header, 0, sizeof(header));
+	header.headerParts.FIN = frame->header().headerParts.FIN;
+	header.headerParts.RSP = frame->header().headerParts.RSP;
+	header.headerParts.Opcode = OPCODE_EXTENSION;
+	header.headerParts.Length = htons(uint16_t(total < FRAME_LENGTH_MAX ? total : FRAME_LENGTH_MAX));
+
+	std::shared_ptr<Frame> result(new Frame(header));
+	result->size(total);
+	if (frame->header().headerParts.RSP)
+	{
+		result->respondingTo(frame->respondingTo());
+	}
+	if (frame->header().headerParts.MASK)
+	{
+		result->mask(frame->mask());
+	}
+
+	uint8_t* payload = result->payload();
+	uint64_t id = htonll(COMPRESSION_EXTENSION_ID);
+	uint32_t dictionaryID = htonl(mDictionaryID);
+	uint32_t originalLength = htonl(uint32_t(length));
+	memcpy(payload, &id, sizeof(id));
+	payload += sizeof(id);
+	payload[0] = uint8_t(mCodec);
+	payload[1] = frame->opcode();
+	memcpy(payload + 2, &dictionaryID, sizeof(dictionaryID));
+	memcpy(payload + 6, &originalLength, sizeof(originalLength));
+	memcpy(payload + COMPRESSION_HEADER_LENGTH, mCompressed.data(), compressed);
+
+	mStats.compressed++;
+	mStats.bytesIn += length;
+	mStats.bytesOut += compressed;
+	return result;
+}
+
+bool Compression::decompress(const FrameView& frame, const uint8_t* data, uint64_t length, FrameView& original)
+{
+	if (length < COMPRESSION_HEADER_LENGTH)
+	{
+		mStats.failures++;
+		return false;
+	}
+
+	uint8_t codec = data[0];
+	uint8_t opcode = data[1];
+	uint32_t dictionaryID;
+	uint32_t originalLength;
+	memcpy(&dictionaryID, data + 2, sizeof(dictionaryID));
+	memcpy(&originalLength, data + 6, sizeof(originalLength));
+	dictionaryID = ntohl(dictionaryID);
+	originalLength = ntohl(originalLength);
+
+	if (opcode > COMPRESSION_OPCODE_MAX || dictionaryID != mDictionaryID || originalLength > mMaxLength ||
+		!available(CompressionCodec(codec)))
+	{
+		mStats.failures++;
+		return false;
+	}
+
+	uint64_t started = threadNanos();
+	std::size_t start = mDictionary.size();
+	if (mOutput.size() < start + originalLength)
+	{
+		mOutput.resize(start + originalLength);
+	}
+	else if (mOutput.size() > start + COMPRESSION_RETAINED_LENGTH && originalLength < COMPRESSION_RETAINED_LENGTH)
+	{
+		// The last frame was a long one, and its view is no longer in use.
+		mOutput.resize(start + COMPRESSION_RETAINED_LENGTH);
+		mOutput.shrink_to_fit();
+	}
+
+	const uint8_t* compressed = data + COMPRESSION_HEADER_LENGTH;
+	std::size_t compressedLength = std::size_t(length - COMPRESSION_HEADER_LENGTH);
+	bool decompressed = false;
+	if (codec == COMPRESSION_LZ)
+	{
+		decompressed = LZ::decompress(compressed, compressedLength, mOutput.data(), start, originalLength) == int64_t(originalLength);
+	}
+	else
+	{
+		decompressed = inflate(compressed, compressedLength, mOutput.data() + start, originalLength);
+	}
+	mStats.decompressNanos += threadNanos() - started;
+
+	if (!decompressed)
+	{
+		mStats.failures++;
+		return false;
+	}
+	mStats.decompressed++;
+	original = frame.inner(opcode, mOutput.data() + start, originalLength);
+	return true;
+}
+
+CompressionCodec Compression::codec(void) const
+{
+	return mCodec;
+}
+
+std::size_t Compression::threshold(void) const
+{
+	return mThreshold;
+}
+
+void Compression::threshold(std::size_t threshold)
+{
+	mThreshold = threshold;
+}
+
+uint32_t Compression::maxLength(void) const
+{
+	return mMaxLength;
+}
+
+void Compression::maxLength(uint32_t maxLength)
+{
+	mMaxLength = maxLength;
+}
+
+double Compression::ratio(void) const
+{
+	return mStats.bytesIn == 0 ? 1.0 : double(mStats.bytesOut) / double(mStats.bytesIn);
+}
+
+const CompressionStats& Compression::stats(void) const
+{
+	return mStats;
+}
+
+std::size_t Compression::deflate(const uint8_t* data, std::size_t length, uint8_t* out, std::size_t capacity)
+{
+#ifdef SEANCE_HAVE_ZLIB
+	z_stream* stream = static_cast<z_stream*>(mDeflate);
+	if (!stream)
+	{
+		stream = new z_stream();
+		memset(stream, 0, sizeof(*stream));
+		if (deflateInit2(stream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			delete stream;
+			return 0;
+		}
+		mDeflate = stream;
+	}
+	else
+	{
+		deflateReset(stream);
+	}
+
+	if (!mDictionary.empty())
+	{
+		deflateSetDictionary(stream, mDictionary.data(), uInt(mDictionary.size()));
+	}
+	stream->next_in = const_cast<uint8_t*>(data);
+	stream->avail_in = uInt(length);
+	stream->next_out = out;
+	stream->avail_out = uInt(capacity);
+	return ::deflate(stream, Z_FINISH) == Z_STREAM_END ? std::size_t(stream->total_out) : 0;
+#else
+	(void)data;
+	(void)length;
+	(void)out;
+	(void)capacity;
+	return 0;
+#endif
+}
+
+bool Compression::inflate(const uint8_t* data, std::size_t length, uint8_t* out, std::size_t capacity)
+{
+#ifdef SEANCE_HAVE_ZLIB
+	z_stream* stream = static_cast<z_stream*>(mInflate);
+	if (!stream)
+	{
+		stream = new z_stream();
+		memset(stream, 0, sizeof(*stream));
+		if (inflateInit2(stream, -MAX_WBITS) != Z_OK)
+		{
+			delete stream;
+			return false;
+		}
+		mInflate = stream;
+	}
+	else
+	{
+		inflateReset(stream);
+	}
+
+	if (!mDictionary.empty())
+	{
+		inflateSetDictionary(stream, mDictionary.data(), uInt(mDictionary.size()));
+	}
+	stream->next_in = const_cast<uint8_t*>(data);
+	stream->avail_in = uInt(length);
+	stream->next_out = out;
+	stream->avail_out = uInt(capacity);
+	return ::inflate(stream, Z_FINISH) == Z_STREAM_END && stream->total_out == capacity;
+#else
+	(void)data;
+	(void)length;
+	(void)out;
+	(void)capacity;
+	return false;
+#endif
+}
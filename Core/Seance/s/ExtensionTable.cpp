@@ -0,0 +1,161 @@
+#include "ExtensionTable.h"
+#include "Endian.h"
+#include "Rcu.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const uint64_t EXTENSION_ID_LENGTH = 8;
+}
+
+ExtensionTable::ExtensionTable(void):
+	mCurrent(new Version()),
+	mWriteLock()
+{
+	const_cast<Version*>(mCurrent.load())->number = 0;
+}
+
+ExtensionTable::~ExtensionTable(void)
+{
+	delete mCurrent.load();
+}
+
+void ExtensionTable::offer(uint64_t id, const Handler& handler)
+{
+	std::lock_guard<std::mutex> lock(mWriteLock);
+
+	Extension extension;
+	extension.id = id;
+	extension.handler = handler;
+
+	Version* next = new Version(*mCurrent.load());
+	std::vector<Extension>::iterator found = std::lower_bound(next->extensions.begin(), next->extensions.end(), id,
+		[](const Extension& extension, uint64_t id)
+		{
+			return extension.id < id;
+		});
+	if (found != next->extensions.end() && found->id == id)
+	{
+		found->handler = handler;
+	}
+	else
+	{
+		next->extensions.insert(found, extension);
+	}
+	publish(next);
+}
+
+void ExtensionTable::withdraw(uint64_t id)
+{
+	std::lock_guard<std::mutex> lock(mWriteLock);
+
+	const Version* current = mCurrent.load();
+	if (!find(*current, id))
+	{
+		return;
+	}
+
+	Version* next = new Version();
+	next->extensions.reserve(current->extensions.size() - 1);
+	for (std::size_t i = 0; i < current->extensions.size(); i++)
+	{
+		if (current->extensions[i].id != id)
+		{
+			next->extensions.push_back(current->extensions[i]);
+		}
+	}
+	publish(next);
+}
+
+bool ExtensionTable::offered(uint64_t id) const
+{
+	Rcu::ReadLock lock;
+	return find(*mCurrent.load(), id) != NULL;
+}
+
+void ExtensionTable::apply(const ExtensionChanges& changes, ExtensionSet& enabled, ExtensionChanges* result) const
+{
+	Rcu::ReadLock lock;
+	const Version* current = mCurrent.load();
+	for (std::size_t i = 0; i < changes.size(); i++)
+	{
+		bool enable = changes[i].second && find(*current, changes[i].first);
+		if (enable)
+		{
+			enabled.insert(changes[i].first);
+		}
+		else
+		{
+			enabled.erase(changes[i].first);
+		}
+		if (result)
+		{
+			result->push_back(std::make_pair(changes[i].first, enable));
+		}
+	}
+}
+
+bool ExtensionTable::dispatch(Seance& seance, FrameView& frame, const ExtensionSet& enabled)
+{
+	if (frame.size() < EXTENSION_ID_LENGTH)
+	{
+		return false;
+	}
+
+	uint64_t id;
+	memcpy(&id, frame.payload(), sizeof(id));
+	id = ntohll(id);
+	if (enabled.count(id) == 0)
+	{
+		return false;
+	}
+
+	Rcu::ReadLock lock;
+	const Extension* extension = find(*mCurrent.load(), id);
+	if (!extension)
+	{
+		return false;
+	}
+	extension->handler(seance, frame, frame.payload() + EXTENSION_ID_LENGTH, frame.size() - EXTENSION_ID_LENGTH);
+	return true;
+}
+
+bool ExtensionTable::enabled(const ExtensionSet& enabled, uint64_t id) const
+{
+	return enabled.count(id) != 0 && offered(id);
+}
+
+std::size_t ExtensionTable::size(void) const
+{
+	Rcu::ReadLock lock;
+	return mCurrent.load()->extensions.size();
+}
+
+uint64_t ExtensionTable::version(void) const
+{
+	Rcu::ReadLock lock;
+	return mCurrent.load()->number;
+}
+
+const ExtensionTable::Extension* ExtensionTable::find(const Version& version, uint64_t id)
+{
+	std::vector<Extension>::const_iterator found = std::lower_bound(version.extensions.begin(), version.extensions.end(), id,
+		[](const Extension& extension, uint64_t id)
+		{
+			return extension.id < id;
+		});
+	return found != version.extensions.end() && found->id == id ? &*found : NULL;
+}
+
+void ExtensionTable::publish(Version* next)
+{
+	const Version* previous = mCurrent.load();
+	next->number = previous->number + 1;
+	mCurrent.store(next);
+	Rcu::retire([previous](void)
+	{
+		delete previous;
+	});
+}
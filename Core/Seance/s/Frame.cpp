@@ -1,4 +1,136 @@
 #include "Frame.h"
+#include "BufferPool.h"
+#include "CRC.h"
+#include "Endian.h"
+#include "Mask.h"
+#include "ParallelCRC.h"
+#include "Socket.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+
+namespace
+{
+	void readFile(int fd, uint8_t* buffer, std::size_t length, off_t offset)
+	{
+		while (length > 0)
+		{
+			ssize_t ret = ::pread(fd, buffer, length, offset);
+			if (ret == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			else if (ret <= 0)
+			{
+				cerr << "Unable to read frame payload from fd=" << fd << " " << errno << " " << strerror(errno) << endl;
+				throw "Frame file read failed";
+			}
+			buffer += ret;
+			length -= ret;
+			offset += ret;
+		}
+	}
+
+	uint64_t monotonicMillis(void)
+	{
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_nsec) / 1000000;
+	}
+
+	/**
+	 * Throw if nothing has gone out since progress for FRAME_SEND_TIMEOUT, or
+	 * the socket has failed; either way it is of no further use.
+	 */
+	void checkProgress(Socket& sock, uint64_t progress)
+	{
+		if (!sock.connected())
+		{
+			throw "Frame send failed";
+		}
+		if (monotonicMillis() - progress >= uint64_t(FRAME_SEND_TIMEOUT))
+		{
+			cerr << "Frame send made no progress for " << FRAME_SEND_TIMEOUT << "ms on fd=" << sock.descriptor() << endl;
+			throw "Frame send timed out";
+		}
+	}
+
+	/**
+	 * Send all of segments, carrying on after short writes for as long as the
+	 * connection lasts and the peer keeps taking data; a frame cut short
+	 * would corrupt the stream for good. Throws once the socket has failed or
+	 * stalled, and so is of no further use.
+	 */
+	void sendFully(Socket& sock, iovec* segments, int count)
+	{
+		uint64_t progress = monotonicMillis();
+		while (count > 0)
+		{
+			// The socket only adjusts a partly sent segment, so remember how
+			// long they all were to step over those which went whole.
+			std::size_t lengths[2];
+			for (int i = 0; i < count; i++)
+			{
+				lengths[i] = segments[i].iov_len;
+			}
+
+			ssize_t sent = sock.send(segments, count);
+			std::size_t done = sent > 0 ? std::size_t(sent) : 0;
+			int whole = 0;
+			while (whole < count && done >= lengths[whole])
+			{
+				done -= lengths[whole];
+				whole++;
+			}
+			segments += whole;
+			count -= whole;
+
+			if (sent > 0)
+			{
+				progress = monotonicMillis();
+			}
+			else if (count > 0)
+			{
+				checkProgress(sock, progress);
+			}
+		}
+	}
+
+	uint32_t fileCRC(uint32_t crc, int fd, off_t offset, uint64_t length)
+	{
+		if (length == 0)
+		{
+			return crc;
+		}
+
+		// Mappings have to start on a page boundary.
+		static const off_t oPageSize = off_t(::sysconf(_SC_PAGESIZE));
+		off_t base = offset & ~(oPageSize - 1);
+		std::size_t span = std::size_t(offset - base) + std::size_t(length);
+		void* mapping = ::mmap(NULL, span, PROT_READ, MAP_SHARED, fd, base);
+		if (mapping != MAP_FAILED)
+		{
+			::madvise(mapping, span, MADV_SEQUENTIAL);
+			crc = CRC32::calculate(crc, static_cast<uint8_t*>(mapping) + (offset - base), std::size_t(length));
+			::munmap(mapping, span);
+			return crc;
+		}
+
+		uint8_t buffer[FRAME_MASK_CHUNK];
+		for (uint64_t done = 0; done < length; )
+		{
+			std::size_t chunk = length - done < FRAME_MASK_CHUNK ? std::size_t(length - done) : FRAME_MASK_CHUNK;
+			readFile(fd, buffer, chunk, offset + done);
+			crc = CRC32::calculate(crc, buffer, chunk);
+			done += chunk;
+		}
+		return crc;
+	}
+}
 
 Frame::Frame(const FrameHeader& header):
 	mHeader(header),
@@ -8,7 +140,19 @@ Frame::Frame(const FrameHeader& header):
 	mMask(0),
 	mCRC(0),
 	mPayload(NULL),
+	mFile(-1),
+	mFileOffset(0),
+	mSource(),
 	/* Internal values only beyond this point */
+	mRunningCRC(0),
+	mVerificationPool(NULL),
+	mParallelThreshold(FRAME_PARALLEL_CRC_THRESHOLD),
+	mParallelCRC(NULL),
+	mSink(),
+	mStreamThreshold(FRAME_STREAM_THRESHOLD),
+	mMaxLength(FRAME_BUFFERED_LENGTH_MAX),
+	mScratch(NULL),
+	mStreaming(false),
 	mLengthSet(false),
 	mLengthBytesWritten(0),
 	mMessageIDBytesWritten(0),
@@ -21,67 +165,58 @@ Frame::Frame(const FrameHeader& header):
 	if (headerLen < FRAME_LENGTH_MAX)
 	{
 		mLength = headerLen;
-		mPayload = new uint8_t[headerLen];
+		mPayload = BufferPool::allocate(headerLen);
 		mLengthSet = true;
 	}
 }
 
 Frame::~Frame(void)
 {
-	delete [] mPayload;
-	mPayload = NULL;
+	// Outstanding CRC pieces point into the payload; wait for them first.
+	delete mParallelCRC;
+	mParallelCRC = NULL;
+
+	releasePayload();
+
+	BufferPool::release(mScratch, FRAME_STREAM_CHUNK);
+	mScratch = NULL;
 }
 
-template<typename T, typename U>
-std::size_t frameWriteHelper(uint8_t*& buffer, std::size_t& length, T& bytesWritten, const T maxBytes, U& destination, bool allowByteSwap = true)
+template<typename T>
+std::size_t frameWriteHelper(const uint8_t*& buffer, std::size_t& length, uint8_t& bytesWritten, const uint8_t maxBytes, T& destination)
 {
-	if (bytesWritten >= maxBytes)
-	{
-		return 0;
-	}
-
 	std::size_t i;
 	for (i = 0; bytesWritten < maxBytes && i < length; i++, bytesWritten++)
 	{
-		destination |= buffer[i];
-		destination <<= 8;
+		// Fields arrive most significant byte first, so shifting them in also
+		// takes care of the conversion to host byte order.
+		destination = T(destination << 8) | buffer[i];
 	}
 	buffer += i;
 	length -= i;
-
-	if (allowByteSwap && bytesWritten == maxBytes)
-	{
-		switch (maxBytes)
-		{
-			case 1:
-				break;
-			case 2:
-				destination = ntohs(destination);
-				break;
-			case 4:
-				destination = ntohl(destination);
-				break;
-			case 8:
-				destination = ntohll(destination);
-				break;
-			default:
-				// WAT
-				throw sizeof(destination);
-		}
-	}
 	return i;
 }
 
-void Frame::write(const uint8_t* buffer, std::size_t length)
+std::size_t Frame::write(const uint8_t* buffer, std::size_t length)
 {
-	uint8_t* cursor = buffer;
+	if (complete())
+	{
+		return 0;
+	}
+
+	const uint8_t* cursor = buffer;
 	if (!mLengthSet)
 	{
 		frameWriteHelper(cursor, length, mLengthBytesWritten, 8, mLength);
 
 		if (mLengthBytesWritten == 8)
 		{
-			mPayload = new uint8_t[mLength];
+			if (mLength < FRAME_LENGTH_MAX)
+			{
+				cerr << "Extended length " << mLength << " fits in the short length." << endl;
+				throw "Invalid frame!";
+			}
+			// The payload is allocated (or not) once the header is complete.
 			mLengthSet = true;
 		}
 	}
@@ -97,39 +232,177 @@ void Frame::write(const uint8_t* buffer, std::size_t length)
 		frameWriteHelper(cursor, length, mMaskBytesWritten, 4, mMask);
 	}
 
-	frameWriteHelper(cursor, length, mCRCBytesWritten, 4, mCRC);
+	if (mCRCBytesWritten < 4)
+	{
+		frameWriteHelper(cursor, length, mCRCBytesWritten, 4, mCRC);
 
-	frameWriteHelper(cursor, length, mPayloadBytesWritten, mLength, mPayload, false);
+		if (mCRCBytesWritten == 4)
+		{
+			// The header is complete; the payload is CRCed as it arrives.
+			uint8_t header[FRAME_HEADER_LENGTH_MAX];
+			std::size_t headerLength = encodeHeader(header);
+			mRunningCRC = CRC32::calculate(0, header, headerLength);
+
+			if (mSink && mLength > 0 && mLength >= mStreamThreshold)
+			{
+				mStreaming = true;
+				releasePayload();
+				if (mHeader.headerParts.MASK)
+				{
+					mScratch = BufferPool::allocate(FRAME_STREAM_CHUNK);
+				}
+			}
+			else
+			{
+				if (mLength > mMaxLength)
+				{
+					cerr << "Refusing to buffer " << mLength << " byte frame payload" << endl;
+					throw "Frame too large!";
+				}
+				if (mPayload == NULL)
+				{
+					mPayload = BufferPool::allocate(mLength);
+				}
+				if (mVerificationPool && mLength >= mParallelThreshold)
+				{
+					mParallelCRC = mHeader.headerParts.MASK ? new ParallelCRC(*mVerificationPool, mMask) : new ParallelCRC(*mVerificationPool);
+				}
+			}
+		}
+	}
 
-	if (mPayloadBytesWritten == mLength)
+	if (mStreaming)
 	{
-		// The entire payload has been read. Time to verify the CRC...
-		uint32_t calculatedCrc = 0;
-		calculatedCrc = CRC32::calculate(calculatedCrc, &mHeader.fullHeader, 2); // Only CRC the flags and opcode.
-		if (mLength >= uint16_t(-1))
+		uint64_t remaining = mLength - mPayloadBytesWritten;
+		std::size_t count = remaining < length ? std::size_t(remaining) : length;
+		while (count > 0)
 		{
-			// Only CRC the 64-bit length if needed.
-			uint64_t networkLen = htonll(mLength);
-			calculatedCrc = CRC32::calculate(calculatedCrc, &networkLen, sizeof(networkLen));
+			std::size_t piece = count;
+			const uint8_t* data = cursor;
+			if (mScratch)
+			{
+				piece = piece < FRAME_STREAM_CHUNK ? piece : FRAME_STREAM_CHUNK;
+				memcpy(mScratch, cursor, piece);
+				mRunningCRC = CRC32::calculateMasked(mRunningCRC, mScratch, piece, mMask, mPayloadBytesWritten);
+				data = mScratch;
+			}
+			else
+			{
+				mRunningCRC = CRC32::calculate(mRunningCRC, cursor, piece);
+			}
+
+			mPayloadBytesWritten += piece;
+			cursor += piece;
+			count -= piece;
+
+			bool final = mPayloadBytesWritten == mLength;
+			mSink(*this, data, piece, final, final && mRunningCRC == mCRC);
 		}
-		calculatedCrc = CRC32::calculate(calculatedCrc, &mMessageID, sizeof(mMessageID));
-		if (mHeader.headerParts.RSP == 1)
+	}
+	else if (mLengthSet && mCRCBytesWritten == 4)
+	{
+		uint64_t remaining = mLength - mPayloadBytesWritten;
+		std::size_t count = remaining < length ? std::size_t(remaining) : length;
+		uint8_t* destination = mPayload + mPayloadBytesWritten;
+		memcpy(destination, cursor, count);
+
+		// Unmask and CRC the piece that just landed while it is still in cache.
+		// It may start part way through the masking key.
+		if (mParallelCRC)
 		{
-			calculatedCrc = CRC32::calculate(calculatedCrc, &mRespondingToID, sizeof(mRespondingToID));
+			mParallelCRC->update(destination, count);
 		}
-		if (mHeader.headerParts.MASK == 1)
+		else if (mHeader.headerParts.MASK)
 		{
-			calculatedCrc = CRC32::calculate(calculatedCrc, &mMask, sizeof(mMask));
+			mRunningCRC = CRC32::calculateMasked(mRunningCRC, destination, count, mMask, mPayloadBytesWritten);
 		}
-		const static uint32_t blankCRC = 0;
-		calculatedCrc = CRC32::calculate(calculatedCrc, &blankCRC, sizeof(mCRC));
-		calculatedCrc = CRC32::calculate(calculatedCrc, mPayload, mLength);
-		if (htonl(calculatedCrc) != mCRC)
+		else
 		{
-			throw "CRC mismatch!";
+			mRunningCRC = CRC32::calculate(mRunningCRC, destination, count);
 		}
 
+		mPayloadBytesWritten += count;
+		cursor += count;
+	}
+
+	if (complete() && mParallelCRC)
+	{
+		mRunningCRC = CRC32::combine(mRunningCRC, mParallelCRC->result(), mLength);
+		delete mParallelCRC;
+		mParallelCRC = NULL;
 	}
+
+	if (complete() && mRunningCRC != mCRC)
+	{
+		throw "CRC mismatch!";
+	}
+
+	return cursor - buffer;
+}
+
+bool Frame::complete(void) const
+{
+	return mLengthSet && mCRCBytesWritten == 4 && mPayloadBytesWritten == mLength;
+}
+
+void Frame::parallelVerification(WorkerPool* pool, uint64_t threshold)
+{
+	mVerificationPool = pool;
+	mParallelThreshold = threshold;
+}
+
+void Frame::stream(const PayloadSink& sink, uint64_t threshold)
+{
+	mSink = sink;
+	mStreamThreshold = threshold;
+}
+
+bool Frame::streaming(void) const
+{
+	return mStreaming;
+}
+
+void Frame::maxLength(uint64_t maxLength)
+{
+	mMaxLength = maxLength;
+}
+
+Frame::PayloadSink Frame::descriptorSink(int fd)
+{
+	return [fd](const Frame& frame, const uint8_t* data, std::size_t length, bool final, bool verified)
+	{
+		while (length > 0)
+		{
+			ssize_t ret = ::write(fd, data, length);
+			if (ret == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			else if (ret == -1)
+			{
+				cerr << "Unable to write streamed payload to fd=" << fd << " " << errno << " " << strerror(errno) << endl;
+				throw "Frame stream write failed";
+			}
+			data += ret;
+			length -= ret;
+		}
+
+		if (final && !verified)
+		{
+			cerr << "Payload streamed to fd=" << fd << " failed its CRC" << endl;
+			throw "CRC mismatch!";
+		}
+	};
+}
+
+const FrameHeader& Frame::header(void) const
+{
+	return mHeader;
+}
+
+uint8_t Frame::opcode(void) const
+{
+	return mHeader.headerParts.Opcode;
 }
 
 uint64_t Frame::size(void) const
@@ -139,11 +412,268 @@ uint64_t Frame::size(void) const
 
 void Frame::size(uint64_t newSize)
 {
+	releasePayload();
 	mLength = newSize;
-	if (mPayload)
+	mPayload = BufferPool::allocate(mLength);
+	mFile = -1;
+	mLengthSet = true;
+}
+
+uint32_t Frame::messageID(void) const
+{
+	return mMessageID;
+}
+
+void Frame::messageID(uint32_t id)
+{
+	mMessageID = id;
+}
+
+uint32_t Frame::respondingTo(void) const
+{
+	return mRespondingToID;
+}
+
+void Frame::respondingTo(uint32_t id)
+{
+	mRespondingToID = id;
+	mHeader.headerParts.RSP = 1;
+}
+
+uint32_t Frame::mask(void) const
+{
+	return mMask;
+}
+
+void Frame::mask(uint32_t key)
+{
+	mMask = key;
+	mHeader.headerParts.MASK = 1;
+}
+
+uint32_t Frame::crc(void) const
+{
+	return mCRC;
+}
+
+const uint8_t* Frame::payload(void) const
+{
+	return mPayload;
+}
+
+uint8_t* Frame::payload(void)
+{
+	return mPayload;
+}
+
+void Frame::file(int fd, off_t offset, uint64_t length)
+{
+	// Mapping past the end of the file would fault when CRCed.
+	struct stat status;
+	if (::fstat(fd, &status) == -1)
 	{
-		delete [] mPayload;
+		cerr << "Unable to stat frame payload fd=" << fd << " " << errno << " " << strerror(errno) << endl;
+		throw "Frame::file failed";
 	}
-	mPayload = new uint8_t[mLength];
+	if (S_ISREG(status.st_mode) && uint64_t(status.st_size) < uint64_t(offset) + length)
+	{
+		cerr << "Frame payload of " << length << " bytes at " << offset << " runs past the end of fd=" << fd << endl;
+		throw "Frame::file failed";
+	}
+
+	releasePayload();
+	mLength = length;
+	mLengthSet = true;
+	mFile = fd;
+	mFileOffset = offset;
+}
+
+int Frame::file(void) const
+{
+	return mFile;
+}
+
+off_t Frame::fileOffset(void) const
+{
+	return mFileOffset;
+}
+
+void Frame::slice(const std::shared_ptr<const Frame>& source, uint64_t offset, uint64_t length)
+{
+	releasePayload();
+	mLength = length;
 	mLengthSet = true;
+	mFile = source->file();
+	mFileOffset = source->fileOffset() + off_t(offset);
+	mPayload = source->payload() ? const_cast<uint8_t*>(source->payload()) + offset : NULL;
+	mSource = source;
+}
+
+void Frame::copyPayload(uint8_t* buffer, uint64_t offset, std::size_t length) const
+{
+	if (mFile != -1)
+	{
+		readFile(mFile, buffer, length, mFileOffset + off_t(offset));
+	}
+	else
+	{
+		memcpy(buffer, mPayload + offset, length);
+	}
+}
+
+std::size_t Frame::encodeHeader(uint8_t* buffer) const
+{
+	uint8_t* cursor = buffer;
+
+	FrameHeader header = mHeader;
+	header.headerParts.Length = htons(mLength < FRAME_LENGTH_MAX ? uint16_t(mLength) : FRAME_LENGTH_MAX);
+	memcpy(cursor, header.fullHeader, sizeof(header.fullHeader));
+	cursor += sizeof(header.fullHeader);
+
+	if (mLength >= FRAME_LENGTH_MAX)
+	{
+		uint64_t networkLength = htonll(mLength);
+		memcpy(cursor, &networkLength, sizeof(networkLength));
+		cursor += sizeof(networkLength);
+	}
+
+	uint32_t networkValue = htonl(mMessageID);
+	memcpy(cursor, &networkValue, sizeof(networkValue));
+	cursor += sizeof(networkValue);
+
+	if (mHeader.headerParts.RSP)
+	{
+		networkValue = htonl(mRespondingToID);
+		memcpy(cursor, &networkValue, sizeof(networkValue));
+		cursor += sizeof(networkValue);
+	}
+	if (mHeader.headerParts.MASK)
+	{
+		networkValue = htonl(mMask);
+		memcpy(cursor, &networkValue, sizeof(networkValue));
+		cursor += sizeof(networkValue);
+	}
+
+	// The CRC field itself is all zeroes while the CRC is generated.
+	memset(cursor, 0, sizeof(mCRC));
+	cursor += sizeof(mCRC);
+
+	return cursor - buffer;
+}
+
+uint32_t Frame::calculateCRC(void) const
+{
+	uint8_t header[FRAME_HEADER_LENGTH_MAX];
+	std::size_t headerLength = encodeHeader(header);
+
+	return payloadCRC(CRC32::calculate(0, header, headerLength));
+}
+
+std::size_t Frame::encode(uint8_t* buffer) const
+{
+	std::size_t headerLength = encodeHeader(buffer);
+
+	uint32_t crc = htonl(payloadCRC(CRC32::calculate(0, buffer, headerLength)));
+	memcpy(buffer + headerLength - sizeof(crc), &crc, sizeof(crc));
+
+	return headerLength;
+}
+
+uint32_t Frame::payloadCRC(uint32_t crc) const
+{
+	if (mFile != -1)
+	{
+		return fileCRC(crc, mFile, mFileOffset, mLength);
+	}
+	return CRC32::calculate(crc, mPayload, mLength);
+}
+
+void Frame::releasePayload(void)
+{
+	// A sliced payload belongs to the frame it was sliced from.
+	if (mSource)
+	{
+		mSource.reset();
+	}
+	else
+	{
+		BufferPool::release(mPayload, mLength);
+	}
+	mPayload = NULL;
+}
+
+Socket& operator<<(Socket& sock, const Frame& frame)
+{
+	uint8_t header[FRAME_HEADER_LENGTH_MAX];
+	std::size_t headerLength = frame.encode(header);
+
+	iovec segments[2];
+	segments[0].iov_base = header;
+	segments[0].iov_len = headerLength;
+
+	bool masked = frame.mHeader.headerParts.MASK;
+	if (!masked && frame.mFile == -1)
+	{
+		segments[1].iov_base = frame.mPayload;
+		segments[1].iov_len = frame.mLength;
+		sendFully(sock, segments, 2);
+		return sock;
+	}
+
+	int count = 2;
+	uint64_t offset = 0;
+	if (!masked)
+	{
+		sendFully(sock, segments, 1);
+
+		off_t position = frame.mFileOffset;
+		uint64_t progress = monotonicMillis();
+		while (offset < frame.mLength)
+		{
+			ssize_t sent = sock.sendFile(frame.mFile, position, frame.mLength - offset);
+			if (sent == -1)
+			{
+				// sendfile cannot read this descriptor; copy the rest instead.
+				break;
+			}
+			if (sent > 0)
+			{
+				offset += uint64_t(sent);
+				progress = monotonicMillis();
+			}
+			else if (offset < frame.mLength)
+			{
+				// Not connected, the peer not reading, or the file cut short.
+				checkProgress(sock, progress);
+			}
+		}
+		if (offset == frame.mLength)
+		{
+			return sock;
+		}
+		count = 1;
+	}
+
+	// The payload itself has to stay unmasked (or is not in memory at all), so
+	// copy a piece at a time into scratch space; the header rides along with
+	// the first piece unless it has already gone.
+	uint8_t scratch[FRAME_MASK_CHUNK];
+	do
+	{
+		std::size_t chunk = frame.mLength - offset < FRAME_MASK_CHUNK ? std::size_t(frame.mLength - offset) : FRAME_MASK_CHUNK;
+		frame.copyPayload(scratch, offset, chunk);
+		if (masked)
+		{
+			applyMask(scratch, chunk, frame.mMask, offset);
+		}
+
+		segments[1].iov_base = scratch;
+		segments[1].iov_len = chunk;
+		sendFully(sock, &segments[2 - count], count);
+
+		offset += chunk;
+		count = 1;
+	} while (offset < frame.mLength);
+
+	return sock;
 }
@@ -0,0 +1,163 @@
+#include "FrameReader.h"
+
+#include <cstring>
+
+FrameReader::FrameReader(const FrameCallback& callback):
+	mCallback(callback),
+	mVerificationPool(NULL),
+	mParallelThreshold(FRAME_PARALLEL_CRC_THRESHOLD),
+	mSink(),
+	mStreamThreshold(FRAME_STREAM_THRESHOLD),
+	mMaxLength(FRAME_BUFFERED_LENGTH_MAX),
+	mPartialHeader(),
+	mPartialHeaderBytes(0),
+	mPartial(NULL)
+{
+	// empty
+}
+
+FrameReader::~FrameReader(void)
+{
+	delete mPartial;
+	mPartial = NULL;
+}
+
+std::size_t FrameReader::read(uint8_t* buffer, std::size_t length)
+{
+	std::size_t frames = 0;
+
+	while (length > 0)
+	{
+		if (mPartial == NULL && mPartialHeaderBytes == 0)
+		{
+			FrameView view;
+			FrameParseResult result = view.parse(buffer, length);
+			if (result == FRAME_PARSE_COMPLETE && mSink && view.size() > 0 && view.size() >= mStreamThreshold)
+			{
+				// Streamed frames all take the Frame path, whole or not.
+			}
+			else if (result == FRAME_PARSE_COMPLETE)
+			{
+				if (!view.verify())
+				{
+					throw "CRC mismatch!";
+				}
+				mCallback(view);
+				frames++;
+
+				buffer += view.frameLength();
+				length -= view.frameLength();
+				continue;
+			}
+			else if (result == FRAME_PARSE_INVALID)
+			{
+				throw "Invalid frame!";
+			}
+			// Otherwise the frame straddles the end of the buffer, and has to
+			// be assembled a piece at a time.
+		}
+
+		if (mPartial == NULL)
+		{
+			std::size_t count = sizeof(mPartialHeader.fullHeader) - mPartialHeaderBytes;
+			count = count < length ? count : length;
+			memcpy(mPartialHeader.fullHeader + mPartialHeaderBytes, buffer, count);
+			mPartialHeaderBytes += count;
+			buffer += count;
+			length -= count;
+
+			if (mPartialHeaderBytes < sizeof(mPartialHeader.fullHeader))
+			{
+				break;
+			}
+			if (mPartialHeader.headerParts.RSV != 0)
+			{
+				throw "Invalid frame!";
+			}
+
+			mPartial = new Frame(mPartialHeader);
+			mPartial->parallelVerification(mVerificationPool, mParallelThreshold);
+			mPartial->stream(mSink, mStreamThreshold);
+			mPartial->maxLength(mMaxLength);
+			mPartialHeaderBytes = 0;
+		}
+
+		std::size_t consumed = mPartial->write(buffer, length);
+		buffer += consumed;
+		length -= consumed;
+
+		if (mPartial->complete())
+		{
+			if (!mPartial->streaming())
+			{
+				FrameView view(*mPartial);
+				mCallback(view);
+			}
+			frames++;
+
+			delete mPartial;
+			mPartial = NULL;
+		}
+	}
+
+	return frames;
+}
+
+int FrameReader::receive(Socket& socket, int timeout)
+{
+	RingBuffer& ring = socket.readAhead();
+	std::size_t frames = 0;
+
+	// Keep going until the socket has nothing more, so that one call fully
+	// handles an edge-triggered readiness notification.
+	while (true)
+	{
+		if (ring.empty())
+		{
+			int ret = socket.fill(timeout);
+			if (ret < 0)
+			{
+				return frames > 0 ? int(frames) : -1;
+			}
+			else if (ret == 0)
+			{
+				break;
+			}
+		}
+
+		iovec segments[2];
+		int count = ring.readable(segments);
+		std::size_t consumed = 0;
+		for (int i = 0; i < count; i++)
+		{
+			frames += read(static_cast<uint8_t*>(segments[i].iov_base), segments[i].iov_len);
+			consumed += segments[i].iov_len;
+		}
+		ring.consume(consumed);
+		timeout = 0;
+	}
+
+	return int(frames);
+}
+
+void FrameReader::parallelVerification(WorkerPool* pool, uint64_t threshold)
+{
+	mVerificationPool = pool;
+	mParallelThreshold = threshold;
+}
+
+void FrameReader::stream(const Frame::PayloadSink& sink, uint64_t threshold)
+{
+	mSink = sink;
+	mStreamThreshold = threshold;
+}
+
+void FrameReader::maxLength(uint64_t maxLength)
+{
+	mMaxLength = maxLength;
+}
+
+bool FrameReader::partial(void) const
+{
+	return mPartial != NULL || mPartialHeaderBytes != 0;
+}
@@ -0,0 +1,279 @@
+#include "FrameScheduler.h"
+#include "OutboundQueue.h"
+#include "Socket.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const uint8_t OPCODE_CONTINUATION = 0x0;
+	const uint8_t OPCODE_CLOSE = 0x8;
+
+	const unsigned FRAME_PRIORITY_WEIGHTS[FRAME_PRIORITIES] = {4, 2, 1};
+}
+
+FrameScheduler::FrameScheduler(OutboundQueue& outbound, Socket& socket, const Emitter& emitter):
+	mOutbound(outbound),
+	mSocket(socket),
+	mEmitter(emitter),
+	mQueues(),
+	mDeficit(),
+	mWeights(),
+	mTurn(0),
+	mCredited(false),
+	mTrain(-1),
+	mFixedFragment(0),
+	mFragment(FRAME_FRAGMENT_MIN),
+	mBytes(0),
+	mQueued(0),
+	mPumping(false),
+	mStats()
+{
+	memset(&mStats, 0, sizeof(mStats));
+	for (std::size_t i = 0; i < FRAME_PRIORITIES; i++)
+	{
+		mDeficit[i] = 0;
+		mWeights[i] = FRAME_PRIORITY_WEIGHTS[i];
+	}
+	measure();
+}
+
+void FrameScheduler::push(const std::shared_ptr<Frame>& frame, FramePriority priority, const SentCallback& sent)
+{
+	if (frame->opcode() >= OPCODE_CLOSE)
+	{
+		// Control frames are short and urgent; they go ahead of everything.
+		mStats.control++;
+		mOutbound.push(mEmitter(frame));
+		if (sent)
+		{
+			sent(frame.get());
+		}
+		return;
+	}
+
+	Pending pending;
+	pending.frame = frame;
+	pending.offset = 0;
+	pending.started = false;
+	pending.sent = sent;
+	mQueues[priority].push_back(pending);
+	mBytes += frame->size();
+	mQueued++;
+	mStats.messages++;
+	pump();
+}
+
+void FrameScheduler::pump(void)
+{
+	if (mPumping)
+	{
+		return;
+	}
+	mPumping = true;
+
+	// Deficit round robin: each class in turn is credited its weight in
+	// fragments, and sends until the next frame would cost more than it
+	// has left. Classes with nothing to send lose their credit.
+	std::size_t idle = 0;
+	while (mQueued > 0 && room() && idle < FRAME_PRIORITIES)
+	{
+		if (mQueues[mTurn].empty() || blocked(mTurn))
+		{
+			if (mQueues[mTurn].empty())
+			{
+				mDeficit[mTurn] = 0;
+			}
+			mCredited = false;
+			mTurn = (mTurn + 1) % FRAME_PRIORITIES;
+			idle++;
+			continue;
+		}
+
+		if (!mCredited)
+		{
+			mDeficit[mTurn] += uint64_t(mWeights[mTurn]) * mFragment;
+			mCredited = true;
+		}
+		if (cost(mQueues[mTurn].front()) > mDeficit[mTurn])
+		{
+			mCredited = false;
+			mTurn = (mTurn + 1) % FRAME_PRIORITIES;
+			continue;
+		}
+
+		idle = 0;
+		emit(mTurn);
+	}
+
+	mPumping = false;
+}
+
+void FrameScheduler::clear(void)
+{
+	// Callbacks may push again, so empty the queues before calling any.
+	std::vector<SentCallback> callbacks;
+	for (std::size_t i = 0; i < FRAME_PRIORITIES; i++)
+	{
+		for (std::size_t j = 0; j < mQueues[i].size(); j++)
+		{
+			if (!mQueues[i][j].started && mQueues[i][j].sent)
+			{
+				callbacks.push_back(mQueues[i][j].sent);
+			}
+		}
+		mQueues[i].clear();
+		mDeficit[i] = 0;
+	}
+	mTrain = -1;
+	mCredited = false;
+	mBytes = 0;
+	mQueued = 0;
+
+	for (std::size_t i = 0; i < callbacks.size(); i++)
+	{
+		callbacks[i](NULL);
+	}
+}
+
+std::size_t FrameScheduler::fragmentSize(void) const
+{
+	return mFragment;
+}
+
+void FrameScheduler::fragmentSize(std::size_t size)
+{
+	mFixedFragment = size;
+	measure();
+}
+
+void FrameScheduler::weight(FramePriority priority, unsigned weight)
+{
+	mWeights[priority] = weight > 0 ? weight : 1;
+}
+
+std::size_t FrameScheduler::queued(void) const
+{
+	return mQueued;
+}
+
+uint64_t FrameScheduler::bytes(void) const
+{
+	return mBytes;
+}
+
+const FrameSchedulerStats& FrameScheduler::stats(void) const
+{
+	return mStats;
+}
+
+bool FrameScheduler::room(void) const
+{
+	return mOutbound.size() < mFragment;
+}
+
+bool FrameScheduler::blocked(std::size_t priority) const
+{
+	// A long message cannot start while another is part way through.
+	const Pending& head = mQueues[priority].front();
+	return mTrain != -1 && std::size_t(mTrain) != priority && !head.started && head.frame->size() > mFragment;
+}
+
+uint64_t FrameScheduler::cost(const Pending& pending) const
+{
+	uint64_t remaining = pending.frame->size() - pending.offset;
+	return remaining < mFragment ? remaining : mFragment;
+}
+
+void FrameScheduler::emit(std::size_t priority)
+{
+	Pending& head = mQueues[priority].front();
+	std::shared_ptr<Frame> frame = head.frame;
+	uint64_t size = frame->size();
+	if (!head.started && size > mFragment)
+	{
+		// The send buffer may have grown since the last long message.
+		measure();
+	}
+
+	std::shared_ptr<Frame> piece = frame;
+	uint64_t length = size;
+	bool first = !head.started;
+	bool last = true;
+	if (head.started || size > mFragment)
+	{
+		length = size - head.offset < mFragment ? size - head.offset : mFragment;
+		last = head.offset + length == size;
+
+		// Pieces share the original's payload. The first carries its opcode
+		// and response ID, the rest are continuations, and the last its FIN.
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = last ? frame->header().headerParts.FIN : 0;
+		header.headerParts.Opcode = first ? frame->opcode() : OPCODE_CONTINUATION;
+		header.headerParts.Length = htons(FRAME_LENGTH_MAX);
+		piece.reset(new Frame(header));
+		piece->slice(frame, head.offset, length);
+		if (first && frame->header().headerParts.RSP)
+		{
+			piece->respondingTo(frame->respondingTo());
+		}
+		if (frame->header().headerParts.MASK)
+		{
+			piece->mask(frame->mask());
+		}
+
+		if (first)
+		{
+			mTrain = int(priority);
+			mStats.fragmented++;
+		}
+		mStats.fragments++;
+		head.offset += length;
+		head.started = true;
+	}
+
+	mOutbound.push(mEmitter(piece));
+	if (first && piece != frame)
+	{
+		// The message goes by the Message ID of its first fragment.
+		frame->messageID(piece->messageID());
+	}
+	mDeficit[priority] -= length < mDeficit[priority] ? length : mDeficit[priority];
+	mBytes -= length;
+	mStats.bytes[priority] += length;
+
+	SentCallback sent;
+	if (first)
+	{
+		sent.swap(head.sent);
+	}
+	if (last)
+	{
+		if (mTrain == int(priority))
+		{
+			mTrain = -1;
+		}
+		mQueues[priority].pop_front();
+		mQueued--;
+	}
+
+	// Last, as it may push more frames.
+	if (sent)
+	{
+		sent(frame.get());
+	}
+}
+
+void FrameScheduler::measure(void)
+{
+	std::size_t size = mFixedFragment;
+	if (size == 0)
+	{
+		int buffer = mSocket.sendBufferSize();
+		size = buffer > 0 ? std::size_t(buffer) : FRAME_FRAGMENT_MIN;
+	}
+	mFragment = size < FRAME_FRAGMENT_MIN ? FRAME_FRAGMENT_MIN : (size > FRAME_FRAGMENT_MAX ? FRAME_FRAGMENT_MAX : size);
+}
@@ -0,0 +1,271 @@
+#include "FrameView.h"
+#include "CRC.h"
+#include "Endian.h"
+
+#include <cstring>
+
+namespace
+{
+	uint32_t read32(const uint8_t* buffer)
+	{
+		uint32_t value;
+		memcpy(&value, buffer, sizeof(value));
+		return ntohl(value);
+	}
+
+	uint64_t read64(const uint8_t* buffer)
+	{
+		uint64_t value;
+		memcpy(&value, buffer, sizeof(value));
+		return ntohll(value);
+	}
+}
+
+FrameView::FrameView(void):
+	mHeader(),
+	mLength(0),
+	mMessageID(0),
+	mRespondingToID(0),
+	mMask(0),
+	mCRC(0),
+	mBuffer(NULL),
+	mPayload(NULL),
+	mHeaderLength(0),
+	mNeeded(0),
+	mUnmasked(false),
+	mVerified(false)
+{
+	// empty
+}
+
+FrameView::FrameView(const Frame& frame):
+	mHeader(frame.header()),
+	mLength(frame.size()),
+	mMessageID(frame.messageID()),
+	mRespondingToID(frame.respondingTo()),
+	mMask(frame.mask()),
+	mCRC(frame.crc()),
+	mBuffer(NULL),
+	mPayload(const_cast<uint8_t*>(frame.payload())),
+	mHeaderLength(0),
+	mNeeded(0),
+	/* A complete Frame has already been unmasked and verified. */
+	mUnmasked(true),
+	mVerified(true)
+{
+	uint8_t header[FRAME_HEADER_LENGTH_MAX];
+	mHeaderLength = frame.encodeHeader(header);
+}
+
+FrameParseResult FrameView::parse(uint8_t* buffer, std::size_t length)
+{
+	mBuffer = NULL;
+	mPayload = NULL;
+	mUnmasked = false;
+	mVerified = false;
+
+	if (length < sizeof(mHeader.fullHeader))
+	{
+		mNeeded = sizeof(mHeader.fullHeader);
+		return FRAME_PARSE_INCOMPLETE;
+	}
+
+	memcpy(mHeader.fullHeader, buffer, sizeof(mHeader.fullHeader));
+	if (mHeader.headerParts.RSV != 0)
+	{
+		return FRAME_PARSE_INVALID;
+	}
+
+	uint16_t shortLength = ntohs(mHeader.headerParts.Length);
+	bool extended = shortLength == FRAME_LENGTH_MAX;
+
+	// Every optional field's presence is known from the first 4 bytes, so the
+	// whole header can be sized (and bounds checked) up front.
+	std::size_t headerLength = sizeof(mHeader.fullHeader) +
+		(extended ? sizeof(uint64_t) : 0) +
+		sizeof(mMessageID) +
+		(mHeader.headerParts.RSP ? sizeof(mRespondingToID) : 0) +
+		(mHeader.headerParts.MASK ? sizeof(mMask) : 0) +
+		sizeof(mCRC);
+	if (length < headerLength)
+	{
+		mNeeded = headerLength;
+		return FRAME_PARSE_INCOMPLETE;
+	}
+
+	const uint8_t* cursor = buffer + sizeof(mHeader.fullHeader);
+	if (extended)
+	{
+		mLength = read64(cursor);
+		cursor += sizeof(uint64_t);
+		if (mLength < FRAME_LENGTH_MAX)
+		{
+			// Only one encoding of a length is valid, so the CRC (taken over
+			// the header as received) matches what Frame would re-encode.
+			return FRAME_PARSE_INVALID;
+		}
+	}
+	else
+	{
+		mLength = shortLength;
+	}
+
+	mMessageID = read32(cursor);
+	cursor += sizeof(mMessageID);
+
+	mRespondingToID = 0;
+	if (mHeader.headerParts.RSP)
+	{
+		mRespondingToID = read32(cursor);
+		cursor += sizeof(mRespondingToID);
+	}
+
+	mMask = 0;
+	if (mHeader.headerParts.MASK)
+	{
+		mMask = read32(cursor);
+		cursor += sizeof(mMask);
+	}
+
+	mCRC = read32(cursor);
+	mHeaderLength = headerLength;
+
+	if (mLength > length - headerLength)
+	{
+		mNeeded = mLength > uint64_t(-1) - headerLength ? uint64_t(-1) : headerLength + mLength;
+		return FRAME_PARSE_INCOMPLETE;
+	}
+
+	mBuffer = buffer;
+	mPayload = buffer + headerLength;
+	mNeeded = 0;
+	return FRAME_PARSE_COMPLETE;
+}
+
+bool FrameView::verify(void)
+{
+	if (mVerified)
+	{
+		return true;
+	}
+	if (mBuffer == NULL)
+	{
+		return false;
+	}
+
+	const static uint32_t blankCRC = 0;
+	std::size_t crcOffset = mHeaderLength - sizeof(mCRC);
+	uint32_t calculatedCrc = CRC32::calculate(0, mBuffer, crcOffset);
+	calculatedCrc = CRC32::calculate(calculatedCrc, &blankCRC, sizeof(blankCRC));
+	if (mHeader.headerParts.MASK && !mUnmasked)
+	{
+		calculatedCrc = CRC32::calculateMasked(calculatedCrc, mPayload, mLength, mMask);
+		mUnmasked = true;
+	}
+	else
+	{
+		calculatedCrc = CRC32::calculate(calculatedCrc, mPayload, mLength);
+	}
+
+	mVerified = calculatedCrc == mCRC;
+	return mVerified;
+}
+
+const FrameHeader& FrameView::header(void) const
+{
+	return mHeader;
+}
+
+uint8_t FrameView::opcode(void) const
+{
+	return mHeader.headerParts.Opcode;
+}
+
+uint64_t FrameView::size(void) const
+{
+	return mLength;
+}
+
+uint32_t FrameView::messageID(void) const
+{
+	return mMessageID;
+}
+
+uint32_t FrameView::respondingTo(void) const
+{
+	return mRespondingToID;
+}
+
+uint32_t FrameView::mask(void) const
+{
+	return mMask;
+}
+
+uint32_t FrameView::crc(void) const
+{
+	return mCRC;
+}
+
+const uint8_t* FrameView::payload(void) const
+{
+	return mPayload;
+}
+
+std::shared_ptr<Frame> FrameView::copy(void) const
+{
+	std::shared_ptr<Frame> result(new Frame(mHeader));
+	if (result->size() != mLength)
+	{
+		result->size(mLength);
+	}
+	if (mLength > 0 && mPayload)
+	{
+		memcpy(result->payload(), mPayload, mLength);
+	}
+	result->messageID(mMessageID);
+	if (mHeader.headerParts.RSP)
+	{
+		result->respondingTo(mRespondingToID);
+	}
+	if (mHeader.headerParts.MASK)
+	{
+		result->mask(mMask);
+	}
+	return result;
+}
+
+FrameView FrameView::inner(uint8_t opcode, uint8_t* payload, uint64_t length) const
+{
+	FrameView result(*this);
+	result.mHeader.headerParts.Opcode = opcode;
+	result.mHeader.headerParts.Length = htons(uint16_t(length < FRAME_LENGTH_MAX ? length : FRAME_LENGTH_MAX));
+	result.mHeader.headerParts.MASK = 0;
+	result.mLength = length;
+	result.mMask = 0;
+	result.mBuffer = NULL;
+	result.mPayload = payload;
+	result.mHeaderLength = sizeof(mHeader.fullHeader) +
+		(length >= FRAME_LENGTH_MAX ? sizeof(uint64_t) : 0) +
+		sizeof(mMessageID) +
+		(mHeader.headerParts.RSP ? sizeof(mRespondingToID) : 0) +
+		sizeof(mCRC);
+	result.mNeeded = 0;
+	result.mUnmasked = true;
+	result.mVerified = true;
+	return result;
+}
+
+std::size_t FrameView::headerLength(void) const
+{
+	return mHeaderLength;
+}
+
+uint64_t FrameView::frameLength(void) const
+{
+	return mHeaderLength + mLength;
+}
+
+uint64_t FrameView::needed(void) const
+{
+	return mNeeded;
+}
@@ -0,0 +1,331 @@
+#include "MessageAssembler.h"
+#include "BufferPool.h"
+
+#include <cstring>
+
+namespace
+{
+	const uint8_t OPCODE_CONTINUATION = 0x0;
+}
+
+Message::Message(void):
+	mHeader(),
+	mMessageID(0),
+	mRespondingTo(0),
+	mSize(0),
+	mPieces(),
+	mBuffers(),
+	mFrames(),
+	mChunk(NULL),
+	mChunkFree(0),
+	mStats(NULL)
+{
+	memset(&mHeader, 0, sizeof(mHeader));
+}
+
+Message::~Message(void)
+{
+	release();
+}
+
+uint8_t Message::opcode(void) const
+{
+	return mHeader.headerParts.Opcode;
+}
+
+const FrameHeader& Message::header(void) const
+{
+	return mHeader;
+}
+
+uint32_t Message::messageID(void) const
+{
+	return mMessageID;
+}
+
+uint32_t Message::respondingTo(void) const
+{
+	return mRespondingTo;
+}
+
+uint64_t Message::size(void) const
+{
+	return mSize;
+}
+
+const std::vector<struct iovec>& Message::pieces(void) const
+{
+	return mPieces;
+}
+
+const uint8_t* Message::flatten(void)
+{
+	if (mPieces.size() == 1)
+	{
+		return static_cast<const uint8_t*>(mPieces[0].iov_base);
+	}
+	if (mPieces.empty())
+	{
+		return NULL;
+	}
+
+	std::size_t length = std::size_t(mSize);
+	uint8_t* flat = BufferPool::allocate(length);
+	uint8_t* cursor = flat;
+	for (std::size_t i = 0; i < mPieces.size(); i++)
+	{
+		memcpy(cursor, mPieces[i].iov_base, mPieces[i].iov_len);
+		cursor += mPieces[i].iov_len;
+	}
+
+	// Only ever hold the message once.
+	uint64_t size = mSize;
+	release();
+	mBuffers.push_back(std::make_pair(flat, length));
+	reference(flat, length);
+	mSize = size;
+	if (mStats)
+	{
+		mStats->flattened++;
+	}
+	return flat;
+}
+
+void Message::start(const FrameView& frame)
+{
+	release();
+	mHeader = frame.header();
+	mMessageID = frame.messageID();
+	mRespondingTo = frame.respondingTo();
+}
+
+void Message::append(const uint8_t* data, std::size_t length)
+{
+	while (length > 0)
+	{
+		if (mChunkFree == 0)
+		{
+			if (length >= MESSAGE_CHUNK_SIZE)
+			{
+				// Big enough for a buffer of its own.
+				uint8_t* buffer = BufferPool::allocate(length);
+				memcpy(buffer, data, length);
+				mBuffers.push_back(std::make_pair(buffer, length));
+				reference(buffer, length);
+				return;
+			}
+			mChunk = BufferPool::allocate(MESSAGE_CHUNK_SIZE);
+			mChunkFree = MESSAGE_CHUNK_SIZE;
+			mBuffers.push_back(std::make_pair(mChunk, MESSAGE_CHUNK_SIZE));
+		}
+
+		std::size_t used = length < mChunkFree ? length : mChunkFree;
+		uint8_t* at = mChunk + (MESSAGE_CHUNK_SIZE - mChunkFree);
+		memcpy(at, data, used);
+		reference(at, used);
+		mChunkFree -= used;
+		data += used;
+		length -= used;
+	}
+}
+
+void Message::reference(const uint8_t* data, std::size_t length)
+{
+	mSize += length;
+	if (length == 0)
+	{
+		return;
+	}
+
+	// Fragments copied back to back into a chunk make a single piece.
+	if (!mPieces.empty())
+	{
+		struct iovec& last = mPieces.back();
+		if (static_cast<const uint8_t*>(last.iov_base) + last.iov_len == data)
+		{
+			last.iov_len += length;
+			return;
+		}
+	}
+
+	struct iovec piece;
+	piece.iov_base = const_cast<uint8_t*>(data);
+	piece.iov_len = length;
+	mPieces.push_back(piece);
+}
+
+void Message::release(void)
+{
+	for (std::size_t i = 0; i < mBuffers.size(); i++)
+	{
+		BufferPool::release(mBuffers[i].first, mBuffers[i].second);
+	}
+	mBuffers.clear();
+	mFrames.clear();
+	mPieces.clear();
+	mSize = 0;
+	mChunk = NULL;
+	mChunkFree = 0;
+}
+
+MessageAssembler::MessageAssembler(uint64_t maxLength):
+	mMessage(),
+	mInterleaved(),
+	mTarget(&mMessage),
+	mComplete(NULL),
+	mMaxLength(maxLength),
+	mAssembling(false),
+	mDiscarding(false),
+	mStats()
+{
+	memset(&mStats, 0, sizeof(mStats));
+	mMessage.mStats = &mStats;
+	mInterleaved.mStats = &mStats;
+}
+
+AssemblyResult MessageAssembler::add(const FrameView& frame)
+{
+	bool whole = frame.opcode() != OPCODE_CONTINUATION && frame.header().headerParts.FIN;
+	AssemblyResult result = begin(frame);
+	if (result != ASSEMBLY_INCOMPLETE)
+	{
+		return result;
+	}
+
+	if (whole)
+	{
+		// Nothing to reassemble; the message is the frame, where it lies.
+		mTarget->reference(frame.payload(), std::size_t(frame.size()));
+	}
+	else
+	{
+		mTarget->append(frame.payload(), std::size_t(frame.size()));
+		mStats.copiedBytes += frame.size();
+	}
+	return finish(frame);
+}
+
+AssemblyResult MessageAssembler::add(const std::shared_ptr<const Frame>& frame)
+{
+	FrameView view(*frame);
+	AssemblyResult result = begin(view);
+	if (result != ASSEMBLY_INCOMPLETE)
+	{
+		return result;
+	}
+
+	std::size_t length = std::size_t(frame->size());
+	if (frame->payload())
+	{
+		mTarget->mFrames.push_back(frame);
+		mTarget->reference(frame->payload(), length);
+		mStats.chainedBytes += length;
+	}
+	else
+	{
+		// Streamed or file-backed; the payload has to be brought in.
+		uint8_t* buffer = BufferPool::allocate(length);
+		frame->copyPayload(buffer, 0, length);
+		mTarget->mBuffers.push_back(std::make_pair(buffer, length));
+		mTarget->reference(buffer, length);
+		mStats.copiedBytes += length;
+	}
+	return finish(view);
+}
+
+Message& MessageAssembler::message(void)
+{
+	return mComplete ? *mComplete : mMessage;
+}
+
+bool MessageAssembler::assembling(void) const
+{
+	return mAssembling;
+}
+
+uint64_t MessageAssembler::buffered(void) const
+{
+	return mAssembling ? mMessage.size() : 0;
+}
+
+uint64_t MessageAssembler::maxLength(void) const
+{
+	return mMaxLength;
+}
+
+void MessageAssembler::maxLength(uint64_t maxLength)
+{
+	mMaxLength = maxLength;
+}
+
+const AssemblyStats& MessageAssembler::stats(void) const
+{
+	return mStats;
+}
+
+AssemblyResult MessageAssembler::begin(const FrameView& frame)
+{
+	mStats.fragments++;
+	if (mComplete)
+	{
+		mComplete->release();
+		mComplete = NULL;
+	}
+
+	bool final = frame.header().headerParts.FIN;
+	mTarget = &mMessage;
+	if (frame.opcode() != OPCODE_CONTINUATION && final && (mAssembling || mDiscarding))
+	{
+		// Sent in between the fragments of the message in progress.
+		mTarget = &mInterleaved;
+		mInterleaved.start(frame);
+	}
+	else if (frame.opcode() != OPCODE_CONTINUATION)
+	{
+		if (mAssembling)
+		{
+			// The last message never finished.
+			mStats.discarded++;
+		}
+		mAssembling = true;
+		mDiscarding = false;
+		mMessage.start(frame);
+	}
+	else if (mDiscarding)
+	{
+		mDiscarding = !final;
+		return ASSEMBLY_DISCARDED;
+	}
+	else if (!mAssembling)
+	{
+		return ASSEMBLY_INVALID;
+	}
+
+	if (mTarget->size() + frame.size() > mMaxLength)
+	{
+		mTarget->release();
+		if (mTarget == &mMessage)
+		{
+			mAssembling = false;
+			mDiscarding = !final;
+		}
+		mStats.discarded++;
+		return ASSEMBLY_TOO_LONG;
+	}
+	return ASSEMBLY_INCOMPLETE;
+}
+
+AssemblyResult MessageAssembler::finish(const FrameView& frame)
+{
+	if (!frame.header().headerParts.FIN)
+	{
+		return ASSEMBLY_INCOMPLETE;
+	}
+	if (mTarget == &mMessage)
+	{
+		mAssembling = false;
+	}
+	mComplete = mTarget;
+	mStats.messages++;
+	return ASSEMBLY_COMPLETE;
+}
@@ -0,0 +1,261 @@
+#include "OutboundQueue.h"
+#include "BufferPool.h"
+#include "EventLoop.h"
+#include "Mask.h"
+#include "Socket.h"
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+namespace
+{
+	// File payloads which cannot be sendfile()d are copied this much at a time.
+	const std::size_t OUTBOUND_FILE_CHUNK = 16 * 1024;
+
+	// Most masked payload bytes to mask for a single gather write.
+	const std::size_t OUTBOUND_MASK_BYTES = 4 * FRAME_MASK_CHUNK;
+
+	const uint8_t OPCODE_CLOSE = 0x8;
+	const uint8_t OPCODE_PING = 0x9;
+}
+
+OutboundQueue::OutboundQueue(Socket& socket, EventLoop* loop, std::size_t flushBytes, int flushDelay):
+	mSocket(socket),
+	mLoop(loop),
+	mFlushBytes(flushBytes),
+	mFlushDelay(flushDelay),
+	mQueue(),
+	mBytes(0),
+	mSent(0),
+	mScheduled(false),
+	mDrained(),
+	mLowWater(0),
+	mSelf(new OutboundQueue*(this))
+{
+}
+
+OutboundQueue::~OutboundQueue(void)
+{
+	*mSelf = NULL;
+}
+
+void OutboundQueue::push(const std::shared_ptr<const Frame>& frame)
+{
+	mQueue.push_back(Entry());
+	Entry& entry = mQueue.back();
+	entry.headerLength = frame->encode(entry.header);
+	entry.frame = frame;
+	entry.length = frame->size();
+	entry.payload = frame->payload();
+	entry.masked = frame->header().headerParts.MASK && entry.length > 0;
+	entry.file = !entry.masked && frame->file() != -1;
+
+	mBytes += entry.headerLength + entry.length;
+
+	uint8_t opcode = frame->opcode();
+	if (opcode == OPCODE_CLOSE || opcode == OPCODE_PING || mBytes >= mFlushBytes)
+	{
+		flush();
+	}
+	else
+	{
+		schedule();
+	}
+}
+
+ssize_t OutboundQueue::flush(void)
+{
+	iovec segments[IOV_MAX];
+	iovec scratch[IOV_MAX / 2];
+	ssize_t total = 0;
+
+	while (!mQueue.empty())
+	{
+		std::size_t batch = 0;
+		ssize_t sent = 0;
+		int scratchCount = 0;
+		Entry& front = mQueue.front();
+		if (front.file && mSent >= front.headerLength)
+		{
+			sent = sendFile(front, batch);
+		}
+		else
+		{
+			int count = 0;
+			std::size_t maskBudget = OUTBOUND_MASK_BYTES;
+			for (std::size_t i = 0; i < mQueue.size() && count + 2 <= IOV_MAX; i++)
+			{
+				// Only the front entry can have been partly written already.
+				Entry& entry = mQueue[i];
+				uint64_t written = i == 0 ? mSent : 0;
+				std::size_t headerSkip = written < entry.headerLength ? std::size_t(written) : entry.headerLength;
+				uint64_t offset = written - headerSkip;
+
+				segments[count].iov_base = entry.header + headerSkip;
+				segments[count].iov_len = entry.headerLength - headerSkip;
+
+				bool more = false;
+				if (entry.file)
+				{
+					segments[count + 1].iov_base = NULL;
+					segments[count + 1].iov_len = 0;
+				}
+				else if (!entry.masked)
+				{
+					segments[count + 1].iov_base = const_cast<uint8_t*>(entry.payload) + offset;
+					segments[count + 1].iov_len = std::size_t(entry.length - offset);
+				}
+				else
+				{
+					// The frame keeps its payload unmasked, so mask the next
+					// piece of it into scratch space of our own.
+					uint64_t remaining = entry.length - offset;
+					std::size_t piece = remaining < FRAME_MASK_CHUNK ? std::size_t(remaining) : FRAME_MASK_CHUNK;
+					piece = piece < maskBudget ? piece : maskBudget;
+					uint8_t* buffer = BufferPool::allocate(piece);
+					entry.frame->copyPayload(buffer, offset, piece);
+					applyMask(buffer, piece, entry.frame->mask(), offset);
+					scratch[scratchCount].iov_base = buffer;
+					scratch[scratchCount].iov_len = piece;
+					scratchCount++;
+
+					segments[count + 1].iov_base = buffer;
+					segments[count + 1].iov_len = piece;
+					maskBudget -= piece;
+					more = piece < remaining || maskBudget == 0;
+				}
+				batch += segments[count].iov_len + segments[count + 1].iov_len;
+				count += 2;
+
+				if (entry.file || more)
+				{
+					// The batch stops at a file's header, as its payload
+					// follows with sendfile, or once no more may be masked.
+					break;
+				}
+			}
+			sent = mSocket.send(segments, count, false);
+		}
+
+		for (int i = 0; i < scratchCount; i++)
+		{
+			BufferPool::release(static_cast<uint8_t*>(scratch[i].iov_base), scratch[i].iov_len);
+		}
+
+		if (sent < 0)
+		{
+			return -1;
+		}
+
+		total += sent;
+		advance(sent);
+
+		if (std::size_t(sent) < batch)
+		{
+			// The socket is full; EPOLLOUT will tell the owner when to retry.
+			break;
+		}
+	}
+
+	if (mDrained && mBytes <= mLowWater)
+	{
+		mDrained();
+	}
+	return total;
+}
+
+void OutboundQueue::drained(const std::function<void(void)>& callback, std::size_t lowWater)
+{
+	mDrained = callback;
+	mLowWater = lowWater;
+}
+
+std::size_t OutboundQueue::size(void) const
+{
+	return mBytes;
+}
+
+std::size_t OutboundQueue::frames(void) const
+{
+	return mQueue.size();
+}
+
+ssize_t OutboundQueue::sendFile(Entry& entry, std::size_t& batch)
+{
+	const Frame& frame = *entry.frame;
+	uint64_t done = mSent - entry.headerLength;
+	uint64_t remaining = entry.length - done;
+	batch = remaining < SSIZE_MAX ? std::size_t(remaining) : SSIZE_MAX;
+
+	off_t position = frame.fileOffset() + off_t(done);
+	ssize_t sent = mSocket.sendFile(frame.file(), position, batch, false);
+	if (sent == -1)
+	{
+		// sendfile cannot read this descriptor, so copy through user space.
+		uint8_t chunk[OUTBOUND_FILE_CHUNK];
+		batch = batch < sizeof(chunk) ? batch : sizeof(chunk);
+		try
+		{
+			frame.copyPayload(chunk, done, batch);
+		}
+		catch (const char* error)
+		{
+			// The file ended early; the frame can never be finished.
+			return -1;
+		}
+
+		iovec segment;
+		segment.iov_base = chunk;
+		segment.iov_len = batch;
+		sent = mSocket.send(&segment, 1, false);
+	}
+	else if (sent >= 0 && std::size_t(sent) < batch)
+	{
+		// Short because the socket is full, or because the file has shrunk
+		// since the frame was queued; no EPOLLOUT would ever come for that.
+		struct stat status;
+		if (::fstat(frame.file(), &status) == -1 ||
+			(S_ISREG(status.st_mode) && uint64_t(status.st_size) < uint64_t(position) + (batch - std::size_t(sent))))
+		{
+			cerr << "Frame payload file fd=" << frame.file() << " ended " << (batch - std::size_t(sent)) << " bytes early" << endl;
+			return -1;
+		}
+	}
+	return sent;
+}
+
+void OutboundQueue::advance(std::size_t sent)
+{
+	mBytes -= sent;
+	uint64_t written = mSent + sent;
+	while (!mQueue.empty() && written >= mQueue.front().headerLength + mQueue.front().length)
+	{
+		written -= mQueue.front().headerLength + mQueue.front().length;
+		mQueue.pop_front();
+	}
+	mSent = written;
+}
+
+void OutboundQueue::schedule(void)
+{
+	if (!mLoop || mScheduled)
+	{
+		return;
+	}
+
+	mScheduled = true;
+	std::shared_ptr<OutboundQueue*> self = mSelf;
+	mLoop->defer([self](void)
+	{
+		OutboundQueue* queue = *self;
+		if (queue)
+		{
+			queue->mScheduled = false;
+			queue->flush();
+		}
+	}, mFlushDelay);
+}
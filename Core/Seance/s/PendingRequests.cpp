@@ -0,0 +1,160 @@
+#include "PendingRequests.h"
+
+#include <utility>
+
+PendingRequests::PendingRequests(std::size_t capacity):
+	mSlots(),
+	mMask(0),
+	mSize(0)
+{
+	std::size_t slots = 1;
+	while (slots < capacity)
+	{
+		slots <<= 1;
+	}
+	mSlots.resize(slots);
+	mMask = slots - 1;
+}
+
+bool PendingRequests::insert(uint32_t id, const Callback& callback, TimerHandle timer)
+{
+	if (find(id) != mSlots.size())
+	{
+		return false;
+	}
+
+	if ((mSize + 1) * 2 > mSlots.size())
+	{
+		grow();
+	}
+
+	std::size_t index = id & mMask;
+	while (mSlots[index].used)
+	{
+		index = (index + 1) & mMask;
+	}
+
+	Slot& slot = mSlots[index];
+	slot.id = id;
+	slot.used = true;
+	slot.timer = timer;
+	slot.callback = callback;
+	mSize++;
+	return true;
+}
+
+bool PendingRequests::contains(uint32_t id) const
+{
+	return find(id) != mSlots.size();
+}
+
+bool PendingRequests::take(uint32_t id, Callback& callback, TimerHandle& timer)
+{
+	std::size_t index = find(id);
+	if (index == mSlots.size())
+	{
+		return false;
+	}
+
+	callback = std::move(mSlots[index].callback);
+	timer = mSlots[index].timer;
+	erase(index);
+	return true;
+}
+
+void PendingRequests::clear(std::vector<Callback>& callbacks, std::vector<TimerHandle>& timers)
+{
+	for (std::size_t i = 0; i < mSlots.size(); i++)
+	{
+		if (mSlots[i].used)
+		{
+			callbacks.push_back(std::move(mSlots[i].callback));
+			timers.push_back(mSlots[i].timer);
+			mSlots[i].callback = Callback();
+			mSlots[i].used = false;
+		}
+	}
+	mSize = 0;
+}
+
+uint32_t PendingRequests::nextID(uint32_t& next, uint32_t half) const
+{
+	uint32_t fixed = next & half;
+	uint32_t id = next;
+
+	// Only possible after wrapping with a request still outstanding from the
+	// previous lap; skip past it rather than confuse the two responses.
+	while (contains(id))
+	{
+		id = fixed | ((id + 1) & ~half);
+	}
+
+	next = fixed | ((id + 1) & ~half);
+	return id;
+}
+
+std::size_t PendingRequests::size(void) const
+{
+	return mSize;
+}
+
+std::size_t PendingRequests::capacity(void) const
+{
+	return mSlots.size();
+}
+
+std::size_t PendingRequests::find(uint32_t id) const
+{
+	// At least half the slots are always free, so the probe terminates.
+	for (std::size_t index = id & mMask; mSlots[index].used; index = (index + 1) & mMask)
+	{
+		if (mSlots[index].id == id)
+		{
+			return index;
+		}
+	}
+	return mSlots.size();
+}
+
+void PendingRequests::erase(std::size_t index)
+{
+	mSlots[index].used = false;
+	mSlots[index].callback = Callback();
+	mSize--;
+
+	// Pull back any later entry of the run whose home slot is at or before
+	// the hole, so that lookups never stop short of it.
+	std::size_t hole = index;
+	for (std::size_t next = (hole + 1) & mMask; mSlots[next].used; next = (next + 1) & mMask)
+	{
+		std::size_t home = mSlots[next].id & mMask;
+		if (((next - home) & mMask) >= ((next - hole) & mMask))
+		{
+			mSlots[hole] = std::move(mSlots[next]);
+			mSlots[next].used = false;
+			mSlots[next].callback = Callback();
+			hole = next;
+		}
+	}
+}
+
+void PendingRequests::grow(void)
+{
+	std::vector<Slot> old;
+	old.swap(mSlots);
+	mSlots.resize(old.size() * 2);
+	mMask = mSlots.size() - 1;
+
+	for (std::size_t i = 0; i < old.size(); i++)
+	{
+		if (old[i].used)
+		{
+			std::size_t index = old[i].id & mMask;
+			while (mSlots[index].used)
+			{
+				index = (index + 1) & mMask;
+			}
+			mSlots[index] = std::move(old[i]);
+		}
+	}
+}
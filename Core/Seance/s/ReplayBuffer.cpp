@@ -0,0 +1,233 @@
+#include "ReplayBuffer.h"
+#include "Endian.h"
+#include "FrameView.h"
+
+#include <cstring>
+
+namespace
+{
+	// Message IDs wrap within their half of the 32 bit space.
+	const uint32_t REPLAY_ID_MASK = 0x7FFFFFFF;
+	const uint32_t REPLAY_ID_WINDOW = 0x40000000;
+
+	const uint8_t REPLAY_RECORDED = 0x1;
+	const uint8_t REPLAY_EVICTED = 0x2;
+
+	uint32_t distance(uint32_t from, uint32_t to)
+	{
+		return (to - from) & REPLAY_ID_MASK;
+	}
+
+	// Serial number comparison (as RFC 1982), so that IDs either side of a
+	// wrap still compare the right way round.
+	bool after(uint32_t id, uint32_t reference)
+	{
+		uint32_t gap = distance(reference, id);
+		return gap != 0 && gap < REPLAY_ID_WINDOW;
+	}
+}
+
+ReplayBuffer::ReplayBuffer(std::size_t budget):
+	mEntries(),
+	mBudget(budget),
+	mBytes(0),
+	mRecorded(false),
+	mNewest(0),
+	mEvicted(false),
+	mEvictedThrough(0),
+	mStats()
+{
+	memset(&mStats, 0, sizeof(mStats));
+}
+
+void ReplayBuffer::record(const std::shared_ptr<const Frame>& frame)
+{
+	Entry entry;
+	entry.id = frame->messageID();
+	entry.bytes = sizeof(Frame) + frame->size();
+	entry.frame = frame;
+	mEntries.push_back(entry);
+
+	mBytes += entry.bytes;
+	mRecorded = true;
+	mNewest = entry.id;
+	mStats.recorded++;
+
+	// Always keep the newest frame, however large.
+	while (mBytes > mBudget && mEntries.size() > 1)
+	{
+		evict();
+	}
+}
+
+void ReplayBuffer::acknowledge(uint32_t id)
+{
+	while (!mEntries.empty() && !after(mEntries.front().id, id))
+	{
+		mBytes -= mEntries.front().bytes;
+		mEntries.pop_front();
+		mStats.acknowledged++;
+	}
+}
+
+bool ReplayBuffer::replay(uint32_t lastSeen, std::vector<std::shared_ptr<const Frame> >& frames)
+{
+	if (mEvicted && after(mEvictedThrough, lastSeen))
+	{
+		mStats.resyncs++;
+		return false;
+	}
+	if (mEntries.empty())
+	{
+		return true;
+	}
+
+	// IDs are normally consecutive, so the first frame to resend is found
+	// directly; anything else falls back to a scan.
+	std::size_t start = 0;
+	uint32_t first = mEntries.front().id;
+	if (!after(first, lastSeen))
+	{
+		start = std::size_t(distance(first, lastSeen)) + 1;
+		bool found = start == mEntries.size() ? !after(mEntries.back().id, lastSeen) :
+			start < mEntries.size() && after(mEntries[start].id, lastSeen) && !after(mEntries[start - 1].id, lastSeen);
+		if (!found)
+		{
+			start = 0;
+			while (start < mEntries.size() && !after(mEntries[start].id, lastSeen))
+			{
+				start++;
+			}
+		}
+	}
+
+	for (std::size_t i = start; i < mEntries.size(); i++)
+	{
+		frames.push_back(mEntries[i].frame);
+	}
+	mStats.replayed += mEntries.size() - start;
+	return true;
+}
+
+bool ReplayBuffer::empty(void) const
+{
+	return !mRecorded;
+}
+
+uint32_t ReplayBuffer::newest(void) const
+{
+	return mNewest;
+}
+
+std::size_t ReplayBuffer::size(void) const
+{
+	return mBytes;
+}
+
+std::size_t ReplayBuffer::frames(void) const
+{
+	return mEntries.size();
+}
+
+std::size_t ReplayBuffer::budget(void) const
+{
+	return mBudget;
+}
+
+void ReplayBuffer::budget(std::size_t budget)
+{
+	mBudget = budget;
+	while (mBytes > mBudget && mEntries.size() > 1)
+	{
+		evict();
+	}
+}
+
+const ReplayStats& ReplayBuffer::stats(void) const
+{
+	return mStats;
+}
+
+std::size_t ReplayBuffer::savedSize(void) const
+{
+	std::size_t length = REPLAY_SAVED_HEADER;
+	uint8_t header[FRAME_HEADER_LENGTH_MAX];
+	for (std::size_t i = 0; i < mEntries.size(); i++)
+	{
+		length += mEntries[i].frame->encodeHeader(header) + std::size_t(mEntries[i].frame->size());
+	}
+	return length;
+}
+
+void ReplayBuffer::save(uint8_t* buffer) const
+{
+	uint64_t budget = htonll(uint64_t(mBudget));
+	uint32_t newest = htonl(mNewest);
+	uint32_t evictedThrough = htonl(mEvictedThrough);
+	memcpy(buffer, &budget, sizeof(budget));
+	memcpy(buffer + 8, &newest, sizeof(newest));
+	memcpy(buffer + 12, &evictedThrough, sizeof(evictedThrough));
+	buffer[16] = (mRecorded ? REPLAY_RECORDED : 0) | (mEvicted ? REPLAY_EVICTED : 0);
+	buffer += REPLAY_SAVED_HEADER;
+
+	for (std::size_t i = 0; i < mEntries.size(); i++)
+	{
+		const Frame& frame = *mEntries[i].frame;
+		buffer += frame.encodeHeader(buffer);
+		frame.copyPayload(buffer, 0, std::size_t(frame.size()));
+		buffer += frame.size();
+	}
+}
+
+std::shared_ptr<ReplayBuffer> ReplayBuffer::load(uint8_t* buffer, std::size_t length)
+{
+	if (length < REPLAY_SAVED_HEADER)
+	{
+		throw "Malformed replay buffer";
+	}
+
+	uint64_t budget;
+	uint32_t newest;
+	uint32_t evictedThrough;
+	memcpy(&budget, buffer, sizeof(budget));
+	memcpy(&newest, buffer + 8, sizeof(newest));
+	memcpy(&evictedThrough, buffer + 12, sizeof(evictedThrough));
+
+	std::shared_ptr<ReplayBuffer> result(new ReplayBuffer(std::size_t(ntohll(budget))));
+	result->mNewest = ntohl(newest);
+	result->mEvictedThrough = ntohl(evictedThrough);
+	result->mRecorded = (buffer[16] & REPLAY_RECORDED) != 0;
+	result->mEvicted = (buffer[16] & REPLAY_EVICTED) != 0;
+
+	// The payloads were saved unmasked, so the views are copied as they are
+	// rather than verified.
+	std::size_t offset = REPLAY_SAVED_HEADER;
+	FrameView view;
+	while (offset < length)
+	{
+		if (view.parse(buffer + offset, length - offset) != FRAME_PARSE_COMPLETE)
+		{
+			throw "Malformed replay buffer";
+		}
+
+		Entry entry;
+		entry.id = view.messageID();
+		entry.bytes = sizeof(Frame) + view.size();
+		entry.frame = view.copy();
+		result->mEntries.push_back(entry);
+		result->mBytes += entry.bytes;
+		offset += std::size_t(view.frameLength());
+	}
+	return result;
+}
+
+void ReplayBuffer::evict(void)
+{
+	const Entry& oldest = mEntries.front();
+	mBytes -= oldest.bytes;
+	mEvicted = true;
+	mEvictedThrough = oldest.id;
+	mStats.evicted++;
+	mStats.evictedBytes += oldest.bytes;
+	mEntries.pop_front();
+}
@@ -0,0 +1,894 @@
+#include "Seance.h"
+#include "Endian.h"
+#include "EventLoop.h"
+#include "Socket.h"
+
+#include <cstring>
+#include <iostream>
+#include <time.h>
+using namespace std;
+
+namespace
+{
+	const uint32_t SEANCE_ID_MASK = ~SEANCE_SERVER_ID_BIT;
+
+	const uint8_t OPCODE_CONTINUATION = 0x0;
+	const uint8_t OPCODE_BINARY = 0x2;
+	const uint8_t OPCODE_EXTENSION = 0x3;
+	const uint8_t OPCODE_CLOSE = 0x8;
+	const uint8_t OPCODE_PING = 0x9;
+	const uint8_t OPCODE_SESSION = 0xA;
+	const uint8_t OPCODE_NEGOTIATE = 0xB;
+
+	std::shared_ptr<Frame> controlFrame(uint8_t opcode, std::size_t length)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = opcode;
+		header.headerParts.Length = htons(uint16_t(length));
+		return std::shared_ptr<Frame>(new Frame(header));
+	}
+
+	std::shared_ptr<Frame> sessionFrame(std::size_t length)
+	{
+		return controlFrame(OPCODE_SESSION, length);
+	}
+
+	std::shared_ptr<Frame> negotiateFrame(const ExtensionChanges& changes)
+	{
+		std::shared_ptr<Frame> frame = controlFrame(OPCODE_NEGOTIATE, changes.size() * EXTENSION_RECORD_LENGTH);
+		uint8_t* record = frame->payload();
+		for (std::size_t i = 0; i < changes.size(); i++, record += EXTENSION_RECORD_LENGTH)
+		{
+			uint64_t id = htonll(changes[i].first);
+			memcpy(record, &id, sizeof(id));
+			record[sizeof(id)] = changes[i].second ? 1 : 0;
+		}
+		return frame;
+	}
+
+	void negotiateRecords(const FrameView& frame, ExtensionChanges& changes)
+	{
+		const uint8_t* record = frame.payload();
+		for (uint64_t i = 0; i < frame.size() / EXTENSION_RECORD_LENGTH; i++, record += EXTENSION_RECORD_LENGTH)
+		{
+			uint64_t id;
+			memcpy(&id, record, sizeof(id));
+			changes.push_back(std::make_pair(ntohll(id), record[sizeof(id)] != 0));
+		}
+	}
+
+	int64_t monotonicMicroseconds(void)
+	{
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+	}
+}
+
+Seance::Seance(Socket& socket, EventLoop& loop, SeanceRole role, const FrameCallback& callback):
+	mSocket(socket),
+	mLoop(loop),
+	mRole(role),
+	mCallback(callback),
+	mOutbound(socket, &loop),
+	mScheduler(mOutbound, socket, [this](const std::shared_ptr<Frame>& frame)
+	{
+		return emit(frame);
+	}),
+	mReader([this](FrameView& frame)
+	{
+		deliver(frame);
+	}),
+	mPending(),
+	mMessageCallback(),
+	mAssembler(),
+	mResponses(),
+	mResponseHead(),
+	mResponseTrain(false),
+	mReplay(),
+	mExtensions(),
+	mEnabled(),
+	mCompression(),
+	mNextID(role == SEANCE_SERVER ? SEANCE_SERVER_ID_BIT : 0),
+	// Just before the peer's first ID, so a new session asks for everything.
+	mLastReceived(role == SEANCE_SERVER ? SEANCE_ID_MASK : SEANCE_SERVER_ID_BIT | SEANCE_ID_MASK),
+	mKeepaliveInterval(0),
+	mKeepaliveTimeout(SEANCE_KEEPALIVE_TIMEOUT),
+	mKeepalive(TIMER_NONE),
+	mPinging(false),
+	mLastHeard(monotonicMicroseconds()),
+	mLastRTT(-1),
+	mRTT(-1),
+	mBudget(&SendBudget::global()),
+	mBudgetWait(0),
+	mCharged(0),
+	mHighWater(SEANCE_HIGH_WATER),
+	mLowWater(SEANCE_LOW_WATER),
+	mWritable(true),
+	mBackpressure(),
+	mWriters(),
+	mOpen(true),
+	mSelf(new Seance*(this))
+{
+	// Top the queue up from the scheduler after every write, and see whether
+	// that changed how writable we are.
+	mOutbound.drained([this](void)
+	{
+		mScheduler.pump();
+		pressure();
+	}, SIZE_MAX);
+
+	if (mLoop.add(&mSocket, EPOLLIN | EPOLLOUT | EPOLLRDHUP, [this](Socket& socket, uint32_t events)
+	{
+		ready(events);
+	}) == -1)
+	{
+		mOpen = false;
+	}
+}
+
+Seance::~Seance(void)
+{
+	close();
+	*mSelf = NULL;
+}
+
+void Seance::send(const std::shared_ptr<Frame>& frame, FramePriority priority)
+{
+	if (!mOpen)
+	{
+		// The socket has left the loop; nothing more may be sent on it.
+		return;
+	}
+	mScheduler.push(frame, priority);
+	pressure();
+}
+
+void Seance::request(const std::shared_ptr<Frame>& frame, const ResponseCallback& callback, int timeout, FramePriority priority)
+{
+	if (!mOpen)
+	{
+		callback(NULL);
+		return;
+	}
+
+	// The ID is only known once the frame goes out, so the request is filed
+	// (and its timeout started) then.
+	mScheduler.push(frame, priority, [this, callback, timeout](const Frame* sent)
+	{
+		if (!sent)
+		{
+			callback(NULL);
+			return;
+		}
+
+		uint32_t id = sent->messageID();
+		std::shared_ptr<Seance*> self = mSelf;
+		TimerHandle timer = mLoop.schedule(timeout, [self, id](void)
+		{
+			Seance* seance = *self;
+			if (seance)
+			{
+				seance->expire(id);
+			}
+		});
+		mPending.insert(id, callback, timer);
+	});
+	pressure();
+}
+
+std::future<std::shared_ptr<Frame> > Seance::request(const std::shared_ptr<Frame>& frame, int timeout, FramePriority priority)
+{
+	// std::function must be copyable, so the promise is shared.
+	std::shared_ptr<std::promise<std::shared_ptr<Frame> > > promise(new std::promise<std::shared_ptr<Frame> >());
+	std::future<std::shared_ptr<Frame> > result = promise->get_future();
+
+	std::shared_ptr<Seance*> self = mSelf;
+	mLoop.post([self, frame, promise, timeout, priority](void)
+	{
+		Seance* seance = *self;
+		if (!seance)
+		{
+			promise->set_exception(std::make_exception_ptr("Seance closed"));
+			return;
+		}
+
+		seance->request(frame, [promise](const FrameView* response)
+		{
+			if (response)
+			{
+				promise->set_value(response->copy());
+			}
+			else
+			{
+				promise->set_exception(std::make_exception_ptr("No response to request"));
+			}
+		}, timeout, priority);
+	});
+
+	return result;
+}
+
+void Seance::respond(const FrameView& request, const std::shared_ptr<Frame>& response, FramePriority priority)
+{
+	if (!mOpen)
+	{
+		return;
+	}
+	response->respondingTo(request.messageID());
+	send(response, priority);
+}
+
+void Seance::close(void)
+{
+	if (!mOpen)
+	{
+		return;
+	}
+	mOpen = false;
+
+	// Fails the requests which never went out.
+	mScheduler.clear();
+	mOutbound.flush();
+	mLoop.remove(&mSocket);
+	mLoop.cancel(mKeepalive);
+	mKeepalive = TIMER_NONE;
+
+	// Whatever is still queued may never go out; stop charging for it.
+	if (mBudgetWait != 0)
+	{
+		mBudget->cancel(mBudgetWait);
+		mBudgetWait = 0;
+	}
+	mBudget->credit(mCharged);
+	mCharged = 0;
+
+	// Callbacks may issue new requests (which fail straight away), so gather
+	// them all before calling any.
+	std::vector<ResponseCallback> callbacks;
+	std::vector<TimerHandle> timers;
+	mPending.clear(callbacks, timers);
+	for (std::size_t i = 0; i < timers.size(); i++)
+	{
+		mLoop.cancel(timers[i]);
+	}
+	for (std::size_t i = 0; i < callbacks.size(); i++)
+	{
+		callbacks[i](NULL);
+	}
+
+	std::deque<WritableCallback> writers;
+	writers.swap(mWriters);
+	for (std::size_t i = 0; i < writers.size(); i++)
+	{
+		writers[i](false);
+	}
+}
+
+void Seance::replay(const std::shared_ptr<ReplayBuffer>& buffer)
+{
+	mReplay = buffer;
+	if (mReplay && !mReplay->empty() && (mReplay->newest() & SEANCE_SERVER_ID_BIT) == (mNextID & SEANCE_SERVER_ID_BIT))
+	{
+		mNextID = (mNextID & SEANCE_SERVER_ID_BIT) | ((mReplay->newest() + 1) & SEANCE_ID_MASK);
+	}
+}
+
+const std::shared_ptr<ReplayBuffer>& Seance::replayBuffer(void) const
+{
+	return mReplay;
+}
+
+void Seance::resume(uint64_t session, uint32_t lastReceived, const std::function<void(bool resumed)>& callback)
+{
+	mLastReceived = lastReceived;
+
+	std::shared_ptr<Frame> frame = sessionFrame(SEANCE_RESUME_LENGTH);
+	uint64_t networkSession = htonll(session);
+	uint32_t networkID = htonl(lastReceived);
+	memcpy(frame->payload(), &networkSession, sizeof(networkSession));
+	memcpy(frame->payload() + sizeof(networkSession), &networkID, sizeof(networkID));
+
+	request(frame, [this, callback](const FrameView* response)
+	{
+		if (!response || response->size() < SEANCE_RESUMED_LENGTH)
+		{
+			callback(false);
+			return;
+		}
+
+		uint32_t networkID;
+		memcpy(&networkID, response->payload() + 1, sizeof(networkID));
+		bool replayed = replayAfter(ntohl(networkID));
+		callback(replayed && response->payload()[0] == SEANCE_RESUMED);
+	});
+}
+
+uint32_t Seance::lastReceived(void) const
+{
+	return mLastReceived;
+}
+
+void Seance::extensions(const std::shared_ptr<ExtensionTable>& table)
+{
+	mExtensions = table;
+}
+
+const std::shared_ptr<ExtensionTable>& Seance::extensions(void) const
+{
+	return mExtensions;
+}
+
+bool Seance::enabled(uint64_t id) const
+{
+	return mExtensions && mExtensions->enabled(mEnabled, id);
+}
+
+void Seance::negotiate(const ExtensionChanges& changes, const std::function<void(bool answered, const ExtensionChanges& agreed)>& callback)
+{
+	request(negotiateFrame(changes), [this, callback](const FrameView* response)
+	{
+		ExtensionChanges agreed;
+		if (!response)
+		{
+			callback(false, agreed);
+			return;
+		}
+
+		negotiateRecords(*response, agreed);
+		if (mExtensions)
+		{
+			mExtensions->apply(agreed, mEnabled);
+		}
+		callback(true, agreed);
+	});
+}
+
+void Seance::messages(const MessageCallback& callback, uint64_t maxLength)
+{
+	mMessageCallback = callback;
+	mAssembler.maxLength(maxLength);
+}
+
+void Seance::compression(const std::shared_ptr<Compression>& context)
+{
+	mCompression = context;
+}
+
+const std::shared_ptr<Compression>& Seance::compression(void) const
+{
+	return mCompression;
+}
+
+void Seance::inject(FrameView& frame)
+{
+	deliver(frame);
+}
+
+void Seance::keepalive(int interval, int timeout)
+{
+	mLoop.cancel(mKeepalive);
+	mKeepalive = TIMER_NONE;
+	mKeepaliveInterval = interval;
+	mKeepaliveTimeout = timeout;
+
+	if (mOpen && interval > 0)
+	{
+		std::shared_ptr<Seance*> self = mSelf;
+		mKeepalive = mLoop.schedule(interval, [self](void)
+		{
+			Seance* seance = *self;
+			if (seance)
+			{
+				seance->idle();
+			}
+		}, interval / 8);
+	}
+}
+
+void Seance::ping(void)
+{
+	FrameHeader header;
+	memset(&header, 0, sizeof(header));
+	header.headerParts.FIN = 1;
+	header.headerParts.Opcode = OPCODE_PING;
+
+	mPinging = true;
+	int64_t sent = monotonicMicroseconds();
+	request(std::shared_ptr<Frame>(new Frame(header)), [this, sent](const FrameView* response)
+	{
+		mPinging = false;
+		if (!response)
+		{
+			if (mOpen)
+			{
+				cerr << "Closing Seance on fd=" << mSocket.descriptor() << ": Ping went unanswered" << endl;
+				close();
+			}
+			return;
+		}
+
+		mLastRTT = monotonicMicroseconds() - sent;
+		mRTT = mRTT == -1 ? mLastRTT : mRTT + (mLastRTT - mRTT) / 8;
+	}, mKeepaliveTimeout);
+}
+
+int64_t Seance::lastRTT(void) const
+{
+	return mLastRTT;
+}
+
+int64_t Seance::rtt(void) const
+{
+	return mRTT;
+}
+
+std::size_t Seance::queued(void) const
+{
+	return std::size_t(mScheduler.bytes()) + mOutbound.size();
+}
+
+void Seance::watermarks(std::size_t highWater, std::size_t lowWater)
+{
+	mHighWater = highWater;
+	mLowWater = lowWater < highWater ? lowWater : highWater;
+	pressure();
+}
+
+void Seance::budget(SendBudget& budget)
+{
+	if (mBudgetWait != 0)
+	{
+		mBudget->cancel(mBudgetWait);
+		mBudgetWait = 0;
+	}
+	mBudget->credit(mCharged);
+	mCharged = 0;
+	mBudget = &budget;
+	pressure();
+}
+
+bool Seance::writable(void) const
+{
+	return mOpen && mWritable;
+}
+
+void Seance::backpressure(const BackpressureCallback& callback)
+{
+	mBackpressure = callback;
+}
+
+void Seance::whenWritable(const WritableCallback& callback)
+{
+	if (!mOpen)
+	{
+		callback(false);
+	}
+	else if (mWritable && mWriters.empty())
+	{
+		callback(true);
+	}
+	else
+	{
+		mWriters.push_back(callback);
+	}
+}
+
+std::future<bool> Seance::whenWritable(void)
+{
+	std::shared_ptr<std::promise<bool> > promise(new std::promise<bool>());
+	std::future<bool> result = promise->get_future();
+
+	std::shared_ptr<Seance*> self = mSelf;
+	mLoop.post([self, promise](void)
+	{
+		Seance* seance = *self;
+		if (!seance)
+		{
+			promise->set_value(false);
+			return;
+		}
+
+		seance->whenWritable([promise](bool open)
+		{
+			promise->set_value(open);
+		});
+	});
+
+	return result;
+}
+
+bool Seance::open(void) const
+{
+	return mOpen;
+}
+
+std::size_t Seance::pending(void) const
+{
+	return mPending.size();
+}
+
+SeanceRole Seance::role(void) const
+{
+	return mRole;
+}
+
+OutboundQueue& Seance::outbound(void)
+{
+	return mOutbound;
+}
+
+FrameScheduler& Seance::scheduler(void)
+{
+	return mScheduler;
+}
+
+FrameReader& Seance::reader(void)
+{
+	return mReader;
+}
+
+MessageAssembler& Seance::assembler(void)
+{
+	return mAssembler;
+}
+
+uint32_t Seance::nextID(void)
+{
+	return mPending.nextID(mNextID, SEANCE_SERVER_ID_BIT);
+}
+
+std::shared_ptr<Frame> Seance::emit(const std::shared_ptr<Frame>& frame)
+{
+	std::shared_ptr<Frame> outgoing = frame;
+	if (mCompression && enabled(COMPRESSION_EXTENSION_ID))
+	{
+		outgoing = mCompression->compress(frame);
+	}
+
+	uint32_t id = nextID();
+	frame->messageID(id);
+	outgoing->messageID(id);
+	if (mReplay && outgoing->opcode() < OPCODE_CLOSE)
+	{
+		// Control frames only mean anything on the connection they were
+		// sent on.
+		mReplay->record(outgoing);
+	}
+	return outgoing;
+}
+
+void Seance::ready(uint32_t events)
+{
+	if (events & EPOLLOUT)
+	{
+		if (mOutbound.flush() == -1)
+		{
+			close();
+			return;
+		}
+	}
+
+	if (events & (EPOLLIN | EPOLLRDHUP))
+	{
+		if (mKeepaliveInterval > 0)
+		{
+			mLastHeard = monotonicMicroseconds();
+		}
+
+		int ret;
+		try
+		{
+			ret = mReader.receive(mSocket, 0);
+		}
+		catch (const char* error)
+		{
+			cerr << "Closing Seance on fd=" << mSocket.descriptor() << ": " << error << endl;
+			ret = -1;
+		}
+
+		if (ret == -1 || !mSocket.connected())
+		{
+			close();
+		}
+	}
+}
+
+void Seance::deliver(FrameView& frame)
+{
+	// The peer numbers its frames from the other half of the ID space.
+	uint32_t peerHalf = mRole == SEANCE_SERVER ? 0 : SEANCE_SERVER_ID_BIT;
+	if ((frame.messageID() & SEANCE_SERVER_ID_BIT) != peerHalf)
+	{
+		cerr << "Dropping frame with Message ID " << frame.messageID() << " from the wrong side of the connection" << endl;
+		return;
+	}
+
+	if (frame.opcode() < OPCODE_CLOSE)
+	{
+		mLastReceived = frame.messageID();
+	}
+
+	// Only one message is ever part way through, so while a response is
+	// the continuations are all its own.
+	if (mResponseTrain && frame.opcode() == OPCODE_CONTINUATION)
+	{
+		responded(frame);
+		return;
+	}
+
+	// Before anything else, as an extension frame may wrap a response.
+	if (frame.opcode() == OPCODE_EXTENSION && mExtensions && mExtensions->dispatch(*this, frame, mEnabled))
+	{
+		return;
+	}
+
+	ResponseCallback callback;
+	TimerHandle timer;
+	if (frame.header().headerParts.RSP)
+	{
+		// The stream is ordered, so the peer also has everything before the
+		// frame it is answering.
+		if (mReplay)
+		{
+			mReplay->acknowledge(frame.respondingTo());
+		}
+		if (!frame.header().headerParts.FIN && mPending.contains(frame.respondingTo()))
+		{
+			// A long response, fragmented by the peer's FrameScheduler; the
+			// request is finished once the whole of it is here.
+			mResponseTrain = true;
+			mResponseHead = frame;
+			responded(frame);
+			return;
+		}
+		if (mPending.take(frame.respondingTo(), callback, timer))
+		{
+			mLoop.cancel(timer);
+			callback(&frame);
+			return;
+		}
+	}
+	else if (frame.opcode() == OPCODE_PING)
+	{
+		respond(frame, frame.copy());
+		return;
+	}
+	else if (frame.opcode() == OPCODE_SESSION)
+	{
+		if (mCallback)
+		{
+			mCallback(*this, frame);
+		}
+		resumed(frame);
+		return;
+	}
+	else if (frame.opcode() == OPCODE_NEGOTIATE)
+	{
+		negotiated(frame);
+		return;
+	}
+
+	if (mMessageCallback && frame.opcode() <= OPCODE_BINARY)
+	{
+		AssemblyResult result = mAssembler.add(frame);
+		if (result == ASSEMBLY_COMPLETE)
+		{
+			mMessageCallback(*this, mAssembler.message());
+		}
+		else if (result == ASSEMBLY_TOO_LONG)
+		{
+			cerr << "Discarding message " << frame.messageID() << ", longer than " << mAssembler.maxLength() << " bytes" << endl;
+		}
+		else if (result == ASSEMBLY_INVALID)
+		{
+			cerr << "Dropping continuation frame " << frame.messageID() << " with no message to continue" << endl;
+		}
+		return;
+	}
+
+	if (mCallback)
+	{
+		mCallback(*this, frame);
+	}
+}
+
+void Seance::responded(FrameView& fragment)
+{
+	AssemblyResult result = mResponses.add(fragment);
+	if (fragment.header().headerParts.FIN)
+	{
+		mResponseTrain = false;
+	}
+	if (result != ASSEMBLY_COMPLETE && result != ASSEMBLY_TOO_LONG)
+	{
+		return;
+	}
+
+	ResponseCallback callback;
+	TimerHandle timer;
+	if (!mPending.take(mResponseHead.respondingTo(), callback, timer))
+	{
+		// The request timed out while its response was arriving.
+		return;
+	}
+	mLoop.cancel(timer);
+
+	if (result == ASSEMBLY_TOO_LONG)
+	{
+		cerr << "Discarding response to " << mResponseHead.respondingTo() << ", longer than " << mResponses.maxLength() << " bytes" << endl;
+		callback(NULL);
+		return;
+	}
+
+	// The response as one frame: the first fragment's header over the whole
+	// payload.
+	Message& message = mResponses.message();
+	FrameView response = mResponseHead.inner(mResponseHead.opcode(), const_cast<uint8_t*>(message.flatten()), message.size());
+	callback(&response);
+}
+
+void Seance::expire(uint32_t id)
+{
+	ResponseCallback callback;
+	TimerHandle timer;
+	if (mPending.take(id, callback, timer))
+	{
+		callback(NULL);
+	}
+}
+
+void Seance::idle(void)
+{
+	mKeepalive = TIMER_NONE;
+	if (!mOpen || mKeepaliveInterval <= 0)
+	{
+		return;
+	}
+
+	// Only wake again once the connection could next have been quiet for a
+	// whole interval, however much traffic there was in between.
+	int64_t quiet = (monotonicMicroseconds() - mLastHeard) / 1000;
+	int64_t wait = mKeepaliveInterval - quiet;
+	if (wait <= 0)
+	{
+		if (!mPinging)
+		{
+			ping();
+		}
+		wait = mKeepaliveInterval;
+	}
+
+	std::shared_ptr<Seance*> self = mSelf;
+	mKeepalive = mLoop.schedule(int(wait), [self](void)
+	{
+		Seance* seance = *self;
+		if (seance)
+		{
+			seance->idle();
+		}
+	}, mKeepaliveInterval / 8);
+}
+
+void Seance::resumed(const FrameView& frame)
+{
+	uint8_t status = SEANCE_RESYNC;
+	if (frame.size() >= SEANCE_RESUME_LENGTH)
+	{
+		uint32_t networkID;
+		memcpy(&networkID, frame.payload() + sizeof(uint64_t), sizeof(networkID));
+		if (replayAfter(ntohl(networkID)))
+		{
+			status = SEANCE_RESUMED;
+		}
+	}
+
+	// Answered after the replay, so that the peer sees Message IDs in order.
+	std::shared_ptr<Frame> response = sessionFrame(SEANCE_RESUMED_LENGTH);
+	uint32_t networkID = htonl(mLastReceived);
+	response->payload()[0] = status;
+	memcpy(response->payload() + 1, &networkID, sizeof(networkID));
+	respond(frame, response);
+}
+
+void Seance::negotiated(const FrameView& frame)
+{
+	ExtensionChanges changes;
+	ExtensionChanges result;
+	negotiateRecords(frame, changes);
+	if (mExtensions)
+	{
+		mExtensions->apply(changes, mEnabled, &result);
+	}
+	else
+	{
+		for (std::size_t i = 0; i < changes.size(); i++)
+		{
+			result.push_back(std::make_pair(changes[i].first, false));
+		}
+	}
+	respond(frame, negotiateFrame(result));
+}
+
+bool Seance::replayAfter(uint32_t lastSeen)
+{
+	if (!mReplay)
+	{
+		return false;
+	}
+
+	mReplay->acknowledge(lastSeen);
+	std::vector<std::shared_ptr<const Frame> > frames;
+	if (!mReplay->replay(lastSeen, frames))
+	{
+		return false;
+	}
+
+	// Resent as they are, Message IDs and all; the OutboundQueue only
+	// references them.
+	for (std::size_t i = 0; i < frames.size(); i++)
+	{
+		mOutbound.push(frames[i]);
+	}
+	return true;
+}
+
+void Seance::pressure(void)
+{
+	if (!mOpen)
+	{
+		return;
+	}
+
+	std::size_t queued = this->queued();
+	if (queued > mCharged)
+	{
+		mBudget->charge(queued - mCharged);
+	}
+	else if (queued < mCharged)
+	{
+		mBudget->credit(mCharged - queued);
+	}
+	mCharged = queued;
+
+	bool exhausted = mBudget->exhausted();
+	if (exhausted && mBudgetWait == 0)
+	{
+		// Told on whichever thread frees the budget up; look again from ours.
+		std::shared_ptr<Seance*> self = mSelf;
+		EventLoop* loop = &mLoop;
+		mBudgetWait = mBudget->wait([self, loop](void)
+		{
+			loop->post([self](void)
+			{
+				Seance* seance = *self;
+				if (seance)
+				{
+					seance->mBudgetWait = 0;
+					seance->pressure();
+				}
+			});
+		});
+	}
+
+	bool writable = !exhausted && (mWritable ? queued < mHighWater : queued <= mLowWater);
+	if (writable == mWritable)
+	{
+		return;
+	}
+	mWritable = writable;
+	if (mBackpressure)
+	{
+		mBackpressure(*this, writable);
+	}
+
+	// Each may queue enough to make us unwritable again.
+	while (mOpen && mWritable && !mWriters.empty())
+	{
+		WritableCallback callback = mWriters.front();
+		mWriters.pop_front();
+		callback(true);
+	}
+}
@@ -0,0 +1,109 @@
+#include "SendBudget.h"
+
+SendBudget::SendBudget(std::size_t limit):
+	mUsed(0),
+	mLimit(limit),
+	mWaiting(false),
+	mLock(),
+	mWaiters(),
+	mNextHandle(1)
+{
+}
+
+SendBudget& SendBudget::global(void)
+{
+	static SendBudget oGlobal;
+	return oGlobal;
+}
+
+void SendBudget::charge(std::size_t bytes)
+{
+	mUsed.fetch_add(bytes);
+}
+
+void SendBudget::credit(std::size_t bytes)
+{
+	mUsed.fetch_sub(bytes);
+	if (mWaiting.load() && recovered())
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		if (recovered())
+		{
+			wake();
+		}
+	}
+}
+
+bool SendBudget::exhausted(void) const
+{
+	return mUsed.load() > mLimit.load();
+}
+
+uint64_t SendBudget::wait(const Waiter& waiter)
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	uint64_t handle = mNextHandle++;
+	mWaiters.push_back(std::make_pair(handle, waiter));
+	mWaiting.store(true);
+
+	// Credits may have landed since the caller saw the budget exhausted.
+	if (recovered())
+	{
+		wake();
+	}
+	return handle;
+}
+
+void SendBudget::cancel(uint64_t handle)
+{
+	std::lock_guard<std::mutex> guard(mLock);
+	for (std::size_t i = 0; i < mWaiters.size(); i++)
+	{
+		if (mWaiters[i].first == handle)
+		{
+			mWaiters.erase(mWaiters.begin() + i);
+			break;
+		}
+	}
+	mWaiting.store(!mWaiters.empty());
+}
+
+std::size_t SendBudget::used(void) const
+{
+	return mUsed.load();
+}
+
+std::size_t SendBudget::limit(void) const
+{
+	return mLimit.load();
+}
+
+void SendBudget::limit(std::size_t limit)
+{
+	mLimit.store(limit);
+	if (mWaiting.load() && recovered())
+	{
+		std::lock_guard<std::mutex> guard(mLock);
+		if (recovered())
+		{
+			wake();
+		}
+	}
+}
+
+bool SendBudget::recovered(void) const
+{
+	std::size_t limit = mLimit.load();
+	return mUsed.load() <= limit - limit / 4;
+}
+
+void SendBudget::wake(void)
+{
+	std::vector<std::pair<uint64_t, Waiter> > waiters;
+	waiters.swap(mWaiters);
+	mWaiting.store(false);
+	for (std::size_t i = 0; i < waiters.size(); i++)
+	{
+		waiters[i].second();
+	}
+}
@@ -0,0 +1,536 @@
+#include "SessionStore.h"
+
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <unordered_set>
+#include <time.h>
+#include <unistd.h>
+using namespace std;
+
+namespace
+{
+	// Spill files grow by doubling, from at least this.
+	const uint64_t SESSION_SPILL_MINIMUM = 1024 * 1024;
+
+	// Stale parking order entries tolerated beyond one per session.
+	const std::size_t SESSION_ORDER_SLACK = 64;
+
+	uint32_t monotonicSeconds(void)
+	{
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return uint32_t(now.tv_sec);
+	}
+
+	// Tokens may well be sequential; spread them over shards and slots.
+	uint64_t mix(uint64_t token)
+	{
+		token ^= token >> 30;
+		token *= 0xbf58476d1ce4e5b9ULL;
+		token ^= token >> 27;
+		token *= 0x94d049bb133111ebULL;
+		return token ^ (token >> 31);
+	}
+
+	uint64_t pageSize(void)
+	{
+		static const uint64_t oPageSize = uint64_t(::sysconf(_SC_PAGESIZE));
+		return oPageSize;
+	}
+}
+
+SessionStore::SessionStore(const char* spillDirectory, std::size_t shards, uint32_t spillAge):
+	mShards(),
+	mSpillDirectory(spillDirectory ? spillDirectory : ""),
+	mSpillAge(spillAge)
+{
+	if (shards == 0)
+	{
+		shards = std::thread::hardware_concurrency();
+		shards = shards == 0 ? 1 : shards;
+	}
+
+	for (std::size_t i = 0; i < shards; i++)
+	{
+		Shard* shard = new Shard();
+		shard->entries.resize(SESSION_SHARD_CAPACITY);
+		shard->buffers.resize(SESSION_SHARD_CAPACITY);
+		shard->mask = SESSION_SHARD_CAPACITY - 1;
+		shard->count = 0;
+		shard->spilled = 0;
+		shard->file = -1;
+		shard->mapping = NULL;
+		shard->capacity = 0;
+		shard->end = 0;
+		shard->used = 0;
+		memset(&shard->stats, 0, sizeof(shard->stats));
+		mShards.push_back(shard);
+	}
+}
+
+SessionStore::~SessionStore(void)
+{
+	for (std::size_t i = 0; i < mShards.size(); i++)
+	{
+		Shard* shard = mShards[i];
+		if (shard->mapping)
+		{
+			::munmap(shard->mapping, shard->capacity);
+		}
+		if (shard->file != -1)
+		{
+			::close(shard->file);
+		}
+		delete shard;
+	}
+	mShards.clear();
+}
+
+void SessionStore::park(uint64_t token, const std::shared_ptr<ReplayBuffer>& replay, uint32_t lastReceived)
+{
+	Shard& owner = shard(token);
+	std::lock_guard<std::mutex> lock(owner.lock);
+
+	std::size_t index = find(owner, token);
+	if (index != owner.entries.size())
+	{
+		// Replaced; whatever was parked before is simply dropped.
+		if (owner.entries[index].length > 0)
+		{
+			release(owner, owner.entries[index].offset, owner.entries[index].length);
+			owner.stats.onDisk--;
+		}
+		else
+		{
+			owner.stats.resident--;
+		}
+		erase(owner, index);
+	}
+
+	Entry entry;
+	entry.token = token;
+	entry.offset = 0;
+	entry.length = 0;
+	entry.parked = monotonicSeconds();
+	entry.lastReceived = lastReceived;
+	entry.used = 1;
+	insert(owner, entry, replay);
+	owner.order.push_back(std::make_pair(entry.parked, token));
+	compact(owner);
+
+	owner.stats.parked++;
+	owner.stats.resident++;
+}
+
+bool SessionStore::claim(uint64_t token, std::shared_ptr<ReplayBuffer>& replay, uint32_t& lastReceived)
+{
+	Shard& owner = shard(token);
+	std::lock_guard<std::mutex> lock(owner.lock);
+
+	std::size_t index = find(owner, token);
+	if (index == owner.entries.size())
+	{
+		return false;
+	}
+
+	Entry entry = owner.entries[index];
+	if (entry.length > 0)
+	{
+		try
+		{
+			replay = fault(owner, entry);
+		}
+		catch (const char* error)
+		{
+			cerr << "Unable to read back session " << token << ": " << error << endl;
+			replay.reset();
+		}
+		release(owner, entry.offset, entry.length);
+		owner.stats.faulted++;
+		owner.stats.onDisk--;
+	}
+	else
+	{
+		replay = owner.buffers[index];
+		owner.stats.resident--;
+	}
+	lastReceived = entry.lastReceived;
+	erase(owner, index);
+	compact(owner);
+
+	owner.stats.claimed++;
+	return true;
+}
+
+bool SessionStore::contains(uint64_t token)
+{
+	Shard& owner = shard(token);
+	std::lock_guard<std::mutex> lock(owner.lock);
+	return find(owner, token) != owner.entries.size();
+}
+
+std::size_t SessionStore::spill(void)
+{
+	if (mSpillDirectory.empty())
+	{
+		return 0;
+	}
+
+	std::size_t spilled = 0;
+	uint32_t now = monotonicSeconds();
+	for (std::size_t i = 0; i < mShards.size(); i++)
+	{
+		Shard& owner = *mShards[i];
+		std::lock_guard<std::mutex> lock(owner.lock);
+
+		// Everything in front of the first young session is old enough, but
+		// may have been claimed or parked again since.
+		for (; owner.spilled < owner.order.size(); owner.spilled++)
+		{
+			const std::pair<uint32_t, uint64_t>& parked = owner.order[owner.spilled];
+			if (now - parked.first < mSpillAge)
+			{
+				break;
+			}
+
+			std::size_t index = find(owner, parked.second);
+			if (index == owner.entries.size() || owner.entries[index].parked != parked.first || owner.entries[index].length > 0)
+			{
+				continue;
+			}
+			if (!spillEntry(owner, index))
+			{
+				break;
+			}
+			spilled++;
+		}
+	}
+	return spilled;
+}
+
+std::size_t SessionStore::expire(uint32_t maxAge)
+{
+	std::size_t expired = 0;
+	uint32_t now = monotonicSeconds();
+	for (std::size_t i = 0; i < mShards.size(); i++)
+	{
+		Shard& owner = *mShards[i];
+		std::lock_guard<std::mutex> lock(owner.lock);
+
+		while (!owner.order.empty() && now - owner.order.front().first >= maxAge)
+		{
+			std::pair<uint32_t, uint64_t> parked = owner.order.front();
+			owner.order.pop_front();
+			owner.spilled = owner.spilled > 0 ? owner.spilled - 1 : 0;
+
+			std::size_t index = find(owner, parked.second);
+			if (index == owner.entries.size() || owner.entries[index].parked != parked.first)
+			{
+				continue;
+			}
+
+			if (owner.entries[index].length > 0)
+			{
+				release(owner, owner.entries[index].offset, owner.entries[index].length);
+				owner.stats.onDisk--;
+			}
+			else
+			{
+				owner.stats.resident--;
+			}
+			erase(owner, index);
+			owner.stats.expired++;
+			expired++;
+		}
+	}
+	return expired;
+}
+
+std::size_t SessionStore::size(void)
+{
+	std::size_t total = 0;
+	for (std::size_t i = 0; i < mShards.size(); i++)
+	{
+		std::lock_guard<std::mutex> lock(mShards[i]->lock);
+		total += mShards[i]->count;
+	}
+	return total;
+}
+
+std::size_t SessionStore::shards(void) const
+{
+	return mShards.size();
+}
+
+SessionStoreStats SessionStore::stats(void)
+{
+	SessionStoreStats total;
+	memset(&total, 0, sizeof(total));
+	for (std::size_t i = 0; i < mShards.size(); i++)
+	{
+		std::lock_guard<std::mutex> lock(mShards[i]->lock);
+		const SessionStoreStats& stats = mShards[i]->stats;
+		total.parked += stats.parked;
+		total.claimed += stats.claimed;
+		total.expired += stats.expired;
+		total.spilled += stats.spilled;
+		total.faulted += stats.faulted;
+		total.resident += stats.resident;
+		total.onDisk += stats.onDisk;
+		total.spilledBytes += mShards[i]->used;
+	}
+	return total;
+}
+
+SessionStore::Shard& SessionStore::shard(uint64_t token)
+{
+	return *mShards[(mix(token) >> 48) % mShards.size()];
+}
+
+std::size_t SessionStore::find(const Shard& shard, uint64_t token)
+{
+	// The table is never more than half full, so the probe terminates.
+	for (std::size_t index = mix(token) & shard.mask; shard.entries[index].used; index = (index + 1) & shard.mask)
+	{
+		if (shard.entries[index].token == token)
+		{
+			return index;
+		}
+	}
+	return shard.entries.size();
+}
+
+void SessionStore::insert(Shard& shard, const Entry& entry, const std::shared_ptr<ReplayBuffer>& buffer)
+{
+	if ((shard.count + 1) * 2 > shard.entries.size())
+	{
+		grow(shard);
+	}
+
+	std::size_t index = mix(entry.token) & shard.mask;
+	while (shard.entries[index].used)
+	{
+		index = (index + 1) & shard.mask;
+	}
+	shard.entries[index] = entry;
+	shard.buffers[index] = buffer;
+	shard.count++;
+}
+
+void SessionStore::erase(Shard& shard, std::size_t index)
+{
+	shard.entries[index].used = 0;
+	shard.buffers[index].reset();
+	shard.count--;
+
+	// Backward shift, as PendingRequests, so that no tombstones build up.
+	std::size_t hole = index;
+	for (std::size_t next = (hole + 1) & shard.mask; shard.entries[next].used; next = (next + 1) & shard.mask)
+	{
+		std::size_t home = mix(shard.entries[next].token) & shard.mask;
+		if (((next - home) & shard.mask) >= ((next - hole) & shard.mask))
+		{
+			shard.entries[hole] = shard.entries[next];
+			shard.buffers[hole].swap(shard.buffers[next]);
+			shard.entries[next].used = 0;
+			hole = next;
+		}
+	}
+}
+
+void SessionStore::grow(Shard& shard)
+{
+	std::vector<Entry> entries(shard.entries.size() * 2);
+	std::vector<std::shared_ptr<ReplayBuffer> > buffers(entries.size());
+	entries.swap(shard.entries);
+	buffers.swap(shard.buffers);
+	shard.mask = shard.entries.size() - 1;
+	shard.count = 0;
+
+	for (std::size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].used)
+		{
+			insert(shard, entries[i], buffers[i]);
+		}
+	}
+}
+
+void SessionStore::compact(Shard& shard)
+{
+	if (shard.order.size() < shard.count * 2 + SESSION_ORDER_SLACK)
+	{
+		return;
+	}
+
+	// Every park adds an entry, so a session's own is the last one for its
+	// token; walk backwards keeping just those, in their original order.
+	std::deque<std::pair<uint32_t, uint64_t> > order;
+	std::unordered_set<uint64_t> seen;
+	std::size_t spilled = 0;
+	for (std::size_t i = shard.order.size(); i > 0; i--)
+	{
+		const std::pair<uint32_t, uint64_t>& parked = shard.order[i - 1];
+		if (find(shard, parked.second) == shard.entries.size() || !seen.insert(parked.second).second)
+		{
+			continue;
+		}
+		order.push_front(parked);
+		spilled += i - 1 < shard.spilled ? 1 : 0;
+	}
+	shard.order.swap(order);
+	shard.spilled = spilled;
+}
+
+bool SessionStore::spillEntry(Shard& shard, std::size_t index)
+{
+	Entry& entry = shard.entries[index];
+	std::shared_ptr<ReplayBuffer>& buffer = shard.buffers[index];
+	std::size_t length = buffer ? buffer->savedSize() : 0;
+	if (length == 0 || length > UINT32_MAX)
+	{
+		// Nothing to write out, or too big for an entry to describe.
+		return true;
+	}
+
+	uint64_t offset = allocate(shard, length);
+	if (offset == UINT64_MAX)
+	{
+		return false;
+	}
+	buffer->save(shard.mapping + offset);
+	buffer.reset();
+	entry.offset = offset;
+	entry.length = uint32_t(length);
+
+	// The data stays in the page cache (and on its way to disk), but leaves
+	// this process's resident set; only whole pages can go.
+	uint64_t first = (offset + pageSize() - 1) & ~(pageSize() - 1);
+	uint64_t last = (offset + length) & ~(pageSize() - 1);
+	if (last > first)
+	{
+		::madvise(shard.mapping + first, last - first, MADV_DONTNEED);
+	}
+
+	shard.stats.spilled++;
+	shard.stats.resident--;
+	shard.stats.onDisk++;
+	return true;
+}
+
+std::shared_ptr<ReplayBuffer> SessionStore::fault(Shard& shard, const Entry& entry)
+{
+	return ReplayBuffer::load(shard.mapping + entry.offset, entry.length);
+}
+
+uint64_t SessionStore::allocate(Shard& shard, uint64_t length)
+{
+	for (std::size_t i = 0; i < shard.holes.size(); i++)
+	{
+		Extent& hole = shard.holes[i];
+		if (hole.length >= length)
+		{
+			uint64_t offset = hole.offset;
+			hole.offset += length;
+			hole.length -= length;
+			if (hole.length == 0)
+			{
+				shard.holes.erase(shard.holes.begin() + i);
+			}
+			shard.used += length;
+			return offset;
+		}
+	}
+
+	if (shard.file == -1)
+	{
+		std::string path = mSpillDirectory + "/seance-sessions-XXXXXX";
+		std::vector<char> name(path.begin(), path.end());
+		name.push_back('\0');
+		shard.file = ::mkstemp(name.data());
+		if (shard.file == -1)
+		{
+			cerr << "Unable to create session spill file in " << mSpillDirectory << " " << errno << " " << strerror(errno) << endl;
+			return UINT64_MAX;
+		}
+		// Only ever reached through the descriptor.
+		::unlink(name.data());
+	}
+
+	if (shard.end + length > shard.capacity)
+	{
+		uint64_t capacity = shard.capacity * 2;
+		capacity = capacity < shard.end + length ? shard.end + length : capacity;
+		capacity = capacity < SESSION_SPILL_MINIMUM ? SESSION_SPILL_MINIMUM : capacity;
+		capacity = (capacity + pageSize() - 1) & ~(pageSize() - 1);
+
+		if (::ftruncate(shard.file, off_t(capacity)) == -1)
+		{
+			cerr << "Unable to grow session spill file " << errno << " " << strerror(errno) << endl;
+			return UINT64_MAX;
+		}
+
+		void* mapping = shard.mapping ?
+			::mremap(shard.mapping, shard.capacity, capacity, MREMAP_MAYMOVE) :
+			::mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, shard.file, 0);
+		if (mapping == MAP_FAILED)
+		{
+			cerr << "Unable to map session spill file " << errno << " " << strerror(errno) << endl;
+			return UINT64_MAX;
+		}
+		shard.mapping = static_cast<uint8_t*>(mapping);
+		shard.capacity = capacity;
+	}
+
+	uint64_t offset = shard.end;
+	shard.end += length;
+	shard.used += length;
+	return offset;
+}
+
+void SessionStore::release(Shard& shard, uint64_t offset, uint64_t length)
+{
+	shard.used -= length;
+	if (shard.used == 0)
+	{
+		// Everything has been claimed; start the file over.
+		shard.end = 0;
+		shard.holes.clear();
+		return;
+	}
+
+	// Merge with the holes either side, so the file does not fragment, and
+	// hand a hole at the end back to end.
+	std::vector<Extent>::iterator next = shard.holes.begin();
+	while (next != shard.holes.end() && next->offset < offset)
+	{
+		++next;
+	}
+	if (next != shard.holes.end() && offset + length == next->offset)
+	{
+		length += next->length;
+		next = shard.holes.erase(next);
+	}
+	if (next != shard.holes.begin() && (next - 1)->offset + (next - 1)->length == offset)
+	{
+		--next;
+		offset = next->offset;
+		length += next->length;
+		next = shard.holes.erase(next);
+	}
+
+	if (offset + length == shard.end)
+	{
+		shard.end = offset;
+		return;
+	}
+
+	Extent hole;
+	hole.offset = offset;
+	hole.length = length;
+	shard.holes.insert(next, hole);
+}
@@ -0,0 +1,51 @@
+#ifndef __RCU_H
+#define __RCU_H
+
+#include <cstddef>
+#include <functional>
+
+/**
+ * Read-copy-update, for data which is read on every frame but rarely changes.
+ *
+ * Readers hold a ReadLock while they look at the data; it takes no lock and
+ * touches nothing other threads write, so readers never wait for each other
+ * or for writers. A writer copies the data, changes the copy, publishes it
+ * with an atomic store and hands the old version to retire(), which frees it
+ * once every reader which could still see it has dropped its ReadLock.
+ * Writers never wait for readers either: retired versions are reclaimed by
+ * later calls to retire() or reclaim().
+ *
+ * Pointers to published data must be loaded with sequentially consistent
+ * atomics, and only under a ReadLock. ReadLocks nest.
+ */
+class Rcu
+{
+public:
+	class ReadLock
+	{
+	public:
+		ReadLock(void);
+		ReadLock(const ReadLock& source) = delete;
+		~ReadLock(void);
+	};
+
+	typedef std::function<void(void)> Reclaimer;
+
+	/**
+	 * Call reclaim once no reader can still see what was unpublished before
+	 * this call; then reclaim anything else whose readers have finished.
+	 */
+	static void retire(const Reclaimer& reclaim);
+
+	/**
+	 * Reclaim everything whose readers have finished. Returns how many.
+	 */
+	static std::size_t reclaim(void);
+
+	/**
+	 * Retired, but not yet reclaimed.
+	 */
+	static std::size_t retired(void);
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __WORKER_POOL_H
+#define __WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of threads pulling tasks off a shared queue. Used to take CPU
+ * heavy work (such as CRCing very large payloads) off the I/O threads.
+ */
+class WorkerPool
+{
+public:
+	typedef std::function<void(void)> Task;
+
+	WorkerPool(std::size_t threads = 0);
+	WorkerPool(const WorkerPool& source) = delete;
+	~WorkerPool(void);
+
+	void submit(const Task& task);
+	std::size_t size(void) const;
+private:
+	void work(void);
+
+	std::mutex mLock;
+	std::condition_variable mReady;
+	std::deque<Task> mTasks;
+	std::vector<std::thread> mThreads;
+	bool mStopping;
+};
+
+#endif
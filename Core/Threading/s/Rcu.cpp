@@ -0,0 +1,150 @@
+#include "Rcu.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	// Bumped by every retire(); a reader records it on entry.
+	std::atomic<uint64_t> gEpoch(1);
+
+	struct Reader
+	{
+		// The epoch the thread's outermost ReadLock started in, or 0 if it
+		// holds none. Only ever written by its own thread.
+		alignas(64) std::atomic<uint64_t> epoch;
+		unsigned depth;
+	};
+
+	struct Domain
+	{
+		std::mutex lock;
+		std::vector<Reader*> readers;
+		std::vector<std::pair<uint64_t, Rcu::Reclaimer> > retired;
+	};
+
+	Domain& domain(void)
+	{
+		static Domain oDomain;
+		return oDomain;
+	}
+
+	// Registers the thread's Reader the first time it reads, and forgets it
+	// when the thread exits.
+	struct Registration
+	{
+		Reader reader;
+
+		Registration(void)
+		{
+			reader.epoch.store(0);
+			reader.depth = 0;
+			std::lock_guard<std::mutex> lock(domain().lock);
+			domain().readers.push_back(&reader);
+		}
+
+		~Registration(void)
+		{
+			Domain& owner = domain();
+			std::lock_guard<std::mutex> lock(owner.lock);
+			for (std::size_t i = 0; i < owner.readers.size(); i++)
+			{
+				if (owner.readers[i] == &reader)
+				{
+					owner.readers[i] = owner.readers.back();
+					owner.readers.pop_back();
+					break;
+				}
+			}
+		}
+	};
+
+	Reader& self(void)
+	{
+		static thread_local Registration oRegistration;
+		return oRegistration.reader;
+	}
+}
+
+Rcu::ReadLock::ReadLock(void)
+{
+	Reader& reader = self();
+	if (reader.depth++ == 0)
+	{
+		// Sequentially consistent, so that the store is seen before anything
+		// this thread goes on to load from published data.
+		reader.epoch.store(gEpoch.load());
+	}
+}
+
+Rcu::ReadLock::~ReadLock(void)
+{
+	Reader& reader = self();
+	if (--reader.depth == 0)
+	{
+		reader.epoch.store(0, std::memory_order_release);
+	}
+}
+
+void Rcu::retire(const Reclaimer& reclaim)
+{
+	{
+		Domain& owner = domain();
+		std::lock_guard<std::mutex> lock(owner.lock);
+
+		// Anyone who can still see the old version loaded it before this,
+		// so entered in this epoch or an earlier one.
+		owner.retired.push_back(std::make_pair(gEpoch.fetch_add(1), reclaim));
+	}
+	Rcu::reclaim();
+}
+
+std::size_t Rcu::reclaim(void)
+{
+	std::vector<Reclaimer> ready;
+	{
+		Domain& owner = domain();
+		std::lock_guard<std::mutex> lock(owner.lock);
+
+		uint64_t oldest = UINT64_MAX;
+		for (std::size_t i = 0; i < owner.readers.size(); i++)
+		{
+			uint64_t epoch = owner.readers[i]->epoch.load();
+			if (epoch != 0 && epoch < oldest)
+			{
+				oldest = epoch;
+			}
+		}
+
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < owner.retired.size(); i++)
+		{
+			if (owner.retired[i].first < oldest)
+			{
+				ready.push_back(owner.retired[i].second);
+			}
+			else
+			{
+				owner.retired[kept++] = owner.retired[i];
+			}
+		}
+		owner.retired.resize(kept);
+	}
+
+	// Outside the lock, in case reclaiming retires something else.
+	for (std::size_t i = 0; i < ready.size(); i++)
+	{
+		ready[i]();
+	}
+	return ready.size();
+}
+
+std::size_t Rcu::retired(void)
+{
+	Domain& owner = domain();
+	std::lock_guard<std::mutex> lock(owner.lock);
+	return owner.retired.size();
+}
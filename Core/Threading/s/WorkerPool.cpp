@@ -0,0 +1,72 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(std::size_t threads):
+	mLock(),
+	mReady(),
+	mTasks(),
+	mThreads(),
+	mStopping(false)
+{
+	if (threads == 0)
+	{
+		threads = std::thread::hardware_concurrency();
+	}
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+
+	for (std::size_t i = 0; i < threads; i++)
+	{
+		mThreads.push_back(std::thread(&WorkerPool::work, this));
+	}
+}
+
+WorkerPool::~WorkerPool(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mStopping = true;
+	}
+	mReady.notify_all();
+
+	for (std::size_t i = 0; i < mThreads.size(); i++)
+	{
+		mThreads[i].join();
+	}
+}
+
+void WorkerPool::submit(const Task& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		mTasks.push_back(task);
+	}
+	mReady.notify_one();
+}
+
+std::size_t WorkerPool::size(void) const
+{
+	return mThreads.size();
+}
+
+void WorkerPool::work(void)
+{
+	while (true)
+	{
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(mLock);
+			mReady.wait(lock, [this](void) { return mStopping || !mTasks.empty(); });
+			// Outstanding tasks are still run when stopping; callers may be
+			// waiting on them.
+			if (mTasks.empty())
+			{
+				return;
+			}
+			task = mTasks.front();
+			mTasks.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef __BUFFER_POOL_H
+#define __BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Power-of-two size classes run from 64 bytes up to 64KiB.
+const std::size_t BUFFER_POOL_MIN_CLASS = 64;
+const std::size_t BUFFER_POOL_MAX_CLASS = 64 * 1024;
+const std::size_t BUFFER_POOL_CLASSES = 11;
+
+// Free bytes each thread keeps cached per size class before returning memory
+// to the heap.
+const std::size_t BUFFER_POOL_RETAIN_BYTES = 1024 * 1024;
+
+struct BufferPoolStats
+{
+	uint64_t hits;     // Allocations served from a free list.
+	uint64_t misses;   // Allocations which went to the heap.
+	uint64_t mapped;   // Allocations too large for a class, mapped directly.
+	uint64_t resident; // Bytes sitting in free lists.
+	int64_t inUse;     // Bytes handed out and not yet released.
+};
+
+/**
+ * Thread-local, size-class allocator for payload buffers.
+ *
+ * Requests up to BUFFER_POOL_MAX_CLASS are rounded up to a power of two and
+ * served from the calling thread's free list for that class; larger ones are
+ * mmapped directly so they never fragment the heap. A buffer may be released
+ * on a different thread from the one that allocated it, but the caller must
+ * pass the same length it asked for.
+ */
+class BufferPool
+{
+public:
+	static uint8_t* allocate(std::size_t length);
+	static void release(uint8_t* buffer, std::size_t length);
+
+	/**
+	 * Counters for the calling thread's pool, or summed over every live
+	 * thread's pool.
+	 */
+	static BufferPoolStats stats(void);
+	static BufferPoolStats total(void);
+private:
+	struct FreeBuffer
+	{
+		FreeBuffer* next;
+	};
+
+	BufferPool(void);
+	BufferPool(const BufferPool& source) = delete;
+	~BufferPool(void);
+
+	static BufferPool& local(void);
+	static std::size_t sizeClass(std::size_t length);
+
+	FreeBuffer* mFree[BUFFER_POOL_CLASSES];
+	std::size_t mFreeBytes[BUFFER_POOL_CLASSES];
+
+	// Only ever written by the owning thread; atomic so total() may read them.
+	std::atomic<uint64_t> mHits;
+	std::atomic<uint64_t> mMisses;
+	std::atomic<uint64_t> mMapped;
+	std::atomic<uint64_t> mResident;
+	std::atomic<int64_t> mInUse; // Cross-thread releases can take it negative.
+
+	BufferPool* mNext;
+	BufferPool* mPrevious;
+};
+
+#endif
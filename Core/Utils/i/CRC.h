@@ -1,16 +1,38 @@
 #ifndef __CRC_H
 #define __CRC_H
 
+#include <cstddef>
 #include <cstdint>
 
 class CRC32
 {
 public:
-	static uint32_t calculate(uint32_t crc, char* buffer, std::size_t length);
-private:
-	static void generateCRC32Table(void);
-	static bool crc32TableCalculated;
-	static uint32_t crc32Table[256];
+	/**
+	 * Continue the CRC32 (ISO 3309/ RFC 1952) crc over length more bytes of
+	 * buffer. Start a new CRC with a crc of 0.
+	 */
+	static uint32_t calculate(uint32_t crc, const void* buffer, std::size_t length);
+
+	/**
+	 * Unmask buffer in place (see applyMask) and continue crc over the
+	 * unmasked bytes, in a single pass over the data.
+	 */
+	static uint32_t calculateMasked(uint32_t crc, uint8_t* buffer, std::size_t length, uint32_t key, uint64_t offset = 0);
+
+	/**
+	 * Given crc1 of one block and crc2 of a following block of length2 bytes
+	 * (started from 0), return the CRC of the two blocks together. This is
+	 * what allows pieces of a buffer to be CRCed independently.
+	 */
+	static uint32_t combine(uint32_t crc1, uint32_t crc2, uint64_t length2);
+
+	/**
+	 * The individual implementations calculate() chooses between. The folded
+	 * (carry-less multiply) version may only be used if accelerated() is true.
+	 */
+	static uint32_t calculateTable(uint32_t crc, const void* buffer, std::size_t length);
+	static uint32_t calculateFolded(uint32_t crc, const void* buffer, std::size_t length);
+	static bool accelerated(void);
 };
 
 #endif
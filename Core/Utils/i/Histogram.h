@@ -0,0 +1,51 @@
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Each power of two is split into 2^HISTOGRAM_SUB_BITS buckets, so recorded
+// values are kept to within 1/128 of themselves.
+const unsigned HISTOGRAM_SUB_BITS = 7;
+
+/**
+ * A log-linear histogram of unsigned values, in the style of HdrHistogram:
+ * values below 2^HISTOGRAM_SUB_BITS are counted exactly, and larger ones
+ * in buckets whose width grows with the value, so any value from 0 to
+ * UINT64_MAX is recorded in constant time and space with bounded relative
+ * error. Meant for latencies in nanoseconds.
+ *
+ * Not thread-safe; keep one per thread and merge() them.
+ */
+class Histogram
+{
+public:
+	Histogram(void);
+
+	void record(uint64_t value, uint64_t count = 1);
+	void merge(const Histogram& other);
+	void reset(void);
+
+	uint64_t count(void) const;
+	uint64_t min(void) const;
+	uint64_t max(void) const;
+	double mean(void) const;
+
+	/**
+	 * The value percent (0 to 100) of recorded values are at or below: the
+	 * highest value its bucket stands for, but never more than max().
+	 */
+	uint64_t percentile(double percent) const;
+private:
+	static std::size_t index(uint64_t value);
+	static uint64_t highest(std::size_t index);
+
+	std::vector<uint64_t> mCounts;
+	uint64_t mCount;
+	uint64_t mMin;
+	uint64_t mMax;
+	long double mSum;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __LZ_H
+#define __LZ_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Entries in the match table; callers own it, so it can be reused.
+const std::size_t LZ_TABLE_SIZE = 1 << 12;
+
+// Furthest back (in bytes) a match may refer.
+const std::size_t LZ_WINDOW = 65535;
+
+/**
+ * A small, fast LZ77 codec in the style of LZ4: literal runs and back
+ * references of at least 4 bytes, found through a single-entry hash table,
+ * with no entropy coding. It compresses at several hundred MB/s and
+ * decompresses faster still, trading ratio for speed.
+ *
+ * The data to compress sits at buffer + start; the start bytes in front of it
+ * act as a dictionary which matches may refer back into, and the decompressor
+ * must have the same bytes in front of where it writes.
+ */
+class LZ
+{
+public:
+	/**
+	 * The most compress() can produce from length bytes.
+	 */
+	static std::size_t bound(std::size_t length);
+
+	/**
+	 * Fill table (LZ_TABLE_SIZE entries) from the dictionary, the first start
+	 * bytes of buffer. A primed table can be copied and reused for every
+	 * compress() with the same dictionary.
+	 */
+	static void prime(uint32_t* table, const uint8_t* buffer, std::size_t start);
+
+	/**
+	 * Compress length bytes at buffer + start into out. table must have been
+	 * primed for the same dictionary, and is left holding positions from this
+	 * call. Returns the compressed length, or 0 if it would exceed capacity.
+	 */
+	static std::size_t compress(uint32_t* table, const uint8_t* buffer, std::size_t start, std::size_t length, uint8_t* out, std::size_t capacity);
+
+	/**
+	 * Decompress length bytes of in to buffer + start, which may hold up to
+	 * capacity bytes. Returns the decompressed length, or -1 if in is
+	 * malformed or decompresses to more than capacity.
+	 */
+	static int64_t decompress(const uint8_t* in, std::size_t length, uint8_t* buffer, std::size_t start, std::size_t capacity);
+};
+
+#endif
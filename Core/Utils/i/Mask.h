@@ -0,0 +1,22 @@
+#ifndef __MASK_H
+#define __MASK_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * XOR buffer against the masking key (in host byte order, so the most
+ * significant byte is the first applied). offset is the position of buffer
+ * within the payload, so that a payload can be unmasked in pieces.
+ *
+ * Masking is its own inverse; the same call masks and unmasks.
+ */
+void applyMask(uint8_t* buffer, std::size_t length, uint32_t key, uint64_t offset = 0);
+
+/**
+ * The key, rotated for offset, as a native word which can be XORed over any
+ * 4-byte aligned (relative to buffer) position of the buffer.
+ */
+uint32_t maskPattern(uint32_t key, uint64_t offset);
+
+#endif
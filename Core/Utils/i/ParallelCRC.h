@@ -0,0 +1,64 @@
+#ifndef __PARALLEL_CRC_H
+#define __PARALLEL_CRC_H
+
+#include "WorkerPool.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+const std::size_t PARALLEL_CRC_CHUNK = 4 * 1024 * 1024;
+
+/**
+ * CRC32 of a large buffer computed in pieces on a WorkerPool, with the
+ * partial results merged by CRC32::combine.
+ *
+ * Data may be handed over as it arrives (update) or all at once (calculate).
+ * Pieces are cut at chunkSize bytes; buffers given to update must remain valid
+ * until result() returns. If a masking key is given, each piece is unmasked in
+ * place as it is CRCed.
+ */
+class ParallelCRC
+{
+public:
+	ParallelCRC(WorkerPool& pool, std::size_t chunkSize = PARALLEL_CRC_CHUNK);
+	ParallelCRC(WorkerPool& pool, uint32_t key, std::size_t chunkSize = PARALLEL_CRC_CHUNK);
+	ParallelCRC(const ParallelCRC& source) = delete;
+	~ParallelCRC(void);
+
+	void update(uint8_t* buffer, std::size_t length);
+
+	/**
+	 * Wait for every piece and return the CRC (started from 0) of all the
+	 * bytes given to update, in order.
+	 */
+	uint32_t result(void);
+
+	static uint32_t calculate(WorkerPool& pool, uint32_t crc, const void* buffer, std::size_t length, std::size_t chunkSize = PARALLEL_CRC_CHUNK);
+private:
+	struct Piece
+	{
+		uint8_t* buffer;
+		std::size_t length;
+		uint64_t offset;
+		uint32_t crc;
+	};
+
+	void submit(void);
+
+	WorkerPool& mPool;
+	std::size_t mChunkSize;
+	bool mMasked;
+	uint32_t mKey;
+	uint8_t* mPendingBuffer;
+	std::size_t mPendingLength;
+	uint64_t mOffset;
+	std::deque<Piece> mPieces;
+	std::mutex mLock;
+	std::condition_variable mDone;
+	std::size_t mOutstanding;
+};
+
+#endif
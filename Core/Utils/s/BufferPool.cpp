@@ -0,0 +1,193 @@
+#include "BufferPool.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+using std::cerr;
+using std::endl;
+
+namespace
+{
+	std::mutex oRegistryLock;
+	BufferPoolStats oRetired = {0, 0, 0, 0, 0};
+
+	template<typename T>
+	void bump(std::atomic<T>& counter, T amount)
+	{
+		// Each counter has a single writer, so no read-modify-write is needed.
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	std::size_t pageRound(std::size_t length)
+	{
+		static const std::size_t oPageSize = std::size_t(::sysconf(_SC_PAGESIZE));
+		return (length + oPageSize - 1) & ~(oPageSize - 1);
+	}
+
+	BufferPool* oPools = NULL;
+}
+
+BufferPool::BufferPool(void):
+	mHits(0),
+	mMisses(0),
+	mMapped(0),
+	mResident(0),
+	mInUse(0),
+	mNext(NULL),
+	mPrevious(NULL)
+{
+	for (std::size_t i = 0; i < BUFFER_POOL_CLASSES; i++)
+	{
+		mFree[i] = NULL;
+		mFreeBytes[i] = 0;
+	}
+
+	std::lock_guard<std::mutex> lock(oRegistryLock);
+	mNext = oPools;
+	if (oPools)
+	{
+		oPools->mPrevious = this;
+	}
+	oPools = this;
+}
+
+BufferPool::~BufferPool(void)
+{
+	for (std::size_t i = 0; i < BUFFER_POOL_CLASSES; i++)
+	{
+		while (mFree[i])
+		{
+			FreeBuffer* buffer = mFree[i];
+			mFree[i] = buffer->next;
+			::operator delete(buffer);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(oRegistryLock);
+	oRetired.hits += mHits.load(std::memory_order_relaxed);
+	oRetired.misses += mMisses.load(std::memory_order_relaxed);
+	oRetired.mapped += mMapped.load(std::memory_order_relaxed);
+	oRetired.inUse += mInUse.load(std::memory_order_relaxed);
+	if (mPrevious)
+	{
+		mPrevious->mNext = mNext;
+	}
+	else
+	{
+		oPools = mNext;
+	}
+	if (mNext)
+	{
+		mNext->mPrevious = mPrevious;
+	}
+}
+
+uint8_t* BufferPool::allocate(std::size_t length)
+{
+	BufferPool& pool = local();
+	bump(pool.mInUse, int64_t(length));
+
+	if (length > BUFFER_POOL_MAX_CLASS)
+	{
+		void* buffer = ::mmap(NULL, pageRound(length), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buffer == MAP_FAILED)
+		{
+			cerr << "Unable to map " << length << " byte buffer " << errno << " " << strerror(errno) << endl;
+			throw "BufferPool::allocate failed";
+		}
+		bump(pool.mMapped, uint64_t(1));
+		return static_cast<uint8_t*>(buffer);
+	}
+
+	std::size_t index = sizeClass(length);
+	FreeBuffer* buffer = pool.mFree[index];
+	if (buffer)
+	{
+		pool.mFree[index] = buffer->next;
+		pool.mFreeBytes[index] -= BUFFER_POOL_MIN_CLASS << index;
+		bump(pool.mResident, uint64_t(0) - (BUFFER_POOL_MIN_CLASS << index));
+		bump(pool.mHits, uint64_t(1));
+		return reinterpret_cast<uint8_t*>(buffer);
+	}
+
+	bump(pool.mMisses, uint64_t(1));
+	return static_cast<uint8_t*>(::operator new(BUFFER_POOL_MIN_CLASS << index));
+}
+
+void BufferPool::release(uint8_t* buffer, std::size_t length)
+{
+	if (buffer == NULL)
+	{
+		return;
+	}
+
+	BufferPool& pool = local();
+	bump(pool.mInUse, -int64_t(length));
+
+	if (length > BUFFER_POOL_MAX_CLASS)
+	{
+		::munmap(buffer, pageRound(length));
+		return;
+	}
+
+	std::size_t index = sizeClass(length);
+	std::size_t classSize = BUFFER_POOL_MIN_CLASS << index;
+	if (pool.mFreeBytes[index] + classSize > BUFFER_POOL_RETAIN_BYTES)
+	{
+		::operator delete(buffer);
+		return;
+	}
+
+	FreeBuffer* entry = reinterpret_cast<FreeBuffer*>(buffer);
+	entry->next = pool.mFree[index];
+	pool.mFree[index] = entry;
+	pool.mFreeBytes[index] += classSize;
+	bump(pool.mResident, uint64_t(classSize));
+}
+
+BufferPoolStats BufferPool::stats(void)
+{
+	BufferPool& pool = local();
+	BufferPoolStats stats;
+	stats.hits = pool.mHits.load(std::memory_order_relaxed);
+	stats.misses = pool.mMisses.load(std::memory_order_relaxed);
+	stats.mapped = pool.mMapped.load(std::memory_order_relaxed);
+	stats.resident = pool.mResident.load(std::memory_order_relaxed);
+	stats.inUse = pool.mInUse.load(std::memory_order_relaxed);
+	return stats;
+}
+
+BufferPoolStats BufferPool::total(void)
+{
+	std::lock_guard<std::mutex> lock(oRegistryLock);
+	BufferPoolStats stats = oRetired;
+	for (BufferPool* pool = oPools; pool; pool = pool->mNext)
+	{
+		stats.hits += pool->mHits.load(std::memory_order_relaxed);
+		stats.misses += pool->mMisses.load(std::memory_order_relaxed);
+		stats.mapped += pool->mMapped.load(std::memory_order_relaxed);
+		stats.resident += pool->mResident.load(std::memory_order_relaxed);
+		stats.inUse += pool->mInUse.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+BufferPool& BufferPool::local(void)
+{
+	static thread_local BufferPool oLocalPool;
+	return oLocalPool;
+}
+
+std::size_t BufferPool::sizeClass(std::size_t length)
+{
+	if (length <= BUFFER_POOL_MIN_CLASS)
+	{
+		return 0;
+	}
+	// Bits needed for length - 1, less the 6 covered by the smallest class.
+	return std::size_t(64 - __builtin_clzll(uint64_t(length) - 1)) - 6;
+}
@@ -1,44 +1,373 @@
 #include "CRC.h"
-#include "RAIIMutex.h"
+#include "Mask.h"
 
-bool CRC32::crc32TableCalculated = false;
-uint32_t CRC32::crc32Table[256] = {};
+#include <cstring>
 
-void CRC32::generateCRC32Table(void)
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC32_FOLDING 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	const uint32_t CRC32_POLYNOMIAL = 0xedb88320;
+	const std::size_t CRC32_SLICES = 8;
+
+	/**
+	 * The lookup tables are generated by the compiler, which is why these are
+	 * written as single-expression recursive constexpr functions.
+	 */
+	constexpr uint32_t crc32Step(uint32_t crc, int bits)
+	{
+		return bits == 0 ? crc : crc32Step((CRC32_POLYNOMIAL * (crc & 1)) ^ (crc >> 1), bits - 1);
+	}
+
+	constexpr uint32_t crc32Entry(uint32_t index)
+	{
+		return crc32Step(index, 8);
+	}
+
+	constexpr uint32_t crc32ZeroByte(uint32_t crc)
+	{
+		return (crc >> 8) ^ crc32Entry(crc & 0xff);
+	}
+
+	constexpr uint32_t crc32SliceEntry(std::size_t slice, uint32_t index)
+	{
+		// Slice n is the CRC of the byte followed by n zero bytes.
+		return slice == 0 ? crc32Entry(index) : crc32ZeroByte(crc32SliceEntry(slice - 1, index));
+	}
+
+	template<std::size_t... Indices>
+	struct IndexSequence
+	{
+	};
+
+	template<std::size_t Count, std::size_t... Indices>
+	struct MakeIndexSequence : MakeIndexSequence<Count - 1, Count - 1, Indices...>
+	{
+	};
+
+	template<std::size_t... Indices>
+	struct MakeIndexSequence<0, Indices...>
+	{
+		typedef IndexSequence<Indices...> type;
+	};
+
+	struct CRC32Table
+	{
+		uint32_t slice[CRC32_SLICES][256];
+	};
+
+	template<std::size_t... Indices>
+	constexpr CRC32Table makeCRC32Table(IndexSequence<Indices...>)
+	{
+		return CRC32Table{{
+			{crc32SliceEntry(0, Indices)...},
+			{crc32SliceEntry(1, Indices)...},
+			{crc32SliceEntry(2, Indices)...},
+			{crc32SliceEntry(3, Indices)...},
+			{crc32SliceEntry(4, Indices)...},
+			{crc32SliceEntry(5, Indices)...},
+			{crc32SliceEntry(6, Indices)...},
+			{crc32SliceEntry(7, Indices)...}
+		}};
+	}
+
+	// Constant initialized, so there is no lazy generation and nothing to lock.
+	constexpr CRC32Table crc32Table = makeCRC32Table(MakeIndexSequence<256>::type());
+
+	inline uint32_t load32(const uint8_t* bytes)
+	{
+		uint32_t value;
+		memcpy(&value, bytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		value = __builtin_bswap32(value);
+#endif
+		return value;
+	}
+}
+
+namespace
 {
-	uint32_t crc;
-	for (std::size_t i = 0; i < 256; i++)
+	typedef uint32_t (*CRC32Function)(uint32_t crc, const void* buffer, std::size_t length);
+
+	// Below this the fixed cost of folding outweighs the table.
+	const std::size_t CRC32_FOLDING_MINIMUM = 64;
+
+	// Without folding, masked payloads are unmasked and CRCed in pieces this
+	// size, so the CRC reads what the unmask just wrote from L1.
+	const std::size_t CRC32_MASK_CHUNK = 4096;
+
+#ifdef CRC32_FOLDING
+	/**
+	 * Load a 16-byte block for folding. When masking, the block is unmasked
+	 * in place on the way through, so the payload is only touched once.
+	 */
+	template<bool Masked>
+	__attribute__((target("pclmul,sse4.1"), always_inline)) inline
+	__m128i crc32FoldLoad(uint8_t* buffer, __m128i pattern)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer));
+		if (Masked)
+		{
+			block = _mm_xor_si128(block, pattern);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(buffer), block);
+		}
+		return block;
+	}
+
+	/**
+	 * Fold 16-byte blocks of buffer (length must be a multiple of 16, and at
+	 * least 64) into the raw, uninverted, crc using carry-less multiplication.
+	 * See Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+	 * Instruction"; the constants are for the bit-reflected 0x04c11db7
+	 * polynomial.
+	 *
+	 * If Masked, every byte is XORed with pattern (see maskPattern) before it
+	 * is folded in, and written back.
+	 */
+	template<bool Masked>
+	__attribute__((target("pclmul,sse4.1")))
+	uint32_t crc32Fold(uint32_t crc, uint8_t* buffer, std::size_t length, uint32_t maskWord)
 	{
-		crc = i;
-		for (std::size_t j = 0; j < 8; j++)
+		const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+		const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+		const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+		const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+		const __m128i lowMask = _mm_setr_epi32(~0, 0, ~0, 0);
+		const __m128i pattern = _mm_set1_epi32(int(maskWord));
+
+		__m128i x1 = crc32FoldLoad<Masked>(buffer + 0x00, pattern);
+		__m128i x2 = crc32FoldLoad<Masked>(buffer + 0x10, pattern);
+		__m128i x3 = crc32FoldLoad<Masked>(buffer + 0x20, pattern);
+		__m128i x4 = crc32FoldLoad<Masked>(buffer + 0x30, pattern);
+		x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(crc)));
+		buffer += 64;
+		length -= 64;
+
+		// Fold four 128-bit lanes at a time, 64 bytes per iteration.
+		while (length >= 64)
 		{
-			crc = (0xedb88320L * (crc & 1)) ^ (crc >> 1);
+			__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+			__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+			__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+			__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+			x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+			x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+			x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), crc32FoldLoad<Masked>(buffer + 0x00, pattern));
+			x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), crc32FoldLoad<Masked>(buffer + 0x10, pattern));
+			x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), crc32FoldLoad<Masked>(buffer + 0x20, pattern));
+			x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), crc32FoldLoad<Masked>(buffer + 0x30, pattern));
+
+			buffer += 64;
+			length -= 64;
 		}
-		crc32Table[i] = crc;
+
+		// Fold the four lanes down into one.
+		__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+		// Any remaining 16-byte blocks, one at a time.
+		while (length >= 16)
+		{
+			x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, crc32FoldLoad<Masked>(buffer, pattern)), x5);
+			buffer += 16;
+			length -= 16;
+		}
+
+		// 128 bits down to 64.
+		x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+		x2 = _mm_srli_si128(x1, 4);
+		x1 = _mm_and_si128(x1, lowMask);
+		x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+
+		// Barrett reduction down to 32.
+		x2 = _mm_and_si128(x1, lowMask);
+		x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+		x2 = _mm_and_si128(x2, lowMask);
+		x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+
+		return uint32_t(_mm_extract_epi32(x1, 1));
 	}
+#endif
+
+	const std::size_t GF2_DIMENSION = 32;
+
+	uint32_t gf2MatrixTimes(const uint32_t* matrix, uint32_t vector)
+	{
+		uint32_t sum = 0;
+		for (; vector; vector >>= 1, matrix++)
+		{
+			if (vector & 1)
+			{
+				sum ^= *matrix;
+			}
+		}
+		return sum;
+	}
+
+	void gf2MatrixSquare(uint32_t* square, const uint32_t* matrix)
+	{
+		for (std::size_t i = 0; i < GF2_DIMENSION; i++)
+		{
+			square[i] = gf2MatrixTimes(matrix, matrix[i]);
+		}
+	}
+
+	CRC32Function selectCRC32(void)
+	{
+		return CRC32::accelerated() ? &CRC32::calculateFolded : &CRC32::calculateTable;
+	}
+}
+
+uint32_t CRC32::calculate(uint32_t crc, const void* buffer, std::size_t length)
+{
+	// Resolved once, on first use, from what the CPU supports.
+	static const CRC32Function oImplementation = selectCRC32();
+	return oImplementation(crc, buffer, length);
+}
+
+uint32_t CRC32::calculateFolded(uint32_t crc, const void* buffer, std::size_t length)
+{
+#ifdef CRC32_FOLDING
+	if (length >= CRC32_FOLDING_MINIMUM)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+		std::size_t folded = length & ~std::size_t(15);
+		// Never written to when not masking.
+		uint8_t* blocks = const_cast<uint8_t*>(bytes);
+		crc = crc32Fold<false>(crc ^ 0xffffffffL, blocks, folded, 0) ^ 0xffffffffL;
+		return calculateTable(crc, bytes + folded, length - folded);
+	}
+#endif
+	return calculateTable(crc, buffer, length);
 }
 
-uint32_t CRC32::calculate(uint32_t crc, char* buffer, std::size_t length)
+uint32_t CRC32::calculateMasked(uint32_t crc, uint8_t* buffer, std::size_t length, uint32_t key, uint64_t offset)
 {
-	if (!crc32TableCalculated)
+#ifdef CRC32_FOLDING
+	if (length >= CRC32_FOLDING_MINIMUM && accelerated())
 	{
-		// By checking the boolean twice, we ensure that we aren't locking resources
-		// the majority of the time, and even if we do wind up locking multiple times
-		// it won't be _every_ time. Just the first few if multiple threads hit this
-		// all at about the same time.
-		RAIIMutex crcTableLock(&crc32Table);
-		if (!crc32TableCalculated)
+		std::size_t folded = length & ~std::size_t(15);
+		crc = crc32Fold<true>(crc ^ 0xffffffffL, buffer, folded, maskPattern(key, offset)) ^ 0xffffffffL;
+		buffer += folded;
+		length -= folded;
+		offset += folded;
+	}
+#endif
+
+	while (length > 0)
+	{
+		std::size_t chunk = length < CRC32_MASK_CHUNK ? length : CRC32_MASK_CHUNK;
+		applyMask(buffer, chunk, key, offset);
+		crc = calculate(crc, buffer, chunk);
+		buffer += chunk;
+		length -= chunk;
+		offset += chunk;
+	}
+	return crc;
+}
+
+uint32_t CRC32::combine(uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+	uint32_t even[GF2_DIMENSION]; // Operator for an even power of two zero bits.
+	uint32_t odd[GF2_DIMENSION]; // Operator for an odd power of two zero bits.
+
+	if (length2 == 0)
+	{
+		return crc1;
+	}
+
+	// The operator for one zero bit; shifting crc1 along by length2 zero
+	// bytes is done by repeatedly squaring it.
+	odd[0] = CRC32_POLYNOMIAL;
+	uint32_t row = 1;
+	for (std::size_t i = 1; i < GF2_DIMENSION; i++)
+	{
+		odd[i] = row;
+		row <<= 1;
+	}
+
+	gf2MatrixSquare(even, odd); // Two zero bits.
+	gf2MatrixSquare(odd, even); // Four zero bits.
+
+	// The first square below gives the operator for one zero byte.
+	do
+	{
+		gf2MatrixSquare(even, odd);
+		if (length2 & 1)
 		{
-			generateCRC32Table();
-			crc32TableCalculated = true;
+			crc1 = gf2MatrixTimes(even, crc1);
+		}
+		length2 >>= 1;
+		if (length2 == 0)
+		{
+			break;
 		}
-	}
 
+		gf2MatrixSquare(odd, even);
+		if (length2 & 1)
+		{
+			crc1 = gf2MatrixTimes(odd, crc1);
+		}
+		length2 >>= 1;
+	} while (length2 != 0);
+
+	return crc1 ^ crc2;
+}
+
+bool CRC32::accelerated(void)
+{
+#ifdef CRC32_FOLDING
+	static const bool oAccelerated = (__builtin_cpu_init(), __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"));
+	return oAccelerated;
+#else
+	return false;
+#endif
+}
+
+uint32_t CRC32::calculateTable(uint32_t crc, const void* buffer, std::size_t length)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+	const uint32_t (*table)[256] = crc32Table.slice;
 	uint32_t newCrc = crc ^ 0xffffffffL;
 
+	// Slice-by-8; each iteration folds 8 bytes in with 8 independent lookups.
+	while (length >= 8)
+	{
+		uint32_t one = load32(bytes) ^ newCrc;
+		uint32_t two = load32(bytes + 4);
+		newCrc = table[7][one & 0xff] ^
+			table[6][(one >> 8) & 0xff] ^
+			table[5][(one >> 16) & 0xff] ^
+			table[4][one >> 24] ^
+			table[3][two & 0xff] ^
+			table[2][(two >> 8) & 0xff] ^
+			table[1][(two >> 16) & 0xff] ^
+			table[0][two >> 24];
+		bytes += 8;
+		length -= 8;
+	}
+
 	for (std::size_t i = 0; i < length; i++)
 	{
-		newCrc = crc32Table[(newCrc ^ buffer[i]) & 0xff] ^ (newCrc >> 8);
+		newCrc = table[0][(newCrc ^ bytes[i]) & 0xff] ^ (newCrc >> 8);
 	}
 
 	return newCrc ^ 0xffffffffL;
@@ -0,0 +1,119 @@
+#include "Histogram.h"
+
+namespace
+{
+	const uint64_t HISTOGRAM_SUB_COUNT = uint64_t(1) << HISTOGRAM_SUB_BITS;
+	const uint64_t HISTOGRAM_SUB_MASK = HISTOGRAM_SUB_COUNT - 1;
+
+	// Exact values below HISTOGRAM_SUB_COUNT, then one run of buckets for
+	// each power of two above.
+	const std::size_t HISTOGRAM_BUCKETS = std::size_t(64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS;
+}
+
+Histogram::Histogram(void):
+	mCounts(HISTOGRAM_BUCKETS, 0),
+	mCount(0),
+	mMin(UINT64_MAX),
+	mMax(0),
+	mSum(0)
+{
+}
+
+void Histogram::record(uint64_t value, uint64_t count)
+{
+	mCounts[index(value)] += count;
+	mCount += count;
+	mMin = value < mMin ? value : mMin;
+	mMax = value > mMax ? value : mMax;
+	mSum += (long double)value * count;
+}
+
+void Histogram::merge(const Histogram& other)
+{
+	for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		mCounts[i] += other.mCounts[i];
+	}
+	mCount += other.mCount;
+	mMin = other.mMin < mMin ? other.mMin : mMin;
+	mMax = other.mMax > mMax ? other.mMax : mMax;
+	mSum += other.mSum;
+}
+
+void Histogram::reset(void)
+{
+	mCounts.assign(HISTOGRAM_BUCKETS, 0);
+	mCount = 0;
+	mMin = UINT64_MAX;
+	mMax = 0;
+	mSum = 0;
+}
+
+uint64_t Histogram::count(void) const
+{
+	return mCount;
+}
+
+uint64_t Histogram::min(void) const
+{
+	return mCount > 0 ? mMin : 0;
+}
+
+uint64_t Histogram::max(void) const
+{
+	return mMax;
+}
+
+double Histogram::mean(void) const
+{
+	return mCount > 0 ? double(mSum / mCount) : 0;
+}
+
+uint64_t Histogram::percentile(double percent) const
+{
+	if (mCount == 0)
+	{
+		return 0;
+	}
+
+	// The rank of the value wanted, counting from 1.
+	uint64_t rank = uint64_t(percent / 100 * double(mCount) + 0.5);
+	rank = rank < 1 ? 1 : (rank > mCount ? mCount : rank);
+
+	uint64_t seen = 0;
+	for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += mCounts[i];
+		if (seen >= rank)
+		{
+			uint64_t value = highest(i);
+			return value < mMax ? value : mMax;
+		}
+	}
+	return mMax;
+}
+
+std::size_t Histogram::index(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_COUNT)
+	{
+		return std::size_t(value);
+	}
+
+	// Keep the top HISTOGRAM_SUB_BITS + 1 bits of the value; the leading one
+	// is implied by which run of buckets it lands in.
+	unsigned shift = unsigned(63 - __builtin_clzll(value)) - HISTOGRAM_SUB_BITS;
+	return (std::size_t(shift + 1) << HISTOGRAM_SUB_BITS) | std::size_t((value >> shift) & HISTOGRAM_SUB_MASK);
+}
+
+uint64_t Histogram::highest(std::size_t index)
+{
+	if (index < HISTOGRAM_SUB_COUNT)
+	{
+		return index;
+	}
+
+	unsigned shift = unsigned(index >> HISTOGRAM_SUB_BITS) - 1;
+	uint64_t lowest = (HISTOGRAM_SUB_COUNT | (index & HISTOGRAM_SUB_MASK)) << shift;
+	return lowest + ((uint64_t(1) << shift) - 1);
+}
@@ -0,0 +1,232 @@
+#include "LZ.h"
+
+#include <cstring>
+
+namespace
+{
+	const std::size_t LZ_MIN_MATCH = 4;
+	const unsigned LZ_HASH_BITS = 12;
+
+	// Literal and match lengths of 15 or more continue in extra bytes.
+	const std::size_t LZ_RUN_MASK = 15;
+
+	// The last literals never start a match, which keeps the match search
+	// from reading past the end.
+	const std::size_t LZ_LAST_LITERALS = 5;
+
+	uint32_t read32(const uint8_t* buffer)
+	{
+		uint32_t value;
+		memcpy(&value, buffer, sizeof(value));
+		return value;
+	}
+
+	uint32_t hash(uint32_t sequence)
+	{
+		return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+	}
+
+	uint8_t* writeLength(uint8_t* out, std::size_t length)
+	{
+		for (; length >= 255; length -= 255)
+		{
+			*out++ = 255;
+		}
+		*out++ = uint8_t(length);
+		return out;
+	}
+
+	// Worst case bytes for a sequence with these lengths.
+	std::size_t sequenceBound(std::size_t literals, std::size_t match)
+	{
+		return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+	}
+}
+
+std::size_t LZ::bound(std::size_t length)
+{
+	return length + length / 255 + 16;
+}
+
+void LZ::prime(uint32_t* table, const uint8_t* buffer, std::size_t start)
+{
+	memset(table, 0, LZ_TABLE_SIZE * sizeof(uint32_t));
+	std::size_t from = start > LZ_WINDOW ? start - LZ_WINDOW : 0;
+	for (std::size_t position = from; position + LZ_MIN_MATCH <= start; position++)
+	{
+		table[hash(read32(buffer + position))] = uint32_t(position);
+	}
+}
+
+std::size_t LZ::compress(uint32_t* table, const uint8_t* buffer, std::size_t start, std::size_t length, uint8_t* out, std::size_t capacity)
+{
+	std::size_t end = start + length;
+	std::size_t anchor = start;
+	std::size_t position = start;
+	uint8_t* cursor = out;
+	uint8_t* limit = out + capacity;
+
+	std::size_t searchEnd = length > LZ_LAST_LITERALS + LZ_MIN_MATCH ? end - LZ_LAST_LITERALS : start;
+	while (position < searchEnd)
+	{
+		uint32_t sequence = read32(buffer + position);
+		uint32_t* slot = table + hash(sequence);
+		std::size_t candidate = *slot;
+		*slot = uint32_t(position);
+
+		if (candidate >= position || position - candidate > LZ_WINDOW || read32(buffer + candidate) != sequence)
+		{
+			// Skip ahead faster the longer nothing has matched.
+			position += 1 + ((position - anchor) >> 6);
+			continue;
+		}
+
+		std::size_t match = LZ_MIN_MATCH;
+		while (position + match < end - LZ_LAST_LITERALS && buffer[candidate + match] == buffer[position + match])
+		{
+			match++;
+		}
+		while (position > anchor && candidate > 0 && buffer[position - 1] == buffer[candidate - 1])
+		{
+			position--;
+			candidate--;
+			match++;
+		}
+
+		std::size_t literals = position - anchor;
+		if (std::size_t(limit - cursor) < sequenceBound(literals, match))
+		{
+			return 0;
+		}
+
+		uint8_t* token = cursor++;
+		*token = uint8_t((literals < LZ_RUN_MASK ? literals : LZ_RUN_MASK) << 4);
+		if (literals >= LZ_RUN_MASK)
+		{
+			cursor = writeLength(cursor, literals - LZ_RUN_MASK);
+		}
+		memcpy(cursor, buffer + anchor, literals);
+		cursor += literals;
+
+		std::size_t offset = position - candidate;
+		*cursor++ = uint8_t(offset);
+		*cursor++ = uint8_t(offset >> 8);
+
+		std::size_t extra = match - LZ_MIN_MATCH;
+		*token |= uint8_t(extra < LZ_RUN_MASK ? extra : LZ_RUN_MASK);
+		if (extra >= LZ_RUN_MASK)
+		{
+			cursor = writeLength(cursor, extra - LZ_RUN_MASK);
+		}
+
+		position += match;
+		anchor = position;
+		if (position - 2 < searchEnd)
+		{
+			table[hash(read32(buffer + position - 2))] = uint32_t(position - 2);
+		}
+	}
+
+	// Whatever is left goes out as a final run of literals, with no match.
+	std::size_t literals = end - anchor;
+	if (std::size_t(limit - cursor) < 1 + literals / 255 + 1 + literals)
+	{
+		return 0;
+	}
+	*cursor++ = uint8_t((literals < LZ_RUN_MASK ? literals : LZ_RUN_MASK) << 4);
+	if (literals >= LZ_RUN_MASK)
+	{
+		cursor = writeLength(cursor, literals - LZ_RUN_MASK);
+	}
+	memcpy(cursor, buffer + anchor, literals);
+	cursor += literals;
+	return std::size_t(cursor - out);
+}
+
+int64_t LZ::decompress(const uint8_t* in, std::size_t length, uint8_t* buffer, std::size_t start, std::size_t capacity)
+{
+	const uint8_t* cursor = in;
+	const uint8_t* inEnd = in + length;
+	std::size_t position = start;
+	std::size_t end = start + capacity;
+
+	while (cursor < inEnd)
+	{
+		uint8_t token = *cursor++;
+
+		std::size_t literals = token >> 4;
+		if (literals == LZ_RUN_MASK)
+		{
+			uint8_t extra;
+			do
+			{
+				if (cursor == inEnd)
+				{
+					return -1;
+				}
+				extra = *cursor++;
+				literals += extra;
+			} while (extra == 255);
+		}
+		if (literals > std::size_t(inEnd - cursor) || literals > end - position)
+		{
+			return -1;
+		}
+		memcpy(buffer + position, cursor, literals);
+		cursor += literals;
+		position += literals;
+
+		if (cursor == inEnd)
+		{
+			break;
+		}
+
+		if (inEnd - cursor < 2)
+		{
+			return -1;
+		}
+		std::size_t offset = std::size_t(cursor[0]) | (std::size_t(cursor[1]) << 8);
+		cursor += 2;
+		if (offset == 0 || offset > position)
+		{
+			return -1;
+		}
+
+		std::size_t match = token & LZ_RUN_MASK;
+		if (match == LZ_RUN_MASK)
+		{
+			uint8_t extra;
+			do
+			{
+				if (cursor == inEnd)
+				{
+					return -1;
+				}
+				extra = *cursor++;
+				match += extra;
+			} while (extra == 255);
+		}
+		match += LZ_MIN_MATCH;
+		if (match > end - position)
+		{
+			return -1;
+		}
+
+		uint8_t* to = buffer + position;
+		const uint8_t* from = to - offset;
+		if (offset >= match)
+		{
+			memcpy(to, from, match);
+		}
+		else
+		{
+			// Overlapping, so the match repeats what it has just written.
+			for (std::size_t i = 0; i < match; i++)
+			{
+				to[i] = from[i];
+			}
+		}
+		position += match;
+	}
+	return int64_t(position - start);
+}
@@ -0,0 +1,127 @@
+#include "Mask.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MASK_VECTORIZED 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	typedef std::size_t (*MaskFunction)(uint8_t* buffer, std::size_t length, uint32_t pattern);
+
+	/**
+	 * Each of these XORs whole words from the front of buffer and returns how
+	 * many bytes were done; always a multiple of 4, so the pattern's phase is
+	 * kept for whatever is left.
+	 */
+	std::size_t maskWords(uint8_t* buffer, std::size_t length, uint32_t pattern)
+	{
+		uint64_t wide = (uint64_t(pattern) << 32) | pattern;
+		std::size_t i = 0;
+		for (; i + 8 <= length; i += 8)
+		{
+			uint64_t value;
+			memcpy(&value, buffer + i, sizeof(value));
+			value ^= wide;
+			memcpy(buffer + i, &value, sizeof(value));
+		}
+		return i;
+	}
+
+#ifdef MASK_VECTORIZED
+	__attribute__((target("sse2")))
+	std::size_t maskSSE2(uint8_t* buffer, std::size_t length, uint32_t pattern)
+	{
+		const __m128i mask = _mm_set1_epi32(int(pattern));
+		std::size_t i = 0;
+		for (; i + 64 <= length; i += 64)
+		{
+			__m128i* block = reinterpret_cast<__m128i*>(buffer + i);
+			_mm_storeu_si128(block + 0, _mm_xor_si128(_mm_loadu_si128(block + 0), mask));
+			_mm_storeu_si128(block + 1, _mm_xor_si128(_mm_loadu_si128(block + 1), mask));
+			_mm_storeu_si128(block + 2, _mm_xor_si128(_mm_loadu_si128(block + 2), mask));
+			_mm_storeu_si128(block + 3, _mm_xor_si128(_mm_loadu_si128(block + 3), mask));
+		}
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i* block = reinterpret_cast<__m128i*>(buffer + i);
+			_mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), mask));
+		}
+		return i;
+	}
+
+	__attribute__((target("avx2")))
+	std::size_t maskAVX2(uint8_t* buffer, std::size_t length, uint32_t pattern)
+	{
+		const __m256i mask = _mm256_set1_epi32(int(pattern));
+		std::size_t i = 0;
+		for (; i + 128 <= length; i += 128)
+		{
+			__m256i* block = reinterpret_cast<__m256i*>(buffer + i);
+			_mm256_storeu_si256(block + 0, _mm256_xor_si256(_mm256_loadu_si256(block + 0), mask));
+			_mm256_storeu_si256(block + 1, _mm256_xor_si256(_mm256_loadu_si256(block + 1), mask));
+			_mm256_storeu_si256(block + 2, _mm256_xor_si256(_mm256_loadu_si256(block + 2), mask));
+			_mm256_storeu_si256(block + 3, _mm256_xor_si256(_mm256_loadu_si256(block + 3), mask));
+		}
+		for (; i + 32 <= length; i += 32)
+		{
+			__m256i* block = reinterpret_cast<__m256i*>(buffer + i);
+			_mm256_storeu_si256(block, _mm256_xor_si256(_mm256_loadu_si256(block), mask));
+		}
+		return i;
+	}
+#endif
+
+	MaskFunction selectMask(void)
+	{
+#ifdef MASK_VECTORIZED
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return &maskAVX2;
+		}
+		if (__builtin_cpu_supports("sse2"))
+		{
+			return &maskSSE2;
+		}
+#endif
+		return &maskWords;
+	}
+}
+
+uint32_t maskPattern(uint32_t key, uint64_t offset)
+{
+	uint8_t keyBytes[4] = {
+		uint8_t(key >> 24),
+		uint8_t(key >> 16),
+		uint8_t(key >> 8),
+		uint8_t(key)
+	};
+	uint8_t rotated[4];
+	for (std::size_t i = 0; i < sizeof(rotated); i++)
+	{
+		rotated[i] = keyBytes[(offset + i) & 3];
+	}
+
+	uint32_t pattern;
+	memcpy(&pattern, rotated, sizeof(pattern));
+	return pattern;
+}
+
+void applyMask(uint8_t* buffer, std::size_t length, uint32_t key, uint64_t offset)
+{
+	static const MaskFunction oImplementation = selectMask();
+
+	uint32_t pattern = maskPattern(key, offset);
+	std::size_t done = oImplementation(buffer, length, pattern);
+	done += maskWords(buffer + done, length - done, pattern);
+
+	uint8_t patternBytes[4];
+	memcpy(patternBytes, &pattern, sizeof(patternBytes));
+	for (std::size_t i = done; i < length; i++)
+	{
+		buffer[i] ^= patternBytes[i & 3];
+	}
+}
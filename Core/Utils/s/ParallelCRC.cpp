@@ -0,0 +1,136 @@
+#include "ParallelCRC.h"
+#include "CRC.h"
+
+ParallelCRC::ParallelCRC(WorkerPool& pool, std::size_t chunkSize):
+	mPool(pool),
+	mChunkSize(chunkSize),
+	mMasked(false),
+	mKey(0),
+	mPendingBuffer(NULL),
+	mPendingLength(0),
+	mOffset(0),
+	mPieces(),
+	mLock(),
+	mDone(),
+	mOutstanding(0)
+{
+	// empty
+}
+
+ParallelCRC::ParallelCRC(WorkerPool& pool, uint32_t key, std::size_t chunkSize):
+	mPool(pool),
+	mChunkSize(chunkSize),
+	mMasked(true),
+	mKey(key),
+	mPendingBuffer(NULL),
+	mPendingLength(0),
+	mOffset(0),
+	mPieces(),
+	mLock(),
+	mDone(),
+	mOutstanding(0)
+{
+	// empty
+}
+
+ParallelCRC::~ParallelCRC(void)
+{
+	// Workers write into mPieces; they must be finished before it goes away.
+	std::unique_lock<std::mutex> lock(mLock);
+	mDone.wait(lock, [this](void) { return mOutstanding == 0; });
+}
+
+void ParallelCRC::update(uint8_t* buffer, std::size_t length)
+{
+	while (length > 0)
+	{
+		if (mPendingLength > 0 && buffer != mPendingBuffer + mPendingLength)
+		{
+			// Not contiguous with what we already have.
+			submit();
+		}
+		if (mPendingLength == 0)
+		{
+			mPendingBuffer = buffer;
+		}
+
+		std::size_t count = mChunkSize - mPendingLength;
+		count = count < length ? count : length;
+		mPendingLength += count;
+		buffer += count;
+		length -= count;
+
+		if (mPendingLength == mChunkSize)
+		{
+			submit();
+		}
+	}
+}
+
+uint32_t ParallelCRC::result(void)
+{
+	submit();
+
+	std::unique_lock<std::mutex> lock(mLock);
+	mDone.wait(lock, [this](void) { return mOutstanding == 0; });
+
+	uint32_t crc = 0;
+	for (std::size_t i = 0; i < mPieces.size(); i++)
+	{
+		crc = CRC32::combine(crc, mPieces[i].crc, mPieces[i].length);
+	}
+	return crc;
+}
+
+uint32_t ParallelCRC::calculate(WorkerPool& pool, uint32_t crc, const void* buffer, std::size_t length, std::size_t chunkSize)
+{
+	ParallelCRC parallel(pool, chunkSize);
+	// Unmasked pieces are only ever read.
+	parallel.update(static_cast<uint8_t*>(const_cast<void*>(buffer)), length);
+	return CRC32::combine(crc, parallel.result(), length);
+}
+
+void ParallelCRC::submit(void)
+{
+	if (mPendingLength == 0)
+	{
+		return;
+	}
+
+	Piece piece;
+	piece.buffer = mPendingBuffer;
+	piece.length = mPendingLength;
+	piece.offset = mOffset;
+	piece.crc = 0;
+
+	std::unique_lock<std::mutex> lock(mLock);
+	mPieces.push_back(piece);
+	mOutstanding++;
+	lock.unlock();
+
+	Piece* submitted = &mPieces.back();
+	bool masked = mMasked;
+	uint32_t key = mKey;
+	mPool.submit([this, submitted, masked, key](void) {
+		uint32_t crc;
+		if (masked)
+		{
+			crc = CRC32::calculateMasked(0, submitted->buffer, submitted->length, key, submitted->offset);
+		}
+		else
+		{
+			crc = CRC32::calculate(0, submitted->buffer, submitted->length);
+		}
+
+		std::lock_guard<std::mutex> lock(mLock);
+		submitted->crc = crc;
+		if (--mOutstanding == 0)
+		{
+			mDone.notify_all();
+		}
+	});
+
+	mOffset += mPendingLength;
+	mPendingBuffer = NULL;
+	mPendingLength = 0;
+}
@@ -0,0 +1,212 @@
+#include "Bench.h"
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+using namespace std;
+
+namespace
+{
+	// Results are written with enough digits to diff runs meaningfully.
+	const int BENCH_PRECISION = 6;
+
+	string escape(const string& text)
+	{
+		string result;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			if (text[i] == '"' || text[i] == '\\')
+			{
+				result += '\\';
+			}
+			result += text[i];
+		}
+		return result;
+	}
+}
+
+Bench::Suite::Suite(const char* name, const Body& body)
+{
+	Entry entry;
+	entry.name = name;
+	entry.body = body;
+	suites().push_back(entry);
+}
+
+Bench::Bench(void):
+	mMinSeconds(BENCH_MIN_SECONDS),
+	mSuite(),
+	mResults()
+{
+}
+
+double Bench::time(const std::function<void(uint64_t iterations)>& loop, uint64_t& iterations)
+{
+	iterations = 1;
+	while (true)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		loop(iterations);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (seconds >= mMinSeconds)
+		{
+			return seconds;
+		}
+
+		// Aim straight for the minimum once a run takes long enough to
+		// extrapolate from.
+		uint64_t next = iterations * 2;
+		if (seconds > mMinSeconds / 100)
+		{
+			uint64_t estimate = uint64_t(double(iterations) * mMinSeconds * 1.2 / seconds);
+			next = estimate > next ? estimate : next;
+		}
+		iterations = next;
+	}
+}
+
+void Bench::record(const std::string& name, double value, const char* unit, uint64_t iterations, double seconds)
+{
+	BenchResult result;
+	result.suite = mSuite;
+	result.name = name;
+	result.value = value;
+	result.unit = unit;
+	result.iterations = iterations;
+	result.seconds = seconds;
+	mResults.push_back(result);
+
+	printf("%-8s %-32s %14.3f %s\n", mSuite.c_str(), name.c_str(), value, unit);
+	fflush(stdout);
+}
+
+int Bench::run(int argc, char** argv)
+{
+	const char* json = NULL;
+	const char* csv = NULL;
+	vector<string> only;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			json = argv[++i];
+		}
+		else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+		{
+			csv = argv[++i];
+		}
+		else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+		{
+			mMinSeconds = atof(argv[++i]);
+		}
+		else if (argv[i][0] == '-')
+		{
+			cerr << "Usage: " << argv[0] << " [--json FILE] [--csv FILE] [--seconds MIN] [SUITE...]" << endl;
+			return 1;
+		}
+		else
+		{
+			only.push_back(argv[i]);
+		}
+	}
+
+	vector<Entry>& entries = suites();
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		bool wanted = only.empty();
+		for (size_t j = 0; j < only.size(); j++)
+		{
+			wanted = wanted || only[j] == entries[i].name;
+		}
+		if (!wanted)
+		{
+			continue;
+		}
+
+		mSuite = entries[i].name;
+		try
+		{
+			entries[i].body(*this);
+		}
+		catch (const char* error)
+		{
+			cerr << "Benchmark suite " << mSuite << " failed: " << error << endl;
+			return 1;
+		}
+	}
+
+	if (json)
+	{
+		ofstream out(json);
+		writeJSON(out);
+		if (!out)
+		{
+			cerr << "Could not write " << json << endl;
+			return 1;
+		}
+	}
+	if (csv)
+	{
+		ofstream out(csv);
+		writeCSV(out);
+		if (!out)
+		{
+			cerr << "Could not write " << csv << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+std::vector<Bench::Entry>& Bench::suites(void)
+{
+	static vector<Entry> oSuites;
+	return oSuites;
+}
+
+void Bench::writeJSON(std::ostream& out) const
+{
+	char host[256] = "";
+	gethostname(host, sizeof(host) - 1);
+
+	out.precision(BENCH_PRECISION);
+	out << "{" << endl;
+	out << "\t\"timestamp\": " << ::time(NULL) << "," << endl;
+	out << "\t\"host\": \"" << escape(host) << "\"," << endl;
+	out << "\t\"compiler\": \"" << escape(__VERSION__) << "\"," << endl;
+	out << "\t\"minSeconds\": " << mMinSeconds << "," << endl;
+	out << "\t\"results\": [" << endl;
+	for (size_t i = 0; i < mResults.size(); i++)
+	{
+		const BenchResult& result = mResults[i];
+		out << "\t\t{\"suite\": \"" << escape(result.suite) << "\", \"name\": \"" << escape(result.name) <<
+			"\", \"value\": " << result.value << ", \"unit\": \"" << escape(result.unit) <<
+			"\", \"iterations\": " << result.iterations << ", \"seconds\": " << result.seconds << "}" <<
+			(i + 1 < mResults.size() ? "," : "") << endl;
+	}
+	out << "\t]" << endl;
+	out << "}" << endl;
+}
+
+void Bench::writeCSV(std::ostream& out) const
+{
+	out.precision(BENCH_PRECISION);
+	out << "suite,name,value,unit,iterations,seconds" << endl;
+	for (size_t i = 0; i < mResults.size(); i++)
+	{
+		const BenchResult& result = mResults[i];
+		out << result.suite << "," << result.name << "," << result.value << "," << result.unit << "," <<
+			result.iterations << "," << result.seconds << endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Bench bench;
+	return bench.run(argc, argv);
+}
@@ -0,0 +1,87 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Seconds each measurement runs for, at least, by default.
+const double BENCH_MIN_SECONDS = 0.25;
+
+struct BenchResult
+{
+	std::string suite;
+	std::string name;
+	double value;
+	std::string unit;
+	uint64_t iterations; // In the timed run the value came from.
+	double seconds;
+};
+
+/**
+ * The harness behind `make bench`.
+ *
+ * Each bench_*.cpp registers a suite with a static Bench::Suite. main (in
+ * Bench.cpp) runs every suite, or just those named on the command line, and
+ * prints each result as it comes. It can also write them all as JSON
+ * (--json FILE) and/or CSV (--csv FILE), so that runs can be diffed.
+ *
+ * The benchmarks are built with optimisation, unlike the rest of the tree,
+ * from their own objects (see the Makefile).
+ */
+class Bench
+{
+public:
+	typedef std::function<void(Bench& bench)> Body;
+
+	class Suite
+	{
+	public:
+		Suite(const char* name, const Body& body);
+	};
+
+	Bench(void);
+	Bench(const Bench& source) = delete;
+
+	/**
+	 * Run loop, which must do whatever is being measured the number of times
+	 * it is given, doubling the count until a run takes at least the minimum
+	 * time. Returns the seconds that run took, and its count in iterations.
+	 */
+	double time(const std::function<void(uint64_t iterations)>& loop, uint64_t& iterations);
+
+	void record(const std::string& name, double value, const char* unit, uint64_t iterations, double seconds);
+
+	/**
+	 * Parse the command line, run the suites and write the results. Returns
+	 * main's exit status.
+	 */
+	int run(int argc, char** argv);
+private:
+	struct Entry
+	{
+		std::string name;
+		Body body;
+	};
+
+	static std::vector<Entry>& suites(void);
+	void writeJSON(std::ostream& out) const;
+	void writeCSV(std::ostream& out) const;
+
+	double mMinSeconds;
+	std::string mSuite;
+	std::vector<BenchResult> mResults;
+};
+
+/**
+ * Keep the compiler from optimising away a value a benchmark computes.
+ */
+inline void benchKeep(uint64_t value)
+{
+	__asm__ __volatile__("" : : "r"(value) : "memory");
+}
+
+#endif
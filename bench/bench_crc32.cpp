@@ -0,0 +1,47 @@
+#include "Bench.h"
+#include "CRC.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const std::size_t CRC_SIZES[] = {64, 1024, 16 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+
+	void throughput(Bench& bench, const char* name, uint32_t (*calculate)(uint32_t, const void*, std::size_t), const std::vector<uint8_t>& buffer)
+	{
+		for (std::size_t i = 0; i < sizeof(CRC_SIZES) / sizeof(CRC_SIZES[0]); i++)
+		{
+			std::size_t size = CRC_SIZES[i];
+			uint32_t crc = 0;
+			uint64_t iterations;
+			double seconds = bench.time([&](uint64_t count)
+			{
+				for (uint64_t j = 0; j < count; j++)
+				{
+					crc = calculate(crc, buffer.data(), size);
+				}
+			}, iterations);
+			benchKeep(crc);
+			bench.record(std::string(name) + "/" + std::to_string(size), double(size) * double(iterations) / seconds / 1e9, "GB/s", iterations, seconds);
+		}
+	}
+
+	void crc32(Bench& bench)
+	{
+		std::vector<uint8_t> buffer(CRC_SIZES[sizeof(CRC_SIZES) / sizeof(CRC_SIZES[0]) - 1]);
+		srand(1305);
+		for (std::size_t i = 0; i < buffer.size(); i++)
+		{
+			buffer[i] = uint8_t(rand());
+		}
+
+		// calculate() is what the rest of the tree uses; the table version
+		// is the baseline it is measured against.
+		throughput(bench, "calculate", CRC32::calculate, buffer);
+		throughput(bench, "table", CRC32::calculateTable, buffer);
+	}
+
+	Bench::Suite oCRC32("crc32", crc32);
+}
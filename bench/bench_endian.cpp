@@ -0,0 +1,41 @@
+#include "Bench.h"
+#include "Endian.h"
+
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+	// Enough values that the loop cannot be folded into a constant.
+	const std::size_t ENDIAN_VALUES = 1024;
+
+	void conversion(Bench& bench, const char* name, uint64_t (*convert)(uint64_t), const std::vector<uint64_t>& values)
+	{
+		uint64_t sum = 0;
+		uint64_t iterations;
+		double seconds = bench.time([&](uint64_t count)
+		{
+			for (uint64_t i = 0; i < count; i++)
+			{
+				sum += convert(values[i % ENDIAN_VALUES]);
+			}
+		}, iterations);
+		benchKeep(sum);
+		bench.record(name, seconds / double(iterations) * 1e9, "ns/op", iterations, seconds);
+	}
+
+	void endian(Bench& bench)
+	{
+		std::vector<uint64_t> values(ENDIAN_VALUES);
+		srand(1305);
+		for (std::size_t i = 0; i < values.size(); i++)
+		{
+			values[i] = (uint64_t(rand()) << 32) ^ uint64_t(rand());
+		}
+
+		conversion(bench, "htonll", htonll, values);
+		conversion(bench, "ntohll", ntohll, values);
+	}
+
+	Bench::Suite oEndian("endian", endian);
+}
@@ -0,0 +1,94 @@
+#include "Bench.h"
+#include "Frame.h"
+#include "Mask.h"
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct FrameCase
+	{
+		const char* name;
+		uint64_t length;
+	};
+
+	// A payload in the header's Length, one needing most of its 16 bits, and
+	// one needing the Extended Length.
+	const FrameCase FRAME_CASES[] = {
+		{"small", 16},
+		{"16bit", 60 * 1024},
+		{"extended", 1024 * 1024}
+	};
+
+	const uint32_t FRAME_MASK_KEY = 0x1305c0de;
+
+	// The frame as it would arrive off the wire.
+	std::vector<uint8_t> encoded(uint64_t length, bool masked)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+		header.headerParts.Length = htons(uint16_t(length < FRAME_LENGTH_MAX ? length : FRAME_LENGTH_MAX));
+
+		Frame frame(header);
+		frame.size(length);
+		frame.messageID(1);
+		for (uint64_t i = 0; i < length; i++)
+		{
+			frame.payload()[i] = uint8_t(rand());
+		}
+		if (masked)
+		{
+			frame.mask(FRAME_MASK_KEY);
+		}
+
+		std::vector<uint8_t> wire(FRAME_HEADER_LENGTH_MAX + length);
+		std::size_t headerLength = frame.encode(wire.data());
+		memcpy(wire.data() + headerLength, frame.payload(), length);
+		if (masked)
+		{
+			applyMask(wire.data() + headerLength, length, FRAME_MASK_KEY);
+		}
+		wire.resize(headerLength + length);
+		return wire;
+	}
+
+	void parse(Bench& bench)
+	{
+		srand(1305);
+		for (std::size_t i = 0; i < sizeof(FRAME_CASES) / sizeof(FRAME_CASES[0]); i++)
+		{
+			for (int masked = 0; masked < 2; masked++)
+			{
+				std::vector<uint8_t> wire = encoded(FRAME_CASES[i].length, masked != 0);
+				FrameHeader header;
+				memcpy(&header, wire.data(), sizeof(header));
+
+				// Each frame is parsed, unmasked and CRCed as Seance would;
+				// write() throws if the CRC does not match.
+				uint64_t iterations;
+				double seconds = bench.time([&](uint64_t count)
+				{
+					for (uint64_t j = 0; j < count; j++)
+					{
+						Frame frame(header);
+						frame.write(wire.data() + sizeof(header), wire.size() - sizeof(header));
+						if (!frame.complete())
+						{
+							throw "Benchmark frame did not parse";
+						}
+					}
+				}, iterations);
+				bench.record(std::string("write/") + FRAME_CASES[i].name + (masked ? "/masked" : "/unmasked"),
+					double(iterations) / seconds, "frames/s", iterations, seconds);
+			}
+		}
+	}
+
+	Bench::Suite oFrame("frame", parse);
+}
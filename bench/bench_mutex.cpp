@@ -0,0 +1,68 @@
+#include "Bench.h"
+#include "RAIIMutex.h"
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const unsigned MUTEX_THREADS[] = {1, 2, 4, 8};
+
+	// count acquisitions of the same lock, shared out between threads.
+	template <typename Acquire>
+	void contend(unsigned threads, uint64_t count, const Acquire& acquire)
+	{
+		std::vector<std::thread> workers;
+		for (unsigned i = 0; i < threads; i++)
+		{
+			uint64_t share = count / threads + (i < count % threads ? 1 : 0);
+			workers.push_back(std::thread([share, &acquire](void)
+			{
+				for (uint64_t j = 0; j < share; j++)
+				{
+					acquire();
+				}
+			}));
+		}
+		for (std::size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+	}
+
+	void contention(Bench& bench)
+	{
+		uint64_t shared = 0;
+		std::mutex plain;
+		for (std::size_t i = 0; i < sizeof(MUTEX_THREADS) / sizeof(MUTEX_THREADS[0]); i++)
+		{
+			unsigned threads = MUTEX_THREADS[i];
+			uint64_t iterations;
+			double seconds = bench.time([&](uint64_t count)
+			{
+				contend(threads, count, [&shared](void)
+				{
+					RAIIMutex lock(&shared);
+					shared++;
+				});
+			}, iterations);
+			bench.record("RAIIMutex/" + std::to_string(threads), seconds / double(iterations) * 1e9, "ns/acquire", iterations, seconds);
+
+			// The same with a bare std::mutex, for what the lookup costs.
+			seconds = bench.time([&](uint64_t count)
+			{
+				contend(threads, count, [&shared, &plain](void)
+				{
+					std::lock_guard<std::mutex> lock(plain);
+					shared++;
+				});
+			}, iterations);
+			bench.record("std::mutex/" + std::to_string(threads), seconds / double(iterations) * 1e9, "ns/acquire", iterations, seconds);
+		}
+		benchKeep(shared);
+	}
+
+	Bench::Suite oMutex("mutex", contention);
+}
@@ -0,0 +1,95 @@
+#include "Bench.h"
+#include "Socket.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const std::size_t SOCKET_PAYLOADS[] = {64, 4096};
+
+	// Loopback ports tried in turn until one binds.
+	const int SOCKET_FIRST_PORT = 34700;
+	const int SOCKET_PORTS = 100;
+
+	void echo(Socket* peer, std::size_t length)
+	{
+		std::vector<char> buffer(length);
+		while (peer->receive(buffer.data(), int(length)) == int(length))
+		{
+			if (peer->send(buffer.data(), int(length)) != int(length))
+			{
+				break;
+			}
+		}
+	}
+
+	double percentile(std::vector<double>& samples, double fraction)
+	{
+		std::size_t index = std::size_t(fraction * double(samples.size() - 1));
+		std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+		return samples[index];
+	}
+
+	void loopback(Bench& bench)
+	{
+		Socket listener;
+		std::string port;
+		for (int i = 0; i < SOCKET_PORTS && port.empty(); i++)
+		{
+			std::string candidate = std::to_string(SOCKET_FIRST_PORT + i);
+			if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+			{
+				port = candidate;
+			}
+		}
+		if (port.empty())
+		{
+			throw "No loopback port to bind";
+		}
+
+		for (std::size_t i = 0; i < sizeof(SOCKET_PAYLOADS) / sizeof(SOCKET_PAYLOADS[0]); i++)
+		{
+			std::size_t length = SOCKET_PAYLOADS[i];
+			Socket client;
+			if (client.connect("127.0.0.1", port.c_str()) != 0)
+			{
+				throw "Loopback connect failed";
+			}
+			Socket* peer = listener.accept(true);
+			std::thread server(echo, peer, length);
+
+			// One round trip after another, each timed by itself.
+			std::vector<char> buffer(length, 'x');
+			std::vector<double> samples;
+			uint64_t iterations;
+			double seconds = bench.time([&](uint64_t count)
+			{
+				samples.clear();
+				for (uint64_t j = 0; j < count; j++)
+				{
+					std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+					if (client.send(buffer.data(), int(length)) != int(length) || client.receive(buffer.data(), int(length)) != int(length))
+					{
+						throw "Loopback round trip failed";
+					}
+					samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+				}
+			}, iterations);
+
+			std::string name = "roundtrip/" + std::to_string(length);
+			bench.record(name + "/mean", seconds / double(iterations) * 1e6, "us", iterations, seconds);
+			bench.record(name + "/p50", percentile(samples, 0.5), "us", iterations, seconds);
+			bench.record(name + "/p99", percentile(samples, 0.99), "us", iterations, seconds);
+
+			client.close();
+			server.join();
+			delete peer;
+		}
+	}
+
+	Bench::Suite oSocket("socket", loopback);
+}
@@ -0,0 +1,289 @@
+#include "Compression.h"
+#include "LZ.h"
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	// Text with plenty of repetition, as messages usually have.
+	vector<uint8_t> sample(size_t length)
+	{
+		const char* words[] = {"seance ", "frame ", "message ", "{\"id\": ", "\"payload\": ", "null, ", "true}\n"};
+		vector<uint8_t> data;
+		while (data.size() < length)
+		{
+			const char* word = words[rand() % 7];
+			data.insert(data.end(), word, word + strlen(word));
+			if (rand() % 5 == 0)
+			{
+				data.push_back(uint8_t('0' + rand() % 10));
+			}
+		}
+		data.resize(length);
+		return data;
+	}
+
+	bool roundTrips(const vector<uint8_t>& data, const vector<uint8_t>& dictionary)
+	{
+		vector<uint32_t> table(LZ_TABLE_SIZE);
+		vector<uint8_t> input(dictionary);
+		input.insert(input.end(), data.begin(), data.end());
+		LZ::prime(table.data(), input.data(), dictionary.size());
+
+		vector<uint8_t> compressed(LZ::bound(data.size()));
+		size_t length = LZ::compress(table.data(), input.data(), dictionary.size(), data.size(), compressed.data(), compressed.size());
+		if (length == 0)
+		{
+			return false;
+		}
+
+		vector<uint8_t> output(dictionary);
+		output.resize(dictionary.size() + data.size());
+		if (LZ::decompress(compressed.data(), length, output.data(), dictionary.size(), data.size()) != int64_t(data.size()) ||
+			memcmp(output.data() + dictionary.size(), data.data(), data.size()) != 0)
+		{
+			return false;
+		}
+
+		// Every truncation, and too little room, must be caught rather than
+		// read or written past.
+		for (size_t cut = 0; cut < length; cut++)
+		{
+			vector<uint8_t> truncated(compressed.begin(), compressed.begin() + cut);
+			if (LZ::decompress(truncated.data(), cut, output.data(), dictionary.size(), data.size()) == int64_t(data.size()) &&
+				data.size() > 0 && cut + 1 < length)
+			{
+				return false;
+			}
+		}
+		return data.empty() || LZ::decompress(compressed.data(), length, output.data(), dictionary.size(), data.size() - 1) == -1;
+	}
+
+	shared_ptr<Frame> makeFrame(const vector<uint8_t>& payload)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x1;
+
+		shared_ptr<Frame> frame(new Frame(header));
+		frame->size(payload.size());
+		memcpy(frame->payload(), payload.data(), payload.size());
+		frame->messageID(42);
+		frame->respondingTo(7);
+		return frame;
+	}
+
+	// An extension frame carrying body, as the compressed frames are.
+	shared_ptr<Frame> makeExtension(const vector<uint8_t>& body)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x3;
+
+		shared_ptr<Frame> extension(new Frame(header));
+		extension->size(body.size());
+		memcpy(extension->payload(), body.data(), body.size());
+		extension->messageID(42);
+		return extension;
+	}
+
+	// The frame as it arrives: encoded, then parsed back in place.
+	vector<uint8_t> wire(const Frame& frame)
+	{
+		vector<uint8_t> encoded(FRAME_HEADER_LENGTH_MAX + size_t(frame.size()));
+		size_t headerLength = frame.encode(encoded.data());
+		memcpy(encoded.data() + headerLength, frame.payload(), size_t(frame.size()));
+		encoded.resize(headerLength + size_t(frame.size()));
+		return encoded;
+	}
+
+	bool decompresses(Compression& compression, vector<uint8_t>& encoded, FrameView& original)
+	{
+		FrameView view;
+		if (view.parse(encoded.data(), encoded.size()) != FRAME_PARSE_COMPLETE || !view.verify() || view.size() < 8)
+		{
+			return false;
+		}
+		return compression.decompress(view, view.payload() + 8, view.size() - 8, original);
+	}
+}
+
+int main(void)
+{
+	srand(1);
+
+	// LZ on its own: lengths around its limits, repetitive, random and
+	// overlapping data, with and without a dictionary.
+	vector<uint8_t> dictionary = sample(4000);
+	const size_t lengths[] = {1, 4, 9, 10, 15, 16, 300, 4096, 70000};
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+	{
+		vector<uint8_t> random(lengths[i]);
+		for (size_t j = 0; j < random.size(); j++)
+		{
+			random[j] = uint8_t(rand());
+		}
+		vector<uint8_t> zeros(lengths[i], 0);
+		vector<uint8_t> text = sample(lengths[i]);
+		if (!roundTrips(random, vector<uint8_t>()) || !roundTrips(zeros, vector<uint8_t>()) || !roundTrips(text, vector<uint8_t>()) ||
+			!roundTrips(text, dictionary) || !roundTrips(zeros, dictionary))
+		{
+			cerr << "LZ did not round trip " << lengths[i] << " bytes" << endl;
+			return 1;
+		}
+	}
+
+	// Back references before the start of the output, or of zero, are
+	// malformed.
+	vector<uint8_t> output(64);
+	const uint8_t before[] = {0x10, 'a', 0x05, 0x00};
+	const uint8_t zero[] = {0x10, 'a', 0x00, 0x00};
+	if (LZ::decompress(before, sizeof(before), output.data(), 0, output.size()) != -1 ||
+		LZ::decompress(zero, sizeof(zero), output.data(), 0, output.size()) != -1)
+	{
+		cerr << "LZ accepted a reference outside the output" << endl;
+		return 1;
+	}
+
+	// Whole frames, with a dictionary at both ends.
+	Compression sender;
+	Compression receiver;
+	sender.dictionary(dictionary.data(), dictionary.size());
+	receiver.dictionary(dictionary.data(), dictionary.size());
+	for (int i = 0; i < 3; i++)
+	{
+		vector<uint8_t> payload = sample(i == 1 ? 200000 : 5000);
+		shared_ptr<Frame> frame = makeFrame(payload);
+		shared_ptr<Frame> compressed = sender.compress(frame);
+		if (compressed == frame || compressed->opcode() != 0x3 || compressed->size() >= frame->size())
+		{
+			cerr << "Frame of " << payload.size() << " bytes was not compressed" << endl;
+			return 1;
+		}
+
+		// Seance gives the compressed frame its Message ID as it goes out.
+		compressed->messageID(frame->messageID());
+		vector<uint8_t> encoded = wire(*compressed);
+		FrameView original;
+		if (!decompresses(receiver, encoded, original) || original.opcode() != 0x1 || original.messageID() != 42 ||
+			original.respondingTo() != 7 || original.size() != payload.size() ||
+			memcmp(original.payload(), payload.data(), payload.size()) != 0)
+		{
+			cerr << "Frame of " << payload.size() << " bytes did not decompress" << endl;
+			return 1;
+		}
+	}
+	if (sender.stats().compressed != 3 || receiver.stats().decompressed != 3 || receiver.stats().failures != 0 || sender.ratio() >= 1.0)
+	{
+		cerr << "Compression stats are off" << endl;
+		return 1;
+	}
+
+	// Too short, or too long, to be worth it.
+	shared_ptr<Frame> small = makeFrame(sample(100));
+	Compression limited;
+	limited.maxLength(4096);
+	shared_ptr<Frame> large = makeFrame(sample(5000));
+	if (sender.compress(small) != small || limited.compress(large) != large || limited.stats().skipped != 1)
+	{
+		cerr << "Frames outside the limits were compressed" << endl;
+		return 1;
+	}
+
+	// Malformed frames fail, and are counted, without a crash.
+	Compression plain;
+	vector<uint8_t> payload = sample(20000);
+	shared_ptr<Frame> compressed = plain.compress(makeFrame(payload));
+	vector<uint8_t> good(compressed->payload(), compressed->payload() + compressed->size());
+	FrameView original;
+	uint64_t failures = 0;
+
+	// A real bomb: a little over the limit of zeros, compressed by a peer
+	// which raised its own. It is refused unless the limit is raised here too.
+	Compression bomber;
+	bomber.maxLength(COMPRESSION_LENGTH_MAX + 1);
+	vector<uint8_t> zeros(COMPRESSION_LENGTH_MAX + 1, 0);
+	shared_ptr<Frame> bomb = bomber.compress(makeFrame(zeros));
+	vector<uint8_t> encoded = wire(*bomb);
+	if (bomb->size() > zeros.size() / 100 || decompresses(plain, encoded, original) || plain.stats().failures != ++failures)
+	{
+		cerr << "A frame decompressing to " << zeros.size() << " bytes was accepted" << endl;
+		return 1;
+	}
+	Compression raised;
+	raised.maxLength(COMPRESSION_LENGTH_MAX + 1);
+	if (!decompresses(raised, encoded, original) || original.size() != zeros.size())
+	{
+		cerr << "A frame within a raised limit was refused" << endl;
+		return 1;
+	}
+
+	Compression strict;
+	strict.maxLength(uint32_t(payload.size() - 1));
+	encoded = wire(*makeExtension(good));
+	if (decompresses(strict, encoded, original) || strict.stats().failures != 1)
+	{
+		cerr << "A frame longer than a lowered limit was accepted" << endl;
+		return 1;
+	}
+
+	// Claiming a different length than it decompresses to.
+	vector<uint8_t> lying = good;
+	uint32_t claimed = htonl(uint32_t(payload.size() + 1));
+	memcpy(lying.data() + 8 + 6, &claimed, sizeof(claimed));
+	encoded = wire(*makeExtension(lying));
+	if (decompresses(plain, encoded, original) || plain.stats().failures != ++failures)
+	{
+		cerr << "A frame with the wrong length was accepted" << endl;
+		return 1;
+	}
+
+	// An unknown codec, an opcode that is never compressed, or the wrong
+	// dictionary.
+	const size_t offsets[] = {0, 1, 2};
+	const uint8_t values[] = {9, 0x8, 0xFF};
+	for (size_t i = 0; i < 3; i++)
+	{
+		vector<uint8_t> bad = good;
+		bad[8 + offsets[i]] = values[i];
+		encoded = wire(*makeExtension(bad));
+		if (decompresses(plain, encoded, original) || plain.stats().failures != ++failures)
+		{
+			cerr << "A frame with a bad header byte " << offsets[i] << " was accepted" << endl;
+			return 1;
+		}
+	}
+
+	// Truncated compressed data, and data too short for the header.
+	for (size_t cut = 1; cut < good.size() - 8; cut += 97)
+	{
+		vector<uint8_t> truncated(good.begin(), good.begin() + 8 + cut);
+		encoded = wire(*makeExtension(truncated));
+		if (decompresses(plain, encoded, original) || plain.stats().failures != ++failures)
+		{
+			cerr << "Compressed data cut to " << cut << " bytes was accepted" << endl;
+			return 1;
+		}
+	}
+
+	// The intact frame still decompresses after all that.
+	encoded = wire(*makeExtension(good));
+	if (!decompresses(plain, encoded, original) || original.size() != payload.size() ||
+		memcmp(original.payload(), payload.data(), payload.size()) != 0)
+	{
+		cerr << "The intact frame did not decompress" << endl;
+		return 1;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
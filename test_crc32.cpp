@@ -0,0 +1,123 @@
+#include "CRC.h"
+#include "Mask.h"
+#include "ParallelCRC.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+int main(void)
+{
+	const char check[] = "123456789";
+	uint32_t expected = 0xcbf43926;
+	if (CRC32::calculateTable(0, check, 9) != expected || CRC32::calculate(0, check, 9) != expected)
+	{
+		cerr << "CRC32 check value mismatch" << endl;
+		return 1;
+	}
+
+	vector<uint8_t> data(1 << 20);
+	srand(1305);
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		data[i] = uint8_t(rand());
+	}
+
+	// The fused unmask + CRC has to match unmasking first and CRCing after,
+	// including when the buffer starts part way through the key.
+	for (size_t i = 0; i < 5000; i++)
+	{
+		size_t offset = rand() % 64;
+		size_t length = rand() % 20000;
+		uint64_t keyOffset = rand();
+		uint32_t key = uint32_t(rand());
+		uint32_t seed = uint32_t(rand());
+
+		vector<uint8_t> separate(data.begin() + offset, data.begin() + offset + length);
+		vector<uint8_t> fused(separate);
+		applyMask(separate.data(), length, key, keyOffset);
+		uint32_t expectedMasked = CRC32::calculateTable(seed, separate.data(), length);
+		uint32_t masked = CRC32::calculateMasked(seed, fused.data(), length, key, keyOffset);
+		if (expectedMasked != masked || separate != fused)
+		{
+			cerr << hex << "Masked CRC32 mismatch length=" << length << " keyOffset=" << keyOffset << endl;
+			return 1;
+		}
+	}
+
+	// Combining the CRCs of two blocks gives the CRC of both together, for
+	// any split, including empty blocks either side.
+	for (size_t i = 0; i < 5000; i++)
+	{
+		size_t length = i < 2500 ? rand() % 4096 : rand() % data.size();
+		size_t split = length == 0 ? 0 : rand() % (length + 1);
+		uint32_t first = CRC32::calculate(0, data.data(), split);
+		uint32_t second = CRC32::calculate(0, data.data() + split, length - split);
+		if (CRC32::combine(first, second, length - split) != CRC32::calculate(0, data.data(), length))
+		{
+			cerr << "CRC32 combine mismatch length=" << length << " split=" << split << endl;
+			return 1;
+		}
+	}
+
+	// Pieces CRCed on a pool, fed in uneven updates, with and without
+	// unmasking, against the CRC of the whole.
+	WorkerPool pool(4);
+	for (size_t i = 0; i < 50; i++)
+	{
+		size_t length = rand() % data.size();
+		size_t chunk = 1 + rand() % 200000;
+		uint32_t seed = uint32_t(rand());
+		if (ParallelCRC::calculate(pool, seed, data.data(), length, chunk) != CRC32::calculate(seed, data.data(), length))
+		{
+			cerr << "ParallelCRC mismatch length=" << length << " chunk=" << chunk << endl;
+			return 1;
+		}
+
+		uint32_t key = uint32_t(rand());
+		vector<uint8_t> separate(data.begin(), data.begin() + length);
+		vector<uint8_t> parallel(separate);
+		uint32_t expectedMasked = CRC32::calculateMasked(0, separate.data(), length, key);
+
+		ParallelCRC masked(pool, key, chunk);
+		for (size_t done = 0; done < length; )
+		{
+			size_t piece = 1 + rand() % 100000;
+			piece = piece < length - done ? piece : length - done;
+			masked.update(parallel.data() + done, piece);
+			done += piece;
+		}
+		if (masked.result() != expectedMasked || parallel != separate)
+		{
+			cerr << "Masked ParallelCRC mismatch length=" << length << " chunk=" << chunk << endl;
+			return 1;
+		}
+	}
+
+	cout << "accelerated: " << CRC32::accelerated() << endl;
+	if (!CRC32::accelerated())
+	{
+		return 0;
+	}
+
+	// Random lengths either side of the folding thresholds, at every alignment.
+	for (size_t i = 0; i < 20000; i++)
+	{
+		size_t offset = rand() % 64;
+		size_t length = i < 10000 ? rand() % 1024 : rand() % (data.size() - offset);
+		uint32_t seed = i % 2 ? uint32_t(rand()) : 0;
+
+		uint32_t table = CRC32::calculateTable(seed, &data[offset], length);
+		uint32_t folded = CRC32::calculateFolded(seed, &data[offset], length);
+		if (table != folded)
+		{
+			cerr << hex << "CRC32 mismatch offset=" << offset << " length=" << length << " seed=" << seed <<
+				" table=" << table << " folded=" << folded << endl;
+			return 1;
+		}
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include "EventLoop.h"
+#include "Socket.h"
+
+#include <fcntl.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 47300;
+	const int PORTS = 100;
+
+	// A connected pair over loopback; the client side is returned in client.
+	Socket* connectPair(Socket& listener, const string& port, Socket*& client)
+	{
+		client = new Socket();
+		if (client->connect("127.0.0.1", port.c_str()) != 0)
+		{
+			throw "Loopback connect failed";
+		}
+		return listener.accept(true);
+	}
+}
+
+int main(void)
+{
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	EventLoop loop;
+
+	// A socket the loop owns, closing itself: the loop must leave deleting it
+	// until close() is done with it, and the descriptor must still be closed.
+	Socket* client;
+	Socket* owned = connectPair(listener, port, client);
+	int fd = owned->descriptor();
+	if (loop.add(owned, EPOLLIN, [](Socket&, uint32_t) {}, true) != 0 || loop.size() != 1)
+	{
+		cerr << "Unable to add socket to loop" << endl;
+		return 1;
+	}
+	owned->close();
+	if (loop.size() != 0 || ::fcntl(fd, F_GETFD) != -1)
+	{
+		cerr << "Owned socket was not removed and closed" << endl;
+		return 1;
+	}
+	delete client;
+
+	// The same, from inside the socket's own callback once the peer hangs up.
+	Socket* closing = connectPair(listener, port, client);
+	fd = closing->descriptor();
+	bool called = false;
+	loop.add(closing, EPOLLIN | EPOLLRDHUP, [&called](Socket& socket, uint32_t) {
+		called = true;
+		socket.close();
+	}, true);
+	client->close();
+	for (int i = 0; i < 100 && !called; i++)
+	{
+		loop.runOnce(10);
+	}
+	if (!called || loop.size() != 0 || ::fcntl(fd, F_GETFD) != -1)
+	{
+		cerr << "Owned socket did not close from its callback" << endl;
+		return 1;
+	}
+	delete client;
+
+	// Sockets the loop does not own are left to their owner.
+	Socket* borrowed = connectPair(listener, port, client);
+	loop.add(borrowed, EPOLLIN, [](Socket&, uint32_t) {});
+	borrowed->close();
+	if (loop.size() != 0 || borrowed->descriptor() != -1)
+	{
+		cerr << "Borrowed socket was not removed and closed" << endl;
+		return 1;
+	}
+	delete borrowed;
+	delete client;
+
+	// Blocking calls off the loop's thread must not wait on the loop, whether
+	// it is one being run here or the private loop of the thread that first
+	// blocked on the socket.
+	for (int round = 0; round < 2; round++)
+	{
+		Socket* server = connectPair(listener, port, client);
+		char buffer[5];
+		if (round == 0)
+		{
+			loop.add(server, EPOLLIN, [](Socket&, uint32_t) {});
+		}
+		else if (server->receive(buffer, sizeof(buffer), 1) != 0)
+		{
+			cerr << "Receive with nothing sent did not time out" << endl;
+			return 1;
+		}
+
+		atomic<int> received(-1);
+		thread reader([&]() { received = server->receive(buffer, sizeof(buffer), 5000); });
+		for (int i = 0; i < 10; i++)
+		{
+			loop.runOnce(10);
+		}
+		client->send("hello", 5);
+		for (int i = 0; i < 500 && received < 0; i++)
+		{
+			loop.runOnce(10);
+		}
+		reader.join();
+		if (received != 5 || memcmp(buffer, "hello", 5) != 0)
+		{
+			cerr << "Receive from another thread got " << received << " bytes" << endl;
+			return 1;
+		}
+		server->close();
+		delete server;
+		delete client;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,172 @@
+#include "Endian.h"
+#include "EventLoop.h"
+#include "ExtensionTable.h"
+#include "Rcu.h"
+#include "Seance.h"
+#include "Socket.h"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 47900;
+	const int PORTS = 100;
+
+	// An extension frame for id carrying length bytes of its own.
+	std::shared_ptr<Frame> extensionFrame(uint64_t id, uint64_t length)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x3;
+		std::shared_ptr<Frame> frame(new Frame(header));
+		frame->size(EXTENSION_RECORD_LENGTH - 1 + length);
+		uint64_t wireID = htonll(id);
+		memcpy(frame->payload(), &wireID, sizeof(wireID));
+		memset(frame->payload() + sizeof(wireID), 0x5A, length);
+		return frame;
+	}
+}
+
+int main(void)
+{
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	// Handlers are handed a Seance, so give them a real one.
+	Socket client;
+	if (client.connect("127.0.0.1", port.c_str()) != 0)
+	{
+		cerr << "Loopback connect failed" << endl;
+		return 1;
+	}
+	Socket* accepted = listener.accept(true);
+	EventLoop loop;
+	Seance seance(*accepted, loop, SEANCE_SERVER, [](Seance&, FrameView&) {});
+
+	// Every offer and withdrawal publishes a version of its own; a withdrawal
+	// of something not on offer changes nothing.
+	ExtensionTable table;
+	atomic<int> calls[2];
+	calls[0] = 0;
+	calls[1] = 0;
+	table.offer(7, [&calls](Seance&, FrameView&, const uint8_t* data, uint64_t length)
+	{
+		calls[0]++;
+		if (length != 5 || data[0] != 0x5A)
+		{
+			calls[0] += 1000;
+		}
+	});
+	table.offer(9, [&calls](Seance&, FrameView&, const uint8_t*, uint64_t) { calls[1]++; });
+	table.withdraw(11);
+	if (table.version() != 2 || table.size() != 2 || !table.offered(7) || table.offered(11))
+	{
+		cerr << "Offers published version " << table.version() << " with " << table.size() << " extensions" << endl;
+		return 1;
+	}
+
+	// Enabling is per set: extensions not on offer stay off, and a set that
+	// has not enabled one does not dispatch to it.
+	ExtensionSet enabled;
+	ExtensionSet other;
+	ExtensionChanges changes;
+	changes.push_back(make_pair(uint64_t(7), true));
+	changes.push_back(make_pair(uint64_t(11), true));
+	ExtensionChanges result;
+	table.apply(changes, enabled, &result);
+	if (result.size() != 2 || !result[0].second || result[1].second || enabled.size() != 1 || table.version() != 2)
+	{
+		cerr << "Applying changes enabled the wrong extensions" << endl;
+		return 1;
+	}
+
+	std::shared_ptr<Frame> frame = extensionFrame(7, 5);
+	FrameView view(*frame);
+	if (!table.enabled(enabled, 7) || table.enabled(other, 7) || !table.dispatch(seance, view, enabled) ||
+		table.dispatch(seance, view, other) || calls[0] != 1)
+	{
+		cerr << "Dispatch did not follow the enabled set" << endl;
+		return 1;
+	}
+
+	std::shared_ptr<Frame> unknown = extensionFrame(9, 0);
+	FrameView unknownView(*unknown);
+	if (table.dispatch(seance, unknownView, enabled) || calls[1] != 0)
+	{
+		cerr << "Dispatched to an extension offered but never enabled" << endl;
+		return 1;
+	}
+
+	// Withdrawing disables it everywhere, even in sets which still list it.
+	table.withdraw(7);
+	if (table.version() != 3 || table.enabled(enabled, 7) || table.dispatch(seance, view, enabled) || calls[0] != 1)
+	{
+		cerr << "Withdrawn extension still dispatched" << endl;
+		return 1;
+	}
+	changes.clear();
+	changes.push_back(make_pair(uint64_t(9), true));
+	changes.push_back(make_pair(uint64_t(7), false));
+	table.apply(changes, enabled);
+	if (enabled.size() != 1 || !table.dispatch(seance, unknownView, enabled) || calls[1] != 1)
+	{
+		cerr << "Disabling or enabling through apply failed" << endl;
+		return 1;
+	}
+
+	// Dispatching on one thread while another republishes the table must
+	// never touch a reclaimed version.
+	atomic<bool> stop(false);
+	atomic<int> dispatched(0);
+	thread reader([&](void)
+	{
+		std::shared_ptr<Frame> readerFrame = extensionFrame(9, 0);
+		FrameView readerView(*readerFrame);
+		while (!stop)
+		{
+			if (table.dispatch(seance, readerView, enabled))
+			{
+				dispatched++;
+			}
+		}
+	});
+	for (int i = 0; i < 2000; i++)
+	{
+		table.offer(100 + i % 10, [](Seance&, FrameView&, const uint8_t*, uint64_t) {});
+		table.withdraw(100 + (i + 5) % 10);
+	}
+	stop = true;
+	reader.join();
+	Rcu::reclaim();
+	if (dispatched == 0 || calls[1] != dispatched + 1 || Rcu::retired() != 0)
+	{
+		cerr << "Concurrent dispatch went wrong: " << dispatched << " dispatched, " << Rcu::retired() << " versions unreclaimed" << endl;
+		return 1;
+	}
+
+	seance.close();
+	delete accepted;
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,246 @@
+#include "CRC.h"
+#include "Frame.h"
+#include "FrameReader.h"
+#include "Mask.h"
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	struct Expected
+	{
+		uint8_t opcode;
+		uint32_t messageID;
+		bool response;
+		uint32_t respondingTo;
+		bool masked;
+		uint32_t crc;
+		vector<uint8_t> payload;
+	};
+
+	// Encode a frame as it goes on the wire, remembering what it should
+	// parse back into.
+	void encode(vector<uint8_t>& wire, vector<Expected>& expected, uint64_t length, bool masked, bool response)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = uint8_t(1 + rand() % 2);
+
+		Frame frame(header);
+		frame.size(length);
+		frame.messageID(uint32_t(rand()));
+		for (uint64_t i = 0; i < length; i++)
+		{
+			frame.payload()[i] = uint8_t(rand());
+		}
+		if (response)
+		{
+			frame.respondingTo(uint32_t(rand()));
+		}
+		if (masked)
+		{
+			frame.mask(uint32_t(rand()));
+		}
+
+		uint8_t encoded[FRAME_HEADER_LENGTH_MAX];
+		size_t headerLength = frame.encode(encoded);
+
+		// FIN, RSP and MASK are the top three bits of the first byte.
+		if (encoded[0] != (0x80 | (response ? 0x40 : 0) | (masked ? 0x20 : 0)))
+		{
+			cerr << "Flags encoded as " << int(encoded[0]) << endl;
+			exit(1);
+		}
+
+		size_t start = wire.size();
+		wire.insert(wire.end(), encoded, encoded + headerLength);
+		wire.insert(wire.end(), frame.payload(), frame.payload() + length);
+		if (masked)
+		{
+			applyMask(wire.data() + start + headerLength, length, frame.mask());
+		}
+
+		Expected frameExpected;
+		frameExpected.opcode = frame.opcode();
+		frameExpected.messageID = frame.messageID();
+		frameExpected.response = response;
+		frameExpected.respondingTo = frame.respondingTo();
+		frameExpected.masked = masked;
+		frameExpected.crc = frame.calculateCRC();
+		frameExpected.payload.assign(frame.payload(), frame.payload() + length);
+		expected.push_back(frameExpected);
+	}
+
+	bool matches(const FrameView& frame, const Expected& expected)
+	{
+		return frame.opcode() == expected.opcode &&
+			frame.messageID() == expected.messageID &&
+			frame.header().headerParts.RSP == expected.response &&
+			(!expected.response || frame.respondingTo() == expected.respondingTo) &&
+			frame.header().headerParts.MASK == expected.masked &&
+			frame.crc() == expected.crc &&
+			frame.size() == expected.payload.size() &&
+			(expected.payload.empty() || memcmp(frame.payload(), expected.payload.data(), expected.payload.size()) == 0);
+	}
+
+	// Read wire in two pieces split at split, checking every frame comes
+	// out as encoded.
+	bool readSplit(const vector<uint8_t>& wire, const vector<Expected>& expected, size_t split)
+	{
+		vector<uint8_t> buffer(wire);
+		size_t delivered = 0;
+		bool good = true;
+		FrameReader reader([&](FrameView& frame)
+		{
+			good = good && delivered < expected.size() && matches(frame, expected[delivered]);
+			delivered++;
+		});
+
+		try
+		{
+			reader.read(buffer.data(), split);
+			reader.read(buffer.data() + split, buffer.size() - split);
+		}
+		catch (const char* error)
+		{
+			cerr << "Reading split at " << split << " threw " << error << endl;
+			return false;
+		}
+		if (!good || delivered != expected.size() || reader.partial())
+		{
+			cerr << "Frames split at " << split << " of " << wire.size() << " did not parse back as encoded" << endl;
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(void)
+{
+	srand(1305);
+
+	// Every combination of mask, RSP and length encoding, each behind a frame
+	// so that it starts part way through the buffer as well.
+	const uint64_t lengths[] = {0, 1, 7, 300, FRAME_LENGTH_MAX - 1, FRAME_LENGTH_MAX, FRAME_LENGTH_MAX + 77};
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+	{
+		for (int flags = 0; flags < 4; flags++)
+		{
+			vector<uint8_t> wire;
+			vector<Expected> expected;
+			encode(wire, expected, 5, false, false);
+			size_t start = wire.size();
+			encode(wire, expected, lengths[i], flags & 1, flags & 2);
+			size_t end = wire.size();
+			encode(wire, expected, 3, true, true);
+
+			// Parsed whole, in place, the header should be exactly as long as
+			// Frame::encode made it.
+			FrameView view;
+			vector<uint8_t> copy(wire.begin() + start, wire.begin() + end);
+			if (view.parse(copy.data(), copy.size()) != FRAME_PARSE_COMPLETE || view.frameLength() != copy.size() ||
+				!view.verify() || !matches(view, expected[1]))
+			{
+				cerr << "Frame of " << lengths[i] << " bytes did not parse in place" << endl;
+				return 1;
+			}
+
+			// Every boundary in the short frames; in the long ones every
+			// boundary in and around the headers, and a sample of the payload.
+			for (size_t split = 0; split <= wire.size(); split++)
+			{
+				bool edge = split < start + FRAME_HEADER_LENGTH_MAX + 64 || split + 64 > end;
+				if ((edge || split % 997 == 0) && !readSplit(wire, expected, split))
+				{
+					return 1;
+				}
+			}
+		}
+	}
+
+	// A corrupted payload must fail its CRC, however it arrives.
+	vector<uint8_t> wire;
+	vector<Expected> expected;
+	encode(wire, expected, 100, true, false);
+	wire.back() ^= 1;
+	for (size_t split = 0; split <= wire.size(); split++)
+	{
+		vector<uint8_t> buffer(wire);
+		FrameReader reader([](FrameView&) {});
+		bool threw = false;
+		try
+		{
+			reader.read(buffer.data(), split);
+			reader.read(buffer.data() + split, buffer.size() - split);
+		}
+		catch (const char* error)
+		{
+			threw = true;
+		}
+		if (!threw)
+		{
+			cerr << "Corrupt frame split at " << split << " was accepted" << endl;
+			return 1;
+		}
+	}
+
+	// A short payload behind Length == 65535 is malformed, and must be
+	// rejected the same way whether it is parsed in place or straddles reads.
+	wire.clear();
+	expected.clear();
+	encode(wire, expected, 300, false, false);
+	vector<uint8_t> padded(wire.begin(), wire.begin() + 2);
+	padded.push_back(0xFF);
+	padded.push_back(0xFF);
+	for (int shift = 56; shift >= 0; shift -= 8)
+	{
+		padded.push_back(uint8_t(uint64_t(300) >> shift));
+	}
+	padded.insert(padded.end(), wire.begin() + 4, wire.begin() + 8);
+	const uint8_t blankCRC[4] = {0, 0, 0, 0};
+	uint32_t crc = CRC32::calculate(0, padded.data(), padded.size());
+	crc = CRC32::calculate(crc, blankCRC, sizeof(blankCRC));
+	crc = CRC32::calculate(crc, wire.data() + 12, 300);
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		padded.push_back(uint8_t(crc >> shift));
+	}
+	padded.insert(padded.end(), wire.begin() + 12, wire.end());
+
+	FrameView view;
+	vector<uint8_t> copy(padded);
+	if (view.parse(copy.data(), copy.size()) != FRAME_PARSE_INVALID)
+	{
+		cerr << "Non-canonical extended length parsed in place" << endl;
+		return 1;
+	}
+	for (size_t split = 0; split <= padded.size(); split++)
+	{
+		vector<uint8_t> buffer(padded);
+		FrameReader reader([](FrameView&) {});
+		const char* thrown = NULL;
+		try
+		{
+			reader.read(buffer.data(), split);
+			reader.read(buffer.data() + split, buffer.size() - split);
+		}
+		catch (const char* error)
+		{
+			thrown = error;
+		}
+		if (thrown == NULL || strcmp(thrown, "Invalid frame!") != 0)
+		{
+			cerr << "Non-canonical extended length split at " << split << " gave " << (thrown ? thrown : "no error") << endl;
+			return 1;
+		}
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
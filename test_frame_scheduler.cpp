@@ -0,0 +1,382 @@
+#include "FrameScheduler.h"
+#include "OutboundQueue.h"
+#include "Socket.h"
+
+#include <sys/socket.h>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 47800;
+	const int PORTS = 100;
+	const size_t FRAGMENT = FRAME_FRAGMENT_MIN;
+
+	// What the emitter saw of each frame that went out.
+	struct Emitted
+	{
+		uint8_t opcode;
+		bool fin;
+		bool rsp;
+		uint32_t respondingTo;
+		uint64_t size;
+		uint8_t tag;
+	};
+
+	// A connected pair over loopback; the client side is returned in client.
+	Socket* connectPair(Socket& listener, const string& port, Socket*& client)
+	{
+		client = new Socket();
+		if (client->connect("127.0.0.1", port.c_str()) != 0)
+		{
+			throw "Loopback connect failed";
+		}
+		return listener.accept(true);
+	}
+
+	// A frame whose every payload byte is tag, so that fragments can be told
+	// apart by where they came from.
+	std::shared_ptr<Frame> taggedFrame(uint8_t opcode, uint64_t length, uint8_t tag, bool fin = true)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = fin ? 1 : 0;
+		header.headerParts.Opcode = opcode;
+		std::shared_ptr<Frame> frame(new Frame(header));
+		frame->size(length);
+		if (length > 0)
+		{
+			memset(frame->payload(), tag, length);
+		}
+		return frame;
+	}
+
+	// The scheduler under test, feeding a real OutboundQueue whose peer
+	// throws everything away; the emitter numbers frames and records them.
+	struct Harness
+	{
+		Harness(Socket& server, Socket& client):
+			mClient(client),
+			mQueue(server, NULL, SIZE_MAX),
+			mNextID(0),
+			mEmitted(),
+			mScheduler(mQueue, server, [this](const std::shared_ptr<Frame>& frame)
+			{
+				frame->messageID(mNextID++);
+				Emitted emitted;
+				emitted.opcode = frame->opcode();
+				emitted.fin = frame->header().headerParts.FIN;
+				emitted.rsp = frame->header().headerParts.RSP;
+				emitted.respondingTo = emitted.rsp ? frame->respondingTo() : 0;
+				emitted.size = frame->size();
+				emitted.tag = frame->size() > 0 ? frame->payload()[0] : 0;
+				mEmitted.push_back(emitted);
+				return frame;
+			})
+		{
+			mScheduler.fragmentSize(FRAGMENT);
+		}
+
+		// Empty the OutboundQueue, as the socket draining would, and let the
+		// scheduler refill it.
+		bool drain(void)
+		{
+			uint8_t buffer[64 * 1024];
+			for (int tries = 0; mQueue.size() > 0 && tries < 1000; tries++)
+			{
+				if (mQueue.flush() < 0)
+				{
+					return false;
+				}
+				while (::recv(mClient.descriptor(), buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+			}
+			if (mQueue.size() > 0)
+			{
+				return false;
+			}
+			mScheduler.pump();
+			return true;
+		}
+
+		// Drain until nothing is left queued anywhere.
+		bool finish(void)
+		{
+			for (int rounds = 0; mScheduler.queued() > 0 && rounds < 10000; rounds++)
+			{
+				if (!drain())
+				{
+					return false;
+				}
+			}
+			return drain() && mScheduler.queued() == 0;
+		}
+
+		Socket& mClient;
+		OutboundQueue mQueue;
+		uint32_t mNextID;
+		vector<Emitted> mEmitted;
+		FrameScheduler mScheduler;
+	};
+
+	bool controlJumpsQueue(Socket& server, Socket& client)
+	{
+		Harness harness(server, client);
+		for (uint8_t tag = 1; tag <= 4; tag++)
+		{
+			harness.mScheduler.push(taggedFrame(0x2, FRAGMENT, tag));
+		}
+		size_t before = harness.mEmitted.size();
+		if (harness.mScheduler.queued() == 0)
+		{
+			cerr << "Nothing was left queued behind the first frame" << endl;
+			return false;
+		}
+
+		harness.mScheduler.push(taggedFrame(0xB, 3, 0xCC));
+		if (harness.mEmitted.size() != before + 1 || harness.mEmitted.back().opcode != 0xB)
+		{
+			cerr << "Control frame waited behind queued data" << endl;
+			return false;
+		}
+		return harness.finish() && harness.mEmitted.size() == 5;
+	}
+
+	bool weightedRounds(Socket& server, Socket& client)
+	{
+		Harness harness(server, client);
+		const size_t perClass = 60;
+		for (size_t i = 0; i < perClass; i++)
+		{
+			harness.mScheduler.push(taggedFrame(0x2, FRAGMENT, 0), FRAME_PRIORITY_HIGH);
+			harness.mScheduler.push(taggedFrame(0x2, FRAGMENT, 1), FRAME_PRIORITY_NORMAL);
+			harness.mScheduler.push(taggedFrame(0x2, FRAGMENT, 2), FRAME_PRIORITY_LOW);
+		}
+		while (harness.mEmitted.size() < 70)
+		{
+			if (!harness.drain())
+			{
+				return false;
+			}
+		}
+
+		// Every class is busy throughout, so each round of 7 fragments goes
+		// 4, 2 and 1.
+		size_t counts[FRAME_PRIORITIES] = {0, 0, 0};
+		for (size_t i = 0; i < 70; i++)
+		{
+			counts[harness.mEmitted[i].tag]++;
+		}
+		if (counts[0] < 38 || counts[0] > 42 || counts[1] < 18 || counts[1] > 22 || counts[2] < 8 || counts[2] > 12)
+		{
+			cerr << "Classes were sent " << counts[0] << "/" << counts[1] << "/" << counts[2] << " rather than 4/2/1" << endl;
+			return false;
+		}
+
+		harness.mScheduler.weight(FRAME_PRIORITY_LOW, 4);
+		harness.mScheduler.weight(FRAME_PRIORITY_NORMAL, 4);
+		size_t start = harness.mEmitted.size();
+		while (harness.mEmitted.size() < start + 24)
+		{
+			if (!harness.drain())
+			{
+				return false;
+			}
+		}
+		memset(counts, 0, sizeof(counts));
+		for (size_t i = start; i < start + 24; i++)
+		{
+			counts[harness.mEmitted[i].tag]++;
+		}
+		if (counts[0] < 6 || counts[0] > 10 || counts[1] < 6 || counts[1] > 10 || counts[2] < 6 || counts[2] > 10)
+		{
+			cerr << "Equal weights sent " << counts[0] << "/" << counts[1] << "/" << counts[2] << endl;
+			return false;
+		}
+		return harness.finish();
+	}
+
+	bool oneTrainAtATime(Socket& server, Socket& client)
+	{
+		Harness harness(server, client);
+		harness.mScheduler.push(taggedFrame(0x2, 5 * FRAGMENT + 1, 1), FRAME_PRIORITY_LOW);
+		harness.mScheduler.push(taggedFrame(0x1, 4 * FRAGMENT, 2), FRAME_PRIORITY_HIGH);
+		for (uint8_t tag = 3; tag < 20; tag++)
+		{
+			harness.mScheduler.push(taggedFrame(0x2, 100, tag), FRAME_PRIORITY_NORMAL);
+		}
+		if (!harness.finish())
+		{
+			return false;
+		}
+
+		// Short messages may go between fragments, but no other train may
+		// start until the one in progress has its final fragment.
+		int train = -1;
+		size_t trains = 0;
+		size_t interleaved = 0;
+		for (size_t i = 0; i < harness.mEmitted.size(); i++)
+		{
+			const Emitted& emitted = harness.mEmitted[i];
+			if (emitted.opcode != 0x0 && !emitted.fin)
+			{
+				if (train != -1)
+				{
+					cerr << "Train " << int(emitted.tag) << " started inside train " << train << endl;
+					return false;
+				}
+				train = emitted.tag;
+				trains++;
+			}
+			else if (emitted.opcode == 0x0)
+			{
+				if (train != emitted.tag)
+				{
+					cerr << "Continuation of " << int(emitted.tag) << " outside its train" << endl;
+					return false;
+				}
+				if (emitted.fin)
+				{
+					train = -1;
+				}
+			}
+			else if (train != -1)
+			{
+				interleaved++;
+			}
+		}
+		if (trains != 2 || train != -1 || interleaved == 0)
+		{
+			cerr << trains << " trains sent, " << interleaved << " messages between their fragments" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool fragmentHeaders(Socket& server, Socket& client)
+	{
+		Harness harness(server, client);
+		std::shared_ptr<Frame> response = taggedFrame(0x2, 3 * FRAGMENT + 10, 1);
+		response->respondingTo(1305);
+		harness.mScheduler.push(response);
+		harness.mScheduler.push(taggedFrame(0x2, 2 * FRAGMENT + 10, 2, false));
+		if (!harness.finish())
+		{
+			return false;
+		}
+
+		// The response goes out as 4 fragments and the unfinished message as
+		// 3, neither of which finishes its message.
+		const vector<Emitted>& emitted = harness.mEmitted;
+		if (emitted.size() != 7)
+		{
+			cerr << emitted.size() << " fragments sent rather than 7" << endl;
+			return false;
+		}
+		for (size_t i = 0; i < emitted.size(); i++)
+		{
+			bool first = i == 0 || i == 4;
+			bool last = i == 3 || i == 6;
+			bool fin = i == 3;
+			if ((emitted[i].opcode == 0x2) != first || emitted[i].fin != fin || emitted[i].rsp != (i == 0) ||
+				(i == 0 && emitted[i].respondingTo != 1305) || (!last && emitted[i].size != FRAGMENT))
+			{
+				cerr << "Fragment " << i << " went out with opcode " << int(emitted[i].opcode) << ", FIN " << emitted[i].fin << ", RSP " << emitted[i].rsp << endl;
+				return false;
+			}
+		}
+		if (response->messageID() != 0)
+		{
+			cerr << "Response took Message ID " << response->messageID() << " rather than its first fragment's" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool clearDropsUnsent(Socket& server, Socket& client)
+	{
+		Harness harness(server, client);
+		const size_t count = 6;
+		vector<int> sent(count, 0);
+		vector<int> dropped(count, 0);
+		for (size_t i = 0; i < count; i++)
+		{
+			// The first is long, so is part way through when cleared.
+			uint64_t length = i == 0 ? 3 * FRAGMENT : FRAGMENT;
+			harness.mScheduler.push(taggedFrame(0x2, length, uint8_t(i)), FRAME_PRIORITY_NORMAL, [&sent, &dropped, i](const Frame* first)
+			{
+				(first ? sent : dropped)[i]++;
+			});
+		}
+		if (!harness.drain())
+		{
+			return false;
+		}
+		harness.mScheduler.clear();
+
+		size_t sentCount = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (sent[i] + dropped[i] != 1)
+			{
+				cerr << "Callback for frame " << i << " called " << sent[i] + dropped[i] << " times" << endl;
+				return false;
+			}
+			sentCount += sent[i];
+		}
+		if (sent[0] != 1 || sentCount == count || harness.mScheduler.queued() != 0 || harness.mScheduler.bytes() != 0)
+		{
+			cerr << sentCount << " of " << count << " frames reported sent across clear()" << endl;
+			return false;
+		}
+
+		// Nothing is left to go out afterwards.
+		size_t emitted = harness.mEmitted.size();
+		if (!harness.drain() || harness.mEmitted.size() != emitted)
+		{
+			cerr << "Frames went out after clear()" << endl;
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(void)
+{
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	bool (*const checks[])(Socket&, Socket&) = {controlJumpsQueue, weightedRounds, oneTrainAtATime, fragmentHeaders, clearDropsUnsent};
+	for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+	{
+		Socket* client;
+		Socket* server = connectPair(listener, port, client);
+		bool passed = checks[i](*server, *client);
+		delete server;
+		delete client;
+		if (!passed)
+		{
+			return 1;
+		}
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,163 @@
+#include "Frame.h"
+#include "Mask.h"
+#include "Socket.h"
+
+#include <sys/socket.h>
+#include <time.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 47600;
+	const int PORTS = 100;
+
+	// A connected pair over loopback; the client side is returned in client.
+	Socket* connectPair(Socket& listener, const string& port, Socket*& client)
+	{
+		client = new Socket();
+		if (client->connect("127.0.0.1", port.c_str()) != 0)
+		{
+			throw "Loopback connect failed";
+		}
+		return listener.accept(true);
+	}
+
+	uint64_t monotonicMillis(void)
+	{
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_nsec) / 1000000;
+	}
+
+	// Read length bytes from fd, a little at a time with pauses, so that the
+	// sender keeps finding the socket full.
+	void readSlowly(int fd, size_t length, vector<uint8_t>& received)
+	{
+		uint8_t buffer[8192];
+		while (received.size() < length)
+		{
+			ssize_t ret = ::recv(fd, buffer, sizeof(buffer), 0);
+			if (ret <= 0)
+			{
+				return;
+			}
+			received.insert(received.end(), buffer, buffer + ret);
+			if (rand() % 8 == 0)
+			{
+				::usleep(1000);
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	// Frames much larger than the socket buffers, to a slow reader: every
+	// write comes up short and must be carried on from where it stopped.
+	for (int masked = 0; masked < 2; masked++)
+	{
+		Socket* client;
+		Socket* server = connectPair(listener, port, client);
+		int small = 4096;
+		::setsockopt(server->descriptor(), SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+		Frame frame(header);
+		frame.size(3 * 1024 * 1024 + 17);
+		for (uint64_t i = 0; i < frame.size(); i++)
+		{
+			frame.payload()[i] = uint8_t(rand());
+		}
+		frame.messageID(uint32_t(masked));
+		if (masked)
+		{
+			frame.mask(uint32_t(rand()));
+		}
+
+		uint8_t encoded[FRAME_HEADER_LENGTH_MAX];
+		size_t headerLength = frame.encode(encoded);
+		vector<uint8_t> wire(encoded, encoded + headerLength);
+		wire.insert(wire.end(), frame.payload(), frame.payload() + frame.size());
+		if (masked)
+		{
+			applyMask(wire.data() + headerLength, size_t(frame.size()), frame.mask());
+		}
+
+		vector<uint8_t> received;
+		thread reader(readSlowly, client->descriptor(), wire.size(), std::ref(received));
+		*server << frame;
+		reader.join();
+		if (received != wire)
+		{
+			cerr << "Frame sent through short writes arrived as " << received.size() << " bytes, not " << wire.size() << endl;
+			return 1;
+		}
+		delete server;
+		delete client;
+	}
+
+	// A peer which stays connected but stops reading: the send gives up once
+	// nothing has been taken for FRAME_SEND_TIMEOUT, rather than waiting
+	// forever.
+	{
+		Socket* client;
+		Socket* server = connectPair(listener, port, client);
+
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+		Frame frame(header);
+		frame.size(64 * 1024 * 1024);
+		memset(frame.payload(), 0x5A, size_t(frame.size()));
+
+		uint64_t started = monotonicMillis();
+		const char* error = NULL;
+		try
+		{
+			*server << frame;
+		}
+		catch (const char* thrown)
+		{
+			error = thrown;
+		}
+		uint64_t elapsed = monotonicMillis() - started;
+		if (error == NULL || strcmp(error, "Frame send timed out") != 0 || elapsed < uint64_t(FRAME_SEND_TIMEOUT) ||
+			elapsed > uint64_t(3 * FRAME_SEND_TIMEOUT))
+		{
+			cerr << "Send to a stalled peer ended after " << elapsed << "ms with " << (error ? error : "no error") << endl;
+			return 1;
+		}
+		delete server;
+		delete client;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
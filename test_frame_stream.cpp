@@ -0,0 +1,149 @@
+#include "BufferPool.h"
+#include "Frame.h"
+#include "FrameReader.h"
+#include "Mask.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	// A frame as it arrives off the wire, with an extended length.
+	vector<uint8_t> encoded(uint64_t length, bool masked)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+
+		Frame frame(header);
+		frame.size(length);
+		frame.messageID(7);
+		for (uint64_t i = 0; i < length; i++)
+		{
+			frame.payload()[i] = uint8_t(rand());
+		}
+		if (masked)
+		{
+			frame.mask(0x1305c0de);
+		}
+
+		vector<uint8_t> wire(FRAME_HEADER_LENGTH_MAX + length);
+		size_t headerLength = frame.encode(wire.data());
+		memcpy(wire.data() + headerLength, frame.payload(), length);
+		if (masked)
+		{
+			applyMask(wire.data() + headerLength, length, frame.mask());
+		}
+		wire.resize(headerLength + length);
+		return wire;
+	}
+
+	// Stream wire through a FrameReader to a temporary file, returning
+	// whether it threw and leaving what reached the file in written.
+	bool streamToFile(vector<uint8_t> wire, vector<uint8_t>& written)
+	{
+		FILE* file = tmpfile();
+		FrameReader reader([](FrameView&) {});
+		reader.stream(Frame::descriptorSink(fileno(file)), 1024);
+
+		bool threw = false;
+		try
+		{
+			// In pieces, so that the frame straddles every read.
+			for (size_t offset = 0; offset < wire.size(); offset += 5000)
+			{
+				size_t piece = wire.size() - offset < 5000 ? wire.size() - offset : 5000;
+				reader.read(wire.data() + offset, piece);
+			}
+		}
+		catch (const char* error)
+		{
+			threw = true;
+		}
+
+		written.resize(size_t(ftell(file)));
+		rewind(file);
+		if (!written.empty() && fread(written.data(), 1, written.size(), file) != written.size())
+		{
+			written.clear();
+		}
+		fclose(file);
+		return threw;
+	}
+}
+
+int main(void)
+{
+	srand(1305);
+
+	// A header declaring a payload past the limit is refused as soon as it is
+	// complete, before anything is allocated for it.
+	FrameHeader header;
+	memset(&header, 0, sizeof(header));
+	header.headerParts.FIN = 1;
+	header.headerParts.Opcode = 0x2;
+	Frame declared(header);
+	declared.size(FRAME_BUFFERED_LENGTH_MAX + 1);
+	declared.messageID(1);
+	uint8_t wire[FRAME_HEADER_LENGTH_MAX];
+	size_t headerLength = declared.encode(wire);
+
+	BufferPoolStats before = BufferPool::stats();
+	bool refused = false;
+	try
+	{
+		FrameReader reader([](FrameView&) {});
+		reader.read(wire, headerLength);
+	}
+	catch (const char* error)
+	{
+		refused = true;
+	}
+	BufferPoolStats after = BufferPool::stats();
+	if (!refused || after.mapped != before.mapped || after.inUse > before.inUse + int64_t(BUFFER_POOL_MAX_CLASS))
+	{
+		cerr << "Oversized declared length was not refused without allocating" << endl;
+		return 1;
+	}
+
+	// Raising the limit lets the same header through.
+	FrameReader raised([](FrameView&) {});
+	raised.maxLength(FRAME_BUFFERED_LENGTH_MAX + 1);
+	raised.read(wire, headerLength);
+	if (!raised.partial())
+	{
+		cerr << "Raised limit did not accept the frame" << endl;
+		return 1;
+	}
+
+	// Streamed payloads land in the sink's file whole and unmasked.
+	for (int masked = 0; masked < 2; masked++)
+	{
+		vector<uint8_t> frame = encoded(100000, masked != 0);
+		vector<uint8_t> written;
+		Frame parsed(*reinterpret_cast<const FrameHeader*>(frame.data()));
+		parsed.write(frame.data() + sizeof(FrameHeader), frame.size() - sizeof(FrameHeader));
+		if (streamToFile(frame, written) || written.size() != parsed.size() || memcmp(written.data(), parsed.payload(), written.size()) != 0)
+		{
+			cerr << "Streamed payload did not reach the file intact" << endl;
+			return 1;
+		}
+
+		// A corrupted payload still reaches the file, but must not pass as
+		// good.
+		frame[frame.size() / 2] ^= 0x10;
+		if (!streamToFile(frame, written))
+		{
+			cerr << "Streamed payload with a bad CRC was accepted" << endl;
+			return 1;
+		}
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,168 @@
+#include "EventLoopGroup.h"
+#include "Listener.h"
+#include "Socket.h"
+
+#include <dirent.h>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 48100;
+	const int PORTS = 100;
+	const int LOOPS = 2;
+	const int CONNECTIONS = 32;
+	const int ACCEPT_TIMEOUT = 5000;
+
+	int openDescriptors(void)
+	{
+		DIR* directory = ::opendir("/proc/self/fd");
+		if (directory == NULL)
+		{
+			return -1;
+		}
+		int count = 0;
+		while (::readdir(directory) != NULL)
+		{
+			count++;
+		}
+		::closedir(directory);
+		return count;
+	}
+
+	// The thread each of the group's loops runs on.
+	map<EventLoop*, thread::id> loopThreads(EventLoopGroup& group)
+	{
+		mutex lock;
+		map<EventLoop*, thread::id> threads;
+		for (size_t i = 0; i < group.size(); i++)
+		{
+			EventLoop* loop = &group.at(i);
+			loop->post([loop, &lock, &threads](void)
+			{
+				lock_guard<mutex> guard(lock);
+				threads[loop] = this_thread::get_id();
+			});
+		}
+		for (int waited = 0; waited < ACCEPT_TIMEOUT; waited++)
+		{
+			{
+				lock_guard<mutex> guard(lock);
+				if (threads.size() == group.size())
+				{
+					break;
+				}
+			}
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+		lock_guard<mutex> guard(lock);
+		return threads;
+	}
+
+	// Listen on the first free port from FIRST_PORT; returns it, or empty.
+	string listenAnywhere(Listener& listener)
+	{
+		for (int i = 0; i < PORTS; i++)
+		{
+			string candidate = to_string(FIRST_PORT + i);
+			if (listener.listen(candidate.c_str(), "127.0.0.1") == 0)
+			{
+				return candidate;
+			}
+		}
+		return string();
+	}
+}
+
+int main(void)
+{
+	int descriptors = openDescriptors();
+
+	// Connections are spread over the loops by the kernel, and each arrives
+	// on the thread of the loop which accepted it.
+	{
+		EventLoopGroup group(LOOPS);
+		group.start();
+		map<EventLoop*, thread::id> threads = loopThreads(group);
+
+		mutex lock;
+		map<EventLoop*, int> perLoop;
+		int wrongThread = 0;
+		Listener listener(group, [&](EventLoop& loop, Socket* connection)
+		{
+			lock_guard<mutex> guard(lock);
+			perLoop[&loop]++;
+			if (threads.count(&loop) == 0 || threads[&loop] != this_thread::get_id())
+			{
+				wrongThread++;
+			}
+			delete connection;
+		});
+		string port = listenAnywhere(listener);
+		if (port.empty())
+		{
+			cerr << "No loopback port to listen on" << endl;
+			return 1;
+		}
+
+		vector<Socket*> clients;
+		for (int i = 0; i < CONNECTIONS; i++)
+		{
+			Socket* client = new Socket();
+			if (client->connect("127.0.0.1", port.c_str()) != 0)
+			{
+				cerr << "Loopback connect failed" << endl;
+				return 1;
+			}
+			clients.push_back(client);
+		}
+		for (int waited = 0; waited < ACCEPT_TIMEOUT && listener.accepted() < uint64_t(CONNECTIONS); waited++)
+		{
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+
+		group.stop();
+		for (size_t i = 0; i < clients.size(); i++)
+		{
+			delete clients[i];
+		}
+		if (listener.accepted() != uint64_t(CONNECTIONS) || perLoop.size() != size_t(LOOPS) || wrongThread != 0)
+		{
+			cerr << listener.accepted() << " of " << CONNECTIONS << " accepted over " << perLoop.size() << " loops, " << wrongThread << " on the wrong thread" << endl;
+			return 1;
+		}
+
+		// The loops are stopped, so closing is left until they are destroyed.
+		listener.close();
+	}
+	if (openDescriptors() != descriptors)
+	{
+		cerr << "Listening sockets left open once their stopped loops were destroyed" << endl;
+		return 1;
+	}
+
+	// Nor does it matter if the loops never ran at all.
+	{
+		EventLoopGroup group(LOOPS);
+		Listener listener(group, [](EventLoop&, Socket* connection) { delete connection; });
+		if (listenAnywhere(listener).empty())
+		{
+			cerr << "No loopback port to listen on" << endl;
+			return 1;
+		}
+	}
+	if (openDescriptors() != descriptors)
+	{
+		cerr << "Listening sockets left open by loops which never ran" << endl;
+		return 1;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,262 @@
+#include "MessageAssembler.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	shared_ptr<Frame> makeFrame(uint8_t opcode, bool final, uint32_t id, size_t length, uint8_t seed)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = final ? 1 : 0;
+		header.headerParts.Opcode = opcode;
+
+		shared_ptr<Frame> frame(new Frame(header));
+		frame->size(length);
+		for (size_t i = 0; i < length; i++)
+		{
+			frame->payload()[i] = uint8_t(seed + i * 7);
+		}
+		frame->messageID(id);
+		return frame;
+	}
+
+	// A frame as it sits in a receive buffer, to be added as a view.
+	struct Received
+	{
+		vector<uint8_t> wire;
+		FrameView view;
+	};
+
+	void receive(Received& received, const Frame& frame)
+	{
+		received.wire.resize(FRAME_HEADER_LENGTH_MAX + size_t(frame.size()));
+		size_t headerLength = frame.encode(received.wire.data());
+		memcpy(received.wire.data() + headerLength, frame.payload(), size_t(frame.size()));
+		received.wire.resize(headerLength + size_t(frame.size()));
+		received.view.parse(received.wire.data(), received.wire.size());
+		received.view.verify();
+	}
+
+	// Whether message holds the payloads of frames, one after another.
+	bool holds(const Message& message, const vector<shared_ptr<Frame> >& frames)
+	{
+		vector<uint8_t> expected;
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			expected.insert(expected.end(), frames[i]->payload(), frames[i]->payload() + frames[i]->size());
+		}
+
+		vector<uint8_t> actual;
+		for (size_t i = 0; i < message.pieces().size(); i++)
+		{
+			const uint8_t* base = static_cast<const uint8_t*>(message.pieces()[i].iov_base);
+			actual.insert(actual.end(), base, base + message.pieces()[i].iov_len);
+		}
+		return message.size() == expected.size() && actual == expected;
+	}
+}
+
+int main(void)
+{
+	// Fragments already in Frames of their own are chained, not copied.
+	{
+		MessageAssembler assembler;
+		vector<shared_ptr<Frame> > frames;
+		frames.push_back(makeFrame(0x2, false, 10, 1000, 1));
+		frames.push_back(makeFrame(0x0, false, 11, 2000, 2));
+		frames.push_back(makeFrame(0x0, true, 12, 3000, 3));
+		if (assembler.add(shared_ptr<const Frame>(frames[0])) != ASSEMBLY_INCOMPLETE ||
+			assembler.add(shared_ptr<const Frame>(frames[1])) != ASSEMBLY_INCOMPLETE || assembler.buffered() != 3000 ||
+			assembler.add(shared_ptr<const Frame>(frames[2])) != ASSEMBLY_COMPLETE)
+		{
+			cerr << "Chained fragments did not assemble" << endl;
+			return 1;
+		}
+
+		Message& message = assembler.message();
+		const AssemblyStats& stats = assembler.stats();
+		if (message.opcode() != 0x2 || message.messageID() != 10 || message.pieces().size() != 3 || !holds(message, frames) ||
+			stats.chainedBytes != 6000 || stats.copiedBytes != 0 || stats.messages != 1 || stats.fragments != 3)
+		{
+			cerr << "Chained message is wrong, or was copied" << endl;
+			return 1;
+		}
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			if (message.pieces()[i].iov_base != frames[i]->payload())
+			{
+				cerr << "Fragment " << i << " was not chained where it lies" << endl;
+				return 1;
+			}
+		}
+
+		// Flattening copies the pieces together once; a single piece is
+		// already flat.
+		const uint8_t* flat = message.flatten();
+		if (flat == NULL || message.pieces().size() != 1 || message.pieces()[0].iov_base != flat || !holds(message, frames) ||
+			stats.flattened != 1 || message.flatten() != flat || stats.flattened != 1)
+		{
+			cerr << "Flattening the chained message failed" << endl;
+			return 1;
+		}
+	}
+
+	// Fragments in receive buffers are copied, exactly once, into shared
+	// chunks; a whole message is referenced where it lies.
+	{
+		MessageAssembler assembler;
+		vector<shared_ptr<Frame> > frames;
+		vector<Received> received(5);
+		for (size_t i = 0; i < received.size(); i++)
+		{
+			frames.push_back(makeFrame(i == 0 ? 0x1 : 0x0, i + 1 == received.size(), uint32_t(20 + i), 100, uint8_t(i)));
+			receive(received[i], *frames[i]);
+			AssemblyResult result = assembler.add(received[i].view);
+			if (result != (i + 1 == received.size() ? ASSEMBLY_COMPLETE : ASSEMBLY_INCOMPLETE))
+			{
+				cerr << "Copied fragment " << i << " gave " << result << endl;
+				return 1;
+			}
+		}
+
+		// The receive buffers are reused as soon as the frames are added.
+		for (size_t i = 0; i < received.size(); i++)
+		{
+			memset(received[i].wire.data(), 0xEE, received[i].wire.size());
+		}
+		const AssemblyStats& stats = assembler.stats();
+		if (!holds(assembler.message(), frames) || assembler.message().pieces().size() != 1 || stats.copiedBytes != 500 ||
+			stats.chainedBytes != 0)
+		{
+			cerr << "Copied fragments did not assemble into one chunk" << endl;
+			return 1;
+		}
+
+		Received whole;
+		shared_ptr<Frame> frame = makeFrame(0x2, true, 30, 100, 9);
+		receive(whole, *frame);
+		if (assembler.add(whole.view) != ASSEMBLY_COMPLETE || assembler.message().pieces().size() != 1 ||
+			assembler.message().pieces()[0].iov_base != whole.view.payload() || stats.copiedBytes != 500)
+		{
+			cerr << "A whole message was copied" << endl;
+			return 1;
+		}
+	}
+
+	// A whole message between the fragments of another completes by itself.
+	{
+		MessageAssembler assembler;
+		vector<shared_ptr<Frame> > fragments;
+		fragments.push_back(makeFrame(0x1, false, 40, 300, 4));
+		fragments.push_back(makeFrame(0x0, true, 41, 200, 5));
+		vector<shared_ptr<Frame> > interleaved(1, makeFrame(0x2, true, 42, 50, 6));
+
+		if (assembler.add(shared_ptr<const Frame>(fragments[0])) != ASSEMBLY_INCOMPLETE ||
+			assembler.add(shared_ptr<const Frame>(interleaved[0])) != ASSEMBLY_COMPLETE)
+		{
+			cerr << "Interleaved message did not complete" << endl;
+			return 1;
+		}
+		if (assembler.message().opcode() != 0x2 || assembler.message().messageID() != 42 || !holds(assembler.message(), interleaved) ||
+			!assembler.assembling() || assembler.buffered() != 300)
+		{
+			cerr << "Interleaved message disturbed the one in progress" << endl;
+			return 1;
+		}
+		if (assembler.add(shared_ptr<const Frame>(fragments[1])) != ASSEMBLY_COMPLETE || assembler.message().opcode() != 0x1 ||
+			assembler.message().messageID() != 40 || !holds(assembler.message(), fragments) || assembler.assembling() ||
+			assembler.stats().messages != 2)
+		{
+			cerr << "Message around the interleaved one did not complete" << endl;
+			return 1;
+		}
+	}
+
+	// A message over the limit is dropped, and so is the rest of it up to
+	// FIN; whole messages in between still get through.
+	{
+		MessageAssembler assembler(1500);
+		vector<shared_ptr<Frame> > interleaved(1, makeFrame(0x2, true, 53, 100, 7));
+		const AssemblyResult expected[] = {ASSEMBLY_INCOMPLETE, ASSEMBLY_TOO_LONG, ASSEMBLY_DISCARDED, ASSEMBLY_COMPLETE,
+			ASSEMBLY_DISCARDED, ASSEMBLY_INVALID};
+		vector<shared_ptr<Frame> > frames;
+		frames.push_back(makeFrame(0x1, false, 50, 1000, 1));
+		frames.push_back(makeFrame(0x0, false, 51, 1000, 2));
+		frames.push_back(makeFrame(0x0, false, 52, 1000, 3));
+		frames.push_back(interleaved[0]);
+		frames.push_back(makeFrame(0x0, true, 54, 1000, 4));
+		frames.push_back(makeFrame(0x0, true, 55, 10, 5));
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			Received received;
+			receive(received, *frames[i]);
+			AssemblyResult result = assembler.add(received.view);
+			if (result != expected[i])
+			{
+				cerr << "Frame " << i << " of an overlong message gave " << result << ", not " << expected[i] << endl;
+				return 1;
+			}
+			if (i == 1 && (assembler.assembling() || assembler.buffered() != 0))
+			{
+				cerr << "The overlong message was kept" << endl;
+				return 1;
+			}
+			if (i == 3 && (assembler.message().messageID() != 53 || !holds(assembler.message(), interleaved)))
+			{
+				cerr << "The message interleaved with a discarded one was lost" << endl;
+				return 1;
+			}
+		}
+
+		// The next message is assembled as normal.
+		vector<shared_ptr<Frame> > after(1, makeFrame(0x1, true, 56, 1400, 8));
+		if (assembler.add(shared_ptr<const Frame>(after[0])) != ASSEMBLY_COMPLETE || !holds(assembler.message(), after) ||
+			assembler.stats().discarded != 1 || assembler.stats().messages != 2)
+		{
+			cerr << "Assembly did not recover after discarding" << endl;
+			return 1;
+		}
+	}
+
+	// Flattening a message of copied chunks and chained frames together.
+	{
+		MessageAssembler assembler;
+		vector<shared_ptr<Frame> > frames;
+		frames.push_back(makeFrame(0x2, false, 60, MESSAGE_CHUNK_SIZE - 10, 1));
+		frames.push_back(makeFrame(0x0, false, 61, 100, 2));
+		frames.push_back(makeFrame(0x0, true, 62, 5000, 3));
+		Received first;
+		Received second;
+		receive(first, *frames[0]);
+		receive(second, *frames[1]);
+		assembler.add(first.view);
+		assembler.add(second.view);
+		if (assembler.add(shared_ptr<const Frame>(frames[2])) != ASSEMBLY_COMPLETE || assembler.message().pieces().size() != 3)
+		{
+			cerr << "Mixed message did not assemble in three pieces" << endl;
+			return 1;
+		}
+
+		Message& message = assembler.message();
+		const uint8_t* flat = message.flatten();
+		vector<uint8_t> expected;
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			expected.insert(expected.end(), frames[i]->payload(), frames[i]->payload() + frames[i]->size());
+		}
+		if (flat == NULL || message.size() != expected.size() || memcmp(flat, expected.data(), expected.size()) != 0 ||
+			message.pieces().size() != 1 || assembler.stats().flattened != 1)
+		{
+			cerr << "Flattening a mixed message failed" << endl;
+			return 1;
+		}
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
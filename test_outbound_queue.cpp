@@ -0,0 +1,300 @@
+#include "Mask.h"
+#include "OutboundQueue.h"
+#include "Socket.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 47500;
+	const int PORTS = 100;
+
+	// A connected pair over loopback; the client side is returned in client.
+	Socket* connectPair(Socket& listener, const string& port, Socket*& client)
+	{
+		client = new Socket();
+		if (client->connect("127.0.0.1", port.c_str()) != 0)
+		{
+			throw "Loopback connect failed";
+		}
+		return listener.accept(true);
+	}
+
+	// What the peer should receive for frame: its header, then its payload.
+	void expect(vector<uint8_t>& wire, const Frame& frame, const vector<uint8_t>& payload)
+	{
+		uint8_t header[FRAME_HEADER_LENGTH_MAX];
+		size_t headerLength = frame.encode(header);
+		wire.insert(wire.end(), header, header + headerLength);
+		wire.insert(wire.end(), payload.begin(), payload.end());
+	}
+
+	// Flush queue into sender until received holds length bytes, reading as
+	// it goes. Returns false if a flush fails or nothing moves for a while.
+	bool pump(OutboundQueue& queue, int receiver, vector<uint8_t>& received, size_t length)
+	{
+		uint8_t buffer[64 * 1024];
+		for (int idle = 0; received.size() < length && idle < 200; )
+		{
+			if (queue.flush() < 0)
+			{
+				return false;
+			}
+			ssize_t ret = ::recv(receiver, buffer, sizeof(buffer), MSG_DONTWAIT);
+			if (ret > 0)
+			{
+				received.insert(received.end(), buffer, buffer + ret);
+				idle = 0;
+			}
+			else
+			{
+				idle++;
+				::usleep(100);
+			}
+		}
+		return received.size() == length && queue.frames() == 0 && queue.size() == 0;
+	}
+
+	shared_ptr<Frame> memoryFrame(uint64_t length, uint32_t id, bool masked, vector<uint8_t>& payload)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+
+		shared_ptr<Frame> frame(new Frame(header));
+		frame->size(length);
+		payload.resize(size_t(length));
+		for (size_t i = 0; i < payload.size(); i++)
+		{
+			payload[i] = uint8_t(rand());
+		}
+		if (length > 0)
+		{
+			memcpy(frame->payload(), payload.data(), payload.size());
+		}
+		frame->messageID(id);
+		if (masked)
+		{
+			frame->mask(uint32_t(rand()));
+			applyMask(payload.data(), payload.size(), frame->mask());
+		}
+		return frame;
+	}
+
+	shared_ptr<Frame> fileFrame(int fd, off_t offset, uint64_t length, uint32_t id)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+
+		shared_ptr<Frame> frame(new Frame(header));
+		frame->file(fd, offset, length);
+		frame->messageID(id);
+		return frame;
+	}
+}
+
+int main(void)
+{
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	uint8_t buffer[4096];
+
+	// More frames than fit in one gather write, masked and not, through a
+	// small send buffer read a few bytes at a time: every write is partial,
+	// stopping inside headers and payloads alike, wherever each round
+	// happens to.
+	for (int round = 0; round < 8; round++)
+	{
+		Socket* client;
+		Socket* server = connectPair(listener, port, client);
+		int small = 4096;
+		::setsockopt(server->descriptor(), SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+		OutboundQueue queue(*server, NULL, SIZE_MAX);
+
+		vector<uint8_t> wire;
+		const uint64_t lengths[] = {0, 1, 13, 300, 65535, 70000, 4 * FRAME_MASK_CHUNK + 5};
+		for (uint32_t id = 0; id < IOV_MAX; id++)
+		{
+			vector<uint8_t> payload;
+			uint64_t length = id % 50 == 0 ? lengths[(id / 50) % 7] : lengths[id % 4];
+			shared_ptr<Frame> frame = memoryFrame(length, id, id % 3 == 0, payload);
+			expect(wire, *frame, payload);
+			queue.push(frame);
+		}
+		if (queue.size() != wire.size() || queue.frames() != IOV_MAX)
+		{
+			cerr << "Queued " << queue.size() << " bytes, not " << wire.size() << endl;
+			return 1;
+		}
+
+		vector<uint8_t> received;
+		size_t flushed = 0;
+		for (int idle = 0; received.size() < wire.size() && idle < 2000; )
+		{
+			ssize_t sent = queue.flush();
+			if (sent < 0)
+			{
+				cerr << "Flushing failed" << endl;
+				return 1;
+			}
+			flushed += size_t(sent);
+			if (flushed + queue.size() != wire.size())
+			{
+				cerr << "Flushed " << flushed << " bytes with " << queue.size() << " queued, of " << wire.size() << endl;
+				return 1;
+			}
+
+			ssize_t ret = ::recv(client->descriptor(), buffer, 1 + rand() % sizeof(buffer), MSG_DONTWAIT);
+			if (ret > 0)
+			{
+				received.insert(received.end(), buffer, buffer + ret);
+				idle = 0;
+			}
+			else
+			{
+				idle++;
+				::usleep(100);
+			}
+		}
+		if (received != wire || queue.frames() != 0)
+		{
+			cerr << "Received " << received.size() << " bytes which differ from the " << wire.size() << " encoded" << endl;
+			return 1;
+		}
+		delete server;
+		delete client;
+	}
+
+	// A file-backed frame goes out with sendfile, from its offset.
+	char path[] = "/tmp/test_outbound_queue-XXXXXX";
+	int fd = ::mkstemp(path);
+	::unlink(path);
+	vector<uint8_t> contents(300 * 1024);
+	for (size_t i = 0; i < contents.size(); i++)
+	{
+		contents[i] = uint8_t(rand());
+	}
+	if (fd == -1 || ::write(fd, contents.data(), contents.size()) != ssize_t(contents.size()))
+	{
+		cerr << "Unable to write a payload file" << endl;
+		return 1;
+	}
+	{
+		Socket* client;
+		Socket* server = connectPair(listener, port, client);
+		OutboundQueue queue(*server);
+
+		vector<uint8_t> wire;
+		shared_ptr<Frame> frame = fileFrame(fd, 1000, contents.size() - 1000, 1);
+		expect(wire, *frame, vector<uint8_t>(contents.begin() + 1000, contents.end()));
+		queue.push(frame);
+
+		vector<uint8_t> received;
+		if (!pump(queue, client->descriptor(), received, wire.size()) || received != wire)
+		{
+			cerr << "A file-backed frame was not sent intact" << endl;
+			return 1;
+		}
+		delete server;
+		delete client;
+	}
+
+	// A file which shrinks after its frame is queued fails the flush, rather
+	// than leaving the queue waiting for a write which can never happen.
+	{
+		Socket* client;
+		Socket* server = connectPair(listener, port, client);
+		OutboundQueue queue(*server);
+
+		queue.push(fileFrame(fd, 0, 32 * 1024, 2));
+		if (::ftruncate(fd, 16 * 1024) == -1)
+		{
+			cerr << "Unable to truncate the payload file" << endl;
+			return 1;
+		}
+		bool failed = false;
+		for (int i = 0; i < 100 && !failed; i++)
+		{
+			failed = queue.flush() < 0;
+			::recv(client->descriptor(), buffer, sizeof(buffer), MSG_DONTWAIT);
+		}
+		if (!failed || queue.frames() != 1)
+		{
+			cerr << "A frame whose file was cut short did not fail" << endl;
+			return 1;
+		}
+		delete server;
+		delete client;
+	}
+	::close(fd);
+
+	// Files sendfile() cannot read from are copied instead. procfs files are
+	// such, and report no size, so the frame slices one opened for nothing.
+	int proc = ::open("/proc/self/limits", O_RDONLY);
+	vector<uint8_t> limits;
+	for (ssize_t ret; proc != -1 && (ret = ::pread(proc, buffer, sizeof(buffer), off_t(limits.size()))) > 0; )
+	{
+		limits.insert(limits.end(), buffer, buffer + ret);
+	}
+	if (limits.size() > 100)
+	{
+		Socket* client;
+		Socket* server = connectPair(listener, port, client);
+		OutboundQueue queue(*server);
+
+		shared_ptr<const Frame> source = fileFrame(proc, 0, 0, 3);
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x1;
+		shared_ptr<Frame> frame(new Frame(header));
+		frame->slice(source, 10, limits.size() - 10);
+		frame->messageID(4);
+
+		vector<uint8_t> wire;
+		expect(wire, *frame, vector<uint8_t>(limits.begin() + 10, limits.end()));
+		queue.push(frame);
+
+		vector<uint8_t> received;
+		if (!pump(queue, client->descriptor(), received, wire.size()) || received != wire)
+		{
+			cerr << "A file-backed frame was not copied intact" << endl;
+			return 1;
+		}
+		delete server;
+		delete client;
+	}
+	if (proc != -1)
+	{
+		::close(proc);
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
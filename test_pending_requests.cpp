@@ -0,0 +1,175 @@
+#include "PendingRequests.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	const uint32_t SERVER_BIT = 0x80000000;
+
+	// Insert id with a callback which records that it was called for id.
+	bool insert(PendingRequests& pending, uint32_t id, vector<uint32_t>& called)
+	{
+		return pending.insert(id, [&called, id](const FrameView*)
+		{
+			called.push_back(id);
+		}, TimerHandle(id) + 1);
+	}
+
+	// Take id, checking that it comes back with its own callback and timer.
+	bool take(PendingRequests& pending, uint32_t id, vector<uint32_t>& called)
+	{
+		PendingRequests::Callback callback;
+		TimerHandle timer;
+		if (!pending.take(id, callback, timer) || timer != TimerHandle(id) + 1)
+		{
+			return false;
+		}
+		called.clear();
+		callback(NULL);
+		return called.size() == 1 && called[0] == id;
+	}
+}
+
+int main(void)
+{
+	vector<uint32_t> called;
+
+	// A run of colliding IDs which wraps from the last slot to the first;
+	// removing from its middle has to shift the rest back across the wrap.
+	{
+		PendingRequests pending(16);
+		const uint32_t run[] = {14, 30, 15, 46, 0, 31, 1};
+		for (size_t i = 0; i < sizeof(run) / sizeof(run[0]); i++)
+		{
+			insert(pending, run[i], called);
+		}
+		if (pending.capacity() != 16 || !take(pending, 30, called) || !take(pending, 14, called))
+		{
+			cerr << "Taking from a wrapped run failed" << endl;
+			return 1;
+		}
+		const uint32_t left[] = {15, 46, 0, 31, 1};
+		for (size_t i = 0; i < sizeof(left) / sizeof(left[0]); i++)
+		{
+			if (!pending.contains(left[i]))
+			{
+				cerr << "Lost " << left[i] << " shifting back a wrapped run" << endl;
+				return 1;
+			}
+		}
+		if (pending.contains(14) || pending.contains(30) || pending.size() != 5)
+		{
+			cerr << "Wrapped run holds the wrong entries" << endl;
+			return 1;
+		}
+	}
+
+	// Against a reference, with IDs clustered on the wrap so that runs are
+	// long and cross it, and the table growing as it goes.
+	{
+		srand(1305);
+		PendingRequests pending(4);
+		map<uint32_t, bool> reference;
+		size_t capacity = pending.capacity();
+		for (int round = 0; round < 200000; round++)
+		{
+			uint32_t id = uint32_t(rand() % 512) * 16 + (rand() % 2 ? 15 : 0) + rand() % 2;
+			if (rand() % 3 && reference.size() < 600)
+			{
+				bool inserted = insert(pending, id, called);
+				if (inserted == (reference.count(id) != 0))
+				{
+					cerr << "Insert of " << id << " disagrees with the reference" << endl;
+					return 1;
+				}
+				reference[id] = true;
+			}
+			else
+			{
+				bool present = reference.erase(id) != 0;
+				PendingRequests::Callback callback;
+				TimerHandle timer;
+				if (present ? !take(pending, id, called) : pending.take(id, callback, timer))
+				{
+					cerr << "Take of " << id << " disagrees with the reference" << endl;
+					return 1;
+				}
+			}
+
+			if (pending.size() != reference.size() || pending.size() * 2 > pending.capacity())
+			{
+				cerr << "Table holds " << pending.size() << " of " << pending.capacity() << ", expected " << reference.size() << endl;
+				return 1;
+			}
+			capacity = pending.capacity() > capacity ? pending.capacity() : capacity;
+		}
+		for (map<uint32_t, bool>::iterator it = reference.begin(); it != reference.end(); ++it)
+		{
+			if (!pending.contains(it->first))
+			{
+				cerr << "Lost " << it->first << endl;
+				return 1;
+			}
+		}
+		if (capacity < 1024)
+		{
+			cerr << "Table never grew" << endl;
+			return 1;
+		}
+
+		vector<PendingRequests::Callback> callbacks;
+		vector<TimerHandle> timers;
+		pending.clear(callbacks, timers);
+		if (callbacks.size() != reference.size() || timers.size() != reference.size() || pending.size() != 0)
+		{
+			cerr << "Clearing returned " << callbacks.size() << " requests, expected " << reference.size() << endl;
+			return 1;
+		}
+	}
+
+	// Message IDs wrap within their own half, and never change half.
+	{
+		PendingRequests pending;
+		uint32_t client = 0x7FFFFFFE;
+		uint32_t server = 0xFFFFFFFE;
+		const uint32_t clientIDs[] = {0x7FFFFFFE, 0x7FFFFFFF, 0, 1};
+		const uint32_t serverIDs[] = {0xFFFFFFFE, 0xFFFFFFFF, SERVER_BIT, SERVER_BIT | 1};
+		for (size_t i = 0; i < 4; i++)
+		{
+			if (pending.nextID(client, SERVER_BIT) != clientIDs[i] || pending.nextID(server, SERVER_BIT) != serverIDs[i])
+			{
+				cerr << "Message IDs did not wrap within their half" << endl;
+				return 1;
+			}
+		}
+	}
+
+	// IDs still pending from the previous lap are skipped, across the wrap too.
+	{
+		PendingRequests pending;
+		insert(pending, 0x7FFFFFFF, called);
+		insert(pending, 0, called);
+		insert(pending, 2, called);
+		insert(pending, SERVER_BIT | 1, called);
+		uint32_t client = 0x7FFFFFFE;
+		uint32_t server = SERVER_BIT;
+		if (pending.nextID(client, SERVER_BIT) != 0x7FFFFFFE || pending.nextID(client, SERVER_BIT) != 1 ||
+			pending.nextID(client, SERVER_BIT) != 3 || client != 4)
+		{
+			cerr << "Pending client IDs were not skipped" << endl;
+			return 1;
+		}
+		if (pending.nextID(server, SERVER_BIT) != SERVER_BIT || pending.nextID(server, SERVER_BIT) != (SERVER_BIT | 2))
+		{
+			cerr << "Pending server IDs were not skipped" << endl;
+			return 1;
+		}
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
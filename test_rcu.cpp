@@ -0,0 +1,86 @@
+#include "Rcu.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+using namespace std;
+
+namespace
+{
+	void waitFor(const atomic<bool>& flag)
+	{
+		while (!flag)
+		{
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+	}
+}
+
+int main(void)
+{
+	// Nothing is reading, so a retired version goes straight away.
+	int reclaimed = 0;
+	Rcu::retire([&reclaimed](void) { reclaimed++; });
+	if (reclaimed != 1 || Rcu::retired() != 0)
+	{
+		cerr << "Retired with no readers, but not reclaimed" << endl;
+		return 1;
+	}
+
+	// A reader on another thread holding its ReadLock across retire() keeps
+	// the version alive however often reclaim() is tried.
+	atomic<bool> reading(false);
+	atomic<bool> done(false);
+	thread reader([&](void)
+	{
+		Rcu::ReadLock lock;
+		reading = true;
+		waitFor(done);
+	});
+	waitFor(reading);
+
+	reclaimed = 0;
+	Rcu::retire([&reclaimed](void) { reclaimed++; });
+	for (int i = 0; i < 10; i++)
+	{
+		Rcu::reclaim();
+	}
+	if (reclaimed != 0 || Rcu::retired() != 1)
+	{
+		cerr << "Reclaimed while a reader could still see it" << endl;
+		return 1;
+	}
+
+	// Readers arriving after the retire() cannot see the old version, so
+	// they do not hold it up; nested locks count as one.
+	{
+		Rcu::ReadLock outer;
+		{
+			Rcu::ReadLock inner;
+		}
+		done = true;
+		reader.join();
+		if (Rcu::reclaim() != 1 || reclaimed != 1)
+		{
+			cerr << "Not reclaimed once the only reader who could see it left" << endl;
+			return 1;
+		}
+
+		// But this thread's own lock holds up what is retired under it.
+		Rcu::retire([&reclaimed](void) { reclaimed++; });
+		if (reclaimed != 1 || Rcu::retired() != 1)
+		{
+			cerr << "Reclaimed under the retiring thread's own ReadLock" << endl;
+			return 1;
+		}
+	}
+	if (Rcu::reclaim() != 1 || reclaimed != 2 || Rcu::retired() != 0)
+	{
+		cerr << "Not reclaimed once the ReadLock was dropped" << endl;
+		return 1;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,175 @@
+#include "ReplayBuffer.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	const uint32_t SERVER_BIT = 0x80000000;
+
+	shared_ptr<Frame> makeFrame(uint32_t id, uint64_t length)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+
+		shared_ptr<Frame> frame(new Frame(header));
+		frame->size(length);
+		for (uint64_t i = 0; i < length; i++)
+		{
+			frame->payload()[i] = uint8_t(id + i);
+		}
+		frame->messageID(id);
+		if (id % 3 == 0)
+		{
+			frame->mask(id * 2654435761u);
+		}
+		if (id % 4 == 0)
+		{
+			frame->respondingTo(id ^ SERVER_BIT);
+		}
+		return frame;
+	}
+
+	// Whether replaying after lastSeen gives exactly the IDs from first, count
+	// of them, in order.
+	bool replays(ReplayBuffer& buffer, uint32_t lastSeen, uint32_t first, size_t count)
+	{
+		vector<shared_ptr<const Frame> > frames;
+		if (!buffer.replay(lastSeen, frames) || frames.size() != count)
+		{
+			return false;
+		}
+		uint32_t half = first & SERVER_BIT;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (frames[i]->messageID() != (half | ((first + uint32_t(i)) & ~SERVER_BIT)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool sameFrame(const Frame& left, const Frame& right)
+	{
+		return left.messageID() == right.messageID() && left.opcode() == right.opcode() &&
+			left.header().headerParts.RSP == right.header().headerParts.RSP &&
+			(!left.header().headerParts.RSP || left.respondingTo() == right.respondingTo()) &&
+			left.header().headerParts.MASK == right.header().headerParts.MASK &&
+			(!left.header().headerParts.MASK || left.mask() == right.mask()) &&
+			left.size() == right.size() && memcmp(left.payload(), right.payload(), size_t(left.size())) == 0;
+	}
+}
+
+int main(void)
+{
+	// Replays and acknowledgements either side of the wrap, in both halves
+	// of the ID space.
+	const uint32_t halves[] = {0, SERVER_BIT};
+	for (size_t h = 0; h < 2; h++)
+	{
+		uint32_t half = halves[h];
+		uint32_t start = half | 0x7FFFFFF0;
+		ReplayBuffer buffer;
+		for (uint32_t i = 0; i < 32; i++)
+		{
+			buffer.record(makeFrame(half | ((start + i) & ~SERVER_BIT), 100));
+		}
+
+		if (buffer.newest() != (half | 15) || !replays(buffer, half | 0x7FFFFFF5, half | 0x7FFFFFF6, 26) ||
+			!replays(buffer, half | 0x7FFFFFFF, half, 16) || !replays(buffer, half | 10, half | 11, 5) ||
+			!replays(buffer, half | 15, half, 0) || !replays(buffer, half | 0x7FFFFFEF, start, 32))
+		{
+			cerr << "Replay across the wrap failed for half " << half << endl;
+			return 1;
+		}
+
+		buffer.acknowledge(half | 0x7FFFFFFA);
+		if (buffer.frames() != 21 || !replays(buffer, half | 0x7FFFFFFA, half | 0x7FFFFFFB, 21))
+		{
+			cerr << "Acknowledging before the wrap failed for half " << half << endl;
+			return 1;
+		}
+		buffer.acknowledge(half | 3);
+		if (buffer.frames() != 12 || buffer.size() != 12 * (sizeof(Frame) + 100) ||
+			!replays(buffer, half | 3, half | 4, 12) || buffer.stats().acknowledged != 20 || buffer.stats().resyncs != 0)
+		{
+			cerr << "Acknowledging across the wrap failed for half " << half << endl;
+			return 1;
+		}
+	}
+
+	// Once frames the peer has not seen are evicted, resuming from before
+	// them needs a resync; resuming from after them still replays.
+	ReplayBuffer evicting(4 * (sizeof(Frame) + 100));
+	for (uint32_t id = 0x7FFFFFFA; id != 4; id = (id + 1) & ~SERVER_BIT)
+	{
+		evicting.record(makeFrame(id, 100));
+	}
+	if (evicting.frames() != 4 || evicting.stats().evicted != 6 || evicting.stats().evictedBytes != 6 * (sizeof(Frame) + 100))
+	{
+		cerr << "Eviction kept " << evicting.frames() << " frames" << endl;
+		return 1;
+	}
+	vector<shared_ptr<const Frame> > frames;
+	if (evicting.replay(0x7FFFFFFE, frames) || !frames.empty() || evicting.stats().resyncs != 1 ||
+		!replays(evicting, 0x7FFFFFFF, 0, 4) || !replays(evicting, 1, 2, 2) || evicting.stats().resyncs != 1)
+	{
+		cerr << "Resuming from before an eviction did not force a resync" << endl;
+		return 1;
+	}
+
+	// Saved and loaded, the buffer carries on exactly as it was: the frames,
+	// the newest ID, and what has been evicted.
+	vector<uint8_t> saved(evicting.savedSize());
+	evicting.save(saved.data());
+	shared_ptr<ReplayBuffer> loaded = ReplayBuffer::load(saved.data(), saved.size());
+	if (loaded->frames() != evicting.frames() || loaded->size() != evicting.size() || loaded->budget() != evicting.budget() ||
+		loaded->newest() != evicting.newest() || loaded->empty() != evicting.empty())
+	{
+		cerr << "Loaded replay buffer does not match the saved one" << endl;
+		return 1;
+	}
+	vector<shared_ptr<const Frame> > before;
+	vector<shared_ptr<const Frame> > after;
+	evicting.replay(0x7FFFFFFF, before);
+	loaded->replay(0x7FFFFFFF, after);
+	for (size_t i = 0; i < before.size(); i++)
+	{
+		if (before.size() != after.size() || !sameFrame(*before[i], *after[i]))
+		{
+			cerr << "Loaded frame " << i << " differs from the saved one" << endl;
+			return 1;
+		}
+	}
+	if (loaded->replay(0x7FFFFFFE, frames) || loaded->stats().resyncs != 1 || !replays(*loaded, 0x7FFFFFFF, 0, 4))
+	{
+		cerr << "Loaded replay buffer forgot its evictions" << endl;
+		return 1;
+	}
+
+	// A truncated save is refused.
+	bool refused = false;
+	try
+	{
+		ReplayBuffer::load(saved.data(), saved.size() - 1);
+	}
+	catch (const char* error)
+	{
+		refused = true;
+	}
+	if (!refused)
+	{
+		cerr << "Truncated replay buffer was loaded" << endl;
+		return 1;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
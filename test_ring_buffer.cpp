@@ -0,0 +1,221 @@
+#include "RingBuffer.h"
+#include "Socket.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 48200;
+	const int PORTS = 100;
+	const size_t READ_AHEAD = 4096;
+	const size_t STREAM_LENGTH = 2 * 1024 * 1024;
+
+	uint8_t streamByte(size_t position)
+	{
+		return uint8_t(position * 31 + position / 251);
+	}
+
+	// Push a known stream through a small ring in uneven pieces, through
+	// both the copying calls and the iovecs, so that it wraps many times.
+	bool ringWraps(void)
+	{
+		RingBuffer ring(1000);
+		if (ring.capacity() != 1024 || !ring.empty() || ring.space() != 1024)
+		{
+			cerr << "Ring of 1000 bytes has capacity " << ring.capacity() << endl;
+			return false;
+		}
+
+		size_t written = 0;
+		size_t read = 0;
+		bool wrapped = false;
+		uint8_t buffer[2048];
+		while (read < 64 * 1024)
+		{
+			size_t length = size_t(rand()) % 1500;
+			if (rand() % 2)
+			{
+				for (size_t i = 0; i < length; i++)
+				{
+					buffer[i] = streamByte(written + i);
+				}
+				written += ring.write(buffer, length);
+			}
+			else
+			{
+				iovec segments[2];
+				int count = ring.writable(segments);
+				size_t produced = 0;
+				for (int i = 0; i < count && produced < length; i++)
+				{
+					uint8_t* base = static_cast<uint8_t*>(segments[i].iov_base);
+					for (size_t j = 0; j < segments[i].iov_len && produced < length; j++)
+					{
+						base[j] = streamByte(written + produced++);
+					}
+				}
+				ring.produce(produced);
+				written += produced;
+			}
+
+			iovec segments[2];
+			wrapped = wrapped || ring.readable(segments) == 2;
+
+			length = size_t(rand()) % 1500;
+			if (rand() % 2)
+			{
+				size_t got = ring.read(buffer, length);
+				for (size_t i = 0; i < got; i++)
+				{
+					if (buffer[i] != streamByte(read + i))
+					{
+						cerr << "Ring returned the wrong byte at " << read + i << endl;
+						return false;
+					}
+				}
+				read += got;
+			}
+			else
+			{
+				int count = ring.readable(segments);
+				size_t consumed = 0;
+				for (int i = 0; i < count && consumed < length; i++)
+				{
+					const uint8_t* base = static_cast<const uint8_t*>(segments[i].iov_base);
+					for (size_t j = 0; j < segments[i].iov_len && consumed < length; j++)
+					{
+						if (base[j] != streamByte(read + consumed++))
+						{
+							cerr << "Ring exposed the wrong byte at " << read + consumed - 1 << endl;
+							return false;
+						}
+					}
+				}
+				ring.consume(consumed);
+				read += consumed;
+			}
+
+			if (ring.size() != written - read || ring.size() + ring.space() != ring.capacity())
+			{
+				cerr << "Ring holds " << ring.size() << " bytes rather than " << written - read << endl;
+				return false;
+			}
+		}
+		if (!wrapped)
+		{
+			cerr << "Ring never wrapped" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Reads smaller than, around and larger than the read-ahead capacity,
+	// mixed, must hand back the peer's stream in order.
+	bool readAhead(Socket& listener, const string& port)
+	{
+		Socket client;
+		if (client.connect("127.0.0.1", port.c_str()) != 0)
+		{
+			cerr << "Loopback connect failed" << endl;
+			return false;
+		}
+		Socket* server = listener.accept(true);
+		if (server->readAhead(READ_AHEAD) != 0 || server->readAhead().capacity() != READ_AHEAD)
+		{
+			cerr << "Unable to size the read-ahead buffer" << endl;
+			delete server;
+			return false;
+		}
+
+		vector<char> stream(STREAM_LENGTH);
+		for (size_t i = 0; i < STREAM_LENGTH; i++)
+		{
+			stream[i] = char(streamByte(i));
+		}
+		thread sender([&](void)
+		{
+			for (size_t sent = 0; sent < STREAM_LENGTH; )
+			{
+				// Not rand(), which the reading thread is using.
+				size_t length = 1 + (sent * 7919) % 20000;
+				length = length < STREAM_LENGTH - sent ? length : STREAM_LENGTH - sent;
+				client.send(&stream[sent], int(length));
+				sent += length;
+			}
+		});
+
+		const size_t sizes[] = {1, 7, 100, READ_AHEAD - 1, READ_AHEAD, READ_AHEAD + 1, 3 * READ_AHEAD + 5, 50000};
+		vector<char> buffer(50000);
+		size_t received = 0;
+		bool buffered = false;
+		bool good = true;
+		while (good && received < STREAM_LENGTH)
+		{
+			size_t length = sizes[size_t(rand()) % (sizeof(sizes) / sizeof(sizes[0]))];
+			length = length < STREAM_LENGTH - received ? length : STREAM_LENGTH - received;
+			int got = server->receive(&buffer[0], int(length), 5000);
+			if (got != int(length) || memcmp(&buffer[0], &stream[received], length) != 0)
+			{
+				cerr << "Read of " << length << " at " << received << " got " << got << " bytes, or the wrong ones" << endl;
+				good = false;
+			}
+			received += length;
+			buffered = buffered || !server->readAhead().empty();
+
+			// The capacity cannot change under buffered data.
+			if (good && !server->readAhead().empty() && server->readAhead(2 * READ_AHEAD) != -1)
+			{
+				cerr << "Read-ahead resized while holding data" << endl;
+				good = false;
+			}
+		}
+		sender.join();
+
+		if (good && !buffered)
+		{
+			cerr << "Short reads never left anything in the read-ahead buffer" << endl;
+			good = false;
+		}
+		delete server;
+		return good;
+	}
+}
+
+int main(void)
+{
+	srand(1305);
+	if (!ringWraps())
+	{
+		return 1;
+	}
+
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	if (!readAhead(listener, port))
+	{
+		return 1;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
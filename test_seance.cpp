@@ -0,0 +1,224 @@
+#include "Endian.h"
+#include "EventLoop.h"
+#include "Seance.h"
+#include "Socket.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 47700;
+	const int PORTS = 100;
+	const int ROUND_TRIP_TIMEOUT = 5000;
+
+	std::shared_ptr<Frame> dataFrame(uint64_t length, uint8_t seed)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+		std::shared_ptr<Frame> frame(new Frame(header));
+		frame->size(length);
+		for (uint64_t i = 0; i < length; i++)
+		{
+			frame->payload()[i] = uint8_t(i * 7 + seed);
+		}
+		return frame;
+	}
+
+	// Responses longer than a fragment go out as continuation trains, and
+	// each request must only finish once the whole of its response is in.
+	bool fragmentedResponses(EventLoop& loop, Socket& listener, const string& port)
+	{
+		Socket client;
+		if (client.connect("127.0.0.1", port.c_str()) != 0)
+		{
+			cerr << "Loopback connect failed" << endl;
+			return false;
+		}
+		Socket* accepted = listener.accept(true);
+
+		Seance server(*accepted, loop, SEANCE_SERVER, [](Seance& seance, FrameView& frame)
+		{
+			seance.respond(frame, frame.copy());
+		});
+		server.scheduler().fragmentSize(FRAME_FRAGMENT_MIN);
+		Seance requester(client, loop, SEANCE_CLIENT, [](Seance&, FrameView&) {});
+
+		const uint64_t lengths[] = {1024 * 1024, 100, 3 * FRAME_FRAGMENT_MIN + 5, FRAME_FRAGMENT_MIN, 0};
+		const size_t count = sizeof(lengths) / sizeof(lengths[0]);
+		size_t answered = 0;
+		bool intact = true;
+		for (size_t i = 0; i < count; i++)
+		{
+			std::shared_ptr<Frame> frame = dataFrame(lengths[i], uint8_t(i));
+			requester.request(frame, [&answered, &intact, frame](const FrameView* response)
+			{
+				answered++;
+				intact = intact && response && response->size() == frame->size() &&
+					(frame->size() == 0 || memcmp(response->payload(), frame->payload(), frame->size()) == 0);
+			}, ROUND_TRIP_TIMEOUT);
+		}
+
+		for (int waited = 0; waited < ROUND_TRIP_TIMEOUT && answered < count; waited += 10)
+		{
+			loop.runOnce(10);
+		}
+
+		bool fragmented = server.scheduler().stats().fragmented == 2;
+		requester.close();
+		server.close();
+		delete accepted;
+
+		if (answered != count || !intact || !fragmented)
+		{
+			cerr << answered << " of " << count << " fragmented responses answered, " << (intact ? "intact" : "corrupt") << endl;
+			return false;
+		}
+		return true;
+	}
+
+	std::shared_ptr<Frame> extensionFrame(uint64_t id)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x3;
+		std::shared_ptr<Frame> frame(new Frame(header));
+		frame->size(sizeof(id));
+		uint64_t wireID = htonll(id);
+		memcpy(frame->payload(), &wireID, sizeof(wireID));
+		return frame;
+	}
+
+	// Two connections sharing one table: negotiating (0xB) on one of them
+	// only enables extensions on that one, at both of its ends.
+	bool negotiation(EventLoop& loop, Socket& listener, const string& port)
+	{
+		const uint64_t offeredID = 7;
+		const uint64_t unknownID = 11;
+		std::shared_ptr<ExtensionTable> table(new ExtensionTable());
+		int handled = 0;
+		table->offer(offeredID, [&handled](Seance&, FrameView&, const uint8_t*, uint64_t) { handled++; });
+
+		Socket clients[2];
+		Socket* accepted[2];
+		Seance* servers[2];
+		Seance* requesters[2];
+		int unhandled[2] = {0, 0};
+		for (int i = 0; i < 2; i++)
+		{
+			if (clients[i].connect("127.0.0.1", port.c_str()) != 0)
+			{
+				cerr << "Loopback connect failed" << endl;
+				return false;
+			}
+			accepted[i] = listener.accept(true);
+			int* count = &unhandled[i];
+			servers[i] = new Seance(*accepted[i], loop, SEANCE_SERVER, [count](Seance&, FrameView&) { (*count)++; });
+			requesters[i] = new Seance(clients[i], loop, SEANCE_CLIENT, [](Seance&, FrameView&) {});
+			servers[i]->extensions(table);
+			requesters[i]->extensions(table);
+		}
+
+		ExtensionChanges changes;
+		changes.push_back(make_pair(offeredID, true));
+		changes.push_back(make_pair(unknownID, true));
+		bool answered = false;
+		ExtensionChanges agreed;
+		requesters[0]->negotiate(changes, [&](bool wasAnswered, const ExtensionChanges& answer)
+		{
+			answered = wasAnswered;
+			agreed = answer;
+		});
+		for (int waited = 0; waited < ROUND_TRIP_TIMEOUT && !answered; waited += 10)
+		{
+			loop.runOnce(10);
+		}
+
+		bool good = answered && agreed.size() == 2 && agreed[0] == make_pair(offeredID, true) && agreed[1] == make_pair(unknownID, false) &&
+			servers[0]->enabled(offeredID) && requesters[0]->enabled(offeredID) && !servers[0]->enabled(unknownID) &&
+			!servers[1]->enabled(offeredID) && !requesters[1]->enabled(offeredID);
+		if (!good)
+		{
+			cerr << "Negotiation " << (answered ? "answered" : "unanswered") << " with " << agreed.size() << " records, or leaked to the other connection" << endl;
+		}
+
+		// Extension frames are only dispatched where the extension is enabled.
+		for (int i = 0; i < 2 && good; i++)
+		{
+			requesters[i]->send(extensionFrame(offeredID));
+		}
+		for (int waited = 0; waited < ROUND_TRIP_TIMEOUT && good && handled + unhandled[1] < 2; waited += 10)
+		{
+			loop.runOnce(10);
+		}
+		if (good && (handled != 1 || unhandled[0] != 0 || unhandled[1] != 1))
+		{
+			cerr << "Extension frames dispatched " << handled << " times, passed on " << unhandled[0] << " and " << unhandled[1] << " times" << endl;
+			good = false;
+		}
+
+		// And disabled again the same way.
+		if (good)
+		{
+			answered = false;
+			requesters[0]->negotiate(ExtensionChanges(1, make_pair(offeredID, false)), [&](bool wasAnswered, const ExtensionChanges& answer)
+			{
+				answered = wasAnswered;
+				agreed = answer;
+			});
+			for (int waited = 0; waited < ROUND_TRIP_TIMEOUT && !answered; waited += 10)
+			{
+				loop.runOnce(10);
+			}
+			if (!answered || agreed.size() != 1 || agreed[0].second || servers[0]->enabled(offeredID) || requesters[0]->enabled(offeredID))
+			{
+				cerr << "Extension was not disabled by negotiation" << endl;
+				good = false;
+			}
+		}
+
+		for (int i = 0; i < 2; i++)
+		{
+			requesters[i]->close();
+			servers[i]->close();
+			delete requesters[i];
+			delete servers[i];
+			delete accepted[i];
+		}
+		return good;
+	}
+}
+
+int main(void)
+{
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	EventLoop loop;
+	if (!fragmentedResponses(loop, listener, port) || !negotiation(loop, listener, port))
+	{
+		return 1;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,289 @@
+#include "EventLoop.h"
+#include "Seance.h"
+#include "SendBudget.h"
+#include "Socket.h"
+
+#include <sys/socket.h>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 48000;
+	const int PORTS = 100;
+	const int DRAIN_TIMEOUT = 5000;
+	const size_t FRAME_LENGTH = 8 * 1024;
+
+	std::shared_ptr<Frame> dataFrame(uint64_t length)
+	{
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+		std::shared_ptr<Frame> frame(new Frame(header));
+		frame->size(length);
+		memset(frame->payload(), 0x42, length);
+		return frame;
+	}
+
+	// Run loop, throwing away whatever reaches the peer, until done() or the
+	// timeout.
+	template <typename Done>
+	bool drain(EventLoop& loop, Socket& peer, Done done)
+	{
+		char buffer[64 * 1024];
+		for (int waited = 0; waited < DRAIN_TIMEOUT && !done(); waited += 10)
+		{
+			loop.runOnce(10);
+			while (::recv(peer.descriptor(), buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+		}
+		return done();
+	}
+
+	bool budgetWaiters(void)
+	{
+		// Exhausted only once over the limit.
+		SendBudget budget(1000);
+		budget.charge(1000);
+		if (budget.exhausted())
+		{
+			cerr << "Budget exhausted at its limit" << endl;
+			return false;
+		}
+		budget.charge(1);
+		if (!budget.exhausted())
+		{
+			cerr << "Budget not exhausted over its limit" << endl;
+			return false;
+		}
+
+		// Waiters are woken once, at three quarters of the limit; not as soon
+		// as the budget stops being exhausted.
+		int woken = 0;
+		budget.wait([&woken](void) { woken++; });
+		budget.credit(250);
+		if (woken != 0 || budget.exhausted())
+		{
+			cerr << "Waiter woken above three quarters of the limit" << endl;
+			return false;
+		}
+		budget.credit(1);
+		budget.credit(100);
+		budget.charge(500);
+		budget.credit(500);
+		if (woken != 1 || budget.used() != 650)
+		{
+			cerr << "Waiter woken " << woken << " times" << endl;
+			return false;
+		}
+
+		// With room already, straight away; and raising the limit makes room.
+		budget.wait([&woken](void) { woken++; });
+		budget.charge(1000);
+		budget.wait([&woken](void) { woken++; });
+		budget.limit(2200);
+		if (woken != 3)
+		{
+			cerr << "Waiters not woken with room in the budget" << endl;
+			return false;
+		}
+
+		// A cancelled waiter is never called, even when another thread is
+		// crediting the budget at the same moment.
+		budget.limit(1000);
+		budget.credit(budget.used());
+		const int rounds = 20000;
+		vector<atomic<bool> > cancelled(rounds);
+		atomic<int> late(0);
+		atomic<bool> stop(false);
+		thread crediting([&](void)
+		{
+			while (!stop)
+			{
+				budget.charge(2000);
+				budget.credit(2000);
+			}
+		});
+		for (int i = 0; i < rounds; i++)
+		{
+			cancelled[i] = false;
+			atomic<bool>* flag = &cancelled[i];
+			uint64_t handle = budget.wait([flag, &late](void)
+			{
+				if (*flag)
+				{
+					late++;
+				}
+			});
+			budget.cancel(handle);
+			cancelled[i] = true;
+		}
+		stop = true;
+		crediting.join();
+		if (late != 0)
+		{
+			cerr << late << " waiters called after cancel()" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Watermark hysteresis, and whenWritable() callbacks in order.
+	bool watermarks(EventLoop& loop, Socket& listener, const string& port)
+	{
+		Socket client;
+		if (client.connect("127.0.0.1", port.c_str()) != 0)
+		{
+			cerr << "Loopback connect failed" << endl;
+			return false;
+		}
+		Socket* accepted = listener.accept(true);
+		SendBudget budget;
+		Seance seance(*accepted, loop, SEANCE_SERVER, [](Seance&, FrameView&) {});
+		seance.budget(budget);
+		seance.scheduler().fragmentSize(FRAME_FRAGMENT_MIN);
+		const size_t highWater = 8 * FRAME_LENGTH;
+		const size_t lowWater = 4 * FRAME_LENGTH;
+		seance.watermarks(highWater, lowWater);
+
+		vector<pair<bool, size_t> > changes;
+		seance.backpressure([&changes](Seance& seance, bool writable)
+		{
+			changes.push_back(make_pair(writable, seance.queued()));
+		});
+
+		// Nothing goes out until the loop runs, so everything sent stays
+		// queued.
+		while (seance.writable())
+		{
+			seance.send(dataFrame(FRAME_LENGTH));
+		}
+		bool good = changes.size() == 1 && changes[0].second >= highWater && seance.queued() >= highWater;
+
+		vector<int> order;
+		for (int i = 0; i < 3; i++)
+		{
+			seance.whenWritable([&order, &changes, i](bool open)
+			{
+				order.push_back(open && changes.size() == 2 ? i : -1);
+			});
+		}
+		good = good && order.empty();
+
+		// Writable again only once it is down to the low watermark.
+		good = good && drain(loop, client, [&changes](void) { return changes.size() >= 2; });
+		good = good && changes.size() == 2 && changes[1].first && changes[1].second <= lowWater;
+		good = good && order.size() == 3 && order[0] == 0 && order[1] == 1 && order[2] == 2;
+		if (!good)
+		{
+			cerr << "Watermarks changed writability " << changes.size() << " times, calling " << order.size() << " writers" << endl;
+		}
+
+		// Waiting writers are told about a close.
+		while (good && seance.writable())
+		{
+			seance.send(dataFrame(FRAME_LENGTH));
+		}
+		vector<bool> closed;
+		seance.whenWritable([&closed](bool open) { closed.push_back(open); });
+		seance.whenWritable([&closed](bool open) { closed.push_back(open); });
+		seance.close();
+		seance.whenWritable([&closed](bool open) { closed.push_back(open); });
+		if (good && (closed.size() != 3 || closed[0] || closed[1] || closed[2] || budget.used() != 0))
+		{
+			cerr << "Close told " << closed.size() << " writers, leaving " << budget.used() << " bytes charged" << endl;
+			good = false;
+		}
+
+		delete accepted;
+		return good;
+	}
+
+	// A Seance closing with a backlog credits it all back to the budget, and
+	// a connection held up by the budget alone carries on.
+	bool closeCredits(EventLoop& loop, Socket& listener, const string& port)
+	{
+		Socket clients[2];
+		Socket* accepted[2];
+		for (int i = 0; i < 2; i++)
+		{
+			if (clients[i].connect("127.0.0.1", port.c_str()) != 0)
+			{
+				cerr << "Loopback connect failed" << endl;
+				return false;
+			}
+			accepted[i] = listener.accept(true);
+		}
+
+		SendBudget budget(12 * FRAME_LENGTH);
+		Seance* hog = new Seance(*accepted[0], loop, SEANCE_SERVER, [](Seance&, FrameView&) {});
+		Seance other(*accepted[1], loop, SEANCE_SERVER, [](Seance&, FrameView&) {});
+		hog->budget(budget);
+		other.budget(budget);
+		hog->scheduler().fragmentSize(FRAME_FRAGMENT_MIN);
+
+		while (!budget.exhausted())
+		{
+			hog->send(dataFrame(FRAME_LENGTH));
+		}
+		other.send(dataFrame(100));
+		size_t otherCharge = other.queued();
+		bool good = !hog->writable() && !other.writable() && budget.used() == hog->queued() + otherCharge;
+
+		bool resumed = false;
+		other.whenWritable([&resumed](bool open) { resumed = open; });
+		hog->close();
+		good = good && budget.used() == otherCharge;
+		good = good && drain(loop, clients[1], [&resumed](void) { return resumed; });
+		if (!good)
+		{
+			cerr << "Closing left " << budget.used() << " bytes charged, other connection " << (resumed ? "resumed" : "stuck") << endl;
+		}
+
+		delete hog;
+		other.close();
+		good = good && budget.used() == 0;
+		delete accepted[0];
+		delete accepted[1];
+		return good;
+	}
+}
+
+int main(void)
+{
+	if (!budgetWaiters())
+	{
+		return 1;
+	}
+
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	EventLoop loop;
+	if (!watermarks(loop, listener, port) || !closeCredits(loop, listener, port))
+	{
+		return 1;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,171 @@
+#include "SessionStore.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	shared_ptr<ReplayBuffer> makeReplay(uint64_t token)
+	{
+		shared_ptr<ReplayBuffer> replay(new ReplayBuffer());
+		for (uint32_t id = 1; id <= 3; id++)
+		{
+			FrameHeader header;
+			memset(&header, 0, sizeof(header));
+			header.headerParts.FIN = 1;
+			header.headerParts.Opcode = 0x2;
+
+			shared_ptr<Frame> frame(new Frame(header));
+			frame->size(token * 100);
+			memset(frame->payload(), int(token), size_t(token * 100));
+			frame->messageID(id);
+			replay->record(frame);
+		}
+		return replay;
+	}
+
+	bool claims(SessionStore& store, uint64_t token)
+	{
+		shared_ptr<ReplayBuffer> replay;
+		uint32_t lastReceived = 0;
+		if (!store.claim(token, replay, lastReceived) || !replay || lastReceived != token * 7 ||
+			replay->frames() != 3 || replay->newest() != 3)
+		{
+			return false;
+		}
+
+		vector<shared_ptr<const Frame> > frames;
+		replay->replay(0, frames);
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			if (frames[i]->size() != token * 100 || frames[i]->payload()[token * 50] != uint8_t(token))
+			{
+				return false;
+			}
+		}
+		return frames.size() == 3;
+	}
+
+	bool matches(SessionStore& store, uint64_t parked, uint64_t claimed, uint64_t expired, uint64_t spilled,
+		uint64_t faulted, uint64_t resident, uint64_t onDisk)
+	{
+		SessionStoreStats stats = store.stats();
+		return stats.parked == parked && stats.claimed == claimed && stats.expired == expired && stats.spilled == spilled &&
+			stats.faulted == faulted && stats.resident == resident && stats.onDisk == onDisk &&
+			store.size() == resident + onDisk;
+	}
+}
+
+int main(void)
+{
+	// Spill straight away, so that nothing needs to wait for the clock.
+	SessionStore store("/tmp", 1, 0);
+	uint64_t bytes = 0;
+	for (uint64_t token = 1; token <= 10; token++)
+	{
+		store.park(token, makeReplay(token), uint32_t(token * 7));
+		bytes += makeReplay(token)->savedSize();
+	}
+	if (!matches(store, 10, 0, 0, 0, 0, 10, 0))
+	{
+		cerr << "Parking did not count 10 resident sessions" << endl;
+		return 1;
+	}
+
+	if (store.spill() != 10 || !matches(store, 10, 0, 0, 10, 0, 0, 10) || store.stats().spilledBytes != bytes)
+	{
+		cerr << "Spilling did not move every session to disk" << endl;
+		return 1;
+	}
+
+	// Claimed out of order, so the holes left behind have to merge.
+	if (!claims(store, 3) || !claims(store, 5) || !claims(store, 4) || !matches(store, 10, 3, 0, 10, 3, 0, 7))
+	{
+		cerr << "Claiming spilled sessions failed" << endl;
+		return 1;
+	}
+	bytes -= makeReplay(3)->savedSize() + makeReplay(4)->savedSize() + makeReplay(5)->savedSize();
+	if (store.stats().spilledBytes != bytes || store.contains(4) || !store.contains(6))
+	{
+		cerr << "Claiming left " << store.stats().spilledBytes << " bytes spilled, not " << bytes << endl;
+		return 1;
+	}
+
+	// One new session, and one replacing a spilled one.
+	store.park(11, makeReplay(11), 77);
+	store.park(2, makeReplay(2), 14);
+	bytes -= makeReplay(2)->savedSize();
+	if (!matches(store, 12, 3, 0, 10, 3, 2, 6) || store.stats().spilledBytes != bytes)
+	{
+		cerr << "Parking again did not replace the spilled session" << endl;
+		return 1;
+	}
+
+	// Sessions parked and claimed over and over leave their parking order
+	// behind; the store must still spill and expire the rest correctly.
+	for (int i = 0; i < 10000; i++)
+	{
+		store.park(12, makeReplay(12), 84);
+		store.park(12, makeReplay(12), 84);
+		if (!claims(store, 12))
+		{
+			cerr << "Claiming a resident session failed" << endl;
+			return 1;
+		}
+	}
+	if (!matches(store, 20012, 10003, 0, 10, 3, 2, 6))
+	{
+		cerr << "Parking and claiming miscounted" << endl;
+		return 1;
+	}
+
+	// The two resident sessions fill the space the claims left behind.
+	if (store.spill() != 2 || !matches(store, 20012, 10003, 0, 12, 3, 0, 8) ||
+		store.stats().spilledBytes != bytes + makeReplay(2)->savedSize() + makeReplay(11)->savedSize())
+	{
+		cerr << "Spilling the remaining sessions failed" << endl;
+		return 1;
+	}
+	if (!claims(store, 11) || !claims(store, 2) || !matches(store, 20012, 10005, 0, 12, 5, 0, 6))
+	{
+		cerr << "Claiming re-spilled sessions failed" << endl;
+		return 1;
+	}
+
+	if (store.expire(0) != 6 || !matches(store, 20012, 10005, 6, 12, 5, 0, 0) || store.stats().spilledBytes != 0)
+	{
+		cerr << "Expiring did not drop every session" << endl;
+		return 1;
+	}
+	for (uint64_t token = 1; token <= 12; token++)
+	{
+		if (store.contains(token))
+		{
+			cerr << "Session " << token << " outlived expiry" << endl;
+			return 1;
+		}
+	}
+
+	// The store starts over once everything is gone.
+	store.park(1, makeReplay(1), 7);
+	if (store.spill() != 1 || !claims(store, 1) || !matches(store, 20013, 10006, 6, 13, 6, 0, 0))
+	{
+		cerr << "Reusing the emptied store failed" << endl;
+		return 1;
+	}
+
+	// Without a directory, nothing is spilled.
+	SessionStore memory(NULL, 1, 0);
+	memory.park(1, makeReplay(1), 7);
+	if (memory.spill() != 0 || !matches(memory, 1, 0, 0, 0, 0, 1, 0) || memory.expire(0) != 1 || !matches(memory, 1, 0, 1, 0, 0, 0, 0))
+	{
+		cerr << "Store without a spill directory misbehaved" << endl;
+		return 1;
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
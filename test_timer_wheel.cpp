@@ -0,0 +1,98 @@
+#include "TimerWheel.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <vector>
+using namespace std;
+
+int main(void)
+{
+	srand(1305);
+	int64_t now = 123456789;
+	TimerWheel wheel(now);
+
+	// Every timer still to fire, by id, and its handle.
+	map<int, int64_t> due;
+	map<int, TimerHandle> handles;
+	vector<int> fired;
+	int next = 0;
+
+	// Schedule, cancel and advance at random, checking every timer fires in
+	// order, on time, and only once; across every level of the wheel.
+	for (int round = 0; round < 20000; round++)
+	{
+		int operation = rand() % 10;
+		if (operation < 5)
+		{
+			int64_t delay = rand() % 4 == 0 ? rand() % 10000000 : rand() % (1 << (rand() % 20));
+			int id = next++;
+			due[id] = now + (delay < 1 ? 1 : delay);
+			handles[id] = wheel.schedule(delay, [&fired, id](void)
+			{
+				fired.push_back(id);
+			});
+		}
+		else if (operation < 7 && !handles.empty())
+		{
+			map<int, TimerHandle>::iterator victim = handles.begin();
+			advance(victim, rand() % handles.size());
+			if (!wheel.cancel(victim->second) || wheel.cancel(victim->second))
+			{
+				cerr << "Cancelling timer " << victim->first << " failed" << endl;
+				return 1;
+			}
+			due.erase(victim->first);
+			handles.erase(victim);
+		}
+		else
+		{
+			int64_t timeout = wheel.timeout(now);
+			now += timeout >= 0 && rand() % 2 ? timeout : (rand() % 3 == 0 ? rand() % 100000 : rand() % 100);
+
+			fired.clear();
+			wheel.advance(now);
+
+			int64_t last = 0;
+			for (size_t i = 0; i < fired.size(); i++)
+			{
+				if (due.count(fired[i]) == 0 || due[fired[i]] > now || due[fired[i]] < last)
+				{
+					cerr << "Timer " << fired[i] << " fired out of turn at " << now << endl;
+					return 1;
+				}
+				last = due[fired[i]];
+				due.erase(fired[i]);
+				handles.erase(fired[i]);
+			}
+
+			int64_t earliest = -1;
+			for (map<int, int64_t>::iterator it = due.begin(); it != due.end(); ++it)
+			{
+				if (it->second <= now)
+				{
+					cerr << "Timer " << it->first << " did not fire at " << now << endl;
+					return 1;
+				}
+				earliest = earliest == -1 || it->second < earliest ? it->second : earliest;
+			}
+
+			// The loop must never sleep past the next expiry.
+			timeout = wheel.timeout(now);
+			if ((earliest == -1) != (timeout == -1) || (earliest != -1 && now + timeout > earliest))
+			{
+				cerr << "Timeout " << timeout << " at " << now << " misses expiry at " << earliest << endl;
+				return 1;
+			}
+		}
+
+		if (wheel.size() != due.size())
+		{
+			cerr << "Wheel holds " << wheel.size() << " timers, expected " << due.size() << endl;
+			return 1;
+		}
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
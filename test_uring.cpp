@@ -0,0 +1,110 @@
+#include "EventLoop.h"
+#include "Seance.h"
+#include "Socket.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+using namespace std;
+
+namespace
+{
+	const int FIRST_PORT = 47400;
+	const int PORTS = 100;
+	const int ROUND_TRIP_TIMEOUT = 5000;
+
+	// Echo a frame of length bytes from client to server and back over loop,
+	// returning whether the response arrived intact.
+	bool echo(EventLoop& loop, Socket& listener, const string& port, uint64_t length)
+	{
+		Socket client;
+		if (client.connect("127.0.0.1", port.c_str()) != 0)
+		{
+			cerr << "Loopback connect failed" << endl;
+			return false;
+		}
+		Socket* accepted = listener.accept(true);
+
+		Seance server(*accepted, loop, SEANCE_SERVER, [](Seance& seance, FrameView& frame)
+		{
+			seance.respond(frame, frame.copy());
+		});
+		Seance requester(client, loop, SEANCE_CLIENT, [](Seance&, FrameView&) {});
+
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = 0x2;
+		std::shared_ptr<Frame> frame(new Frame(header));
+		frame->size(length);
+		for (uint64_t i = 0; i < length; i++)
+		{
+			frame->payload()[i] = uint8_t(i * 7);
+		}
+		frame->mask(0x1305c0de);
+
+		bool answered = false;
+		bool intact = false;
+		requester.request(frame, [&](const FrameView* response)
+		{
+			answered = true;
+			intact = response && response->size() == length && memcmp(response->payload(), frame->payload(), length) == 0;
+		}, ROUND_TRIP_TIMEOUT);
+
+		for (int waited = 0; waited < ROUND_TRIP_TIMEOUT && !answered; waited += 10)
+		{
+			loop.runOnce(10);
+		}
+
+		requester.close();
+		server.close();
+		delete accepted;
+		return answered && intact;
+	}
+}
+
+int main(void)
+{
+	Socket listener;
+	string port;
+	for (int i = 0; i < PORTS && port.empty(); i++)
+	{
+		string candidate = to_string(FIRST_PORT + i);
+		if (listener.bind(candidate.c_str(), "127.0.0.1") == 0)
+		{
+			port = candidate;
+		}
+	}
+	if (port.empty())
+	{
+		cerr << "No loopback port to bind" << endl;
+		return 1;
+	}
+
+	// Frames longer than a socket's io_uring send staging (URING_SEND_BUFFER)
+	// go out over several send completions, which must keep flushing even
+	// when they are reaped while the socket waits to receive.
+	const uint64_t lengths[] = {1000, URING_SEND_BUFFER - 1000, URING_SEND_BUFFER + 7000, 3 * 1024 * 1024};
+	for (int uring = 0; uring < 2; uring++)
+	{
+		EventLoop loop;
+		if (uring && loop.enableUring() != 0)
+		{
+			cout << "io_uring unavailable; only checked epoll" << endl;
+			break;
+		}
+
+		for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+		{
+			if (!echo(loop, listener, port, lengths[i]))
+			{
+				cerr << "Echo of " << lengths[i] << " bytes failed on " << (uring ? "io_uring" : "epoll") << endl;
+				return 1;
+			}
+		}
+	}
+
+	cout << "ok" << endl;
+	return 0;
+}
@@ -0,0 +1,685 @@
+/**
+ * seance_load: drives N concurrent client connections against a Seance echo
+ * server on localhost and reports throughput, latency percentiles and CPU
+ * per message, so that I/O backends and settings can be compared.
+ *
+ * Every message is a request which the server echoes back as its response
+ * (Pings are answered by Seance itself). With --rate the load is open loop:
+ * each connection has a schedule of send times, and latency is measured from
+ * when a message was due to be sent rather than when it was, so a stalled
+ * server is charged for every message it held up (no coordinated omission).
+ * Due messages are picked up on a 1ms tick, so open loop latencies include
+ * up to a millisecond of that.
+ * Without it each connection keeps --depth requests in flight.
+ *
+ * Client and server run in the same process, on separate EventLoopGroups;
+ * CPU time is taken per loop thread, so each side's cost is reported apart.
+ */
+#include "EventLoopGroup.h"
+#include "Frame.h"
+#include "Histogram.h"
+#include "Listener.h"
+#include "Seance.h"
+#include "Socket.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+using namespace std;
+
+namespace
+{
+	// Longest payload generated, whatever the distribution asks for.
+	const uint64_t LOAD_SIZE_MAX = 64 * 1024 * 1024;
+
+	// Ping payloads are kept short, as they would be in practice.
+	const size_t LOAD_PING_MAX = 64;
+
+	// Milliseconds between open loop scheduling ticks.
+	const int LOAD_TICK = 1;
+
+	// Seconds given to requests still in flight once the run ends.
+	const int LOAD_DRAIN_SECONDS = 5;
+
+	const uint8_t OPCODE_TEXT = 0x1;
+	const uint8_t OPCODE_BINARY = 0x2;
+	const uint8_t OPCODE_PING = 0x9;
+
+	enum SizeDistribution
+	{
+		SIZE_FIXED,
+		SIZE_UNIFORM,
+		SIZE_EXPONENTIAL
+	};
+
+	struct Options
+	{
+		string port;
+		size_t connections;
+		unsigned depth;
+		double rate; // Messages per second over all connections; 0 for closed loop.
+		double duration;
+		double warmup;
+		SizeDistribution distribution;
+		uint64_t sizeMin;
+		uint64_t sizeMax;
+		double sizeMean;
+		unsigned weights[3]; // Text, binary and Ping.
+		bool mask;
+		size_t clientLoops;
+		size_t serverLoops;
+		bool uring;
+		string json;
+	};
+
+	struct Connection
+	{
+		Socket socket;
+		Seance* seance;
+		mt19937_64 random;
+		unsigned outstanding;
+		deque<int64_t> backlog; // Due times of messages waiting for a slot.
+		int64_t next;           // When the next message falls due.
+	};
+
+	// One per client loop, only touched from the loop's thread while it runs.
+	struct Worker
+	{
+		EventLoop* loop;
+		vector<Connection*> connections;
+		Histogram latency;
+		uint64_t completed;
+		uint64_t failed;
+		uint64_t bytes;
+		bool measuring;
+		bool stopping;
+	};
+
+	int64_t monotonicNanos(void)
+	{
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+	}
+
+	int64_t threadCPUNanos(void)
+	{
+		timespec now;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+	}
+
+	// Run task on loop's thread and wait for it.
+	template <typename Result>
+	Result onLoop(EventLoop& loop, const function<Result(void)>& task)
+	{
+		shared_ptr<promise<Result> > done(new promise<Result>());
+		future<Result> result = done->get_future();
+		loop.post([done, task](void)
+		{
+			done->set_value(task());
+		});
+		return result.get();
+	}
+
+	int64_t loopCPUNanos(EventLoopGroup& loops)
+	{
+		int64_t total = 0;
+		for (size_t i = 0; i < loops.size(); i++)
+		{
+			total += onLoop<int64_t>(loops.at(i), threadCPUNanos);
+		}
+		return total;
+	}
+
+	uint64_t drawSize(const Options& options, mt19937_64& random)
+	{
+		if (options.distribution == SIZE_UNIFORM)
+		{
+			return uniform_int_distribution<uint64_t>(options.sizeMin, options.sizeMax)(random);
+		}
+		else if (options.distribution == SIZE_EXPONENTIAL)
+		{
+			double size = exponential_distribution<double>(1.0 / options.sizeMean)(random);
+			return size < double(LOAD_SIZE_MAX) ? uint64_t(size) : LOAD_SIZE_MAX;
+		}
+		return options.sizeMin;
+	}
+
+	uint8_t drawOpcode(const Options& options, mt19937_64& random)
+	{
+		unsigned total = options.weights[0] + options.weights[1] + options.weights[2];
+		unsigned pick = unsigned(random() % total);
+		if (pick < options.weights[0])
+		{
+			return OPCODE_TEXT;
+		}
+		else if (pick < options.weights[0] + options.weights[1])
+		{
+			return OPCODE_BINARY;
+		}
+		return OPCODE_PING;
+	}
+
+	shared_ptr<Frame> makeFrame(const Options& options, mt19937_64& random)
+	{
+		uint8_t opcode = drawOpcode(options, random);
+		uint64_t length = drawSize(options, random);
+		if (opcode == OPCODE_PING && length > LOAD_PING_MAX)
+		{
+			length = LOAD_PING_MAX;
+		}
+
+		FrameHeader header;
+		memset(&header, 0, sizeof(header));
+		header.headerParts.FIN = 1;
+		header.headerParts.Opcode = opcode;
+		header.headerParts.Length = htons(uint16_t(length < FRAME_LENGTH_MAX ? length : FRAME_LENGTH_MAX));
+
+		shared_ptr<Frame> frame(new Frame(header));
+		if (length >= FRAME_LENGTH_MAX)
+		{
+			frame->size(length);
+		}
+		memset(frame->payload(), 'x', size_t(length));
+		if (options.mask)
+		{
+			frame->mask(uint32_t(random()));
+		}
+		return frame;
+	}
+
+	void issue(const Options& options, Worker& worker, Connection& connection, int64_t due);
+
+	// Send whatever is due and has a slot to go in.
+	void refill(const Options& options, Worker& worker, Connection& connection)
+	{
+		while (!worker.stopping && connection.outstanding < options.depth && connection.seance->open())
+		{
+			if (options.rate <= 0)
+			{
+				issue(options, worker, connection, monotonicNanos());
+			}
+			else if (!connection.backlog.empty())
+			{
+				int64_t due = connection.backlog.front();
+				connection.backlog.pop_front();
+				issue(options, worker, connection, due);
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+
+	void issue(const Options& options, Worker& worker, Connection& connection, int64_t due)
+	{
+		shared_ptr<Frame> frame = makeFrame(options, connection.random);
+		uint64_t length = frame->size();
+		Worker* owner = &worker;
+		Connection* target = &connection;
+		const Options* settings = &options;
+
+		connection.outstanding++;
+		connection.seance->request(frame, [owner, target, settings, due, length](const FrameView* response)
+		{
+			target->outstanding--;
+			if (owner->measuring)
+			{
+				if (response)
+				{
+					int64_t latency = monotonicNanos() - due;
+					owner->latency.record(uint64_t(latency > 0 ? latency : 0));
+					owner->completed++;
+					owner->bytes += length;
+				}
+				else
+				{
+					owner->failed++;
+				}
+			}
+			refill(*settings, *owner, *target);
+		});
+	}
+
+	// Open loop: queue every message which has fallen due since the last tick.
+	void tick(const Options& options, Worker& worker, int64_t interval)
+	{
+		if (worker.stopping)
+		{
+			return;
+		}
+
+		int64_t now = monotonicNanos();
+		for (size_t i = 0; i < worker.connections.size(); i++)
+		{
+			Connection& connection = *worker.connections[i];
+			while (connection.next <= now)
+			{
+				connection.backlog.push_back(connection.next);
+				connection.next += interval;
+			}
+			refill(options, worker, connection);
+		}
+
+		worker.loop->schedule(LOAD_TICK, [&options, &worker, interval](void)
+		{
+			tick(options, worker, interval);
+		});
+	}
+
+	bool parseSize(const char* text, Options& options)
+	{
+		if (strncmp(text, "exp:", 4) == 0)
+		{
+			options.distribution = SIZE_EXPONENTIAL;
+			options.sizeMean = atof(text + 4);
+			return options.sizeMean > 0;
+		}
+
+		const char* dash = strchr(text, '-');
+		options.sizeMin = strtoull(text, NULL, 10);
+		options.sizeMax = dash ? strtoull(dash + 1, NULL, 10) : options.sizeMin;
+		options.distribution = dash ? SIZE_UNIFORM : SIZE_FIXED;
+		return options.sizeMin <= options.sizeMax && options.sizeMax <= LOAD_SIZE_MAX;
+	}
+
+	bool parseMix(const char* text, Options& options)
+	{
+		const char* names[] = {"text", "binary", "ping"};
+		memset(options.weights, 0, sizeof(options.weights));
+		string mix(text);
+		size_t start = 0;
+		while (start < mix.size())
+		{
+			size_t end = mix.find(',', start);
+			string item = mix.substr(start, end == string::npos ? string::npos : end - start);
+			size_t equals = item.find('=');
+			bool known = false;
+			for (size_t i = 0; i < 3 && equals != string::npos; i++)
+			{
+				if (item.compare(0, equals, names[i]) == 0)
+				{
+					options.weights[i] = unsigned(atoi(item.c_str() + equals + 1));
+					known = true;
+				}
+			}
+			if (!known)
+			{
+				return false;
+			}
+			start = end == string::npos ? mix.size() : end + 1;
+		}
+		return options.weights[0] + options.weights[1] + options.weights[2] > 0;
+	}
+
+	void usage(const char* name)
+	{
+		cerr << "Usage: " << name << " [options]" << endl <<
+			"  --connections N    concurrent client connections (16)" << endl <<
+			"  --depth N          requests in flight per connection (1)" << endl <<
+			"  --rate N           messages/s over all connections, open loop (0: closed loop)" << endl <<
+			"  --duration S       seconds measured (10)" << endl <<
+			"  --warmup S         seconds run before measuring (1)" << endl <<
+			"  --size SPEC        payload bytes: N, MIN-MAX (uniform) or exp:MEAN (64)" << endl <<
+			"  --mix SPEC         opcode weights, e.g. text=1,binary=3,ping=1 (binary=1)" << endl <<
+			"  --no-mask          send client frames unmasked" << endl <<
+			"  --client-loops N   client EventLoops (1)" << endl <<
+			"  --server-loops N   server EventLoops (1)" << endl <<
+			"  --uring            run both sides on io_uring rather than epoll" << endl <<
+			"  --port PORT        loopback port for the echo server (34900)" << endl <<
+			"  --json FILE        also write the results as JSON" << endl;
+	}
+
+	bool parse(int argc, char** argv, Options& options)
+	{
+		options.port = "34900";
+		options.connections = 16;
+		options.depth = 1;
+		options.rate = 0;
+		options.duration = 10;
+		options.warmup = 1;
+		options.distribution = SIZE_FIXED;
+		options.sizeMin = 64;
+		options.sizeMax = 64;
+		options.sizeMean = 0;
+		options.weights[0] = 0;
+		options.weights[1] = 1;
+		options.weights[2] = 0;
+		options.mask = true;
+		options.clientLoops = 1;
+		options.serverLoops = 1;
+		options.uring = false;
+
+		for (int i = 1; i < argc; i++)
+		{
+			string option(argv[i]);
+			const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+			if (option == "--no-mask")
+			{
+				options.mask = false;
+				continue;
+			}
+			else if (option == "--uring")
+			{
+				options.uring = true;
+				continue;
+			}
+			else if (value == NULL)
+			{
+				return false;
+			}
+
+			i++;
+			if (option == "--connections")
+			{
+				options.connections = size_t(atoi(value));
+			}
+			else if (option == "--depth")
+			{
+				options.depth = unsigned(atoi(value));
+			}
+			else if (option == "--rate")
+			{
+				options.rate = atof(value);
+			}
+			else if (option == "--duration")
+			{
+				options.duration = atof(value);
+			}
+			else if (option == "--warmup")
+			{
+				options.warmup = atof(value);
+			}
+			else if (option == "--size")
+			{
+				if (!parseSize(value, options))
+				{
+					return false;
+				}
+			}
+			else if (option == "--mix")
+			{
+				if (!parseMix(value, options))
+				{
+					return false;
+				}
+			}
+			else if (option == "--client-loops")
+			{
+				options.clientLoops = size_t(atoi(value));
+			}
+			else if (option == "--server-loops")
+			{
+				options.serverLoops = size_t(atoi(value));
+			}
+			else if (option == "--port")
+			{
+				options.port = value;
+			}
+			else if (option == "--json")
+			{
+				options.json = value;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return options.connections > 0 && options.depth > 0 && options.duration > 0 && options.clientLoops > 0 && options.serverLoops > 0;
+	}
+
+	string describeSize(const Options& options)
+	{
+		if (options.distribution == SIZE_UNIFORM)
+		{
+			return to_string(options.sizeMin) + "-" + to_string(options.sizeMax);
+		}
+		else if (options.distribution == SIZE_EXPONENTIAL)
+		{
+			return "exp:" + to_string(uint64_t(options.sizeMean));
+		}
+		return to_string(options.sizeMin);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parse(argc, argv, options))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	EventLoopGroup servers(options.serverLoops);
+	EventLoopGroup clients(options.clientLoops);
+	string backend = "epoll";
+	if (options.uring)
+	{
+		if (servers.enableUring() == -1 || clients.enableUring() == -1)
+		{
+			cerr << "io_uring is not available; staying on epoll" << endl;
+		}
+		else
+		{
+			backend = "io_uring";
+		}
+	}
+
+	// The echo server: every request comes straight back as its response.
+	mutex accepting;
+	vector<pair<Seance*, Socket*> > accepted;
+	Listener listener(servers, [&accepting, &accepted](EventLoop& loop, Socket* connection)
+	{
+		Seance* seance = new Seance(*connection, loop, SEANCE_SERVER, [](Seance& seance, FrameView& frame)
+		{
+			seance.respond(frame, frame.copy());
+		});
+		lock_guard<mutex> guard(accepting);
+		accepted.push_back(make_pair(seance, connection));
+	});
+	if (listener.listen(options.port.c_str(), "127.0.0.1") == -1)
+	{
+		cerr << "Could not listen on port " << options.port << endl;
+		return 1;
+	}
+	servers.start();
+
+	// Connections are made before the client loops start, so that they can
+	// be registered from here.
+	vector<Worker*> workers;
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		Worker* worker = new Worker();
+		worker->loop = &clients.at(i);
+		worker->completed = 0;
+		worker->failed = 0;
+		worker->bytes = 0;
+		worker->measuring = false;
+		worker->stopping = false;
+		workers.push_back(worker);
+	}
+
+	int64_t interval = options.rate > 0 ? int64_t(1e9 * double(options.connections) / options.rate) : 0;
+	int64_t start = monotonicNanos();
+	for (size_t i = 0; i < options.connections; i++)
+	{
+		Worker& worker = *workers[i % workers.size()];
+		Connection* connection = new Connection();
+		if (connection->socket.connect("127.0.0.1", options.port.c_str()) != 0)
+		{
+			cerr << "Could not connect to port " << options.port << endl;
+			return 1;
+		}
+		connection->seance = new Seance(connection->socket, *worker.loop, SEANCE_CLIENT, [](Seance& seance, FrameView& frame)
+		{
+		});
+		connection->random.seed(1305 + i);
+		connection->outstanding = 0;
+		// Staggered, so that the connections do not all send at once.
+		connection->next = start + interval * int64_t(i) / int64_t(options.connections);
+		worker.connections.push_back(connection);
+	}
+	clients.start();
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		Worker* worker = workers[i];
+		worker->loop->post([&options, worker, interval](void)
+		{
+			if (options.rate > 0)
+			{
+				tick(options, *worker, interval);
+				return;
+			}
+			for (size_t j = 0; j < worker->connections.size(); j++)
+			{
+				refill(options, *worker, *worker->connections[j]);
+			}
+		});
+	}
+
+	this_thread::sleep_for(chrono::duration<double>(options.warmup));
+
+	// The measured window.
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		Worker* worker = workers[i];
+		onLoop<bool>(*worker->loop, [worker](void)
+		{
+			worker->latency.reset();
+			worker->measuring = true;
+			return true;
+		});
+	}
+	int64_t clientCPU = loopCPUNanos(clients);
+	int64_t serverCPU = loopCPUNanos(servers);
+	int64_t began = monotonicNanos();
+
+	this_thread::sleep_for(chrono::duration<double>(options.duration));
+
+	Histogram latency;
+	uint64_t completed = 0;
+	uint64_t failed = 0;
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		Worker* worker = workers[i];
+		onLoop<bool>(*worker->loop, [worker](void)
+		{
+			worker->measuring = false;
+			worker->stopping = true;
+			return true;
+		});
+		latency.merge(worker->latency);
+		completed += worker->completed;
+		failed += worker->failed;
+		bytes += worker->bytes;
+	}
+	double elapsed = double(monotonicNanos() - began) / 1e9;
+	clientCPU = loopCPUNanos(clients) - clientCPU;
+	serverCPU = loopCPUNanos(servers) - serverCPU;
+
+	// Let what is in flight land before tearing the connections down.
+	for (int waited = 0; waited < LOAD_DRAIN_SECONDS * 100; waited++)
+	{
+		size_t outstanding = 0;
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			Worker* worker = workers[i];
+			outstanding += onLoop<size_t>(*worker->loop, [worker](void)
+			{
+				size_t count = 0;
+				for (size_t j = 0; j < worker->connections.size(); j++)
+				{
+					count += worker->connections[j]->outstanding;
+				}
+				return count;
+			});
+		}
+		if (outstanding == 0)
+		{
+			break;
+		}
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+
+	clients.stop();
+	servers.stop();
+	listener.close();
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		for (size_t j = 0; j < workers[i]->connections.size(); j++)
+		{
+			delete workers[i]->connections[j]->seance;
+			delete workers[i]->connections[j];
+		}
+		delete workers[i];
+	}
+	for (size_t i = 0; i < accepted.size(); i++)
+	{
+		delete accepted[i].first;
+		delete accepted[i].second;
+	}
+
+	double perMessage = completed > 0 ? 1.0 / double(completed) / 1000 : 0;
+	printf("backend %s, %zu connections on %zu+%zu loops, depth %u, %s, size %s, mix text=%u,binary=%u,ping=%u, %s\n",
+		backend.c_str(), options.connections, options.clientLoops, options.serverLoops, options.depth,
+		options.rate > 0 ? (to_string(uint64_t(options.rate)) + " msg/s open loop").c_str() : "closed loop",
+		describeSize(options).c_str(), options.weights[0], options.weights[1], options.weights[2], options.mask ? "masked" : "unmasked");
+	printf("throughput   %.0f msg/s, %.2f MB/s each way, %llu failed\n", double(completed) / elapsed,
+		double(bytes) / elapsed / 1e6, (unsigned long long)failed);
+	printf("latency (us) min %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f p99.99 %.1f max %.1f mean %.1f\n",
+		latency.min() / 1e3, latency.percentile(50) / 1e3, latency.percentile(90) / 1e3, latency.percentile(99) / 1e3,
+		latency.percentile(99.9) / 1e3, latency.percentile(99.99) / 1e3, latency.max() / 1e3, latency.mean() / 1e3);
+	printf("cpu/message  client %.2f us, server %.2f us\n", double(clientCPU) * perMessage, double(serverCPU) * perMessage);
+
+	if (!options.json.empty())
+	{
+		ofstream out(options.json.c_str());
+		out << "{" << endl <<
+			"\t\"backend\": \"" << backend << "\"," << endl <<
+			"\t\"connections\": " << options.connections << "," << endl <<
+			"\t\"clientLoops\": " << options.clientLoops << "," << endl <<
+			"\t\"serverLoops\": " << options.serverLoops << "," << endl <<
+			"\t\"depth\": " << options.depth << "," << endl <<
+			"\t\"rate\": " << options.rate << "," << endl <<
+			"\t\"size\": \"" << describeSize(options) << "\"," << endl <<
+			"\t\"mix\": {\"text\": " << options.weights[0] << ", \"binary\": " << options.weights[1] << ", \"ping\": " << options.weights[2] << "}," << endl <<
+			"\t\"masked\": " << (options.mask ? "true" : "false") << "," << endl <<
+			"\t\"seconds\": " << elapsed << "," << endl <<
+			"\t\"messages\": " << completed << "," << endl <<
+			"\t\"failed\": " << failed << "," << endl <<
+			"\t\"messagesPerSecond\": " << double(completed) / elapsed << "," << endl <<
+			"\t\"bytesPerSecond\": " << double(bytes) / elapsed << "," << endl <<
+			"\t\"latencyNanos\": {\"min\": " << latency.min() << ", \"p50\": " << latency.percentile(50) <<
+			", \"p90\": " << latency.percentile(90) << ", \"p99\": " << latency.percentile(99) <<
+			", \"p99.9\": " << latency.percentile(99.9) << ", \"p99.99\": " << latency.percentile(99.99) <<
+			", \"max\": " << latency.max() << ", \"mean\": " << latency.mean() << "}," << endl <<
+			"\t\"cpuMicrosPerMessage\": {\"client\": " << double(clientCPU) * perMessage <<
+			", \"server\": " << double(serverCPU) * perMessage << "}" << endl <<
+			"}" << endl;
+		if (!out)
+		{
+			cerr << "Could not write " << options.json << endl;
+			return 1;
+		}
+	}
+	return failed > 0 ? 2 : 0;
+}